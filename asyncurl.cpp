@@ -23,12 +23,17 @@
 
 #include "asyncurl.h"
 
+#include "evtrace.h"
 #include "sysutils.h"
 
 #define NOMINMAX
 #include <algorithm>
+#include <functional>
 #include <stdexcept>
 
+#include <stdio.h>
+#include <string.h>
+
 #include <curl/curl.h>
 
 namespace webstor
@@ -56,9 +61,34 @@ struct AsyncState
     SocketHandle    socket;
     AsyncLoop *     asyncLoop;
 
-#ifdef PERF
-    UInt64          creationTimestamp;
-#endif
+    // Concurrency limit of the AsyncMan, set when the request is added to the
+    // multi-handle ('admitted').
+
+    ConcurrencyLimiter *limiter;
+    bool            admitted;
+    bool            counted;        // holds a slot of the limiter
+    UInt64          admitTime;      // timeElapsedUs()
+
+    // Decides if a completed attempt is retried, see AsyncRetryCallback.
+
+    AsyncRetryCallback *retryCallback;
+    void *          retryCtx;
+
+    // Admission deadline, timeElapsedUs() or 0 if none, and priority class.
+
+    UInt64          deadline;
+    AsyncPriority   priority;
+
+    // Interval of the progress checks of the request, in msecs, 0 if none
+    // (see AsyncCurl::pendOp(..)).
+
+    UInt32          progressInterval;
+
+    // Rate limits of the AsyncMan, and if the transfer is paused by them
+    // (see AsyncLoop::pause(..)).
+
+    RateLimiter *   rateLimiter;
+    bool            paused;
 };
 
 inline
@@ -66,12 +96,19 @@ AsyncState::AsyncState()
     : opResult( CURLE_OK )
     , socket( 0 )
     , asyncLoop( 0 )
+    , limiter( 0 )
+    , admitted( false )
+    , counted( false )
+    , admitTime( 0 )
+    , retryCallback( 0 )
+    , retryCtx( 0 )
+    , deadline( 0 )
+    , priority( ASYNC_PRIORITY_NORMAL )
+    , progressInterval( 0 )
+    , rateLimiter( 0 )
+    , paused( false )
 { 
     completedEvent.set();
-
-#ifdef PERF
-    creationTimestamp = timeElapsed();
-#endif
 }
 
 inline void
@@ -91,6 +128,146 @@ AsyncState::getFromCurl( CURL *curl )  // nofail
     return as; 
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// AsyncLoopCounters -- stats counters of AsyncLoop, see AsyncLoopStats.
+// All counters but 'queued' are updated by the asyncLoop thread only, 'queued'
+// is updated under the AsyncLoop's lock, so there is a single writer for each
+// counter and no atomic operations are needed. Readers take the snapshot
+// without locking (64-bit loads are atomic on the platforms we run on).
+
+struct AsyncLoopCounters
+{
+                    AsyncLoopCounters();
+
+    volatile UInt64 queued;         // requests appended to the pending list
+    volatile UInt64 dequeued;       // requests moved from the pending list
+    volatile size_t sockets;
+
+    volatile UInt64 completed;
+    volatile UInt64 canceled;
+    volatile UInt64 retries;
+    volatile UInt64 expired;
+    volatile UInt64 pauses;
+    volatile UInt64 timeouts;
+    volatile UInt64 connectErrors;
+    volatile UInt64 transferErrors;
+    volatile UInt64 otherErrors;
+    volatile UInt64 serverErrors;
+    volatile UInt64 bytesUploaded;
+    volatile UInt64 bytesDownloaded;
+    volatile UInt64 wakeups;
+    volatile UInt64 idleWakeups;
+    volatile UInt64 curlTime;
+    volatile UInt64 iterations;
+    volatile UInt64 timeoutActions;
+    volatile UInt64 sweeps;
+};
+
+inline
+AsyncLoopCounters::AsyncLoopCounters()
+    : queued( 0 )
+    , dequeued( 0 )
+    , sockets( 0 )
+    , completed( 0 )
+    , canceled( 0 )
+    , retries( 0 )
+    , expired( 0 )
+    , pauses( 0 )
+    , timeouts( 0 )
+    , connectErrors( 0 )
+    , transferErrors( 0 )
+    , otherErrors( 0 )
+    , serverErrors( 0 )
+    , bytesUploaded( 0 )
+    , bytesDownloaded( 0 )
+    , wakeups( 0 )
+    , idleWakeups( 0 )
+    , curlTime( 0 )
+    , iterations( 0 )
+    , timeoutActions( 0 )
+    , sweeps( 0 )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ConcurrencyLimiter -- AIMD limit of requests in flight of AsyncMan, see
+// AsyncConcurrencyPolicy. Loops admit pending requests while the limiter
+// grants slots and keep the rest pending; when a slot frees up, the limiter
+// wakes up the loops that have requests waiting.
+
+class ConcurrencyLimiter
+{
+public:
+    explicit        ConcurrencyLimiter( AsyncLoop *head );
+
+    void            setPolicy( const AsyncConcurrencyPolicy *policy );  // nofail
+    void            setPriorityPolicy( const AsyncPriorityPolicy *policy );  // nofail
+    bool            tryAcquire( AsyncPriority priority, bool *counted /* out */ );  // nofail
+    void            release( CURL *request, CURLcode curlCode, UInt64 admitTime,
+                        bool feedback );  // nofail
+    void            getStats( AsyncConcurrencyStats *stats );  // nofail
+
+private:
+                    ConcurrencyLimiter( const ConcurrencyLimiter & );  // forbidden
+    ConcurrencyLimiter &operator=( const ConcurrencyLimiter & );  // forbidden
+
+    bool            isCongested( CURL *request );  // nofail
+    bool            canAcquire( AsyncPriority priority ) const;  // nofail
+    bool            canAcquireAny() const;  // nofail
+    void            wakeLoops();  // nofail
+
+    ExLockSync      m_lock;
+    AsyncLoop *     m_head;
+
+    volatile bool   m_enabled;      // also read without the lock
+    AsyncConcurrencyPolicy m_policy;
+    double          m_limit;
+    size_t          m_inFlight;
+    bool            m_waiting;      // some loop has requests over the limit
+
+    // Priority classes.
+
+    volatile bool   m_prioritized;
+    AsyncPriorityPolicy m_priorityPolicy;
+    size_t          m_inFlightByPriority[ ASYNC_PRIORITY_END ];
+
+    UInt64          m_lastDecrease; // timeElapsedUs()
+    UInt64          m_baseline;     // usecs
+
+    UInt64          m_throttled;
+    UInt64          m_congested;
+    UInt64          m_decreases;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// RateLimiter -- token buckets of AsyncMan, see AsyncRatePolicy.
+
+class RateLimiter
+{
+public:
+                    RateLimiter() : m_limited( false ) {}
+
+    void            setPolicy( const AsyncRatePolicy *policy );  // nofail
+    bool            isLimited() const { return m_limited; }  // nofail
+
+    // Return 0 if the request or the chunk passes, otherwise the time to wait
+    // in msecs.
+
+    UInt32          admitRequest();  // nofail
+    void            refundRequest();  // nofail
+    UInt32          passBytes( bool upload, size_t size );  // nofail
+    void            chargeUpload( size_t size );  // nofail
+
+private:
+                    RateLimiter( const RateLimiter & );  // forbidden
+    RateLimiter &   operator=( const RateLimiter & );  // forbidden
+
+    volatile bool   m_limited;
+    TokenBucket     m_upload;
+    TokenBucket     m_download;
+    TokenBucket     m_requests;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // AsyncLoop -- async cURL-multi object.
 
@@ -101,11 +278,16 @@ AsyncState::getFromCurl( CURL *curl )  // nofail
 class AsyncLoop
 {
 public:
-                    AsyncLoop();
+    explicit        AsyncLoop( size_t connectionsPerThread );
     static void     destroy( AsyncLoop *head );
 
     static void     pendOp( AsyncLoop *head, CURL *request, size_t connectionsPerThread );
     void            cancelOp( CURL *request );  // nofail
+
+    AsyncLoop *     next() const { return m_next; }
+    void            getStats( AsyncLoopStats *stats ) const;  // nofail
+    void            wakeDeferred();  // nofail
+    void            pause( CURL *request, UInt32 delay );  // nofail
 private:
     enum { c_maxSocketTimeout = 3000, c_interruptOnlyTimeout = -1 };
 
@@ -120,14 +302,30 @@ private:
     static TaskResult TASKAPI asyncLoopTask( void *arg );
 
     void            handlePendingRequests();
+    void            addDueRetries();
+    void            expireRequests();
     void            addNewRequests();
     void            removeCanceledRequests();
     void            removeCompletedRequests();
 
     void            addSocket( AsyncState *asyncState, curl_socket_t socket, int what ); // nofail
-    void            removeSocket( AsyncState *asyncState );  // nofail
+    void            removeSocket( SocketHandle socket );  // nofail
+    void            removeSockets( AsyncState *asyncState );  // nofail
 
     void            executeSocketAction( SocketHandle socket, SocketActionMask actionMask = 0 );  // nofail
+    void            countCompleted( CURL *request, CURLcode curlCode );  // nofail
+    bool            retry( CURL *request, CURLcode curlCode );  // nofail
+
+    void            resumePausedRequests();  // nofail
+    void            dropPaused( CURL *request );  // nofail
+
+    void            addProgressCheck( AsyncState *asyncState );  // nofail
+    void            removeProgressCheck( AsyncState *asyncState );  // nofail
+    void            checkProgress();  // nofail
+
+    UInt64          nextDue() const;  // nofail
+    bool            hasDueWork() const;  // nofail
+    UInt32          waitTimeout( UInt32 timeout ) const;  // nofail
 
     // Curl callbacks.
 
@@ -148,12 +346,24 @@ private:
 
     UInt32          m_socketActionTimeout;
 
+    // Set when curl asks for an immediate 'timeout' action. Curl doesn't allow
+    // to call it from its callbacks, so the action is executed by the loop.
+
+    bool            m_timeoutExpired;
+
     // A pool of active sockets provided by curl through the handleAddRemoveSocket callback.
     // The field is used by asyncLoop thread only.
     // We don't have any synchronization for this field.
 
     SocketPool      m_socketPool;
 
+    // Requests owning the sockets in the m_socketPool (used by asyncLoop thread only).
+    // Curl may hand the connection of a completed request over to another request
+    // before the completed one is removed from the multi-handle, so a request
+    // must remove only the sockets it still owns.
+
+    std::vector< std::pair< SocketHandle, AsyncState * > > m_socketOwners;
+
     ExLockSync      m_lock;
 
     // The next asyncLoop item. Needed to handle more requests than one asyncLoop
@@ -170,6 +380,32 @@ private:
     std::vector< CURL * >   m_pendingRequests; 
     std::vector< CURL * >   m_canceledRequests;
 
+    // Requests waiting for a retry, a min-heap by the time they are due
+    // (timeElapsedUs()). Modified by asyncLoop thread only, under the m_lock.
+
+    typedef std::pair< UInt64, CURL * > RetryRequest;
+    std::vector< RetryRequest > m_retryRequests;
+
+    // The earliest deadline of the requests left pending by the concurrency
+    // limit (timeElapsedUs() or 0 if none), to fail them in time.
+
+    UInt64          m_pendingDeadline;
+
+    // Transfers paused by the rate limits, a min-heap by the time they are
+    // resumed, and the time the request rate admits the next request
+    // (timeElapsedUs() or 0 if not limited). Accessed by asyncLoop thread only.
+
+    std::vector< RetryRequest > m_pausedRequests;
+    UInt64          m_rateAdmitTime;
+
+    // Running requests with progress checks, their shortest interval (in
+    // msecs) and the time of the next check (timeElapsedUs() or 0 if none).
+    // Accessed by asyncLoop thread only.
+
+    size_t          m_progressRequests;
+    UInt32          m_progressInterval;
+    UInt64          m_nextProgress;
+
     // Number of running requests (number of easy handles in the multi-handle).
     // It's equal or greater than the number of sockets in the m_socketPool.
     // The field is modified by the asyncLoop thread only after easy handle is
@@ -180,6 +416,17 @@ private:
     // A flag indicating if there are pending new or canceled requests.
 
     volatile bool   m_hasPending;
+
+    // Set if some of the pending requests are waiting for the concurrency
+    // limit, and when the limiter frees a slot for them.
+
+    volatile bool   m_deferred;
+    volatile bool   m_admitPending;
+
+    // Stats counters.
+
+    AsyncLoopCounters m_counters;
+    UInt64          m_startTime;    // timeElapsedUs() when the loop was created
 };
 
 static void
@@ -200,13 +447,23 @@ raiseIfError( CURLMcode multiCurlCode )
     }
 }
 
-AsyncLoop::AsyncLoop()
+AsyncLoop::AsyncLoop( size_t connectionsPerThread )
     : m_multiCurl( NULL )
     , m_shutdown( false )
     , m_socketActionTimeout( c_maxSocketTimeout )
+    , m_timeoutExpired( false )
+    , m_lock( "AsyncLoop" )
     , m_next ( NULL )
+    , m_pendingDeadline( 0 )
+    , m_rateAdmitTime( 0 )
+    , m_progressRequests( 0 )
+    , m_progressInterval( 0 )
+    , m_nextProgress( 0 )
     , m_runningRequestCount( 0 )
     , m_hasPending( false )
+    , m_deferred( false )
+    , m_admitPending( false )
+    , m_startTime( timeElapsedUs() )
 {
     // Allocate a multi-handle.
 
@@ -222,6 +479,13 @@ AsyncLoop::AsyncLoop()
     curl_multi_setopt_checked( m_multiCurl, CURLMOPT_TIMERFUNCTION, handleTimeout );
     curl_multi_setopt_checked( m_multiCurl, CURLMOPT_TIMERDATA, this );
 
+    // By default the connection cache keeps up to 4 connections per easy
+    // handle in the multi handle and closes the oldest idle one as requests
+    // complete, keep as many as the loop may run instead, so connections
+    // warmed up ahead of a burst (see S3ConnectionPool) survive.
+
+    curl_multi_setopt_checked( m_multiCurl, CURLMOPT_MAXCONNECTS, static_cast< long >( connectionsPerThread ) );
+
     // Start the background task.
 
     try
@@ -288,25 +552,43 @@ AsyncLoop::asyncLoop()
 
     SocketActions socketActions;
 
+    evTrace( EVT_LOOP_START, this );  // nofail
+
     while( !m_shutdown )
     {
+        m_counters.iterations++;
+
         try
         {
-            if( m_hasPending )
+            if( m_hasPending || m_admitPending || hasDueWork() )
             {
-                // Add new and remove canceled requests.
+                // Add new and remove canceled requests. Reset the wakeup by
+                // the limiter first, so that a slot freed meanwhile isn't lost.
 
+                m_admitPending = false;
                 handlePendingRequests();
                 dbgAssert( m_runningRequestCount >= m_socketPool.size() );
             }
 
+            // Resume transfers paused by the rate limits, if they are due.
+
+            resumePausedRequests();
+
+            // Let curl call the progress callbacks, if they are due.
+
+            checkProgress();
+
             size_t socketCount =  m_socketPool.size();
 
-            if( m_runningRequestCount > socketCount )
+            if( m_runningRequestCount > socketCount + m_pausedRequests.size() || m_timeoutExpired )
             {
                 // We have added more requests to the multi-handle than the number of sockets
-                // curl reported back to us yet. Execute 'timeout' action.
+                // curl reported back to us yet or curl's timeout has expired.
+                // Execute 'timeout' action. Note: curl stops watching sockets of paused
+                // transfers.
 
+                m_timeoutExpired = false;
+                m_counters.timeoutActions++;
                 executeSocketAction( INVALID_SOCKET_HANDLE );
             }
             else
@@ -315,10 +597,14 @@ AsyncLoop::asyncLoop()
 
                 socketActions.reserve( socketCount );
 
-                if( m_socketPool.wait( m_socketActionTimeout, c_interruptOnlyTimeout, &socketActions ) )
+                if( m_socketPool.wait( waitTimeout( m_socketActionTimeout ),
+                        waitTimeout( c_interruptOnlyTimeout ), &socketActions ) )
                 {
                     // Some activity (or interrupt) has been detected, handle it.
 
+                    m_counters.wakeups++;
+                    evTrace( EVT_WAKE, this, socketActions.size() );  // nofail
+
                     for( SocketActions::const_iterator it = socketActions.begin();
                         it != socketActions.end(); ++it )
                     {
@@ -332,8 +618,14 @@ AsyncLoop::asyncLoop()
                     // there is another way to check all sockets. Without this call some sockets
                     // may stuck for very long.
 
+                    m_counters.idleWakeups++;
+                    m_counters.sweeps++;
+                    evTrace( EVT_WAKE, this );  // nofail
+
+                    Stopwatch stopwatch( true );
                     int stillRunning = 0;
                     CURLMcode multiCurlCode = curl_multi_socket_all( m_multiCurl, &stillRunning );
+                    m_counters.curlTime += stopwatch.elapsedUs();
                     raiseIfError( multiCurlCode );
                 }
             }
@@ -363,9 +655,11 @@ AsyncLoop::executeSocketAction( SocketHandle socket, SocketActionMask actionMask
 
     try
     {
+        Stopwatch stopwatch( true );
         int stillRunning = 0;
         CURLMcode multiCurlCode =
             curl_multi_socket_action( m_multiCurl, ( curl_socket_t ) socket, actionMask, &stillRunning );
+        m_counters.curlTime += stopwatch.elapsedUs();
 
         raiseIfError( multiCurlCode );
     }
@@ -387,7 +681,7 @@ AsyncLoop::handleAddRemoveSocket( CURL *curl, curl_socket_t socket, int what, vo
 
     if( what == CURL_POLL_REMOVE )
     {
-        asyncLoop->removeSocket( asyncState );  // nofail
+        asyncLoop->removeSocket( ( SocketHandle )( socket ) );  // nofail
 
         // Do not try to do anything with the socket here because it may be invalid.
     } 
@@ -407,9 +701,10 @@ AsyncLoop::handleTimeout( CURLM *multi, long msTimeout, void *ctx ) // nofail
 
     if( msTimeout == 0 )
     {
-        // Execute 'timeout' action.
+        // Execute 'timeout' action on the next loop iteration, curl returns
+        // CURLM_RECURSIVE_API_CALL if it's called from here.
 
-        asyncLoop->executeSocketAction( INVALID_SOCKET_HANDLE );  // nofail
+        asyncLoop->m_timeoutExpired = true;
         asyncLoop->m_socketActionTimeout = c_maxSocketTimeout;
     }
     else
@@ -427,6 +722,11 @@ AsyncLoop::handlePendingRequests()
     m_lock.claimLock();  
     ScopedExLock lock( &m_lock );
 
+    // Queue retries that are due ahead of new requests, they have already
+    // waited for their turn.
+
+    addDueRetries();
+
     // Check if there are any new requests, add them to the multi-handle.
 
     addNewRequests();
@@ -448,40 +748,165 @@ AsyncLoop::addNewRequests()
     // Reserve space in the socketList to ensure nofail in addSocket(..).
 
     m_socketPool.reserve( m_runningRequestCount + m_pendingRequests.size() );  // can throw std::bad_alloc.
+    m_socketOwners.reserve( m_runningRequestCount + m_pendingRequests.size() );  // can throw std::bad_alloc.
+
+    // Reserve space to ensure nofail in retry(..).
+
+    m_retryRequests.reserve( m_runningRequestCount + m_pendingRequests.size() + m_retryRequests.size() );  // can throw std::bad_alloc.
+
+    // Reserve space to ensure nofail in pause(..).
+
+    m_pausedRequests.reserve( m_runningRequestCount + m_pendingRequests.size() );  // can throw std::bad_alloc.
+
+    // Fail requests that have missed their deadline, order the rest by
+    // priority, then earliest deadline first (requests without deadline go
+    // last).
 
-    // Add pending requests.
+    expireRequests();
 
-    if( !m_pendingRequests.empty() )
+    // Add pending requests, while the concurrency limit allows. The rest stay
+    // pending in order till the limiter frees a slot. Once a request of a
+    // class is held back, the later ones of the class are too, but other
+    // classes may still have room.
+
+    bool blocked[ ASYNC_PRIORITY_END ] = { false };
+    bool rateBlocked = false;
+    size_t kept = 0;
+    m_pendingDeadline = 0;
+    m_rateAdmitTime = 0;
+
+    for( size_t i = 0; i < m_pendingRequests.size(); ++i )
     {
-        for( size_t i = 0; i < m_pendingRequests.size(); ++i )
+        CURL *const request = m_pendingRequests[ i ];
+        dbgAssert( request );
+        AsyncState *const asyncState = AsyncState::getFromCurl( request );
+        dbgAssert( asyncState );
+        dbgAssert( !asyncState->isCompleted() );
+        dbgAssert( asyncState->limiter );
+
+        // The request rate holds back all classes.
+
+        UInt32 rateWait = 0;
+
+        if( !rateBlocked && !blocked[ asyncState->priority ] &&
+            ( rateWait = asyncState->rateLimiter->admitRequest() ) != 0 )
         {
-            CURL *const request = m_pendingRequests[ i ];
-            dbgAssert( request );
-            AsyncState *const asyncState = AsyncState::getFromCurl( request );
-            dbgAssert( asyncState );
-            dbgAssert( !asyncState->isCompleted() );
+            rateBlocked = true;
+            m_rateAdmitTime = timeElapsedUs() + rateWait * 1000ULL;
+        }
+
+        if( !rateBlocked && !blocked[ asyncState->priority ] &&
+            !asyncState->limiter->tryAcquire( asyncState->priority, &asyncState->counted ) )
+        {
+            blocked[ asyncState->priority ] = true;
+            asyncState->rateLimiter->refundRequest();  // nofail
+        }
 
-            m_pendingRequests[ i ] = NULL;
+        if( rateBlocked || blocked[ asyncState->priority ] )
+        {
+            m_pendingRequests[ kept++ ] = request;
 
-            if( ( multiCurlCode = curl_multi_add_handle( m_multiCurl, request ) ) == CURLM_OK )
+            if( asyncState->deadline && ( !m_pendingDeadline || asyncState->deadline < m_pendingDeadline ) )
             {
-                m_runningRequestCount++;
+                m_pendingDeadline = asyncState->deadline;
+            }
 
-#ifdef PERF
-                LOG_TRACE( "request enqueueing lag: request=0x%llx, runningCount=%llu, asyncLoop=0x%llx, elapsed=%llu", 
-                    ( UInt64 )request, m_runningRequestCount, ( UInt64 )this,  
-                    timeElapsed() - asyncState->creationTimestamp );
-#endif
+            continue;
+        }
+
+        asyncState->admitted = true;
+        asyncState->admitTime = timeElapsedUs();
+        m_counters.dequeued++;
+
+        if( ( multiCurlCode = curl_multi_add_handle( m_multiCurl, request ) ) == CURLM_OK )
+        {
+            m_runningRequestCount++;
+            addProgressCheck( asyncState );  // nofail
+            evTrace( EVT_ADD, request, m_runningRequestCount );  // nofail
+        }
+        else
+        {
+            dbgAssert( multiCurlCode == CURLM_OUT_OF_MEMORY );
+            asyncState->limiter->release( request, CURLE_OUT_OF_MEMORY, 0, false );  // nofail
+            m_counters.completed++;
+            m_counters.otherErrors++;
+            asyncState->opResult = CURLE_OUT_OF_MEMORY;
+            asyncState->setCompleted();
+        }
+    }
+
+    m_pendingRequests.resize( kept );  // nofail
+    m_deferred = !m_pendingRequests.empty();
+}
+
+static bool
+isMoreUrgent( CURL *a, CURL *b )  // nofail
+{
+    const AsyncState *aState = AsyncState::getFromCurl( a );
+    const AsyncState *bState = AsyncState::getFromCurl( b );
+
+    if( aState->priority != bState->priority )
+    {
+        return aState->priority < bState->priority;
+    }
+
+    UInt64 aDeadline = aState->deadline - 1;  // 0 wraps to the latest
+    UInt64 bDeadline = bState->deadline - 1;
+
+    return aDeadline < bDeadline;
+}
+
+void
+AsyncLoop::expireRequests()
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+
+    UInt64 now = 0;
+    size_t kept = 0;
+    bool unordered = false;
+
+    for( size_t i = 0; i < m_pendingRequests.size(); ++i )
+    {
+        CURL *const request = m_pendingRequests[ i ];
+        AsyncState *const asyncState = AsyncState::getFromCurl( request );
+        dbgAssert( asyncState );
+
+        if( asyncState->deadline )
+        {
+            if( !now )
+            {
+                now = timeElapsedUs();
             }
-            else
+
+            if( asyncState->deadline <= now )
             {
-                dbgAssert( multiCurlCode == CURLM_OUT_OF_MEMORY );
-                asyncState->opResult = CURLE_OUT_OF_MEMORY;
+                // Don't send the request, it would be late anyway.
+
+                m_counters.dequeued++;
+                m_counters.completed++;
+                m_counters.timeouts++;
+                m_counters.expired++;
+                asyncState->opResult = CURLE_OPERATION_TIMEDOUT;
+                evTrace( EVT_COMPLETE, request, CURLE_OPERATION_TIMEDOUT );  // nofail
                 asyncState->setCompleted();
+                continue;
             }
+
+            unordered = true;
         }
 
-        m_pendingRequests.clear();
+        unordered = unordered || asyncState->priority != ASYNC_PRIORITY_NORMAL;
+        m_pendingRequests[ kept++ ] = request;
+    }
+
+    m_pendingRequests.resize( kept );  // nofail
+
+    // Keep the order of requests with equal priority and deadline, e.g.
+    // FIFO if none has a deadline.
+
+    if( unordered && kept > 1 )
+    {
+        std::stable_sort( m_pendingRequests.begin(), m_pendingRequests.end(), isMoreUrgent );
     }
 }
 
@@ -503,10 +928,47 @@ AsyncLoop::removeCanceledRequests()
 
             if( !asyncState->isCompleted() )
             {
-                dbgVerify( m_socketPool.remove( asyncState->socket ) );
-                dbgVerify( curl_multi_remove_handle( m_multiCurl, request ) == CURLM_OK );
-                dbgAssert( m_runningRequestCount );
-                m_runningRequestCount--;
+                if( asyncState->admitted )
+                {
+                    removeSockets( asyncState );  // nofail
+                    dropPaused( request );  // nofail
+                    dbgVerify( curl_multi_remove_handle( m_multiCurl, request ) == CURLM_OK );
+                    dbgAssert( m_runningRequestCount );
+                    m_runningRequestCount--;
+                    removeProgressCheck( asyncState );  // nofail
+                    asyncState->limiter->release( request, CURLE_OK, 0, false );  // nofail
+                }
+                else
+                {
+                    // The request is still waiting for the concurrency limit
+                    // or for a retry.
+
+                    std::vector< CURL * >::iterator it = std::find( m_pendingRequests.begin(),
+                        m_pendingRequests.end(), request );
+
+                    if( it != m_pendingRequests.end() )
+                    {
+                        m_pendingRequests.erase( it );  // nofail
+                        m_counters.dequeued++;
+                        m_deferred = !m_pendingRequests.empty();
+                    }
+                    else
+                    {
+                        for( size_t j = 0; j < m_retryRequests.size(); ++j )
+                        {
+                            if( m_retryRequests[ j ].second == request )
+                            {
+                                m_retryRequests.erase( m_retryRequests.begin() + j );  // nofail
+                                std::make_heap( m_retryRequests.begin(), m_retryRequests.end(),
+                                    std::greater< RetryRequest >() );  // nofail
+                                break;
+                            }
+                        }
+                    }
+                }
+
+                m_counters.canceled++;
+                evTrace( EVT_CANCEL, request );  // nofail
                 asyncState->setCompleted();
             }
         }
@@ -516,10 +978,45 @@ AsyncLoop::removeCanceledRequests()
 }
 
 void
-AsyncLoop::removeSocket( AsyncState *asyncState )  // nofail
+AsyncLoop::removeSocket( SocketHandle socket )  // nofail
+{
+    m_socketPool.remove( socket );  // nofail
+    m_counters.sockets = m_socketPool.size();
+
+    for( size_t i = 0; i < m_socketOwners.size(); ++i )
+    {
+        if( m_socketOwners[ i ].first == socket )
+        {
+            m_socketOwners[ i ] = m_socketOwners.back();
+            m_socketOwners.pop_back();
+            break;
+        }
+    }
+}
+
+void
+AsyncLoop::removeSockets( AsyncState *asyncState )  // nofail
 {
-    if( asyncState )
-        m_socketPool.remove( asyncState->socket );  // nofail
+    dbgAssert( asyncState );
+
+    // Remove sockets still owned by the request, those handed over to other
+    // requests stay in the pool.
+
+    for( size_t i = 0; i < m_socketOwners.size(); )
+    {
+        if( m_socketOwners[ i ].second == asyncState )
+        {
+            m_socketPool.remove( m_socketOwners[ i ].first );  // nofail
+            m_socketOwners[ i ] = m_socketOwners.back();
+            m_socketOwners.pop_back();
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    m_counters.sockets = m_socketPool.size();
 }
 
 void
@@ -535,6 +1032,20 @@ AsyncLoop::addSocket( AsyncState *asyncState, curl_socket_t socket, int what ) /
     CASSERT( sizeof( curl_socket_t ) == sizeof( SocketHandle ) );
     asyncState->socket = ( SocketHandle )( socket );
     m_socketPool.add( asyncState->socket, what );  // nofail 
+    m_counters.sockets = m_socketPool.size();
+
+    // Take over the socket if curl moved its connection from another request.
+
+    for( size_t i = 0; i < m_socketOwners.size(); ++i )
+    {
+        if( m_socketOwners[ i ].first == asyncState->socket )
+        {
+            m_socketOwners[ i ].second = asyncState;
+            return;
+        }
+    }
+
+    m_socketOwners.push_back( std::make_pair( asyncState->socket, asyncState ) );  // nofail, reserved
 }
 
 void
@@ -561,18 +1072,22 @@ AsyncLoop::removeCompletedRequests()
             AsyncState *const asyncState = AsyncState::getFromCurl( curl );  // nofail
             dbgAssert( asyncState );
 
-            removeSocket( asyncState );
+            removeSockets( asyncState );  // nofail
+            dropPaused( curl );  // nofail
+            removeProgressCheck( asyncState );  // nofail
+            countCompleted( curl, curlCode );  // nofail
+            asyncState->limiter->release( curl, curlCode, asyncState->admitTime, true );  // nofail
+
+            if( retry( curl, curlCode ) )  // nofail
+            {
+                continue;
+            }
 
             // Save if the request failed, the error will be raised by the thread that
             // calls completeXXX.
 
             asyncState->opResult = curlCode;
-
-#ifdef PERF
-            LOG_TRACE( "request completion time: request=0x%llx, runningCount=%llu, asyncLoop=0x%llx, elapsed=%llu", 
-                ( UInt64 )curl, m_runningRequestCount, ( UInt64 )this,  
-                timeElapsed() - asyncState->creationTimestamp );
-#endif
+            evTrace( EVT_COMPLETE, curl, curlCode );  // nofail
 
             // Now tell everyone that the request has completed.
 
@@ -581,173 +1096,980 @@ AsyncLoop::removeCompletedRequests()
     }
 }
 
-void
-AsyncLoop::pendOp( AsyncLoop *head, CURL *request, size_t connectionsPerThread )
+bool
+AsyncLoop::retry( CURL *request, CURLcode curlCode )  // nofail
 {
-    dbgAssert( head );
     dbgAssert( request );
+    AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+    dbgAssert( asyncState );
 
-    //
-    // Algorithm:
-    //
-    // 1. if we have only 1 thread/asyncLoop:
-    //    then if number of requests < m_connectionsPerThread => append to that thread
-    //             else create a new thread/asyncLoop.
-    // 2. if we have multiple threads/asyncLoops:
-    //    then append to the first thread with number of requests < half of m_connectionsPerThread.
-    //    if we could not find such thread then find the min number of requests across all threads.
-    //    if min < m_connectionsPerThread => append to that thread else create a new thread/asyncLoop.
-
-    while( true )
+    if( !asyncState->retryCallback )
     {
-        size_t totalRequest = 0;
-        size_t minTotalRequest = 0;
+        return false;
+    }
 
-        AsyncLoop *candidate = head;
-        AsyncLoop *last = head;
+    // Complete with the outcome of the attempt, if the deadline has passed
+    // meanwhile.
 
-        if( head->m_next )
-        {
-            // We have multiple asyncLoops.
+    if( asyncState->deadline && asyncState->deadline <= timeElapsedUs() )
+    {
+        return false;
+    }
 
-            size_t half = std::max( ( size_t )1, connectionsPerThread / 2 );
-            minTotalRequest = -1;
+    long delay = asyncState->retryCallback( asyncState->retryCtx, curlCode );  // nofail
 
-            for( AsyncLoop *cur = head; cur; cur = cur->m_next )
-            {
-                // Make sure we see memory pointed to by cur->m_next as
-                // initalized.
+    if( delay < 0 )
+    {
+        return false;
+    }
 
-                cpuMemLoadFence();
+    // The request goes through admission again when it's due.
 
-                // Try to append with limit set to 'half'.
+    asyncState->admitted = false;
+    m_counters.retries++;
+    evTrace( EVT_RETRY, request, delay );  // nofail
 
-                if( cur->AsyncLoop::pendOp( request, half, &totalRequest ) )
-                {
-                    return;
-                }
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
 
-                // The current asyncLoop has more than 'half' requests.
+    m_retryRequests.push_back( RetryRequest( timeElapsedUs() + delay * 1000ULL, request ) );  // nofail, reserved
+    std::push_heap( m_retryRequests.begin(), m_retryRequests.end(), std::greater< RetryRequest >() );  // nofail
+    return true;
+}
 
-                if( totalRequest < minTotalRequest )
-                {
-                    // Remember the min.
+void
+AsyncLoop::addDueRetries()
+{
+    dbgAssert( m_lock.dbgHoldLock() );
 
-                    minTotalRequest = totalRequest;
-                    candidate = cur;
-                }
+    if( m_retryRequests.empty() )
+    {
+        return;
+    }
 
-                // Remember in case this is the last.
+    UInt64 now = timeElapsedUs();
 
-                last = cur;
-            }
-        }
+    while( !m_retryRequests.empty() && m_retryRequests.front().first <= now )
+    {
+        m_pendingRequests.insert( m_pendingRequests.begin(), m_retryRequests.front().second );  // can throw std::bad_alloc
+        m_counters.queued++;
 
-        // Try to append to the head (if this is the only asyncLoop) or
-        // to the found 'min' candidate (if there are multiple asyncLoops).
+        std::pop_heap( m_retryRequests.begin(), m_retryRequests.end(), std::greater< RetryRequest >() );  // nofail
+        m_retryRequests.pop_back();
+    }
+}
 
-        dbgAssert( candidate );
+static UInt64
+earliest( UInt64 a, UInt64 b )  // nofail
+{
+    // 0 means never.
 
-        if( minTotalRequest < connectionsPerThread &&
-            candidate->AsyncLoop::pendOp( request, connectionsPerThread, &totalRequest ) )
+    return a && ( !b || a < b ) ? a : b;
+}
+
+void
+AsyncLoop::addProgressCheck( AsyncState *asyncState )  // nofail
+{
+    dbgAssert( asyncState );
+
+    if( !asyncState->progressInterval )
+    {
+        return;
+    }
+
+    if( !m_progressRequests++ || asyncState->progressInterval < m_progressInterval )
+    {
+        m_progressInterval = asyncState->progressInterval;
+        m_nextProgress = earliest( m_nextProgress, timeElapsedUs() + m_progressInterval * 1000ULL );
+    }
+}
+
+void
+AsyncLoop::removeProgressCheck( AsyncState *asyncState )  // nofail
+{
+    dbgAssert( asyncState );
+
+    if( !asyncState->progressInterval )
+    {
+        return;
+    }
+
+    dbgAssert( m_progressRequests );
+
+    // Keep the shortest interval till the last request with checks is gone.
+
+    if( !--m_progressRequests )
+    {
+        m_progressInterval = 0;
+        m_nextProgress = 0;
+    }
+}
+
+void
+AsyncLoop::checkProgress()  // nofail
+{
+    // Curl calls the progress callback only when it processes a transfer,
+    // i.e. on activity of its socket or on curl's own timers. Requests that
+    // check their progress (e.g. the first-byte deadline) are processed by a
+    // sweep of all transfers when their check is due.
+
+    if( !m_nextProgress || m_nextProgress > timeElapsedUs() )
+    {
+        return;
+    }
+
+    m_counters.sweeps++;
+
+    try
+    {
+        Stopwatch stopwatch( true );
+        int stillRunning = 0;
+        CURLMcode multiCurlCode = curl_multi_socket_all( m_multiCurl, &stillRunning );
+        m_counters.curlTime += stopwatch.elapsedUs();
+        raiseIfError( multiCurlCode );
+    }
+    catch( ... )
+    {
+        // We cannot fail this method, handle the error and continue.
+
+        handleBackgroundError();
+    }
+
+    m_nextProgress = m_progressRequests ? timeElapsedUs() + m_progressInterval * 1000ULL : 0;
+}
+
+UInt64
+AsyncLoop::nextDue() const  // nofail
+{
+    // The earliest retry, pending deadline or admission by the request rate,
+    // 0 if none.
+
+    UInt64 due = m_retryRequests.empty() ? 0 : m_retryRequests.front().first;
+
+    due = earliest( due, m_pendingDeadline );
+    return earliest( due, m_deferred ? m_rateAdmitTime : 0 );
+}
+
+void
+AsyncLoop::pause( CURL *request, UInt32 delay )  // nofail
+{
+    // Called by the write and read callbacks on the asyncLoop thread, the
+    // callback pauses the transfer.
+
+    dbgAssert( request );
+    AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+    dbgAssert( asyncState );
+    dbgAssert( !asyncState->paused );
+
+    asyncState->paused = true;
+    m_counters.pauses++;
+
+    m_pausedRequests.push_back( RetryRequest( timeElapsedUs() + delay * 1000ULL, request ) );  // nofail, reserved
+    std::push_heap( m_pausedRequests.begin(), m_pausedRequests.end(), std::greater< RetryRequest >() );  // nofail
+}
+
+void
+AsyncLoop::resumePausedRequests()  // nofail
+{
+    if( m_pausedRequests.empty() )
+    {
+        return;
+    }
+
+    UInt64 now = timeElapsedUs();
+
+    while( !m_pausedRequests.empty() && m_pausedRequests.front().first <= now )
+    {
+        CURL *const request = m_pausedRequests.front().second;
+
+        std::pop_heap( m_pausedRequests.begin(), m_pausedRequests.end(), std::greater< RetryRequest >() );  // nofail
+        m_pausedRequests.pop_back();
+        AsyncState::getFromCurl( request )->paused = false;
+
+        // Curl may pass the held data to the callback right away, which may
+        // pause the transfer again (later than now), and arms the timeout to
+        // drive the transfer.
+
+        Stopwatch stopwatch( true );
+        curl_easy_pause( request, CURLPAUSE_CONT );
+        m_counters.curlTime += stopwatch.elapsedUs();
+    }
+}
+
+void
+AsyncLoop::dropPaused( CURL *request )  // nofail
+{
+    AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+    dbgAssert( asyncState );
+
+    if( !asyncState->paused )
+    {
+        return;
+    }
+
+    asyncState->paused = false;
+
+    for( size_t i = 0; i < m_pausedRequests.size(); ++i )
+    {
+        if( m_pausedRequests[ i ].second == request )
+        {
+            m_pausedRequests.erase( m_pausedRequests.begin() + i );  // nofail
+            std::make_heap( m_pausedRequests.begin(), m_pausedRequests.end(),
+                std::greater< RetryRequest >() );  // nofail
+            break;
+        }
+    }
+}
+
+bool
+AsyncLoop::hasDueWork() const  // nofail
+{
+    UInt64 due = nextDue();
+    return due && due <= timeElapsedUs();
+}
+
+UInt32
+AsyncLoop::waitTimeout( UInt32 timeout ) const  // nofail
+{
+    // Wake up for the earliest retry, deadline, admission, paused transfer or
+    // progress check, if it's sooner than the given timeout. Note: the loop may have no
+    // sockets to wait for, while a retry is due.
+
+    UInt64 due = earliest( nextDue(), m_pausedRequests.empty() ? 0 : m_pausedRequests.front().first );
+    due = earliest( due, m_nextProgress );
+
+    if( !due )
+    {
+        return timeout;
+    }
+
+    UInt64 now = timeElapsedUs();
+    UInt64 retryTimeout = due > now ? ( due - now + 999 ) / 1000 : 0;
+
+    return static_cast< UInt32 >( std::min( retryTimeout, static_cast< UInt64 >( timeout ) ) );
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+
+static UInt64
+getInfoBytes( CURL *curl, CURLINFO info )  // nofail
+{
+    curl_off_t value = 0;
+    curl_easy_getinfo( curl, info, &value );
+    return value > 0 ? static_cast< UInt64 >( value ) : 0;
+}
+
+#define CURLINFO_BYTES( name ) CURLINFO_ ## name ## _T
+
+#else
+
+static UInt64
+getInfoBytes( CURL *curl, CURLINFO info )  // nofail
+{
+    double value = 0;
+    curl_easy_getinfo( curl, info, &value );
+    return value > 0 ? static_cast< UInt64 >( value ) : 0;
+}
+
+#define CURLINFO_BYTES( name ) CURLINFO_ ## name
+
+#endif
+
+void
+AsyncLoop::countCompleted( CURL *request, CURLcode curlCode )  // nofail
+{
+    dbgAssert( request );
+
+    m_counters.completed++;
+
+    switch( curlCode )
+    {
+        case CURLE_OK:
+            break;
+
+        case CURLE_OPERATION_TIMEDOUT:
+            m_counters.timeouts++;
+            break;
+
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+            m_counters.connectErrors++;
+            break;
+
+        case CURLE_PARTIAL_FILE:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+            m_counters.transferErrors++;
+            break;
+
+        default:
+            m_counters.otherErrors++;
+            break;
+    }
+
+    long httpCode = 0;
+    curl_easy_getinfo( request, CURLINFO_RESPONSE_CODE, &httpCode );
+
+    if( httpCode >= 500 )
+    {
+        m_counters.serverErrors++;
+    }
+
+    m_counters.bytesUploaded += getInfoBytes( request, CURLINFO_BYTES( SIZE_UPLOAD ) );
+    m_counters.bytesDownloaded += getInfoBytes( request, CURLINFO_BYTES( SIZE_DOWNLOAD ) );
+}
+
+void
+AsyncLoop::getStats( AsyncLoopStats *stats ) const  // nofail
+{
+    dbgAssert( stats );
+
+    // Read 'dequeued' first, so that it doesn't get ahead of 'queued'.
+
+    UInt64 dequeued = m_counters.dequeued;
+    cpuMemLoadFence();
+
+    stats->runningRequests = m_runningRequestCount;
+    stats->pendingRequests = static_cast< size_t >( m_counters.queued - dequeued );
+    stats->sockets = m_counters.sockets;
+    stats->completed = m_counters.completed;
+    stats->canceled = m_counters.canceled;
+    stats->retries = m_counters.retries;
+    stats->expired = m_counters.expired;
+    stats->pauses = m_counters.pauses;
+    stats->timeouts = m_counters.timeouts;
+    stats->connectErrors = m_counters.connectErrors;
+    stats->transferErrors = m_counters.transferErrors;
+    stats->otherErrors = m_counters.otherErrors;
+    stats->serverErrors = m_counters.serverErrors;
+    stats->bytesUploaded = m_counters.bytesUploaded;
+    stats->bytesDownloaded = m_counters.bytesDownloaded;
+    stats->wakeups = m_counters.wakeups;
+    stats->idleWakeups = m_counters.idleWakeups;
+    stats->curlTime = m_counters.curlTime;
+    stats->iterations = m_counters.iterations;
+    stats->timeoutActions = m_counters.timeoutActions;
+    stats->sweeps = m_counters.sweeps;
+
+    const SocketPoolStats &poolStats = m_socketPool.stats();
+
+    stats->waits = poolStats.waits;
+    stats->polls = poolStats.polls;
+    stats->socketEvents = poolStats.events;
+    stats->interruptWakeups = poolStats.interrupts;
+    stats->blockedTime = poolStats.blockedTime;
+
+    UInt64 lifetime = timeElapsedUs() - m_startTime;
+    stats->workTime = lifetime > stats->blockedTime ? lifetime - stats->blockedTime : 0;
+}
+
+void
+AsyncLoop::pendOp( AsyncLoop *head, CURL *request, size_t connectionsPerThread )
+{
+    dbgAssert( head );
+    dbgAssert( request );
+
+    //
+    // Algorithm:
+    //
+    // 1. if we have only 1 thread/asyncLoop:
+    //    then if number of requests < m_connectionsPerThread => append to that thread
+    //             else create a new thread/asyncLoop.
+    // 2. if we have multiple threads/asyncLoops:
+    //    then append to the first thread with number of requests < half of m_connectionsPerThread.
+    //    if we could not find such thread then find the min number of requests across all threads.
+    //    if min < m_connectionsPerThread => append to that thread else create a new thread/asyncLoop.
+
+    while( true )
+    {
+        size_t totalRequest = 0;
+        size_t minTotalRequest = 0;
+
+        AsyncLoop *candidate = head;
+        AsyncLoop *last = head;
+
+        if( head->m_next )
+        {
+            // We have multiple asyncLoops.
+
+            size_t half = std::max( ( size_t )1, connectionsPerThread / 2 );
+            minTotalRequest = -1;
+
+            for( AsyncLoop *cur = head; cur; cur = cur->m_next )
+            {
+                // Make sure we see memory pointed to by cur->m_next as
+                // initalized.
+
+                cpuMemLoadFence();
+
+                // Try to append with limit set to 'half'.
+
+                if( cur->AsyncLoop::pendOp( request, half, &totalRequest ) )
+                {
+                    return;
+                }
+
+                // The current asyncLoop has more than 'half' requests.
+
+                if( totalRequest < minTotalRequest )
+                {
+                    // Remember the min.
+
+                    minTotalRequest = totalRequest;
+                    candidate = cur;
+                }
+
+                // Remember in case this is the last.
+
+                last = cur;
+            }
+        }
+
+        // Try to append to the head (if this is the only asyncLoop) or
+        // to the found 'min' candidate (if there are multiple asyncLoops).
+
+        dbgAssert( candidate );
+
+        if( minTotalRequest < connectionsPerThread &&
+            candidate->AsyncLoop::pendOp( request, connectionsPerThread, &totalRequest ) )
+        {
+            return;
+        }
+
+        // We don't have an asyncLoop that can accommodate a new request, create a new one.
+
+        candidate = new AsyncLoop( connectionsPerThread );
+
+        {
+            head->m_lock.claimLock();  // nofail
+            ScopedExLock lock( &head->m_lock );
+
+            // While we were waiting for the lock, another thread could create and add a new asyncLoop.
+            // Find the real last item.
+
+            for( ; last->m_next; last = last->m_next ) {}
+
+            // Add the created asyncLoop.
+
+            last->m_next = candidate; 
+        }
+
+        // Add the request to the created asyncLoop.
+
+        if( candidate->AsyncLoop::pendOp( request, connectionsPerThread, &totalRequest ) )
         {
             return;
         }
 
-        // We don't have an asyncLoop that can accommodate a new request, create a new one.
+        // ops, another thread managed to append its request(s) to the new asyncLoop we have just created.
+        // Repeat, we should be more lucky the next time.
+    }
+}
+
+bool
+AsyncLoop::pendOp( CURL *request, size_t connectionsPerThread, size_t *totalRequest )
+{
+    dbgAssert( request );
+    dbgAssert( totalRequest );
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        *totalRequest = m_runningRequestCount + m_pendingRequests.size() + m_retryRequests.size();
+
+        if( *totalRequest >= connectionsPerThread )
+        {
+            return false;
+        }
+
+        // Pre-allocate some space to avoid std::bad_alloc and ensure nofail in cancel(..).
+
+        m_canceledRequests.reserve( *totalRequest + 1 );  // +1 one extra for the request being appended.
+
+        // Append pending request.
+
+        AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+        dbgAssert( asyncState );
+
+        m_pendingRequests.push_back( request );  // can throw std::bad_alloc
+        m_counters.queued++;
+        evTrace( EVT_PEND, request );  // nofail
+        asyncState->completedEvent.reset();  // nofail
+        asyncState->opResult = CURLE_BAD_FUNCTION_ARGUMENT;
+        asyncState->asyncLoop = this;
+        asyncState->admitted = false;
+        ( *totalRequest )++;
+
+        m_hasPending = true;
+    }
+
+    m_socketPool.signal(); // nofail
+    return true;
+}
+
+void
+AsyncLoop::cancelOp( CURL *request ) // nofail
+{
+    dbgAssert( request );
+    AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+    dbgAssert( asyncState );
+
+    if( !asyncState->isCompleted() )
+    {
+        // Append cancellation.
+        {
+            m_lock.claimLock();  
+            ScopedExLock lock( &m_lock );
+
+            dbgAssert( m_canceledRequests.capacity() > m_pendingRequests.size() );
+            m_canceledRequests.push_back( request ); // nofail because it has enough capacity reserved by pendOp(..)
+
+            m_hasPending = true;
+        }
+
+        m_socketPool.signal(); // nofail
+
+        // Wait for the complete event.
+
+        asyncState->completedEvent.wait(); // nofail
+
+        // The request may have completed before the loop got to the
+        // cancellation (e.g. a hedged get canceling the loser), drop it,
+        // so that the loop doesn't touch the request after it's reused.
+
+        m_lock.claimLock();  
+        ScopedExLock lock( &m_lock );
+
+        std::vector< CURL * >::iterator it = std::find( m_canceledRequests.begin(), 
+            m_canceledRequests.end(), request );
+
+        if( it != m_canceledRequests.end() )
+        {
+            m_canceledRequests.erase( it );  // nofail
+        }
+    }
+}
+
+void
+AsyncLoop::wakeDeferred()  // nofail
+{
+    if( m_deferred )
+    {
+        m_admitPending = true;
+        m_socketPool.signal();  // nofail
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// ConcurrencyLimiter -- AIMD limit of requests in flight of AsyncMan.
+
+ConcurrencyLimiter::ConcurrencyLimiter( AsyncLoop *head )
+    : m_lock( "ConcurrencyLimiter" )
+    , m_head( head )
+    , m_enabled( false )
+    , m_limit( 0 )
+    , m_inFlight( 0 )
+    , m_waiting( false )
+    , m_prioritized( false )
+    , m_lastDecrease( 0 )
+    , m_baseline( 0 )
+    , m_throttled( 0 )
+    , m_congested( 0 )
+    , m_decreases( 0 )
+{
+    dbgAssert( head );
+
+    memset( m_inFlightByPriority, 0, sizeof( m_inFlightByPriority ) );
+}
+
+void
+ConcurrencyLimiter::setPolicy( const AsyncConcurrencyPolicy *policy )  // nofail
+{
+    {
+        m_lock.claimLock();  // nofail
+        ScopedExLock lock( &m_lock );
+
+        m_enabled = policy != NULL;
+
+        if( policy )
+        {
+            m_policy = *policy;
+            m_policy.minLimit = std::max( m_policy.minLimit, ( size_t )1 );
+            m_policy.maxLimit = std::max( m_policy.maxLimit, m_policy.minLimit );
+            m_limit = static_cast< double >( std::min( std::max( m_policy.initialLimit,
+                m_policy.minLimit ), m_policy.maxLimit ) );
+            m_baseline = 0;
+        }
+
+        m_waiting = false;
+    }
+
+    // Let the loops re-check their waiting requests against the new limit.
+
+    wakeLoops();  // nofail
+}
+
+void
+ConcurrencyLimiter::setPriorityPolicy( const AsyncPriorityPolicy *policy )  // nofail
+{
+    {
+        m_lock.claimLock();  // nofail
+        ScopedExLock lock( &m_lock );
+
+        m_prioritized = policy != NULL;
+
+        if( policy )
+        {
+            m_priorityPolicy = *policy;
+            m_priorityPolicy.capacity = std::max( m_priorityPolicy.capacity, ( size_t )1 );
+        }
+
+        m_waiting = false;
+    }
+
+    wakeLoops();  // nofail
+}
+
+bool
+ConcurrencyLimiter::canAcquire( AsyncPriority priority ) const  // nofail
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+    dbgAssert( priority >= 0 && priority < ASYNC_PRIORITY_END );
+
+    if( !m_prioritized )
+    {
+        return !m_enabled || m_inFlight < static_cast< size_t >( m_limit );
+    }
+
+    size_t maxInFlight = m_priorityPolicy.maxInFlight[ priority ];
+
+    if( maxInFlight && m_inFlightByPriority[ priority ] >= maxInFlight )
+    {
+        return false;
+    }
+
+    size_t capacity = m_enabled ? static_cast< size_t >( m_limit ) : m_priorityPolicy.capacity;
+
+    if( m_inFlight >= capacity )
+    {
+        return false;
+    }
+
+    // Leave the unused reservations of the other classes, but the last slot.
+
+    size_t unused = 0;
+
+    for( int i = 0; i < ASYNC_PRIORITY_END; ++i )
+    {
+        if( i != priority && m_priorityPolicy.reserved[ i ] > m_inFlightByPriority[ i ] )
+        {
+            unused += m_priorityPolicy.reserved[ i ] - m_inFlightByPriority[ i ];
+        }
+    }
+
+    return m_inFlight + std::min( unused, capacity - 1 ) < capacity;
+}
+
+bool
+ConcurrencyLimiter::canAcquireAny() const  // nofail
+{
+    for( int i = 0; i < ASYNC_PRIORITY_END; ++i )
+    {
+        if( canAcquire( static_cast< AsyncPriority >( i ) ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+ConcurrencyLimiter::tryAcquire( AsyncPriority priority, bool *counted /* out */ )  // nofail
+{
+    dbgAssert( counted );
+
+    *counted = false;
+
+    // Without a policy there is nothing to count, don't take the lock. A
+    // policy set meanwhile applies from the next request.
+
+    if( !m_enabled && !m_prioritized )
+    {
+        return true;
+    }
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    if( !canAcquire( priority ) )
+    {
+        m_waiting = true;
+        return false;
+    }
+
+    m_inFlight++;
+    m_inFlightByPriority[ priority ]++;
+    *counted = true;
+    return true;
+}
+
+void
+ConcurrencyLimiter::release( CURL *request, CURLcode curlCode, UInt64 admitTime,
+    bool feedback )  // nofail
+{
+    dbgAssert( request );
+
+    // Only requests admitted while a policy was on hold a slot.
+
+    AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
+
+    if( !asyncState->counted )
+    {
+        return;
+    }
+
+    asyncState->counted = false;
+
+    AsyncPriority priority = asyncState->priority;
+    bool wake = false;
+
+    // Read the response before taking the lock.
+
+    long httpCode = 0;
+
+    if( feedback && m_enabled )
+    {
+        curl_easy_getinfo( request, CURLINFO_RESPONSE_CODE, &httpCode );
+    }
+
+    {
+        m_lock.claimLock();  // nofail
+        ScopedExLock lock( &m_lock );
 
-        candidate = new AsyncLoop();
+        dbgAssert( m_inFlight );
+        dbgAssert( m_inFlightByPriority[ priority ] );
+        size_t inFlight = m_inFlight--;
+        m_inFlightByPriority[ priority ]--;
 
+        if( m_enabled && feedback )
         {
-            head->m_lock.claimLock();  // nofail
-            ScopedExLock lock( &head->m_lock );
+            bool throttled = httpCode == 503;
+            bool congested = !throttled && curlCode == CURLE_OK && httpCode < 500 &&
+                isCongested( request );
 
-            // While we were waiting for the lock, another thread could create and add a new asyncLoop.
-            // Find the real last item.
+            if( throttled || congested )
+            {
+                throttled ? m_throttled++ : m_congested++;
 
-            for( ; last->m_next; last = last->m_next ) {}
+                // Requests admitted before the last decrease have been sent
+                // under the old limit, don't let them decrease it again.
 
-            // Add the created asyncLoop.
+                if( admitTime >= m_lastDecrease )
+                {
+                    m_limit = std::max( m_limit * m_policy.decrease,
+                        static_cast< double >( m_policy.minLimit ) );
+                    m_lastDecrease = timeElapsedUs();
+                    m_decreases++;
+                }
+            }
+            else if( curlCode == CURLE_OK && httpCode < 500 &&
+                inFlight >= static_cast< size_t >( m_limit ) )
+            {
+                // Grow by one per round trip, but only if the limit is what
+                // holds the requests back.
 
-            last->m_next = candidate; 
+                m_limit = std::min( m_limit + 1 / m_limit,
+                    static_cast< double >( m_policy.maxLimit ) );
+            }
         }
 
-        // Add the request to the created asyncLoop.
-
-        if( candidate->AsyncLoop::pendOp( request, connectionsPerThread, &totalRequest ) )
+        if( m_waiting && canAcquireAny() )
         {
-            return;
+            m_waiting = false;
+            wake = true;
         }
+    }
 
-        // ops, another thread managed to append its request(s) to the new asyncLoop we have just created.
-        // Repeat, we should be more lucky the next time.
+    if( wake )
+    {
+        wakeLoops();  // nofail
     }
 }
 
 bool
-AsyncLoop::pendOp( CURL *request, size_t connectionsPerThread, size_t *totalRequest )
+ConcurrencyLimiter::isCongested( CURL *request )  // nofail
 {
-    dbgAssert( request );
-    dbgAssert( totalRequest );
+    dbgAssert( m_lock.dbgHoldLock() );
+
+    // Only requests without a body give a clean latency sample, the time to
+    // first byte of uploads includes sending the body.
+
+    double preTransferTime = 0;
+    double startTransferTime = 0;
 
+    curl_easy_getinfo( request, CURLINFO_PRETRANSFER_TIME, &preTransferTime );
+    curl_easy_getinfo( request, CURLINFO_STARTTRANSFER_TIME, &startTransferTime );
+
+    if( getInfoBytes( request, CURLINFO_BYTES( SIZE_UPLOAD ) ) || startTransferTime <= preTransferTime )
     {
-        m_lock.claimLock();
-        ScopedExLock lock( &m_lock );
+        return false;
+    }
 
-        *totalRequest = m_runningRequestCount + m_pendingRequests.size();
+    UInt64 latency = static_cast< UInt64 >( ( startTransferTime - preTransferTime ) * 1000000 );
 
-        if( *totalRequest >= connectionsPerThread )
-        {
-            return false;
-        }
+    // The baseline follows the lowest latency, and slowly drifts up, so that
+    // a lasting change of the round trip is learned.
 
-        // Pre-allocate some space to avoid std::bad_alloc and ensure nofail in cancel(..).
+    if( !m_baseline || latency < m_baseline )
+    {
+        m_baseline = latency;
+        return false;
+    }
 
-        m_canceledRequests.reserve( *totalRequest + 1 );  // +1 one extra for the request being appended.
+    m_baseline += ( latency - m_baseline ) / 256;
 
-        // Append pending request.
+    return m_policy.latencyTolerance > 0 &&
+        latency > m_baseline * m_policy.latencyTolerance &&
+        latency > m_baseline + m_policy.latencySlack * 1000ULL;
+}
 
-        AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
-        dbgAssert( asyncState );
+void
+ConcurrencyLimiter::wakeLoops()  // nofail
+{
+    for( AsyncLoop *cur = m_head; cur; cur = cur->next() )
+    {
+        // Make sure we see memory pointed to by cur->m_next as
+        // initalized.
 
-        m_pendingRequests.push_back( request );  // can throw std::bad_alloc
-        asyncState->completedEvent.reset();  // nofail
-        asyncState->opResult = CURLE_BAD_FUNCTION_ARGUMENT;
-        asyncState->asyncLoop = this;
-        ( *totalRequest )++;
+        cpuMemLoadFence();
+        cur->wakeDeferred();  // nofail
+    }
+}
 
-        m_hasPending = true;
+void
+ConcurrencyLimiter::getStats( AsyncConcurrencyStats *stats )  // nofail
+{
+    dbgAssert( stats );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    stats->limit = m_enabled ? static_cast< size_t >( m_limit ) : 0;
+    stats->inFlight = m_inFlight;
+    memcpy( stats->inFlightByPriority, m_inFlightByPriority, sizeof( stats->inFlightByPriority ) );
+    stats->throttled = m_throttled;
+    stats->congested = m_congested;
+    stats->decreases = m_decreases;
+    stats->baselineLatency = m_baseline;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// RateLimiter -- token buckets of AsyncMan.
+
+void
+RateLimiter::setPolicy( const AsyncRatePolicy *policy )  // nofail
+{
+    AsyncRatePolicy none;
+    none.uploadRate = 0;
+    none.downloadRate = 0;
+    none.requestRate = 0;
+
+    const AsyncRatePolicy &p = policy ? *policy : none;
+    double burst = p.burst / 1000.0;
+
+    m_upload.setRate( static_cast< double >( p.uploadRate ), p.uploadRate * burst );  // nofail
+    m_download.setRate( static_cast< double >( p.downloadRate ), p.downloadRate * burst );  // nofail
+    m_requests.setRate( p.requestRate, p.requestRate * burst );  // nofail
+
+    m_limited = m_upload.isLimited() || m_download.isLimited() || m_requests.isLimited();
+}
+
+UInt32
+RateLimiter::admitRequest()  // nofail
+{
+    return m_requests.isLimited() ? m_requests.take( 1 ) : 0;  // nofail
+}
+
+void
+RateLimiter::refundRequest()  // nofail
+{
+    if( m_requests.isLimited() )
+    {
+        m_requests.charge( -1 );  // nofail
     }
+}
 
-    m_socketPool.signal(); // nofail
-    return true;
+UInt32
+RateLimiter::passBytes( bool upload, size_t size )  // nofail
+{
+    TokenBucket &bucket = upload ? m_upload : m_download;
+    return bucket.isLimited() ? bucket.take( static_cast< double >( size ) ) : 0;  // nofail
 }
 
 void
-AsyncLoop::cancelOp( CURL *request ) // nofail
+RateLimiter::chargeUpload( size_t size )  // nofail
+{
+    if( m_upload.isLimited() )
+    {
+        m_upload.charge( static_cast< double >( size ) );  // nofail
+    }
+}
+
+static AsyncState *
+getRateLimited( CURL *request )  // nofail
 {
     dbgAssert( request );
     AsyncState *const asyncState = AsyncState::getFromCurl( request );  // nofail
-    dbgAssert( asyncState );
 
-    if( !asyncState->isCompleted() )
+    // Sync requests are not limited.
+
+    return asyncState && asyncState->asyncLoop && asyncState->rateLimiter ? asyncState : NULL;
+}
+
+static bool
+passBytes( CURL *request, bool upload, size_t size )  // nofail
+{
+    AsyncState *const asyncState = getRateLimited( request );  // nofail
+
+    if( !asyncState )
     {
-        // Append cancellation.
-        {
-            m_lock.claimLock();  
-            ScopedExLock lock( &m_lock );
+        return true;
+    }
 
-            dbgAssert( m_canceledRequests.capacity() > m_pendingRequests.size() );
-            m_canceledRequests.push_back( request ); // nofail because it has enough capacity reserved by pendOp(..)
+    UInt32 delay = asyncState->rateLimiter->passBytes( upload, size );  // nofail
 
-            m_hasPending = true;
-        }
+    if( !delay )
+    {
+        return true;
+    }
 
-        m_socketPool.signal(); // nofail
+    asyncState->asyncLoop->pause( request, delay );  // nofail
+    return false;
+}
 
-        // Wait for the complete event.
+bool
+passDownload( CURL *request, size_t size )  // nofail
+{
+    return passBytes( request, false, size );  // nofail
+}
 
-        asyncState->completedEvent.wait(); // nofail
+bool
+passUpload( CURL *request )  // nofail
+{
+    return passBytes( request, true, 0 );  // nofail
+}
+
+void
+chargeUpload( CURL *request, size_t size )  // nofail
+{
+    if( AsyncState *const asyncState = getRateLimited( request ) )
+    {
+        asyncState->rateLimiter->chargeUpload( size );  // nofail
     }
 }
 
@@ -775,13 +2097,21 @@ AsyncCurl::~AsyncCurl()
 }
 
 void
-AsyncCurl::pendOp( AsyncMan *opMan )
+AsyncCurl::pendOp( AsyncMan *opMan, AsyncRetryCallback *retryCallback, void *retryCtx,
+    unsigned long long deadline, AsyncPriority priority, unsigned int progressInterval )
 {
     dbgAssert( opMan );
     dbgAssert( !m_asyncState->asyncLoop );
     dbgAssert( !AsyncState::getFromCurl( m_curl ) || AsyncState::getFromCurl( m_curl ) == m_asyncState );
 
     AsyncState::setToCurl( m_curl, m_asyncState );
+    m_asyncState->limiter = opMan->concurrencyLimiter();
+    m_asyncState->retryCallback = retryCallback;
+    m_asyncState->retryCtx = retryCtx;
+    m_asyncState->deadline = deadline;
+    m_asyncState->priority = priority;
+    m_asyncState->progressInterval = progressInterval;
+    m_asyncState->rateLimiter = opMan->rateLimiter();
     AsyncLoop::pendOp( opMan->head(), m_curl, opMan->connectionsPerThread() );
     dbgAssert( m_asyncState->asyncLoop );
 }
@@ -822,6 +2152,117 @@ AsyncCurl::completedEvent() const
     return &m_asyncState->completedEvent;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// StatsDump -- periodic dump of AsyncMan stats to a file.
+
+class StatsDump
+{
+public:
+                    StatsDump( const AsyncMan *asyncMan, const char *path, UInt32 msInterval );
+                    ~StatsDump();
+
+private:
+                    StatsDump( const StatsDump & );  // forbidden
+    StatsDump &     operator=( const StatsDump & );  // forbidden
+
+    static TaskResult TASKAPI dumpTask( void *arg );
+    void            dump();
+
+    const AsyncMan *m_asyncMan;
+    FILE *          m_file;
+    UInt32          m_interval;
+    EventSync       m_stop;
+    TaskCtrl        m_dumpTaskCtrl;
+};
+
+StatsDump::StatsDump( const AsyncMan *asyncMan, const char *path, UInt32 msInterval )
+    : m_asyncMan( asyncMan )
+    , m_file( NULL )
+    , m_interval( msInterval + !msInterval )
+{
+    dbgAssert( asyncMan );
+    dbgAssert( path );
+
+    m_file = fopen( path, "a" );
+
+    if( !m_file )
+    {
+        std::string msg( "cannot open stats dump file " );
+        msg.append( path );
+        throw std::runtime_error( msg );
+    }
+
+    try
+    {
+        taskStartAsync( &dumpTask, this, &m_dumpTaskCtrl );
+    }
+    catch( ... )
+    {
+        fclose( m_file );
+        throw;
+    }
+}
+
+StatsDump::~StatsDump()
+{
+    m_stop.set();  // nofail
+    m_dumpTaskCtrl.wait();  // nofail
+
+    fclose( m_file );
+}
+
+TaskResult TASKAPI
+StatsDump::dumpTask( void *arg )
+{
+    dbgAssert( arg );
+    StatsDump *const statsDump = static_cast< StatsDump * >( arg );
+
+    while( !statsDump->m_stop.wait( statsDump->m_interval ) )
+    {
+        try
+        {
+            statsDump->dump();
+        }
+        catch( ... )
+        {
+            handleBackgroundError();
+        }
+    }
+
+    return 0;
+}
+
+void
+StatsDump::dump()
+{
+    std::vector< AsyncLoopStats > stats;
+    m_asyncMan->getStats( &stats );
+
+    UInt64 now = timeElapsed();
+
+    for( size_t i = 0; i < stats.size(); ++i )
+    {
+        const AsyncLoopStats &loop = stats[ i ];
+
+        fprintf( m_file, "time=%llu loop=%llu running=%llu pending=%llu sockets=%llu "
+            "completed=%llu canceled=%llu retries=%llu expired=%llu pauses=%llu timeouts=%llu connectErrors=%llu transferErrors=%llu "
+            "otherErrors=%llu serverErrors=%llu bytesUploaded=%llu bytesDownloaded=%llu "
+            "wakeups=%llu idleWakeups=%llu curlTime=%llu iterations=%llu timeoutActions=%llu "
+            "sweeps=%llu waits=%llu polls=%llu socketEvents=%llu interruptWakeups=%llu "
+            "blockedTime=%llu workTime=%llu\n",
+            now, ( UInt64 )i, ( UInt64 )loop.runningRequests, ( UInt64 )loop.pendingRequests,
+            ( UInt64 )loop.sockets, loop.completed, loop.canceled, loop.retries, loop.expired,
+            loop.pauses, loop.timeouts,
+            loop.connectErrors, loop.transferErrors, loop.otherErrors, loop.serverErrors,
+            loop.bytesUploaded, loop.bytesDownloaded, loop.wakeups, loop.idleWakeups,
+            loop.curlTime, loop.iterations, loop.timeoutActions, loop.sweeps, loop.waits,
+            loop.polls, loop.socketEvents, loop.interruptWakeups, loop.blockedTime,
+            loop.workTime );
+    }
+
+    fflush( m_file );
+}
+
 }  // namespace internal
 
 using namespace internal;
@@ -830,16 +2271,184 @@ using namespace internal;
 // AsyncCurlOpMan -- manager for async cURL operations.
 
 AsyncMan::AsyncMan( size_t connectionsPerThread )
-    : m_head( new AsyncLoop )
+    : m_head( new AsyncLoop( connectionsPerThread + !connectionsPerThread ) )
     , m_connectionsPerThread( connectionsPerThread + !connectionsPerThread )
+    , m_statsDump( NULL )
+    , m_slowTraceBudget( NULL )
+    , m_concurrencyLimiter( NULL )
+    , m_rateLimiter( NULL )
 {
     if( m_connectionsPerThread > c_cMaxConnectionsPerThread )
         m_connectionsPerThread = c_cMaxConnectionsPerThread;
+
+    try
+    {
+        m_slowTraceBudget = new MemoryBudget( c_defaultSlowTraceBudget );
+        m_concurrencyLimiter = new ConcurrencyLimiter( m_head );
+        m_rateLimiter = new RateLimiter;
+    }
+    catch( ... )
+    {
+        delete m_concurrencyLimiter;
+        delete m_slowTraceBudget;
+        AsyncLoop::destroy( m_head );
+        throw;
+    }
 }
 
 AsyncMan::~AsyncMan()
 {
+    stopStatsDump();  // nofail
     AsyncLoop::destroy( m_head );
+
+    // Requests release their traces when they are completed or canceled,
+    // which must happen before AsyncMan is destroyed.
+
+    dbgAssert( !m_slowTraceBudget->used() );
+    delete m_slowTraceBudget;
+    delete m_concurrencyLimiter;
+    delete m_rateLimiter;
+}
+
+void
+AsyncMan::setSlowTraceBudget( size_t bytes )  // nofail
+{
+    m_slowTraceBudget->setLimit( bytes );  // nofail
+}
+
+void
+AsyncMan::setConcurrencyPolicy( const AsyncConcurrencyPolicy *policy )  // nofail
+{
+    m_concurrencyLimiter->setPolicy( policy );  // nofail
+}
+
+void
+AsyncMan::setPriorityPolicy( const AsyncPriorityPolicy *policy )  // nofail
+{
+    m_concurrencyLimiter->setPriorityPolicy( policy );  // nofail
+}
+
+void
+AsyncMan::setRatePolicy( const AsyncRatePolicy *policy )  // nofail
+{
+    m_rateLimiter->setPolicy( policy );  // nofail
+}
+
+bool
+AsyncMan::isRateLimited() const  // nofail
+{
+    return m_rateLimiter->isLimited();  // nofail
+}
+
+void
+AsyncMan::getConcurrencyStats( AsyncConcurrencyStats *stats /* out */ ) const  // nofail
+{
+    m_concurrencyLimiter->getStats( stats );  // nofail
+}
+
+void
+AsyncMan::getStats( std::vector< AsyncLoopStats > *stats /* out */ ) const
+{
+    dbgAssert( stats );
+
+    stats->clear();
+
+    for( AsyncLoop *cur = m_head; cur; cur = cur->next() )
+    {
+        // Make sure we see memory pointed to by cur->m_next as
+        // initalized.
+
+        cpuMemLoadFence();
+
+        stats->push_back( AsyncLoopStats() );
+        cur->getStats( &stats->back() );  // nofail
+    }
+}
+
+void
+AsyncMan::startStatsDump( const char *path, unsigned int msInterval )
+{
+    dbgAssert( path );
+
+    stopStatsDump();  // nofail
+    m_statsDump = new StatsDump( this, path, msInterval );
+}
+
+void
+AsyncMan::stopStatsDump()  // nofail
+{
+    delete m_statsDump;
+    m_statsDump = NULL;
+}
+
+AsyncLoopStats::AsyncLoopStats()
+    : runningRequests( 0 )
+    , pendingRequests( 0 )
+    , sockets( 0 )
+    , completed( 0 )
+    , canceled( 0 )
+    , retries( 0 )
+    , expired( 0 )
+    , pauses( 0 )
+    , timeouts( 0 )
+    , connectErrors( 0 )
+    , transferErrors( 0 )
+    , otherErrors( 0 )
+    , serverErrors( 0 )
+    , bytesUploaded( 0 )
+    , bytesDownloaded( 0 )
+    , wakeups( 0 )
+    , idleWakeups( 0 )
+    , curlTime( 0 )
+    , iterations( 0 )
+    , timeoutActions( 0 )
+    , sweeps( 0 )
+    , waits( 0 )
+    , polls( 0 )
+    , socketEvents( 0 )
+    , interruptWakeups( 0 )
+    , blockedTime( 0 )
+    , workTime( 0 )
+{
+}
+
+AsyncConcurrencyPolicy::AsyncConcurrencyPolicy()
+    : minLimit( 1 )
+    , maxLimit( AsyncMan::c_cMaxConnectionsPerThread )
+    , initialLimit( 8 )
+    , decrease( 0.7 )
+    , latencyTolerance( 2 )
+    , latencySlack( 50 )
+{
+}
+
+AsyncRatePolicy::AsyncRatePolicy()
+    : uploadRate( 0 )
+    , downloadRate( 0 )
+    , requestRate( 0 )
+    , burst( 100 )
+{
+}
+
+AsyncPriorityPolicy::AsyncPriorityPolicy()
+    : capacity( AsyncMan::c_cMaxConnectionsPerThread )
+{
+    memset( maxInFlight, 0, sizeof( maxInFlight ) );
+    memset( reserved, 0, sizeof( reserved ) );
+
+    maxInFlight[ ASYNC_PRIORITY_BULK ] = 96;
+    reserved[ ASYNC_PRIORITY_INTERACTIVE ] = 16;
+}
+
+AsyncConcurrencyStats::AsyncConcurrencyStats()
+    : limit( 0 )
+    , inFlight( 0 )
+    , throttled( 0 )
+    , congested( 0 )
+    , decreases( 0 )
+    , baselineLatency( 0 )
+{
+    memset( inFlightByPriority, 0, sizeof( inFlightByPriority ) );
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -26,11 +26,24 @@
 
 #include <stddef.h>
 
+#include <vector>
+
 namespace webstor
 {
 
 class AsyncMan;
 
+//////////////////////////////////////////////////////////////////////////////
+///@brief Priority classes of async requests, see AsyncPriorityPolicy.
+
+enum AsyncPriority
+{
+    ASYNC_PRIORITY_INTERACTIVE = 0,
+    ASYNC_PRIORITY_NORMAL,
+    ASYNC_PRIORITY_BULK,
+    ASYNC_PRIORITY_END
+};
+
 namespace internal
 {
 
@@ -38,7 +51,19 @@ typedef void CURL;
 
 struct AsyncState;
 class AsyncLoop;
+class ConcurrencyLimiter;
+class RateLimiter;
 class EventSync;
+class MemoryBudget;
+class StatsDump;
+
+///@brief INTERNAL: called by the background thread when an attempt of an
+/// async request completes, with <b>curlCode</b> of the attempt.
+///@details Returns the delay before the request is retried, in milliseconds
+/// (the callback must have prepared the request for the next attempt), or -1
+/// to complete the request. Must be nofail.
+
+typedef long ( AsyncRetryCallback )( void *ctx, int curlCode );
 
 //////////////////////////////////////////////////////////////////////////////
 ///@brief INTERNAL: AsyncCurl -- cURL extended with async functionality.
@@ -53,7 +78,17 @@ public:
 
     operator        CURL *() const { return m_curl; }
 
-    void            pendOp( AsyncMan *opMan );
+    // <b>deadline</b> is in timeElapsedUs(), 0 means none: pending requests
+    // are admitted by <b>priority</b>, then earliest deadline first, requests
+    // that haven't been sent by their deadline fail with
+    // CURLE_OPERATION_TIMEDOUT. If <b>progressInterval</b> (in msecs) is set,
+    // the loop makes curl call the progress callback of the request at
+    // least that often while it's sent, even if its socket is idle.
+
+    void            pendOp( AsyncMan *opMan, AsyncRetryCallback *retryCallback = NULL,
+                        void *retryCtx = NULL, unsigned long long deadline = 0,
+                        AsyncPriority priority = ASYNC_PRIORITY_NORMAL,
+                        unsigned int progressInterval = 0 );
 
     void            completeOp();  // nofail
     void            cancelOp();  // nofail
@@ -71,6 +106,24 @@ private:
     AsyncState *    m_asyncState;
 };
 
+///@brief INTERNAL: rate limits of the AsyncMan of an async request (see
+/// AsyncRatePolicy), called by the write and read callbacks of the request
+/// on its AsyncLoop thread.
+///@details passDownload(..) and passUpload(..) return true if the chunk may
+/// pass, otherwise the loop resumes the request once the rate allows, and
+/// the callback must pause it (return CURL_WRITEFUNC_PAUSE or
+/// CURL_READFUNC_PAUSE). The read callback doesn't know the size of the
+/// chunk in advance, so it asks with passUpload(..) and then reports the
+/// bytes it has read with chargeUpload(..).
+
+bool
+passDownload( CURL *request, size_t size );  // nofail
+
+bool
+passUpload( CURL *request );  // nofail
+
+void
+chargeUpload( CURL *request, size_t size );  // nofail
 
 void 
 handleBackgroundError();  // nofail
@@ -78,6 +131,209 @@ handleBackgroundError();  // nofail
 }  
 
 
+//////////////////////////////////////////////////////////////////////////////
+///@brief Runtime stats of an async loop (a background thread of AsyncMan).
+///@details Gauges show the state at the time of the snapshot, counters are
+/// cumulative since the loop has started: take two snapshots to get rates.
+/// The counters are updated by the loop thread without locks, so a snapshot
+/// may be a bit stale or inconsistent across fields (e.g. a completed request
+/// may not be in the bytes yet).
+
+struct AsyncLoopStats
+{
+                    AsyncLoopStats();
+
+    /// Gauges: requests in the curl multi-handle, requests queued for the
+    /// loop (including requests waiting for the concurrency limit, see
+    /// AsyncConcurrencyPolicy) and sockets the loop is waiting on.
+
+    size_t          runningRequests;
+    size_t          pendingRequests;
+    size_t          sockets;
+
+    /// Requests completed by curl (successfully or not) and canceled.
+
+    unsigned long long completed;
+    unsigned long long canceled;
+
+    /// Attempts retried by the loop (see S3Connection::setRetryPolicy(..)),
+    /// each attempt is counted in 'completed' and the outcomes below.
+
+    unsigned long long retries;
+
+    /// Requests failed without being sent because their deadline had passed
+    /// (see S3Connection::setDeadline(..)), also counted in 'completed' and
+    /// 'timeouts'.
+
+    unsigned long long expired;
+
+    /// Transfers paused by the rate limits, see AsyncRatePolicy.
+
+    unsigned long long pauses;
+
+    /// Completed requests by outcome: timeouts, failures to resolve or
+    /// connect (including TLS handshake), network errors in the middle of
+    /// the transfer, other curl errors (e.g. aborted by a callback) and HTTP
+    /// 5xx responses (e.g. 503 Slow Down, curl doesn't fail these).
+
+    unsigned long long timeouts;
+    unsigned long long connectErrors;
+    unsigned long long transferErrors;
+    unsigned long long otherErrors;
+    unsigned long long serverErrors;
+
+    /// Body bytes of the completed requests.
+
+    unsigned long long bytesUploaded;
+    unsigned long long bytesDownloaded;
+
+    /// Loop wakeups on socket activity or new requests, wakeups on curl
+    /// timeouts without any activity, and time spent in curl (including the
+    /// read/write callbacks), in microseconds.
+
+    unsigned long long wakeups;
+    unsigned long long idleWakeups;
+    unsigned long long curlTime;
+
+    /// Loop profile: iterations, 'timeout' actions executed without waiting
+    /// (curl has more requests than reported sockets or asked for an immediate
+    /// timeout) and curl_multi_socket_all sweeps after idle wakeups and for
+    /// progress checks of requests.
+
+    unsigned long long iterations;
+    unsigned long long timeoutActions;
+    unsigned long long sweeps;
+
+    /// Socket waits: calls, polls (epoll_wait or WSAPoll, there may be several
+    /// per wait), socket events (socketEvents / wakeups is events per wake)
+    /// and wakeups by new or canceled requests without socket events.
+
+    unsigned long long waits;
+    unsigned long long polls;
+    unsigned long long socketEvents;
+    unsigned long long interruptWakeups;
+
+    /// Time the loop has been blocked in socket waits and working (the rest
+    /// of its lifetime), in microseconds.
+
+    unsigned long long blockedTime;
+    unsigned long long workTime;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Adaptive limit of requests in flight of an AsyncMan (see
+/// AsyncMan::setConcurrencyPolicy(..)).
+///@details The limit is adjusted with AIMD (additive increase, multiplicative
+/// decrease): it shrinks when the server throttles (503 Slow Down) or the
+/// latency inflates, and grows by one per round trip of successful requests
+/// while all of the allowed requests are in flight. Requests over the limit
+/// wait in the AsyncLoop queue, the caller doesn't block.
+
+struct AsyncConcurrencyPolicy
+{
+                    AsyncConcurrencyPolicy();
+
+    /// Bounds and the initial value of the limit.
+
+    size_t          minLimit;
+    size_t          maxLimit;
+    size_t          initialLimit;
+
+    /// Factor the limit is multiplied by on throttling or latency inflation,
+    /// at most once per round trip (requests in flight at the time of the
+    /// decrease don't decrease it again).
+
+    double          decrease;
+
+    /// A request is considered delayed by congestion if its time to first
+    /// byte (without connecting and uploading) exceeds the baseline (the
+    /// lowest latency seen recently) <b>latencyTolerance</b> times and by at
+    /// least <b>latencySlack</b> milliseconds. 0 tolerance turns off the
+    /// latency signal, so that only throttling decreases the limit.
+
+    double          latencyTolerance;
+    unsigned int    latencySlack;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Rate limits of an AsyncMan (see AsyncMan::setRatePolicy(..)), 0
+/// means unlimited.
+///@details The limits are token buckets shared by all requests pended to the
+/// AsyncMan. A transfer over the byte rate is paused (its loop keeps serving
+/// the other requests) and resumed when the bucket refills; a request over
+/// the request rate waits in the AsyncLoop queue. Sync requests are not
+/// limited.
+
+struct AsyncRatePolicy
+{
+                    AsyncRatePolicy();
+
+    /// Body bytes per second sent and received.
+
+    unsigned long long uploadRate;
+    unsigned long long downloadRate;
+
+    /// Requests (including retries) sent per second.
+
+    double          requestRate;
+
+    /// Burst the buckets allow, in milliseconds of their rate.
+
+    unsigned int    burst;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Shares of the requests in flight of an AsyncMan by priority class
+/// (see AsyncMan::setPriorityPolicy(..)).
+///@details Each class may have a cap on its requests in flight and capacity
+/// reserved for it: while a class has fewer requests in flight than its
+/// reservation, the other classes can't take the rest of it. The capacity
+/// is the adaptive limit if it's on (see AsyncConcurrencyPolicy), otherwise
+/// <b>capacity</b>. Reservations never take the last slot of the capacity
+/// from a class, so that each class can make progress. Requests held back
+/// wait in the AsyncLoop queue, higher classes are admitted first.
+
+struct AsyncPriorityPolicy
+{
+                    AsyncPriorityPolicy();
+
+    /// Requests in flight of all classes, if the adaptive limit is off.
+
+    size_t          capacity;
+
+    /// Cap (0 means none) and reserved capacity of each class, indexed by
+    /// AsyncPriority.
+
+    size_t          maxInFlight[ ASYNC_PRIORITY_END ];
+    size_t          reserved[ ASYNC_PRIORITY_END ];
+};
+
+///@brief Runtime stats of the concurrency limit of an AsyncMan.
+
+struct AsyncConcurrencyStats
+{
+                    AsyncConcurrencyStats();
+
+    /// Current limit (0 if the limit is off) and requests in flight, in
+    /// total and by priority class. Requests are counted only if they have
+    /// been admitted while the limit or priority classes were on.
+
+    size_t          limit;
+    size_t          inFlight;
+    size_t          inFlightByPriority[ ASYNC_PRIORITY_END ];
+
+    /// Requests throttled by the server, delayed by congestion, and the
+    /// number of times the limit has been decreased.
+
+    unsigned long long throttled;
+    unsigned long long congested;
+    unsigned long long decreases;
+
+    /// Baseline latency, in microseconds.
+
+    unsigned long long baselineLatency;
+};
+
 //////////////////////////////////////////////////////////////////////////////
 ///@brief AsyncMan -- manager for async operations.
 ///@details An instance of this class is needed to initiate an async cURL operation.
@@ -98,6 +354,10 @@ public:
 
     enum { c_cMaxConnectionsPerThread = 128 };
 
+    /// Default memory budget of buffered slow request traces, in bytes.
+
+    enum { c_defaultSlowTraceBudget = 4 * 1024 * 1024 };
+
     ///@brief Constructs a new instance of AsyncMan. 
     ///@details </b>connectionsPerThread</b> specifies
     /// how many connections can be handled by a single thread.
@@ -114,8 +374,64 @@ public:
 
     size_t                  connectionsPerThread() const { return m_connectionsPerThread; }
 
+    ///@brief Returns stats of all async loops, one per background thread.
+    ///@details The method doesn't block the loops, it's cheap enough to be
+    /// polled by a monitoring thread.
+
+    void                    getStats( std::vector< AsyncLoopStats > *stats /* out */ ) const;
+
+    ///@brief Starts appending stats of all loops to the given file every
+    /// <b>msInterval</b> milliseconds, one line per loop.
+    ///@details Stops the previous dump if any. The dump is stopped by
+    /// stopStatsDump() or when AsyncMan is destroyed. Unlike the rest of
+    /// AsyncMan, starting and stopping the dump is not thread-safe.
+
+    void                    startStatsDump( const char *path, unsigned int msInterval );
+    void                    stopStatsDump();  // nofail
+
+    ///@brief Sets the memory budget shared by traces buffered by requests
+    /// pended to this AsyncMan (see S3Connection::enableSlowRequestTracing(..)),
+    /// in bytes.
+    ///@details Once the budget is used up, requests drop the rest of their
+    /// traces till other requests complete and free theirs.
+
+    void                    setSlowTraceBudget( size_t bytes );  // nofail
+
+    ///@brief Turns on the adaptive limit of requests in flight with the
+    /// given policy, NULL turns it off (the default).
+    ///@details The limit is shared by all connections using this AsyncMan,
+    /// bulk jobs can pend requests on as many connections as they like and
+    /// let the limit converge to the throughput the server sustains.
+
+    void                    setConcurrencyPolicy( const AsyncConcurrencyPolicy *policy );  // nofail
+
+    void                    getConcurrencyStats( AsyncConcurrencyStats *stats /* out */ ) const;  // nofail
+
+    ///@brief Turns on priority classes with the given policy, NULL turns
+    /// them off (the default).
+    ///@details Requests are pended with the priority of their connection,
+    /// see S3Connection::setPriority(..). The default policy caps bulk
+    /// requests at 96 of 128 requests in flight and reserves 16 for
+    /// interactive ones.
+
+    void                    setPriorityPolicy( const AsyncPriorityPolicy *policy );  // nofail
+
+    ///@brief Sets the rate limits of the requests pended to this AsyncMan,
+    /// NULL turns them off (the default).
+    ///@details New rates apply at once, also to the requests pended before
+    /// and to their transfers in flight. The exception is the byte limits
+    /// for requests pended while all limits were off: these requests are
+    /// never throttled by byte limits, not even limits set later. They still
+    /// wait for the request rate until they are sent.
+
+    void                    setRatePolicy( const AsyncRatePolicy *policy );  // nofail
+
 public:
     internal::AsyncLoop *   head() const { return m_head; }
+    internal::MemoryBudget *slowTraceBudget() const { return m_slowTraceBudget; }
+    internal::ConcurrencyLimiter *concurrencyLimiter() const { return m_concurrencyLimiter; }
+    internal::RateLimiter * rateLimiter() const { return m_rateLimiter; }
+    bool                    isRateLimited() const;  // nofail
 
 private:
                     AsyncMan( const AsyncMan & );  // forbidden
@@ -123,6 +439,10 @@ private:
 
     internal::AsyncLoop *   m_head;
     size_t                  m_connectionsPerThread;
+    internal::StatsDump *   m_statsDump;
+    internal::MemoryBudget *m_slowTraceBudget;
+    internal::ConcurrencyLimiter *m_concurrencyLimiter;
+    internal::RateLimiter * m_rateLimiter;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,319 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Low-overhead binary event tracing.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "evtrace.h"
+#include "sysutils.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec( thread )
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+namespace webstor
+{
+
+namespace internal
+{
+
+CASSERT( sizeof( EvTraceEvent ) == 32 );
+
+//////////////////////////////////////////////////////////////////////////////
+// EvTraceRing -- single-producer single-consumer ring of events.
+// The owner thread advances 'head', the flusher advances 'tail'. Rings are
+// never freed: a thread doesn't get notified when another thread exits, so
+// the flusher cannot tell if a ring is still in use.
+
+struct EvTraceRing
+{
+    enum { c_size = 1 << 14 };  // 512KB per thread
+
+    EvTraceEvent    events[ c_size ];
+    volatile UInt64 head;
+    volatile UInt64 tail;
+    volatile UInt64 dropped;        // by the owner thread
+    UInt64          droppedFlushed; // by the flusher
+    UInt32          thread;
+    EvTraceRing *volatile next;
+};
+
+// Maximum number of tracing threads, events of threads beyond that are not
+// recorded.
+
+static const UInt32 c_maxRings = 256;
+
+static volatile bool s_evTraceOn = false;
+static EvTraceRing *volatile s_rings = NULL;
+static UInt32 s_ringCount = 0;
+static ExLockSync s_ringsLock( "EvTrace" );
+
+static THREAD_LOCAL EvTraceRing *t_ring = NULL;
+static THREAD_LOCAL bool t_noRing = false;
+
+static EvTraceRing *
+attachRing()  // nofail
+{
+    dbgAssert( !t_ring );
+
+    if( t_noRing )
+    {
+        return NULL;
+    }
+
+    s_ringsLock.claimLock();  // nofail
+    ScopedExLock lock( &s_ringsLock );
+
+    EvTraceRing *ring = NULL;
+
+    if( s_ringCount < c_maxRings && ( ring = new( std::nothrow ) EvTraceRing ) )
+    {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->droppedFlushed = 0;
+        ring->thread = s_ringCount++;
+        ring->next = s_rings;
+
+        // Make sure the flusher sees the ring initialized.
+
+        cpuMemStoreFence();
+        s_rings = ring;
+    }
+
+    t_ring = ring;
+    t_noRing = !ring;
+    return ring;
+}
+
+void
+evTrace( EvTraceType type, const void *id, unsigned long long arg )  // nofail
+{
+    if( !s_evTraceOn )
+    {
+        return;
+    }
+
+    EvTraceRing *ring = t_ring ? t_ring : attachRing();
+
+    if( !ring )
+    {
+        return;
+    }
+
+    UInt64 head = ring->head;
+
+    if( head - ring->tail >= EvTraceRing::c_size )
+    {
+        ring->dropped++;
+        return;
+    }
+
+    EvTraceEvent &event = ring->events[ head & ( EvTraceRing::c_size - 1 ) ];
+    event.timestamp = timeNowNs();
+    event.id = ( UInt64 )id;
+    event.arg = arg;
+    event.thread = ring->thread;
+    event.type = type;
+
+    // Publish the event.
+
+    cpuMemStoreFence();
+    ring->head = head + 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// EvTraceFlusher -- background task writing the rings to the file.
+
+class EvTraceFlusher
+{
+public:
+    enum { c_flushInterval = 100 };  // msecs
+
+                    EvTraceFlusher( const char *path );
+                    ~EvTraceFlusher();
+
+private:
+                    EvTraceFlusher( const EvTraceFlusher & );  // forbidden
+    EvTraceFlusher &operator=( const EvTraceFlusher & );  // forbidden
+
+    static TaskResult TASKAPI flushTask( void *arg );
+    void            flush();  // nofail
+    void            write( const EvTraceEvent *events, size_t count );  // nofail
+
+    FILE *          m_file;
+    EventSync       m_stop;
+    TaskCtrl        m_flushTaskCtrl;
+};
+
+static EvTraceFlusher *s_flusher = NULL;
+
+EvTraceFlusher::EvTraceFlusher( const char *path )
+    : m_file( NULL )
+{
+    dbgAssert( path );
+
+    m_file = fopen( path, "ab" );
+
+    if( !m_file )
+    {
+        std::string msg( "cannot open event trace file " );
+        msg.append( path ).append( ": " ).append( strerror( errno ) );
+        throw std::runtime_error( msg );
+    }
+
+    EvTraceHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, "WSEVTR02", sizeof( header.magic ) );
+    header.eventSize = sizeof( EvTraceEvent );
+    fwrite( &header, sizeof( header ), 1, m_file );
+
+    // Skip events left from the previous recording.
+
+    cpuMemLoadFence();
+
+    for( EvTraceRing *ring = s_rings; ring; ring = ring->next )
+    {
+        ring->tail = ring->head;
+        ring->droppedFlushed = ring->dropped;
+    }
+
+    try
+    {
+        taskStartAsync( &flushTask, this, &m_flushTaskCtrl );
+    }
+    catch( ... )
+    {
+        fclose( m_file );
+        throw;
+    }
+}
+
+EvTraceFlusher::~EvTraceFlusher()
+{
+    m_stop.set();  // nofail
+    m_flushTaskCtrl.wait();  // nofail
+
+    flush();  // nofail
+    fclose( m_file );
+}
+
+TaskResult TASKAPI
+EvTraceFlusher::flushTask( void *arg )
+{
+    dbgAssert( arg );
+    EvTraceFlusher *const flusher = static_cast< EvTraceFlusher * >( arg );
+
+    while( !flusher->m_stop.wait( c_flushInterval ) )
+    {
+        flusher->flush();  // nofail
+    }
+
+    return 0;
+}
+
+void
+EvTraceFlusher::flush()  // nofail
+{
+    cpuMemLoadFence();
+
+    for( EvTraceRing *ring = s_rings; ring; ring = ring->next )
+    {
+        UInt64 head = ring->head;
+        UInt64 tail = ring->tail;
+
+        // Make sure we see the events published before the 'head'.
+
+        cpuMemLoadFence();
+
+        while( tail != head )
+        {
+            size_t offset = static_cast< size_t >( tail & ( EvTraceRing::c_size - 1 ) );
+            size_t count = static_cast< size_t >( std::min< UInt64 >( head - tail, EvTraceRing::c_size - offset ) );
+
+            write( &ring->events[ offset ], count );
+            tail += count;
+        }
+
+        // Let the owner thread reuse the space only after the events are copied.
+
+        cpuMemFullFence();
+        ring->tail = tail;
+
+        UInt64 dropped = ring->dropped;
+
+        if( dropped != ring->droppedFlushed )
+        {
+            EvTraceEvent event;
+            memset( &event, 0, sizeof( event ) );
+            event.timestamp = timeNowNs();
+            event.arg = dropped - ring->droppedFlushed;
+            event.thread = ring->thread;
+            event.type = EVT_DROPPED;
+
+            write( &event, 1 );
+            ring->droppedFlushed = dropped;
+        }
+    }
+
+    fflush( m_file );
+}
+
+void
+EvTraceFlusher::write( const EvTraceEvent *events, size_t count )  // nofail
+{
+    // Silently ignore errors, tracing must not fail the traced code.
+
+    fwrite( events, sizeof( *events ), count, m_file );
+}
+
+}  // namespace internal
+
+using namespace internal;
+
+void
+startEventTrace( const char *path )
+{
+    dbgAssert( path );
+
+    stopEventTrace();  // nofail
+
+    s_flusher = new EvTraceFlusher( path );
+    s_evTraceOn = true;
+}
+
+void
+stopEventTrace()  // nofail
+{
+    s_evTraceOn = false;
+
+    delete s_flusher;
+    s_flusher = NULL;
+}
+
+}  // namespace webstor
@@ -0,0 +1,94 @@
+#ifndef INCLUDED_EVTRACE_H
+#define INCLUDED_EVTRACE_H
+
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Low-overhead binary event tracing.
+//
+// Unlike LOG_TRACE (a debug-only text log written under a global lock), the
+// event trace is meant to stay on in production: each thread records fixed
+// size binary events into its own ring buffer without locks or formatting,
+// and a background task flushes the rings to a file.  If a ring fills up
+// (the flusher falls behind), new events of that thread are dropped and the
+// number of dropped events is recorded instead.  Use s3evtrace to convert
+// the file to Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+//
+// The trace file starts with EvTraceHeader followed by EvTraceEvent records
+// in native byte order, ordered by time within a thread only.
+//////////////////////////////////////////////////////////////////////////////
+
+namespace webstor
+{
+
+///@brief Starts recording events to the given file (appends if the file
+/// exists), stops the previous recording if any. Throws on failure.
+///@details Start and stop are not thread-safe, recording is.
+
+void
+startEventTrace( const char *path );
+
+///@brief Stops recording, flushes the recorded events and closes the file.
+
+void
+stopEventTrace();  // nofail
+
+namespace internal
+{
+
+//////////////////////////////////////////////////////////////////////////////
+// Trace file format.
+
+enum EvTraceType
+{
+    EVT_LOOP_START = 1,     // AsyncLoop thread started, id = AsyncLoop
+    EVT_PEND,               // request queued for an AsyncLoop, id = request
+    EVT_ADD,                // request added to the multi-handle, arg = running requests
+    EVT_FIRST_BYTE,         // first byte of the response received
+    EVT_COMPLETE,           // request completed, arg = CURLcode
+    EVT_CANCEL,             // request canceled
+    EVT_WAKE,               // AsyncLoop woke up, arg = socket actions (0 on timeout)
+    EVT_DROPPED,            // written by the flusher, arg = events dropped by the thread
+    EVT_RETRY               // request attempt completed and is to be retried, arg = delay in msecs
+};
+
+struct EvTraceHeader
+{
+    char            magic[ 8 ];     // "WSEVTR02"
+    unsigned int    eventSize;      // sizeof( EvTraceEvent )
+    unsigned int    reserved;
+};
+
+struct EvTraceEvent
+{
+    unsigned long long timestamp;   // nanoseconds, see timeNowNs()
+    unsigned long long id;          // request (curl handle) or AsyncLoop address
+    unsigned long long arg;
+    unsigned int    thread;         // index of the recording thread
+    unsigned int    type;           // EvTraceType
+};
+
+// Records an event if tracing is on.
+
+void
+evTrace( EvTraceType type, const void *id, unsigned long long arg = 0 );  // nofail
+
+}  // namespace internal
+
+}  // namespace webstor
+
+#endif // !INCLUDED_EVTRACE_H
@@ -0,0 +1,2378 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// S3 benchmark driver.
+//
+// One tool for all throughput measurements (replaces s3put, s3get and
+// s3multiget).  It sweeps object sizes, connection counts and AsyncMan
+// counts and prints one result record per run as text, JSON or CSV.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "evtrace.h"
+#include "s3conn.h"
+#include "sysutils.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#ifdef _WIN32
+#define snprintf sprintf_s
+#endif
+
+using namespace webstor;
+using namespace webstor::internal;
+
+static char s_errMsg[ 512 ] = {};
+static const size_t KB = 1024;
+static const size_t MB = KB * 1024;
+static const size_t GB = MB * 1024;
+static const size_t s_maxReportedErrors = 10;
+
+// Note: this option list must be consistent with usage() and parseCommandLine(..)
+// methods.
+
+static StringWithLen s_cmdFlags =
+    { STRING_WITH_LEN( "-H -P -U -G -n -p -s -c -a -w -ki -kh -all -key -r -m -x -rate -sched -t -speed -prep -trace -evt -aimd -f -o -pr -v -help --help -? --?" ) };
+
+static void
+usage()
+{
+    std::cout <<
+        "s3bench command [options]                                                      \n"
+        "                                                                               \n"
+        "commands:                                                                      \n"
+        "    put       upload keys [keylow, keyhigh) for each object size,              \n"
+        "    get       download keys [keylow, keyhigh) for each object size,            \n"
+        "    range-get download a single object in ranges split across all ranks,       \n"
+        "    list      list all objects with the given prefix page by page,             \n"
+        "    mixed     random mix of get and put over keys [keylow, keyhigh),           \n"
+        "    replay    re-issue gets, puts and deletes of a trace written by -trace.    \n"
+        "                                                                               \n"
+        "options:                                                                       \n"
+        "    -n bucket name,                                                            \n"
+        "       (it can be specified via AWS_BUCKET_NAME env. variable)                 \n"
+        "    -H optional region-specific endpoint or a mandatory Walrus host name,      \n"
+        "       (it can be specified via AWS_HOST env. variable)                        \n"
+        "    -P optional port number,                                                   \n"
+        "    -U (optional flag to use HTTP instead of HTTPS),                           \n"
+        "    -G optional proxy with port number (proxy:port),                           \n"
+        "       (it can be specified via AWS_PROXY env. variable)                       \n"
+        "    -p key prefix (default is empty),                                          \n"
+        "    -s object size, repeat to sweep (number in MB or with k/m/g suffix),       \n"
+        "    -c connection count, repeat to sweep (default 1),                          \n"
+        "    -a AsyncMan count, repeat to sweep (default 4),                            \n"
+        "    -w worker threads per process, each with its own connections and AsyncMans \n"
+        "       and acting as a separate rank (default 1),                              \n"
+        "    -ki first key (default 0),                                                 \n"
+        "    -kh last key, exclusive (default keylow + 1),                              \n"
+        "    -all every rank accesses all keys instead of its own share,                \n"
+        "    -key object key for 'range-get' (default keylow),                          \n"
+        "    -r range size for 'range-get' (default object size / (ranks * conns)),     \n"
+        "    -m percentage of gets for 'mixed' (default 50),                            \n"
+        "    -x page size for 'list' (default 1000),                                    \n"
+        "    -rate open-loop mode: issue ops at the given rate (ops/s per rank) instead \n"
+        "       of as fast as connections complete; latency is measured from the time   \n"
+        "       an op was scheduled, so queueing behind busy connections is counted,    \n"
+        "    -sched open-loop schedule: poisson or constant (default poisson),          \n"
+        "    -t trace file for 'replay',                                                \n"
+        "    -speed 'replay' timing: 1 keeps the original timing, 2 replays twice as    \n"
+        "       fast, etc.; 0 issues ops as fast as connections complete (default 1),   \n"
+        "    -prep upload objects read by the trace before replaying it,                \n"
+        "    -trace record requests of this run to a file (one file per rank, with     \n"
+        "       '.<rank>' suffix, if there are several ranks),                          \n"
+        "    -evt record an event trace of the process to a file, convert it with       \n"
+        "       s3evtrace (with '.<process>' suffix if there are several processes),    \n"
+        "    -aimd limit requests in flight of each AsyncMan adaptively, shrinking the  \n"
+        "       limit on 503 Slow Down and on latency inflation,                        \n"
+        "    -f output format: text, json or csv (default text),                        \n"
+        "    -o append results to a file instead of stdout,                             \n"
+        "    -pr print a record for each rank in addition to the summary of all ranks,  \n"
+        "    -v verbose mode (report individual errors).                                \n"
+        "                                                                               \n"
+        "AWS_ACCESS_KEY and AWS_SECRET_KEY env. variables must be set.                  \n"
+        "Keys are named '<prefix><key>/<size>mb' (e.g. '7/16mb'), so objects written    \n"
+        "by 'put' are read back by 'get', 'range-get' and 'mixed'. Traces keep hashes   \n"
+        "of keys only, 'replay' names them '<prefix>trace/<hash>'; with several ranks   \n"
+        "each rank replays its share of keys.                                           \n"
+        "                                                                               \n"
+        "Ranks are worker threads (-w) of one or several MPI processes. s3bench built   \n"
+        "with MPI=0 (see Makefile) runs without an MPI stack, as a single process.      \n"
+        "                                                                               \n"
+        "Examples:                                                                      \n"
+        "                                                                               \n"
+        " * upload 1000 16MB objects with 32 connections:                               \n"
+        "   s3bench put -n mybucket -s 16 -c 32 -kh 1000                                \n"
+        "                                                                               \n"
+        " * sweep download throughput across 4 MPI processes with 2 workers each:       \n"
+        "   mpirun -np 4 s3bench get -n mybucket -s 16 -c 8 -c 16 -kh 1000 -w 2 -f csv  \n"
+        "   (rank 0 prints one record per run for all 8 ranks: total bytes, aggregate   \n"
+        "   MiB/s over the slowest rank's time, per-rank MiB/s range, skew, merged      \n"
+        "   latency percentiles)                                                        \n"
+        "                                                                               \n"
+        " * fetch object 0 of 1GB in 8MB ranges:                                        \n"
+        "   s3bench range-get -n mybucket -s 1g -r 8m -c 16 -key 0 -f json              \n"
+        "                                                                               \n"
+        " * offer 200 gets/s of 1MB objects, at most 64 outstanding:                    \n"
+        "   s3bench get -n mybucket -s 1 -c 64 -kh 10000 -rate 200                      \n"
+        "                                                                               \n"
+        " * record a mixed workload, then replay it against another endpoint 4x faster: \n"
+        "   s3bench mixed -n mybucket -s 1 -c 16 -kh 1000 -trace mixed.trace            \n"
+        "   s3bench replay -n mybucket -H host -c 16 -t mixed.trace -speed 4 -prep      \n";
+}
+
+struct Options
+{
+    Options()
+        : isHttps( true )
+        , keyLow( 0 )
+        , keyHigh( 0 )
+        , readAll( false )
+        , rangeKey( -1 )
+        , rangeSize( 0 )
+        , readPercent( 50 )
+        , maxKeys( 1000 )
+        , workers( 1 )
+        , rate( 0 )
+        , schedule( "poisson" )
+        , speed( 1 )
+        , prepare( false )
+        , adaptive( false )
+        , format( "text" )
+        , perRank( false )
+        , verbose( false )
+        , showUsage( false )
+    {}
+
+    std::string command;
+    std::string accKey;
+    std::string secKey;
+    std::string host;
+    std::string port;
+    bool isHttps;
+    std::string proxy;
+    std::string bucketName;
+    std::string prefix;
+    std::vector< size_t > objectSizes;
+    std::vector< size_t > connectionCounts;
+    std::vector< size_t > asyncManCounts;
+    size_t keyLow;
+    size_t keyHigh;
+    bool readAll;
+    int rangeKey;
+    size_t rangeSize;
+    size_t readPercent;
+    size_t maxKeys;
+    size_t workers;
+    size_t rate;
+    std::string schedule;
+    std::string traceFile;
+    double speed;
+    bool prepare;
+    std::string recordFile;
+    std::string eventTraceFile;
+    bool adaptive;
+    std::string format;
+    std::string outFile;
+    bool perRank;
+    bool verbose;
+    bool showUsage;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Cmdline parsing.
+
+static bool
+isCmdFlag( const char *value )
+{
+    dbgAssert( value && *value );
+    size_t len = strlen( value );
+
+    // A flag may be a prefix of another one (e.g. -pr and -prep), so look
+    // for a whole word match.
+
+    for( const char *p = strstr( s_cmdFlags.str, value ); p; p = strstr( p + 1, value ) )
+    {
+        if( ( p == s_cmdFlags.str || *( p - 1 ) == ' ' ) &&
+            ( p + len >= s_cmdFlags.str + s_cmdFlags.len || *( p + len ) == ' ' ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static const char *
+getValue( const char *flag, int *i, int argc, char **argv )
+{
+    dbgAssert( *i >= 0 && *i < argc );
+    dbgAssert( isCmdFlag( flag ) );
+
+    if( strcmp( argv[ *i ], flag ) )
+    {
+        return NULL;
+    }
+
+    if( *i + 1 < argc && !isCmdFlag( argv[ *i + 1 ] ) )
+    {
+        return argv[ ++( *i ) ];
+    }
+
+    snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Value is missing for %s.", flag );
+    throw s_errMsg;
+}
+
+static size_t
+parseSize( const char *flag, const char *value, size_t defaultUnit )
+{
+    dbgAssert( value );
+
+    char *end = NULL;
+    double size = strtod( value, &end );
+    size_t unit = defaultUnit;
+
+    if( end && *end )
+    {
+        switch( *end )
+        {
+            case 'b': case 'B': unit = 1; break;
+            case 'k': case 'K': unit = KB; break;
+            case 'm': case 'M': unit = MB; break;
+            case 'g': case 'G': unit = GB; break;
+            default: unit = 0; break;
+        }
+
+        if( unit && end[ 1 ] && strcmp( end + 1, "b" ) && strcmp( end + 1, "B" ) )
+        {
+            unit = 0;
+        }
+    }
+
+    if( end == value || !unit || size <= 0 )
+    {
+        snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Invalid size '%s' for %s.", value, flag );
+        throw s_errMsg;
+    }
+
+    return static_cast< size_t >( size * unit );
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, std::string *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        *field = value;
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, size_t *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        *field = atoi( value );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, int *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        *field = atoi( value );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, double *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        *field = atof( value );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, std::vector< size_t > *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        field->push_back( atoi( value ) );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetSize( const char *flag, int *i, int argc, char **argv, size_t *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        *field = parseSize( flag, value, MB );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetSize( const char *flag, int *i, int argc, char **argv, std::vector< size_t > *field )
+{
+    const char *value = getValue( flag, i, argc, argv );
+
+    if( value )
+    {
+        field->push_back( parseSize( flag, value, MB ) );
+    }
+
+    return value != NULL;
+}
+
+static bool
+tryGetValue( const char *flag, int *i, int argc, char **argv, bool *field, bool value = true )
+{
+    dbgAssert( *i >= 0 && *i < argc );
+    dbgAssert( isCmdFlag( flag ) );
+
+    if( !strcmp( argv[ *i ], flag ) )
+    {
+        *field = value;
+        return true;
+    }
+
+    return false;
+}
+
+static void
+readEnvVar( const char *var, std::string *field )
+{
+    dbgAssert( var );
+    dbgAssert( field );
+
+    const char *value = getenv( var );
+
+    if( value && *value )
+    {
+        field->assign( value );
+    }
+}
+
+static void
+readEnvVars( Options *options )
+{
+    dbgAssert( options );
+
+    readEnvVar( "AWS_ACCESS_KEY", &options->accKey );
+    readEnvVar( "AWS_SECRET_KEY", &options->secKey );
+    readEnvVar( "AWS_BUCKET_NAME", &options->bucketName );
+    readEnvVar( "AWS_HOST", &options->host );
+    readEnvVar( "AWS_PROXY", &options->proxy );
+}
+
+static void
+parseCommandLine( int argc, char **argv, Options *options )
+{
+    dbgAssert( options );
+
+    int i = 1;
+
+    if( argc > 1 && argv[ 1 ][ 0 ] != '-' )
+    {
+        options->command = argv[ 1 ];
+        ++i;
+    }
+
+    for( ; i < argc; i++ )
+    {
+        // Note: option flags are taken from s_cmdFlags.
+        // If you add a new, don't forget to update s_cmdFlags.
+
+        if( tryGetValue( "-H", &i, argc, argv, &options->host ) ||
+            tryGetValue( "-P", &i, argc, argv, &options->port ) ||
+            tryGetValue( "-U", &i, argc, argv, &options->isHttps, false ) ||
+            tryGetValue( "-G", &i, argc, argv, &options->proxy ) ||
+            tryGetValue( "-n", &i, argc, argv, &options->bucketName ) ||
+            tryGetValue( "-p", &i, argc, argv, &options->prefix ) ||
+            tryGetSize( "-s", &i, argc, argv, &options->objectSizes ) ||
+            tryGetValue( "-c", &i, argc, argv, &options->connectionCounts ) ||
+            tryGetValue( "-a", &i, argc, argv, &options->asyncManCounts ) ||
+            tryGetValue( "-w", &i, argc, argv, &options->workers ) ||
+            tryGetValue( "-ki", &i, argc, argv, &options->keyLow ) ||
+            tryGetValue( "-kh", &i, argc, argv, &options->keyHigh ) ||
+            tryGetValue( "-all", &i, argc, argv, &options->readAll ) ||
+            tryGetValue( "-key", &i, argc, argv, &options->rangeKey ) ||
+            tryGetSize( "-r", &i, argc, argv, &options->rangeSize ) ||
+            tryGetValue( "-m", &i, argc, argv, &options->readPercent ) ||
+            tryGetValue( "-x", &i, argc, argv, &options->maxKeys ) ||
+            tryGetValue( "-rate", &i, argc, argv, &options->rate ) ||
+            tryGetValue( "-sched", &i, argc, argv, &options->schedule ) ||
+            tryGetValue( "-t", &i, argc, argv, &options->traceFile ) ||
+            tryGetValue( "-speed", &i, argc, argv, &options->speed ) ||
+            tryGetValue( "-prep", &i, argc, argv, &options->prepare ) ||
+            tryGetValue( "-trace", &i, argc, argv, &options->recordFile ) ||
+            tryGetValue( "-evt", &i, argc, argv, &options->eventTraceFile ) ||
+            tryGetValue( "-aimd", &i, argc, argv, &options->adaptive ) ||
+            tryGetValue( "-f", &i, argc, argv, &options->format ) ||
+            tryGetValue( "-o", &i, argc, argv, &options->outFile ) ||
+            tryGetValue( "-pr", &i, argc, argv, &options->perRank ) ||
+            tryGetValue( "-v", &i, argc, argv, &options->verbose ) ||
+            tryGetValue( "--help", &i, argc, argv, &options->showUsage ) ||
+            tryGetValue( "-help", &i, argc, argv, &options->showUsage ) ||
+            tryGetValue( "-?", &i, argc, argv, &options->showUsage ) ||
+            tryGetValue( "--?", &i, argc, argv, &options->showUsage ) )
+        {
+            continue;
+        }
+
+        snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Invalid option '%s'.", argv[ i ] );
+        throw s_errMsg;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Verification of option fields.
+
+static void
+checkSpecified( const std::string &value, const char *errMsg )
+{
+    if( value.empty() )
+    {
+        throw errMsg;
+    }
+}
+
+static void
+checkOptions( Options *options )
+{
+    dbgAssert( options );
+
+    checkSpecified( options->accKey, "AWS access key is not specified. Set AWS_ACCESS_KEY env. variable." );
+    checkSpecified( options->secKey, "AWS secret key is not specified. Set AWS_SECRET_KEY env. variable." );
+    checkSpecified( options->command, "Command is not specified. Use one of put, get, range-get, list, mixed or replay." );
+    checkSpecified( options->bucketName, "bucket name is not specified. You need to provide '-n bucketName' option." );
+
+    if( options->command != "put" && options->command != "get" && options->command != "range-get" &&
+        options->command != "list" && options->command != "mixed" && options->command != "replay" )
+    {
+        snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Unknown command '%s'.", options->command.c_str() );
+        throw s_errMsg;
+    }
+
+    if( options->format != "text" && options->format != "json" && options->format != "csv" )
+    {
+        snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Unknown output format '%s'.", options->format.c_str() );
+        throw s_errMsg;
+    }
+
+    if( options->objectSizes.empty() && options->command != "list" && options->command != "replay" )
+    {
+        throw "Object size is not specified. You need to provide '-s size' option.";
+    }
+
+    if( options->connectionCounts.empty() )
+    {
+        options->connectionCounts.push_back( 1 );
+    }
+
+    if( options->asyncManCounts.empty() )
+    {
+        options->asyncManCounts.push_back( 4 );
+    }
+
+    for( size_t i = 0; i < options->connectionCounts.size(); ++i )
+    {
+        if( options->connectionCounts[ i ] == 0 ||
+            options->connectionCounts[ i ] > S3Connection::c_maxWaitAny )
+        {
+            snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Connection count must be between 1 and %d.",
+                S3Connection::c_maxWaitAny );
+            throw s_errMsg;
+        }
+    }
+
+    for( size_t i = 0; i < options->asyncManCounts.size(); ++i )
+    {
+        if( options->asyncManCounts[ i ] == 0 )
+        {
+            throw "AsyncMan count must be positive.";
+        }
+    }
+
+    if( options->workers == 0 )
+    {
+        throw "Worker count must be positive.";
+    }
+
+    if( options->keyHigh <= options->keyLow )
+    {
+        options->keyHigh = options->keyLow + 1;
+    }
+
+    if( options->rangeKey < 0 )
+    {
+        options->rangeKey = static_cast< int >( options->keyLow );
+    }
+
+    if( options->readPercent > 100 )
+    {
+        throw "Read percentage must be between 0 and 100.";
+    }
+
+    if( options->maxKeys == 0 )
+    {
+        options->maxKeys = 1000;
+    }
+
+    if( options->schedule != "poisson" && options->schedule != "constant" )
+    {
+        snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Unknown schedule '%s'.", options->schedule.c_str() );
+        throw s_errMsg;
+    }
+
+    if( options->rate && options->command == "list" )
+    {
+        throw "Open-loop mode is not supported for 'list'.";
+    }
+
+    if( options->command == "replay" )
+    {
+        checkSpecified( options->traceFile, "Trace file is not specified. You need to provide '-t file' option." );
+
+        if( options->rate )
+        {
+            throw "'replay' takes its timing from the trace, use -speed instead of -rate.";
+        }
+
+        if( options->speed < 0 )
+        {
+            throw "Replay speed must not be negative.";
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Results.
+
+struct BenchResult
+{
+    BenchResult()
+        : objectSize( 0 )
+        , connections( 0 )
+        , asyncMans( 0 )
+        , rank( 0 )
+        , ranks( 1 )
+        , ops( 0 )
+        , errors( 0 )
+        , bytes( 0 )
+        , elapsed( 0 )
+        , offeredRate( 0 )
+        , isSummary( false )
+        , rankMibMin( 0 )
+        , rankMibMax( 0 )
+        , skew( 1 )
+    {}
+
+    std::string     command;
+    size_t          objectSize;
+    size_t          connections;
+    size_t          asyncMans;
+    int             rank;
+    int             ranks;
+    UInt64          ops;
+    UInt64          errors;
+    UInt64          bytes;
+    UInt64          elapsed;    // in usecs
+    double          offeredRate;  // in ops/s, 0 for closed-loop runs
+
+    // A summary of all ranks has the total ops, errors and bytes, the
+    // elapsed time of the slowest rank, the range of per-rank MiB/s and
+    // skew: the slowest rank's time divided by the fastest one's.
+
+    bool            isSummary;
+    double          rankMibMin;
+    double          rankMibMax;
+    double          skew;
+
+    // Completion latencies of successful operations, in usecs.
+    // Open-loop runs measure them from the scheduled start time.
+
+    LatencyHistogram latencies;
+};
+
+static void
+printResult( std::ostream &out, const std::string &format, const BenchResult &result )
+{
+    static bool s_csvHeaderPrinted = false;
+
+    const LatencyHistogram &lat = result.latencies;
+
+    double mibps = result.elapsed ? 1000000.0 * result.bytes / MB / result.elapsed : 0;
+    double opsps = result.elapsed ? 1000000.0 * result.ops / result.elapsed : 0;
+    double rankMibMin = result.isSummary ? result.rankMibMin : mibps;
+    double rankMibMax = result.isSummary ? result.rankMibMax : mibps;
+
+    std::stringstream rank;
+
+    if( result.isSummary )
+    {
+        rank << "all";
+    }
+    else
+    {
+        rank << result.rank;
+    }
+
+    if( format == "json" )
+    {
+        out << "{\"command\":\"" << result.command << "\""
+            << ",\"timestamp\":" << static_cast< UInt64 >( time( NULL ) )
+            << ",\"rank\":" << ( result.isSummary ? "\"all\"" : rank.str() )
+            << ",\"ranks\":" << result.ranks
+            << ",\"objectSize\":" << result.objectSize
+            << ",\"connections\":" << result.connections
+            << ",\"asyncMans\":" << result.asyncMans
+            << ",\"ops\":" << result.ops
+            << ",\"errors\":" << result.errors
+            << ",\"bytes\":" << result.bytes
+            << ",\"elapsedMs\":" << result.elapsed / 1000.0
+            << ",\"mibPerSec\":" << mibps
+            << ",\"opsPerSec\":" << opsps
+            << ",\"latencyUs\":{\"avg\":" << lat.mean()
+            << ",\"p50\":" << lat.percentile( 50 )
+            << ",\"p90\":" << lat.percentile( 90 )
+            << ",\"p99\":" << lat.percentile( 99 )
+            << ",\"p999\":" << lat.percentile( 99.9 )
+            << ",\"max\":" << lat.max()
+            << "},\"offeredOpsPerSec\":" << result.offeredRate
+            << ",\"rankMibPerSecMin\":" << rankMibMin
+            << ",\"rankMibPerSecMax\":" << rankMibMax
+            << ",\"skew\":" << result.skew
+            << "}" << std::endl;
+    }
+    else if( format == "csv" )
+    {
+        // All ranks may write to the same output, only rank 0 prints the header.
+
+        if( !s_csvHeaderPrinted && result.rank == 0 )
+        {
+            out << "command,timestamp,rank,ranks,objectSize,connections,asyncMans,ops,errors,bytes,"
+                "elapsedMs,mibPerSec,opsPerSec,latAvgUs,latP50Us,latP90Us,latP99Us,latP999Us,latMaxUs,"
+                "offeredOpsPerSec,rankMibPerSecMin,rankMibPerSecMax,skew"
+                << std::endl;
+        }
+
+        s_csvHeaderPrinted = true;
+
+        out << result.command << ','
+            << static_cast< UInt64 >( time( NULL ) ) << ','
+            << rank.str() << ','
+            << result.ranks << ','
+            << result.objectSize << ','
+            << result.connections << ','
+            << result.asyncMans << ','
+            << result.ops << ','
+            << result.errors << ','
+            << result.bytes << ','
+            << result.elapsed / 1000.0 << ','
+            << mibps << ','
+            << opsps << ','
+            << lat.mean() << ','
+            << lat.percentile( 50 ) << ','
+            << lat.percentile( 90 ) << ','
+            << lat.percentile( 99 ) << ','
+            << lat.percentile( 99.9 ) << ','
+            << lat.max() << ','
+            << result.offeredRate << ','
+            << rankMibMin << ','
+            << rankMibMax << ','
+            << result.skew << std::endl;
+    }
+    else
+    {
+        out << rank.str() << ": " << result.command
+            << " size=" << result.objectSize
+            << " conns=" << result.connections
+            << " asyncMans=" << result.asyncMans
+            << " ops=" << result.ops
+            << " errors=" << result.errors
+            << " " << mibps << "MiB/s"
+            << " " << opsps << "ops/s";
+
+        if( result.offeredRate )
+        {
+            out << " (offered " << result.offeredRate << "ops/s)";
+        }
+
+        if( result.isSummary )
+        {
+            out << " ranks=" << result.ranks
+                << " rank MiB/s min=" << rankMibMin
+                << " max=" << rankMibMax
+                << " skew=" << result.skew;
+        }
+
+        out << " latency(us) avg=" << lat.mean()
+            << " p50=" << lat.percentile( 50 )
+            << " p90=" << lat.percentile( 90 )
+            << " p99=" << lat.percentile( 99 )
+            << " p99.9=" << lat.percentile( 99.9 )
+            << " max=" << lat.max() << std::endl;
+    }
+}
+
+// Partial aggregate of results of several ranks: sums, extremes and merged
+// latency counters.
+
+struct ResultTotals
+{
+    ResultTotals()
+        : mibpsMin( HUGE_VAL )
+        , mibpsMax( 0 )
+        , offeredRate( 0 )
+        , counters( LatencyHistogram::c_counterCount )
+    {
+        for( size_t i = 0; i < dimensionOf( sums ); ++i )
+        {
+            sums[ i ] = 0;
+        }
+
+        for( size_t i = 0; i < dimensionOf( maxs ); ++i )
+        {
+            maxs[ i ] = 0;
+            mins[ i ] = ~0ULL;
+        }
+    }
+
+    explicit ResultTotals( const BenchResult &result )
+        : offeredRate( result.offeredRate )
+        , counters( result.latencies.counters(),
+            result.latencies.counters() + LatencyHistogram::c_counterCount )
+    {
+        const LatencyHistogram &lat = result.latencies;
+
+        sums[ 0 ] = result.ops;
+        sums[ 1 ] = result.errors;
+        sums[ 2 ] = result.bytes;
+        sums[ 3 ] = lat.sum();
+        maxs[ 0 ] = result.elapsed;
+        maxs[ 1 ] = lat.max();
+        mins[ 0 ] = result.elapsed;
+        mins[ 1 ] = lat.count() ? lat.min() : ~0ULL;
+        mibpsMin = mibpsMax = result.elapsed ? 1000000.0 * result.bytes / MB / result.elapsed : 0;
+    }
+
+    void merge( const ResultTotals &other )
+    {
+        for( size_t i = 0; i < dimensionOf( sums ); ++i )
+        {
+            sums[ i ] += other.sums[ i ];
+        }
+
+        for( size_t i = 0; i < dimensionOf( maxs ); ++i )
+        {
+            maxs[ i ] = std::max( maxs[ i ], other.maxs[ i ] );
+            mins[ i ] = std::min( mins[ i ], other.mins[ i ] );
+        }
+
+        for( size_t i = 0; i < counters.size(); ++i )
+        {
+            counters[ i ] += other.counters[ i ];
+        }
+
+        mibpsMin = std::min( mibpsMin, other.mibpsMin );
+        mibpsMax = std::max( mibpsMax, other.mibpsMax );
+        offeredRate += other.offeredRate;
+    }
+
+    UInt64          sums[ 4 ];  // ops, errors, bytes, latency sum
+    UInt64          maxs[ 2 ];  // elapsed, latency max
+    UInt64          mins[ 2 ];  // elapsed, latency min
+    double          mibpsMin;
+    double          mibpsMax;
+    double          offeredRate;
+    std::vector< UInt64 > counters;
+};
+
+#ifdef USE_MPI
+
+// Combines totals of all MPI processes into 'total' on process 0, must be
+// called by all processes.
+
+static void
+reduceTotals( const ResultTotals &local, ResultTotals *total )
+{
+    dbgAssert( total );
+    CASSERT( sizeof( UInt64 ) == sizeof( unsigned long long ) );
+
+    MPI_Reduce( const_cast< UInt64 * >( local.sums ), total->sums, dimensionOf( local.sums ),
+        MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< UInt64 * >( local.maxs ), total->maxs, dimensionOf( local.maxs ),
+        MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< UInt64 * >( local.mins ), total->mins, dimensionOf( local.mins ),
+        MPI_UNSIGNED_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< double * >( &local.mibpsMin ), &total->mibpsMin, 1, MPI_DOUBLE, MPI_MIN, 0,
+        MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< double * >( &local.mibpsMax ), &total->mibpsMax, 1, MPI_DOUBLE, MPI_MAX, 0,
+        MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< double * >( &local.offeredRate ), &total->offeredRate, 1, MPI_DOUBLE, MPI_SUM, 0,
+        MPI_COMM_WORLD );
+    MPI_Reduce( const_cast< UInt64 * >( &local.counters[ 0 ] ), &total->counters[ 0 ], local.counters.size(),
+        MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD );
+}
+
+#endif // USE_MPI
+
+// Makes a summary of all ranks from their totals.
+
+static void
+setSummary( const BenchResult &local, const ResultTotals &totals, BenchResult *total )
+{
+    dbgAssert( total );
+
+    total->command = local.command;
+    total->objectSize = local.objectSize;
+    total->connections = local.connections;
+    total->asyncMans = local.asyncMans;
+    total->rank = local.rank;
+    total->ranks = local.ranks;
+    total->isSummary = true;
+    total->ops = totals.sums[ 0 ];
+    total->errors = totals.sums[ 1 ];
+    total->bytes = totals.sums[ 2 ];
+    total->elapsed = totals.maxs[ 0 ];
+    total->offeredRate = totals.offeredRate;
+    total->rankMibMin = totals.mibpsMin;
+    total->rankMibMax = totals.mibpsMax;
+    total->skew = totals.mins[ 0 ] ? static_cast< double >( totals.maxs[ 0 ] ) / totals.mins[ 0 ] : 1;
+    total->latencies.assign( &totals.counters[ 0 ], totals.mins[ 1 ], totals.maxs[ 1 ], totals.sums[ 3 ] );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Team -- worker threads of all processes.
+//
+// Each MPI process (or the only process, without MPI) runs -w worker threads
+// with their own connections and AsyncMans. A worker acts as a rank of its
+// own: worker 'w' of process 'p' is rank p * workers + w, so key shares,
+// traces and result records are per worker. Collective operations first
+// combine the workers of a process, then the last worker to arrive combines
+// processes over MPI while the others wait, so MPI is only called by one
+// thread at a time.
+
+class Team
+{
+public:
+                    Team( int process, int processes, size_t workers );
+
+    int             rank( size_t worker ) const { return static_cast< int >( m_process * m_workers + worker ); }
+    int             ranks() const { return static_cast< int >( m_processes * m_workers ); }
+
+    // Waits for all workers of all processes.
+
+    void            barrier();
+
+    // Combines 'local' results of all workers of all processes into 'total',
+    // must be called by all workers; returns true on rank 0, which gets the
+    // summary.
+
+    bool            aggregate( const BenchResult &local, BenchResult *total );
+
+    // Serializes output of workers.
+
+    ExLockSync *    outputLock() { return &m_outputLock; }
+
+    // Terminates all processes, used when a worker fails and the others could
+    // wait for it forever.
+
+    void            abort();
+
+private:
+                    Team( const Team & );  // forbidden
+    Team &          operator=( const Team & );  // forbidden
+
+    void            arrive( const ResultTotals *totals );
+
+    int             m_process;
+    int             m_processes;
+    size_t          m_workers;
+
+    ExLockSync      m_lock;
+    ExLockSync      m_outputLock;
+
+    // Workers arrived at the current collective operation, they wait on
+    // m_released[ m_generation % 2 ]; the other event is reset for the next
+    // operation.
+
+    size_t          m_arrived;
+    size_t          m_generation;
+    EventSync       m_released[ 2 ];
+
+    // Totals of workers of this process arrived so far, and totals of all
+    // processes of the last completed operation (valid on process 0).
+
+    ResultTotals    m_partial;
+    ResultTotals    m_totals;
+};
+
+Team::Team( int process, int processes, size_t workers )
+    : m_process( process )
+    , m_processes( processes )
+    , m_workers( workers )
+    , m_arrived( 0 )
+    , m_generation( 0 )
+{
+    dbgAssert( workers );
+}
+
+void
+Team::barrier()
+{
+    arrive( NULL );
+}
+
+bool
+Team::aggregate( const BenchResult &local, BenchResult *total )
+{
+    dbgAssert( total );
+
+    ResultTotals totals( local );
+    arrive( &totals );
+
+    if( local.rank != 0 )
+    {
+        return false;
+    }
+
+    // m_totals stays intact till the next collective operation, which can't
+    // complete without this worker.
+
+    setSummary( local, m_totals, total );
+    return true;
+}
+
+void
+Team::arrive( const ResultTotals *totals )
+{
+    size_t generation = 0;
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        generation = m_generation;
+
+        if( totals )
+        {
+            m_partial.merge( *totals );
+        }
+
+        if( ++m_arrived == m_workers )
+        {
+            // The last worker of this process, combine processes and release
+            // the others.
+
+#ifdef USE_MPI
+            if( m_processes > 1 )
+            {
+                if( totals )
+                {
+                    reduceTotals( m_partial, &m_totals );
+                }
+                else
+                {
+                    MPI_Barrier( MPI_COMM_WORLD );
+                }
+            }
+            else
+#endif
+            {
+                m_totals = m_partial;
+            }
+
+            m_partial = ResultTotals();
+            m_arrived = 0;
+            m_generation++;
+            m_released[ ( generation + 1 ) % 2 ].reset();
+            m_released[ generation % 2 ].set();
+        }
+    }
+
+    m_released[ generation % 2 ].wait();
+}
+
+void
+Team::abort()
+{
+#ifdef USE_MPI
+    if( m_processes > 1 )
+    {
+        MPI_Abort( MPI_COMM_WORLD, 1 );
+    }
+#endif
+
+    exit( 1 );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Benchmark state.
+
+enum OpKind
+{
+    OP_PUT,
+    OP_GET,
+    OP_RANGE_GET,
+    OP_DEL
+};
+
+struct Op
+{
+    OpKind          kind;
+    size_t          key;
+    size_t          offset;
+    size_t          size;
+};
+
+struct Bench
+{
+    Bench()
+        : rank( 0 )
+        , ranks( 1 )
+        , team( NULL )
+        , randomState( 1 )
+        , keyLow( 0 )
+        , keyCount( 0 )
+        , bufSize( 0 )
+    {}
+
+    Options         options;
+    int             rank;
+    int             ranks;
+    Team           *team;
+
+    // State of the worker's random sequence, see benchRandom(..).
+
+    UInt64          randomState;
+
+    // Keys accessed by this rank.
+
+    size_t          keyLow;
+    size_t          keyCount;
+
+    std::vector< AsyncMan * > asyncMans;
+    std::vector< S3Connection * > cons;
+    std::vector< unsigned char * > bufs;
+    size_t          bufSize;
+
+    // Payload state of each buffer: xor of its bytes after the header for
+    // the object size it was computed for (0 if unknown), see stampPayload(..).
+
+    std::vector< size_t > tailSizes;
+    std::vector< unsigned char > tailXors;
+
+    // 'replay' state: ops of this rank's share of the trace with their
+    // scheduled start times (in usecs since the start of the replay, already
+    // scaled by -speed), and objects the trace reads, see loadTrace(..).
+
+    std::vector< Op > traceOps;
+    std::vector< double > traceSchedule;
+    std::vector< Op > traceObjects;
+};
+
+// Returns a pseudo-random number in [0, 1); each worker has its own sequence
+// (rand() is shared by all threads).
+
+static double
+benchRandom( Bench *bench )
+{
+    dbgAssert( bench );
+
+    // xorshift64*, the top 53 bits.
+
+    UInt64 &x = bench->randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+
+    return ( ( x * 0x2545F4914F6CDD1DULL ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+// Prints a single summary of all ranks on rank 0, preceded by a record of
+// each rank if asked; must be called by all ranks.
+
+static void
+reportResult( const Bench &bench, std::ostream &out, const BenchResult &result )
+{
+    const Options &options = bench.options;
+
+    if( result.ranks == 1 )
+    {
+        printResult( out, options.format, result );
+        return;
+    }
+
+    if( options.perRank )
+    {
+        bench.team->outputLock()->claimLock();
+        ScopedExLock lock( bench.team->outputLock() );
+
+        printResult( out, options.format, result );
+    }
+
+    BenchResult total;
+
+    if( bench.team->aggregate( result, &total ) )
+    {
+        bench.team->outputLock()->claimLock();
+        ScopedExLock lock( bench.team->outputLock() );
+
+        printResult( out, options.format, total );
+    }
+}
+
+static std::string
+getKey( const std::string &prefix, size_t i, size_t objectSize )
+{
+    std::stringstream tmp;
+
+    if( !objectSize )
+    {
+        // A replayed key, 'i' is its hash.
+
+        tmp << prefix << "trace/" << std::hex << i;
+        return tmp.str();
+    }
+
+    tmp << prefix << i << '/';
+
+    if( objectSize % MB == 0 )
+    {
+        tmp << objectSize / MB << "mb";
+    }
+    else if( objectSize % KB == 0 )
+    {
+        tmp << objectSize / KB << "kb";
+    }
+    else
+    {
+        tmp << objectSize << 'b';
+    }
+
+    return tmp.str();
+}
+
+static void
+reportError( const Bench &bench, const char *what, const Op &op, size_t *reported )  // nofail
+{
+    // This function must be called from inside of a catch( ... ).
+
+    dbgAssert( reported );
+
+    if( !bench.options.verbose || *reported >= s_maxReportedErrors )
+    {
+        return;
+    }
+
+    ++( *reported );
+    std::cerr << bench.rank << ": " << what << " failed for key " << op.key;
+
+    try
+    {
+        throw;
+    }
+    catch( const std::exception &e )
+    {
+        std::cerr << ": " << e.what() << std::endl;
+    }
+    catch( ... )
+    {
+        std::cerr << ": unknown exception" << std::endl;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Object payloads.
+//
+// Each buffer is filled with pseudo-random data once; an upload only stamps
+// the key into the payload header and fixes up the checksum byte, so it costs
+// O(1) instead of O(object size) between waitAny(..) and the next pendPut(..).
+//
+// Payload layout: byte 0 makes xor of the whole object equal to the key's low
+// byte (this allows to spot-check downloaded content), bytes 1..8 hold the
+// key, so objects differ, the rest is the buffer's random data.
+
+static const size_t s_payloadHeaderSize = 1 + sizeof( UInt64 );
+
+static void
+fillRandom( unsigned char *buf, size_t size, UInt64 seed )
+{
+    // xorshift64*, 8 bytes per step.
+
+    UInt64 x = seed * 0x9E3779B97F4A7C15ULL | 1;
+    size_t i = 0;
+
+    for( ; i + sizeof( UInt64 ) <= size; i += sizeof( UInt64 ) )
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        UInt64 v = x * 0x2545F4914F6CDD1DULL;
+        memcpy( buf + i, &v, sizeof( v ) );
+    }
+
+    for( ; i < size; ++i )
+    {
+        buf[ i ] = static_cast< unsigned char >( x >>= 8 );
+    }
+}
+
+static void
+stampPayload( Bench *bench, size_t k, size_t key, size_t size )
+{
+    dbgAssert( bench );
+    dbgAssert( size <= bench->bufSize );
+
+    unsigned char *buf = bench->bufs[ k ];
+    size_t headerSize = std::min( size, s_payloadHeaderSize );
+
+    // The tail is computed once per object size (and after the buffer is
+    // reused for a download).
+
+    if( bench->tailSizes[ k ] != size )
+    {
+        unsigned char x = 0;
+
+        for( size_t i = headerSize; i < size; ++i )
+        {
+            x ^= buf[ i ];
+        }
+
+        bench->tailXors[ k ] = x;
+        bench->tailSizes[ k ] = size;
+    }
+
+    unsigned char x = static_cast< unsigned char >( key % 256 ) ^ bench->tailXors[ k ];
+    UInt64 stamp = key;
+
+    for( size_t i = 1; i < headerSize; ++i, stamp >>= 8 )
+    {
+        buf[ i ] = static_cast< unsigned char >( stamp );
+        x ^= buf[ i ];
+    }
+
+    buf[ 0 ] = x;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Closed-loop driver: keeps every connection busy till all ops are done.
+
+struct Run
+{
+    Run( Bench *_bench, size_t _objectSize, size_t _connectionCount, size_t _asyncManCount,
+        BenchResult *_result )
+        : bench( _bench )
+        , objectSize( _objectSize )
+        , connectionCount( _connectionCount )
+        , asyncManCount( _asyncManCount )
+        , opCount( 0 )
+        , next( 0 )
+        , reported( 0 )
+        , ops( _connectionCount )
+        , startTimes( _connectionCount )
+        , schedule( NULL )
+        , clock( true )
+        , result( _result )
+    {}
+
+    Bench          *bench;
+    size_t          objectSize;
+    size_t          connectionCount;
+    size_t          asyncManCount;
+    size_t          opCount;
+    size_t          next;
+    size_t          reported;
+
+    // The op and its start time for each connection.
+
+    std::vector< Op > ops;
+    std::vector< UInt64 > startTimes;  // in usecs since 'clock' started
+
+    // Scheduled start time of each op for open-loop runs (in usecs since
+    // 'clock' started), NULL if ops are scheduled at -rate.
+
+    const std::vector< double > *schedule;
+    Stopwatch       clock;
+
+    BenchResult    *result;
+};
+
+// Returns a description of the op number 'i' of the current run.
+
+typedef Op ( OpGenerator )( const Run &run, size_t i );
+
+static Op
+putOp( const Run &run, size_t i )
+{
+    Op op = { OP_PUT, run.bench->keyLow + i, 0, run.objectSize };
+    return op;
+}
+
+static Op
+getOp( const Run &run, size_t i )
+{
+    Op op = { OP_GET, run.bench->keyLow + i, 0, run.objectSize };
+    return op;
+}
+
+static Op
+mixedOp( const Run &run, size_t i )
+{
+    OpKind kind = benchRandom( run.bench ) * 100 < run.bench->options.readPercent ? OP_GET : OP_PUT;
+    Op op = { kind, run.bench->keyLow + i, 0, run.objectSize };
+    return op;
+}
+
+static size_t
+rangeSize( const Bench &bench, size_t objectSize, size_t connectionCount )
+{
+    size_t size = bench.options.rangeSize;
+
+    if( !size )
+    {
+        size = objectSize / bench.ranks / connectionCount;
+    }
+
+    return std::max( size, static_cast< size_t >( 1 ) );
+}
+
+static void
+rankShare( const Bench &bench, size_t objectSize, size_t *begin, size_t *end )
+{
+    // Each rank fetches its contiguous share of the object, the last one
+    // takes the remainder.
+
+    size_t share = objectSize / bench.ranks;
+
+    *begin = share * bench.rank;
+    *end = bench.rank + 1 == bench.ranks ? objectSize : *begin + share;
+}
+
+static Op
+rangeGetOp( const Run &run, size_t i )
+{
+    size_t begin = 0;
+    size_t end = 0;
+    rankShare( *run.bench, run.objectSize, &begin, &end );
+
+    size_t size = rangeSize( *run.bench, run.objectSize, run.connectionCount );
+    size_t offset = begin + i * size;
+
+    Op op = { OP_RANGE_GET, static_cast< size_t >( run.bench->options.rangeKey ), offset,
+        std::min( size, end - offset ) };
+    return op;
+}
+
+static size_t
+rangeGetOpCount( const Bench &bench, size_t objectSize, size_t connectionCount )
+{
+    size_t begin = 0;
+    size_t end = 0;
+    rankShare( bench, objectSize, &begin, &end );
+
+    size_t size = rangeSize( bench, objectSize, connectionCount );
+    return ( end - begin + size - 1 ) / size;
+}
+
+static void
+pendOp( Bench *bench, size_t k, AsyncMan *asyncMan, const Op &op, size_t objectSize )
+{
+    dbgAssert( bench );
+
+    const char *bucketName = bench->options.bucketName.c_str();
+    std::string key = getKey( bench->options.prefix, op.key, objectSize );
+
+    switch( op.kind )
+    {
+        case OP_PUT:
+            stampPayload( bench, k, op.key, op.size );
+            bench->cons[ k ]->pendPut( asyncMan, bucketName, key.c_str(), bench->bufs[ k ], op.size );
+            break;
+
+        case OP_GET:
+            bench->tailSizes[ k ] = 0;  // the download overwrites the payload
+            bench->cons[ k ]->pendGet( asyncMan, bucketName, key.c_str(), bench->bufs[ k ], op.size );
+            break;
+
+        case OP_RANGE_GET:
+            bench->tailSizes[ k ] = 0;
+            bench->cons[ k ]->pendGet( asyncMan, bucketName, key.c_str(), bench->bufs[ k ], op.size,
+                op.offset );
+            break;
+
+        case OP_DEL:
+            bench->cons[ k ]->pendDel( asyncMan, bucketName, key.c_str() );
+            break;
+    }
+}
+
+static bool
+completeOp( Run *run, size_t k )  // nofail
+{
+    dbgAssert( run );
+
+    Bench *bench = run->bench;
+    const Op &op = run->ops[ k ];
+
+    try
+    {
+        if( op.kind == OP_PUT )
+        {
+            bench->cons[ k ]->completePut();
+            return true;
+        }
+
+        if( op.kind == OP_DEL )
+        {
+            bench->cons[ k ]->completeDel();
+            return true;
+        }
+
+        S3GetResponse response;
+        bench->cons[ k ]->completeGet( &response );
+
+        if( response.loadedContentLength != op.size || response.isTruncated )
+        {
+            if( bench->options.verbose && run->reported < s_maxReportedErrors )
+            {
+                ++run->reported;
+                std::cerr << bench->rank << ": get failed for key " << op.key << ": ";
+
+                if( response.loadedContentLength == static_cast< size_t >( -1 ) )
+                {
+                    std::cerr << "object is missing" << std::endl;
+                }
+                else
+                {
+                    std::cerr << "loaded " << response.loadedContentLength << " bytes instead of "
+                        << op.size << std::endl;
+                }
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+    catch( ... )
+    {
+        reportError( *bench, op.kind == OP_PUT ? "put" : op.kind == OP_DEL ? "del" : "get", op,
+            &run->reported );
+    }
+
+    return false;
+}
+
+// Starts the op number 'i' on the connection 'k', its latency is measured
+// from 'startTime'. Returns false if the op could not be started.
+
+static bool
+pendAt( Run *run, OpGenerator *generator, size_t k, size_t i, UInt64 startTime )  // nofail
+{
+    dbgAssert( run );
+    dbgAssert( generator );
+
+    Op op = generator( *run, i );
+
+    try
+    {
+        run->ops[ k ] = op;
+        run->startTimes[ k ] = startTime;
+        pendOp( run->bench, k, run->bench->asyncMans[ i % run->asyncManCount ], op, run->objectSize );
+        return true;
+    }
+    catch( ... )
+    {
+        run->result->ops++;
+        run->result->errors++;
+        reportError( *run->bench, "pend", op, &run->reported );
+    }
+
+    return false;
+}
+
+// Starts the next op on the connection 'k', returns false if there are no more ops.
+
+static bool
+pendNext( Run *run, OpGenerator *generator, size_t k )  // nofail
+{
+    dbgAssert( run );
+
+    while( run->next < run->opCount )
+    {
+        if( pendAt( run, generator, k, run->next++, run->clock.elapsedUs() ) )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Completes the op pending on the connection 'k' and accounts for it.
+
+static void
+finishOp( Run *run, size_t k )  // nofail
+{
+    dbgAssert( run );
+
+    BenchResult *result = run->result;
+    result->ops++;
+
+    if( completeOp( run, k ) )
+    {
+        result->bytes += run->ops[ k ].size;
+        result->latencies.record( run->clock.elapsedUs() - run->startTimes[ k ] );
+    }
+    else
+    {
+        result->errors++;
+    }
+}
+
+static void
+runClosedLoop( Run *run, OpGenerator *generator )
+{
+    dbgAssert( run );
+    dbgAssert( generator );
+    dbgAssert( run->connectionCount <= run->bench->cons.size() );
+
+    // 'active' holds indices of connections with a pending request, 'cons'
+    // mirrors it for waitAny(..).
+
+    std::vector< size_t > active;
+    std::vector< S3Connection * > cons;
+
+    active.reserve( run->connectionCount );
+    cons.reserve( run->connectionCount );
+
+    Stopwatch stopwatch( true );
+
+    for( size_t k = 0; k < run->connectionCount; ++k )
+    {
+        if( pendNext( run, generator, k ) )
+        {
+            active.push_back( k );
+            cons.push_back( run->bench->cons[ k ] );
+        }
+    }
+
+    for( size_t round = 0; !active.empty(); ++round )
+    {
+        int w = S3Connection::waitAny( &cons[ 0 ], cons.size(), round % cons.size() );
+        dbgAssert( w >= 0 && static_cast< size_t >( w ) < active.size() );
+
+        size_t k = active[ w ];
+        finishOp( run, k );
+
+        if( !pendNext( run, generator, k ) )
+        {
+            // No more work for this connection, stop waiting on it.
+
+            active[ w ] = active.back();
+            active.pop_back();
+            cons[ w ] = cons.back();
+            cons.pop_back();
+        }
+    }
+
+    run->result->elapsed = stopwatch.elapsedUs();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Open-loop driver: issues ops on a schedule at the target rate regardless of
+// how fast they complete.
+//
+// A closed loop slows down together with the server and so hides the time
+// requests would have spent waiting (coordinated omission). Here each op has
+// an intended start time; if all connections are busy at that moment, the op
+// waits for one to free up and the wait is counted in its latency.
+
+// Returns the scheduled start time of the next op given the previous one, in
+// usecs since 'clock' started.
+
+static double
+nextDue( const Run &run, double due )
+{
+    if( run.schedule )
+    {
+        return run.next < run.schedule->size() ? ( *run.schedule )[ run.next ] : due;
+    }
+
+    const Options &options = run.bench->options;
+    double interval = 1000000.0 / options.rate;
+
+    if( options.schedule == "constant" )
+    {
+        return due + interval;
+    }
+
+    // Poisson arrivals: exponentially distributed inter-arrival times.
+
+    double u = 1 - benchRandom( run.bench );  // (0, 1]
+    return due - log( u ) * interval;
+}
+
+static void
+runOpenLoop( Run *run, OpGenerator *generator )
+{
+    dbgAssert( run );
+    dbgAssert( generator );
+    dbgAssert( run->connectionCount <= run->bench->cons.size() );
+    dbgAssert( run->bench->options.rate || run->schedule );
+    dbgAssert( !run->schedule || run->schedule->size() >= run->opCount );
+
+    // 'idle' holds indices of connections available for the next op, 'active'
+    // and 'cons' are the same as in runClosedLoop(..).
+
+    std::vector< size_t > idle;
+    std::vector< size_t > active;
+    std::vector< S3Connection * > cons;
+
+    idle.reserve( run->connectionCount );
+    active.reserve( run->connectionCount );
+    cons.reserve( run->connectionCount );
+
+    for( size_t k = run->connectionCount; k > 0; --k )
+    {
+        idle.push_back( k - 1 );
+    }
+
+    run->result->offeredRate = static_cast< double >( run->bench->options.rate );
+
+    if( run->schedule && run->opCount )
+    {
+        double span = ( *run->schedule )[ run->opCount - 1 ];
+        run->result->offeredRate = span > 0 ? run->opCount * 1000000.0 / span : 0;
+    }
+
+    run->clock.start();
+
+    // Scheduled start of the next op, in usecs since 'clock' started.
+
+    double due = run->schedule ? nextDue( *run, 0 ) : 0;
+
+    for( size_t round = 0; run->next < run->opCount || !active.empty(); ++round )
+    {
+        // Start all ops which are due, as long as there are idle connections.
+
+        UInt64 now = run->clock.elapsedUs();
+
+        while( run->next < run->opCount && due <= now && !idle.empty() )
+        {
+            size_t k = idle.back();
+            idle.pop_back();
+
+            if( pendAt( run, generator, k, run->next++, static_cast< UInt64 >( due ) ) )
+            {
+                active.push_back( k );
+                cons.push_back( run->bench->cons[ k ] );
+            }
+            else
+            {
+                idle.push_back( k );
+            }
+
+            due = nextDue( *run, due );
+        }
+
+        // Wait for a completion, but no longer than till the next op is due.
+        // If no connection is idle, the next op can only start after a completion.
+
+        long timeout = -1;
+
+        if( run->next < run->opCount && !idle.empty() )
+        {
+            now = run->clock.elapsedUs();
+            timeout = due > now ? static_cast< long >( ( due - now + 999 ) / 1000 ) : 0;
+        }
+
+        if( active.empty() )
+        {
+            dbgAssert( timeout >= 0 );
+            taskSleep( static_cast< UInt32 >( timeout ) );
+            continue;
+        }
+
+        int w = S3Connection::waitAny( &cons[ 0 ], cons.size(), round % cons.size(), timeout );
+
+        if( w < 0 )
+        {
+            continue;  // the next op is due
+        }
+
+        dbgAssert( static_cast< size_t >( w ) < active.size() );
+
+        size_t k = active[ w ];
+        finishOp( run, k );
+
+        active[ w ] = active.back();
+        active.pop_back();
+        cons[ w ] = cons.back();
+        cons.pop_back();
+        idle.push_back( k );
+    }
+
+    run->result->elapsed = run->clock.elapsedUs();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// 'list' command.
+
+static void
+runList( Bench *bench, BenchResult *result )
+{
+    dbgAssert( bench );
+    dbgAssert( result );
+
+    const Options &options = bench->options;
+    S3ListObjectsResponse response;
+    std::vector< S3Object > objects;
+    size_t reported = 0;
+
+    Stopwatch stopwatch( true );
+
+    do
+    {
+        objects.clear();
+        Stopwatch latency( true );
+        result->ops++;
+
+        try
+        {
+            bench->cons[ 0 ]->listObjects( options.bucketName.c_str(), options.prefix.c_str(),
+                response.nextMarker.c_str(), NULL, options.maxKeys, &objects, &response );
+        }
+        catch( ... )
+        {
+            Op op = { OP_GET, 0, 0, 0 };
+            result->errors++;
+            reportError( *bench, "list", op, &reported );
+            break;
+        }
+
+        result->latencies.record( latency.elapsedUs() );
+    }
+    while( response.isTruncated );
+
+    result->elapsed = stopwatch.elapsedUs();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// 'replay' command.
+//
+// Gets, range gets, puts and deletes of the trace are re-issued in the order
+// they started; lists and other requests are skipped. Ops of the same key go
+// to the same rank, so each key sees the original sequence of ops.
+
+struct TraceOrder
+{
+    bool operator()( const std::pair< UInt64, Op > &a, const std::pair< UInt64, Op > &b ) const
+    {
+        return a.first < b.first;
+    }
+};
+
+static void
+loadTrace( Bench *bench )
+{
+    dbgAssert( bench );
+
+    const Options &options = bench->options;
+    std::vector< std::pair< UInt64, Op > > ops;
+    std::vector< std::pair< size_t, size_t > > objects;  // key, size
+    S3TraceReader reader( options.traceFile.c_str() );
+    S3TraceRecord record;
+
+    while( reader.read( &record ) )
+    {
+        size_t key = static_cast< size_t >( record.keyHash );
+        size_t offset = static_cast< size_t >( record.offset );
+        size_t size = static_cast< size_t >( record.size );
+
+        if( key % bench->ranks != static_cast< size_t >( bench->rank ) )
+        {
+            continue;
+        }
+
+        Op op = { OP_GET, key, 0, size };
+
+        switch( record.op )
+        {
+            case S3_TRACE_OP_GET:
+                // A get of a whole object is replayed as a range get of its
+                // recorded size, which reads the same bytes.
+
+                op.kind = size ? OP_RANGE_GET : OP_GET;
+                op.offset = offset;
+                objects.push_back( std::make_pair( key, offset + size ) );
+                break;
+
+            case S3_TRACE_OP_PUT:
+                op.kind = OP_PUT;
+                break;
+
+            case S3_TRACE_OP_DEL:
+                op.kind = OP_DEL;
+                op.size = 0;
+                break;
+
+            default:
+                continue;
+        }
+
+        ops.push_back( std::make_pair( record.timestamp, op ) );
+        bench->bufSize = std::max( bench->bufSize, op.size );
+    }
+
+    // Records are written as requests complete, replay them in the order they started.
+
+    std::stable_sort( ops.begin(), ops.end(), TraceOrder() );
+
+    UInt64 start = ops.empty() ? 0 : ops.front().first;
+
+    for( size_t i = 0; i < ops.size(); ++i )
+    {
+        bench->traceOps.push_back( ops[ i ].second );
+        bench->traceSchedule.push_back( options.speed ? ( ops[ i ].first - start ) / options.speed : 0 );
+    }
+
+    // Each object read by the trace must be large enough for its largest read.
+
+    std::sort( objects.begin(), objects.end() );
+
+    for( size_t i = 0; i < objects.size(); ++i )
+    {
+        if( i + 1 < objects.size() && objects[ i + 1 ].first == objects[ i ].first )
+        {
+            continue;
+        }
+
+        Op op = { OP_PUT, objects[ i ].first, 0, objects[ i ].second };
+        bench->traceObjects.push_back( op );
+        bench->bufSize = std::max( bench->bufSize, op.size );
+    }
+}
+
+static Op
+traceOp( const Run &run, size_t i )
+{
+    return run.bench->traceOps[ i ];
+}
+
+static Op
+traceObjectOp( const Run &run, size_t i )
+{
+    return run.bench->traceObjects[ i ];
+}
+
+static void
+runReplay( Bench *bench, std::ostream &out )
+{
+    dbgAssert( bench );
+
+    const Options &options = bench->options;
+
+    if( options.prepare )
+    {
+        BenchResult result;
+        Run run( bench, 0, options.connectionCounts.back(), options.asyncManCounts.back(), &result );
+        run.opCount = bench->traceObjects.size();
+        runClosedLoop( &run, &traceObjectOp );
+
+        if( result.errors )
+        {
+            snprintf( s_errMsg, sizeof( s_errMsg ) - 1,
+                "%d: failed to upload %llu of %llu objects read by the trace.", bench->rank, static_cast< unsigned long long >( result.errors ),
+                static_cast< unsigned long long >( result.ops ) );
+            throw s_errMsg;
+        }
+    }
+
+    for( size_t a = 0; a < options.asyncManCounts.size(); ++a )
+    {
+        for( size_t c = 0; c < options.connectionCounts.size(); ++c )
+        {
+            BenchResult result;
+            result.command = options.command;
+            result.connections = options.connectionCounts[ c ];
+            result.asyncMans = options.asyncManCounts[ a ];
+            result.rank = bench->rank;
+            result.ranks = bench->ranks;
+
+            Run run( bench, 0, result.connections, result.asyncMans, &result );
+            run.opCount = bench->traceOps.size();
+            run.schedule = &bench->traceSchedule;
+
+            bench->team->barrier();
+
+            if( options.speed )
+            {
+                runOpenLoop( &run, &traceOp );
+            }
+            else
+            {
+                runClosedLoop( &run, &traceOp );
+            }
+
+            reportResult( *bench, out, result );
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Sweep driver.
+
+static void
+runSweep( Bench *bench, std::ostream &out )
+{
+    dbgAssert( bench );
+
+    const Options &options = bench->options;
+
+    // Split keys between ranks unless each rank is asked to access all of them.
+
+    bench->keyLow = options.keyLow;
+    bench->keyCount = options.keyHigh - options.keyLow;
+
+    if( !options.readAll && bench->ranks > 1 )
+    {
+        bench->keyCount /= bench->ranks;
+        bench->keyLow += bench->keyCount * bench->rank;
+    }
+
+    if( options.command == "list" )
+    {
+        BenchResult result;
+        result.command = options.command;
+        result.connections = 1;
+        result.rank = bench->rank;
+        result.ranks = bench->ranks;
+
+        bench->team->barrier();
+        runList( bench, &result );
+        reportResult( *bench, out, result );
+        return;
+    }
+
+    if( options.command == "replay" )
+    {
+        runReplay( bench, out );
+        return;
+    }
+
+    for( size_t a = 0; a < options.asyncManCounts.size(); ++a )
+    {
+        for( size_t s = 0; s < options.objectSizes.size(); ++s )
+        {
+            for( size_t c = 0; c < options.connectionCounts.size(); ++c )
+            {
+                size_t asyncManCount = options.asyncManCounts[ a ];
+                size_t objectSize = options.objectSizes[ s ];
+                size_t connectionCount = options.connectionCounts[ c ];
+
+                BenchResult result;
+                result.command = options.command;
+                result.objectSize = objectSize;
+                result.connections = connectionCount;
+                result.asyncMans = asyncManCount;
+                result.rank = bench->rank;
+                result.ranks = bench->ranks;
+
+                Run run( bench, objectSize, connectionCount, asyncManCount, &result );
+                OpGenerator *generator = NULL;
+                run.opCount = bench->keyCount;
+
+                if( options.command == "put" )
+                {
+                    generator = &putOp;
+                }
+                else if( options.command == "get" )
+                {
+                    generator = &getOp;
+                }
+                else if( options.command == "mixed" )
+                {
+                    generator = &mixedOp;
+                }
+                else
+                {
+                    dbgAssert( options.command == "range-get" );
+                    generator = &rangeGetOp;
+                    run.opCount = rangeGetOpCount( *bench, objectSize, connectionCount );
+                }
+
+                // Align the start of the run across ranks.
+
+                bench->team->barrier();
+
+                if( options.rate )
+                {
+                    runOpenLoop( &run, generator );
+                }
+                else
+                {
+                    runClosedLoop( &run, generator );
+                }
+
+                reportResult( *bench, out, result );
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Workers.
+
+struct Worker
+{
+    Worker()
+        : config( NULL )
+        , out( NULL )
+        , result( 0 )
+    {}
+
+    Bench           bench;
+    const S3Config *config;
+    std::ostream   *out;
+    TaskCtrl        task;
+    int             result;
+};
+
+static void
+runWorker( Worker *worker )  // nofail
+{
+    dbgAssert( worker );
+    dbgAssert( worker->config );
+    dbgAssert( worker->out );
+
+    Bench &bench = worker->bench;
+    const Options &options = bench.options;
+    std::auto_ptr< S3TraceRecorder > recorder;
+
+    try
+    {
+        // Allocate for the largest run of the sweep.
+
+        size_t maxConnections = *std::max_element( options.connectionCounts.begin(),
+            options.connectionCounts.end() );
+        size_t maxAsyncMans = *std::max_element( options.asyncManCounts.begin(),
+            options.asyncManCounts.end() );
+        bench.bufSize = 0;
+
+        if( options.command == "replay" )
+        {
+            loadTrace( &bench );
+        }
+
+        for( size_t s = 0; s < options.objectSizes.size(); ++s )
+        {
+            size_t size = options.objectSizes[ s ];
+
+            if( options.command == "range-get" )
+            {
+                for( size_t c = 0; c < options.connectionCounts.size(); ++c )
+                {
+                    bench.bufSize = std::max( bench.bufSize,
+                        std::min( size, rangeSize( bench, size, options.connectionCounts[ c ] ) ) );
+                }
+            }
+            else
+            {
+                bench.bufSize = std::max( bench.bufSize, size );
+            }
+        }
+
+        for( size_t i = 0; i < maxAsyncMans; ++i )
+        {
+            bench.asyncMans.push_back( new AsyncMan() );
+
+            if( options.adaptive )
+            {
+                AsyncConcurrencyPolicy policy;
+                bench.asyncMans.back()->setConcurrencyPolicy( &policy );
+            }
+        }
+
+        if( !options.recordFile.empty() )
+        {
+            std::string fileName = options.recordFile;
+
+            if( bench.ranks > 1 )
+            {
+                std::stringstream suffix;
+                suffix << '.' << bench.rank;
+                fileName += suffix.str();
+            }
+
+            recorder.reset( new S3TraceRecorder( fileName.c_str() ) );
+        }
+
+        for( size_t i = 0; i < maxConnections; ++i )
+        {
+            bench.cons.push_back( new S3Connection( *worker->config ) );
+            bench.cons.back()->setTraceRecorder( recorder.get() );
+            bench.bufs.push_back( bench.bufSize ? new unsigned char[ bench.bufSize ] : NULL );
+            bench.tailSizes.push_back( 0 );
+            bench.tailXors.push_back( 0 );
+
+            if( bench.bufSize )
+            {
+                fillRandom( bench.bufs.back(), bench.bufSize, bench.rank * maxConnections + i + 1 );
+            }
+        }
+
+        bench.randomState = ( bench.rank + 1 ) * 0x9E3779B97F4A7C15ULL | 1;
+
+        runSweep( &bench, *worker->out );
+    }
+    catch( const std::exception &e )
+    {
+        std::cerr << e.what() << std::endl;
+        worker->result = 1;
+    }
+    catch( const char *s )
+    {
+        std::cerr << s << std::endl;
+        worker->result = 1;
+    }
+    catch( ... )
+    {
+        std::cerr << "Unknown error" << std::endl;
+        worker->result = 1;
+    }
+
+    for( size_t i = 0; i < bench.cons.size(); ++i )
+    {
+        delete bench.cons[ i ];
+        delete[] bench.bufs[ i ];
+    }
+
+    for( size_t i = 0; i < bench.asyncMans.size(); ++i )
+    {
+        delete bench.asyncMans[ i ];
+    }
+
+    bench.cons.clear();
+    bench.bufs.clear();
+    bench.asyncMans.clear();
+
+    // Other ranks would wait for this one at the next collective operation.
+
+    if( worker->result && bench.ranks > 1 )
+    {
+        bench.team->abort();
+    }
+}
+
+static TaskResult TASKAPI
+workerTask( void *arg )
+{
+    dbgAssert( arg );
+    runWorker( static_cast< Worker * >( arg ) );
+    return 0;
+}
+
+int
+main( int argc, char **argv )
+{
+    int process = 0;
+    int processes = 1;
+
+#ifdef USE_MPI
+    // Workers call MPI one at a time, see Team.
+
+    int threadSupport = MPI_THREAD_SINGLE;
+    MPI_Init_thread( &argc, &argv, MPI_THREAD_SERIALIZED, &threadSupport );
+    MPI_Comm_rank( MPI_COMM_WORLD, &process );
+    MPI_Comm_size( MPI_COMM_WORLD, &processes );
+#endif
+
+    Options options;
+    std::vector< Worker * > workers;
+    int result = 0;
+
+    try
+    {
+        readEnvVars( &options );
+        parseCommandLine( argc, argv, &options );
+
+        if( options.showUsage || argc <= 1 )
+        {
+            usage();
+        }
+        else
+        {
+            checkOptions( &options );
+
+#ifdef USE_MPI
+            if( options.workers > 1 && processes > 1 && threadSupport < MPI_THREAD_SERIALIZED )
+            {
+                throw "MPI library doesn't support threads, use '-w 1' or more processes instead.";
+            }
+#endif
+
+            bool isWalrus = !options.host.empty() && !strstr( options.host.c_str(), "amazonaws.com" );
+
+            S3Config config = {};
+            config.accKey = options.accKey.c_str();
+            config.secKey = options.secKey.c_str();
+            config.host = options.host.c_str();
+            config.isWalrus = isWalrus;
+            config.isHttps = isWalrus ? false : options.isHttps;
+            config.port = options.port.c_str();
+            config.proxy = options.proxy.c_str();
+
+            std::ofstream outFile;
+
+            if( !options.outFile.empty() )
+            {
+                outFile.open( options.outFile.c_str(), std::ofstream::out | std::ofstream::app );
+
+                if( !outFile )
+                {
+                    snprintf( s_errMsg, sizeof( s_errMsg ) - 1, "Cannot open '%s'.", options.outFile.c_str() );
+                    throw s_errMsg;
+                }
+            }
+
+            if( !options.eventTraceFile.empty() )
+            {
+                std::string fileName = options.eventTraceFile;
+
+                if( processes > 1 )
+                {
+                    std::stringstream suffix;
+                    suffix << '.' << process;
+                    fileName += suffix.str();
+                }
+
+                startEventTrace( fileName.c_str() );
+            }
+
+            Team team( process, processes, options.workers );
+
+            for( size_t w = 0; w < options.workers; ++w )
+            {
+                workers.push_back( new Worker() );
+
+                Worker *worker = workers.back();
+                worker->bench.options = options;
+                worker->bench.rank = team.rank( w );
+                worker->bench.ranks = team.ranks();
+                worker->bench.team = &team;
+                worker->config = &config;
+                worker->out = options.outFile.empty() ? &std::cout : &outFile;
+            }
+
+            // The first worker runs on the main thread.
+
+            try
+            {
+                for( size_t w = 1; w < workers.size(); ++w )
+                {
+                    taskStartAsync( &workerTask, workers[ w ], &workers[ w ]->task );
+                }
+            }
+            catch( const std::exception &e )
+            {
+                // Started workers would wait for the others forever.
+
+                std::cerr << e.what() << std::endl;
+                team.abort();
+            }
+
+            runWorker( workers[ 0 ] );
+
+            for( size_t w = 0; w < workers.size(); ++w )
+            {
+                workers[ w ]->task.wait();
+                result |= workers[ w ]->result;
+            }
+
+            stopEventTrace();  // nofail
+        }
+    }
+    catch( const std::exception &e )
+    {
+        std::cerr << e.what() << std::endl;
+        result = 1;
+    }
+    catch( const char *s )
+    {
+        std::cerr << s << std::endl;
+        result = 1;
+    }
+    catch( ... )
+    {
+        std::cerr << "Unknown error" << std::endl;
+        result = 1;
+    }
+
+    for( size_t w = 0; w < workers.size(); ++w )
+    {
+        delete workers[ w ];
+    }
+
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
+
+    return result;
+}
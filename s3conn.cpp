@@ -22,6 +22,7 @@
 //////////////////////////////////////////////////////////////////////////////
 
 #include "s3conn.h"
+#include "evtrace.h"
 #include "sysutils.h"
 
 #define NOMINMAX
@@ -49,9 +50,12 @@ const static char errCurl[] = "%s.";
 const static char errHTTP[] = "%s.";
 const static char errHTTPResourceNotFound[] = "HTTP resource not found: %s."; 
 const static char errParser[] = "Cannot parse the response.";
+const static char errFirstByteTimeout[] = "Transfer stalled: no response within %ld ms.";
 const static char errAWS[] = "%s (Code='%s', RequestId='%s')."; 
 const static char errS3Summary[] = "S3 %s for '%s' failed. %s";
 const static char errTooManyConnetions[] = "Too many connections passed to waitAny method.";
+const static char errTraceOpen[] = "Cannot open trace file '%s'.";
+const static char errTraceFormat[] = "'%s' is not a trace file.";
 
 //////////////////////////////////////////////////////////////////////////////
 // S3 statics.
@@ -90,6 +94,12 @@ static const TcpKeepAliveParams s_tcpKeepAliveProbes =
 
 static const UInt32 s_socketBufferSize = 1024 * 1024;  // 1MB
 
+// Slow request traces are buffered in chunks of s_slowTraceChunkSize up to
+// s_maxSlowTraceSize per request.
+
+static const size_t s_slowTraceChunkSize = 4 * 1024;    // 4KB
+static const size_t s_maxSlowTraceSize = 16 * 1024;     // 16KB
+
 //////////////////////////////////////////////////////////////////////////////
 // String conversion functions. 
 
@@ -605,18 +615,31 @@ struct S3GetResponseBufferLoader : public S3GetResponseLoader
                     S3GetResponseBufferLoader( void *buffer, size_t size );
 
     size_t          onLoad( const void *chunkData, size_t chunkSize, size_t totalSizeHint ) ;
+    bool            onRewind();
 
     void           *p;
     size_t          left;
+    void           *buffer;
+    size_t          size;
 };
 
 S3GetResponseBufferLoader::S3GetResponseBufferLoader( void *buffer, size_t size )
     : p( buffer )
     , left( size )
+    , buffer( buffer )
+    , size( size )
 {
     dbgAssert( implies( size,  buffer ) );
 }
 
+bool
+S3GetResponseBufferLoader::onRewind()
+{
+    p = buffer;
+    left = size;
+    return true;
+}
+
 size_t 
 S3GetResponseBufferLoader::onLoad( const void *chunkData, size_t chunkSize, size_t totalSizeHint ) 
 {
@@ -645,6 +668,7 @@ struct S3PutRequestBufferUploader : public S3PutRequestUploader
 
     void            setUpload( const void *_buffer, size_t _size );
     virtual size_t  onUpload( void *chunkBuf, size_t chunkSize );
+    virtual bool    onRewind() { offset = 0; return true; }
 
     const void *    buffer;
     size_t          size;
@@ -730,6 +754,10 @@ struct S3ResponseDetails
     // Length of the loaded content (in case of Get response)
 
     size_t          loadedContentLength;
+
+    // Transfer timing.
+
+    S3RequestStats  stats;
 };
 
 S3ResponseDetails::S3ResponseDetails()
@@ -753,6 +781,70 @@ protected:
     std::vector< char > m_msg;
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Transfer timing.
+
+static unsigned long long
+getInfoUsecs( CURL *curl, CURLINFO info )  // nofail
+{
+    double secs = 0;
+    curl_easy_getinfo( curl, info, &secs );
+    return static_cast< unsigned long long >( secs * 1000000 + 0.5 );
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073700
+
+// Sizes and speeds are curl_off_t since curl 7.55.0.
+
+static double
+getInfoNumber( CURL *curl, CURLINFO info )  // nofail
+{
+    curl_off_t value = 0;
+    curl_easy_getinfo( curl, info, &value );
+    return static_cast< double >( value );
+}
+
+#define CURLINFO_STATS( name ) CURLINFO_ ## name ## _T
+
+#else
+
+static double
+getInfoNumber( CURL *curl, CURLINFO info )  // nofail
+{
+    double value = 0;
+    curl_easy_getinfo( curl, info, &value );
+    return value;
+}
+
+#define CURLINFO_STATS( name ) CURLINFO_ ## name
+
+#endif
+
+static void
+getRequestStats( CURL *curl, S3RequestStats *stats /* out */ )  // nofail
+{
+    dbgAssert( curl );
+    dbgAssert( stats );
+
+    stats->nameLookupTime = getInfoUsecs( curl, CURLINFO_NAMELOOKUP_TIME );
+    stats->connectTime = getInfoUsecs( curl, CURLINFO_CONNECT_TIME );
+    stats->appConnectTime = getInfoUsecs( curl, CURLINFO_APPCONNECT_TIME );
+    stats->preTransferTime = getInfoUsecs( curl, CURLINFO_PRETRANSFER_TIME );
+    stats->startTransferTime = getInfoUsecs( curl, CURLINFO_STARTTRANSFER_TIME );
+    stats->totalTime = getInfoUsecs( curl, CURLINFO_TOTAL_TIME );
+    stats->bytesUploaded = static_cast< unsigned long long >( getInfoNumber( curl, CURLINFO_STATS( SIZE_UPLOAD ) ) );
+    stats->bytesDownloaded = static_cast< unsigned long long >( getInfoNumber( curl, CURLINFO_STATS( SIZE_DOWNLOAD ) ) );
+    stats->uploadSpeed = getInfoNumber( curl, CURLINFO_STATS( SPEED_UPLOAD ) );
+    stats->downloadSpeed = getInfoNumber( curl, CURLINFO_STATS( SPEED_DOWNLOAD ) );
+
+    // NUM_CONNECTS counts new connections the request had to open, it is 0
+    // for a failed connect too, so require that the request has been sent.
+
+    long connects = 0;
+    curl_easy_getinfo( curl, CURLINFO_NUM_CONNECTS, &connects );
+    stats->connectionReused = connects == 0 && stats->preTransferTime;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Base request handling.
 
@@ -975,9 +1067,57 @@ public:
 
     const char *    httpVerb() { return onHttpVerb(); }
 
+    // Indicates if the response status line has been received, can be
+    // polled while the request is in progress.
+
+    bool            hasFirstByte() const { return m_firstByte; }
+
     ScopedCurlList  headers;
+
+    // Request tracing, the request is recorded when it completes.
+
+    void            startTrace( S3TraceRecorder *recorder, const char *bucketName, const char *key,
+                        size_t low, size_t high );  // nofail
+
+    // Slow request tracing, the buffered trace is passed to the callback when
+    // the request completes if it is slow or failed. Async requests claim
+    // the buffer from the budget of their AsyncMan.
+
+    void            startSlowTrace( TraceCallback *callback, void *cookie, long latencyThreshold );
+    void            setSlowTraceBudget( MemoryBudget *budget ) { m_slowTraceBudget = budget; }
+
+    // Rate limits of async requests, the callbacks pause the transfer when
+    // the AsyncMan's limits are exceeded.
+
+    void            setRateLimited( bool rateLimited ) { m_rateLimited = rateLimited; }
+
+    // Stall detection, the low-speed limit is enforced by curl, the
+    // first-byte deadline is checked by the progress callback.
+
+    void            startStallCheck( long firstByteTimeout, bool lowSpeedCheck, long timeout, 
+                        bool *stalled /* out */ );
+
+    // Interval of the progress checks of an async request, in msecs (see
+    // AsyncCurl::pendOp(..)): a quarter of the first-byte deadline, at most
+    // a second, 0 if there is no deadline.
+
+    UInt32          progressInterval() const;  // nofail
+
+    // Retries of transient failures, see S3RetryPolicy. Async requests pass
+    // handleRetry(..) to the AsyncLoop, sync ones retry in execute().
+
+    void            startRetries( const S3RetryPolicy *policy, unsigned int *retries /* out */ );
+    AsyncRetryCallback *retryCallback() const { return m_retryPolicy ? handleRetry : NULL; }
+
+    // Connects to the address assigned by the S3EndpointSet and reports the
+    // outcome to it when the request completes.
+
+    void            startEndpoint( CURL *curl, EndpointState *endpoints, UInt64 endpointId,
+                        const char *connectTo );
+
 protected:
-    
+    friend class internal::S3HotPaths;
+
     // Override in derived class if you need to customize response payload parsing for
     // a specific S3 operation.
 
@@ -991,6 +1131,11 @@ protected:
     virtual void    onPrepare( CURL *curl );
     virtual const char *onHttpVerb() = 0;
 
+    // Override to replay the request body or discard the delivered response
+    // before a retry, return false if it's not possible.
+
+    virtual bool    onRewind() { return !m_delivered && !m_uploadedLength; }
+
 protected:
     void            throwXmlParserError() { throw S3Exception( errParser ); }
 
@@ -1018,6 +1163,29 @@ private:
     void            setXmlValueImpl( const xmlChar *value, int len );
     void            endXmlElementImpl( );
 
+    void            recordTrace();  // nofail
+    void            recordEndpoint();  // nofail
+
+    static int      handleSlowTrace( CURL *curl, curl_infotype type, char *data, size_t size,
+                        void *ctx );  // nofail
+    void            handleSlowTrace_( curl_infotype type, const char *data, size_t size );  // nofail
+    void            emitSlowTrace();  // nofail
+    void            releaseSlowTrace();  // nofail
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+    static int      handleProgress( void *ctx, curl_off_t dlTotal, curl_off_t dlNow, 
+                        curl_off_t ulTotal, curl_off_t ulNow );  // nofail
+#else
+    static int      handleProgress( void *ctx, double dlTotal, double dlNow, 
+                        double ulTotal, double ulNow );  // nofail
+#endif
+    bool            handleProgress_( bool hasBody );  // nofail
+    void            checkStalled( CURLcode curlCode );
+
+    static long     handleRetry( void *ctx, int curlCode );  // nofail
+    long            handleRetry_( CURLcode curlCode );  // nofail
+    void            resetForRetry();  // nofail
+
 protected:
 
     // Xml parser and its state.
@@ -1030,6 +1198,49 @@ protected:
     // Request response.
 
     S3ResponseDetails  m_responseDetails;
+
+    // Tracing.
+
+    S3TraceRecorder *m_traceRecorder;
+    S3TraceRecord   m_traceRecord;
+    size_t          m_uploadedLength;
+
+    TraceCallback * m_slowTraceCallback;
+    void *          m_slowTraceCookie;
+    UInt64          m_slowTraceThreshold;   // in usecs
+    MemoryBudget *  m_slowTraceBudget;
+    std::string     m_slowTrace;            // records: type, UInt32 size, data
+    size_t          m_slowTraceClaimed;
+    size_t          m_slowTraceDropped;
+
+    // Stall detection.
+
+    long            m_firstByteTimeout;     // in milliseconds
+    bool            m_firstByteExpired;
+    bool            m_lowSpeedCheck;
+    long            m_timeout;              // in milliseconds
+    bool *          m_stalled;              // the connection's flag, see getLastRequestStats(..)
+
+    volatile bool   m_firstByte;
+
+    // Indicates if a part of the response has been passed to the loader or
+    // the parser of a successful response, so a retry has to rewind it.
+
+    bool            m_delivered;
+
+    bool            m_rateLimited;
+
+    // Retries.
+
+    const S3RetryPolicy *m_retryPolicy;
+    unsigned int    m_attempts;             // retries made so far
+    unsigned int *  m_retries;              // the connection's counter, see getLastRequestStats(..)
+
+    // Endpoint addresses.
+
+    EndpointState * m_endpoints;
+    UInt64          m_endpointId;
+    ScopedCurlList  m_connectTo;
 };
 
 static bool 
@@ -1116,10 +1327,37 @@ startsWith( const char *p, size_t size, const char *prefix, size_t prefixLen,
     return size >= prefixLen && !strncmp( p, prefix, prefixLen );
 }
 
+static size_t   
+writeNoop( const void *chunkData, size_t count, size_t elementSize, void *ctx ) // nofail
+{ 
+    return count * elementSize; 
+}
+
 S3Request::S3Request( const char *name )
     : m_responseDetails()
     , m_ctx( NULL )
     , m_stackTop( 0 )
+    , m_traceRecorder( NULL )
+    , m_uploadedLength( 0 )
+    , m_slowTraceCallback( NULL )
+    , m_slowTraceCookie( NULL )
+    , m_slowTraceThreshold( 0 )
+    , m_slowTraceBudget( NULL )
+    , m_slowTraceClaimed( 0 )
+    , m_slowTraceDropped( 0 )
+    , m_firstByteTimeout( 0 )
+    , m_firstByteExpired( false )
+    , m_lowSpeedCheck( false )
+    , m_timeout( 0 )
+    , m_stalled( NULL )
+    , m_firstByte( false )
+    , m_delivered( false )
+    , m_rateLimited( false )
+    , m_retryPolicy( NULL )
+    , m_attempts( 0 )
+    , m_retries( NULL )
+    , m_endpoints( NULL )
+    , m_endpointId( 0 )
 {
     if( name )
     {
@@ -1153,6 +1391,10 @@ S3Request::~S3Request()
     // Free the parser.
 
     xmlFreeParserCtxt ( m_ctx );  // it handles nulls.
+
+    // Canceled requests still hold their traces.
+
+    releaseSlowTrace();  // nofail
 }
 
 S3ResponseDetails &
@@ -1161,6 +1403,14 @@ S3Request::execute()
     dbgAssert( !m_responseDetails.url.empty() ); 
 
     CURLcode curlCode = curl_easy_perform( m_curl ); 
+    long delay = 0;
+
+    while( m_retryPolicy && ( delay = handleRetry_( curlCode ) ) >= 0 )
+    {
+        taskSleep( static_cast< UInt32 >( delay ) );
+        curlCode = curl_easy_perform( m_curl );
+    }
+
     return complete( curlCode );
 }
 
@@ -1168,6 +1418,9 @@ S3ResponseDetails &
 S3Request::complete( CURLcode curlCode )
 {
     saveIfCurlError( curlCode );
+    getRequestStats( m_curl, &m_responseDetails.stats );
+    m_responseDetails.stats.retries = m_attempts;
+    checkStalled( curlCode );
 
     if( m_ctx )
     {
@@ -1182,131 +1435,611 @@ S3Request::complete( CURLcode curlCode )
         m_ctx = NULL;
     }
 
+    if( m_traceRecorder )
+    {
+        recordTrace();
+    }
+
+    if( m_endpoints )
+    {
+        recordEndpoint();
+    }
+
+    if( m_slowTraceCallback )
+    {
+        emitSlowTrace();
+        releaseSlowTrace();
+    }
+
     raiseIfError();
 
     return m_responseDetails;
 }
 
-size_t
-S3Request::handleHeader( const void *headerData, size_t count, 
-    size_t elementSize, void *ctx ) // nofail
+static S3TraceOp
+traceOp( const char *httpVerb, const char *key )
 {
-    S3Request *state = static_cast< S3Request * >( ctx );
-    return state->handleHeader_( headerData, count, elementSize ); // nofail
+    dbgAssert( httpVerb );
+
+    bool hasKey = key && *key;
+
+    if( !strcmp( httpVerb, "GET" ) )
+    {
+        return hasKey ? S3_TRACE_OP_GET : S3_TRACE_OP_LIST;
+    }
+    else if( !strcmp( httpVerb, "PUT" ) && hasKey )
+    {
+        return S3_TRACE_OP_PUT;
+    }
+    else if( !strcmp( httpVerb, "DELETE" ) && hasKey )
+    {
+        return S3_TRACE_OP_DEL;
+    }
+
+    return S3_TRACE_OP_OTHER;
 }
 
-size_t
-S3Request::handleXmlPayload( const void *chunkData, size_t count,
-    size_t elementSize, void *ctx ) // nofail
+void
+S3Request::startTrace( S3TraceRecorder *recorder, const char *bucketName, const char *key,
+    size_t low, size_t high )  // nofail
 {
-    S3Request *state = static_cast< S3Request * >( ctx );
-    return state->handleXmlPayload_( chunkData, count, elementSize ); // nofail
+    dbgAssert( recorder );
+
+    m_traceRecorder = recorder;
+    memset( &m_traceRecord, 0, sizeof( m_traceRecord ) );
+
+    // The request name is the original key (or prefix), 'key' is escaped.
+
+    m_traceRecord.timestamp = recorder->now();
+    m_traceRecord.op = traceOp( httpVerb(), key );
+    m_traceRecord.keyHash = S3TraceRecorder::hash( name() );
+    m_traceRecord.bucketHash = static_cast< unsigned int >( S3TraceRecorder::hash( bucketName ) );
+
+    if( low < high )
+    {
+        m_traceRecord.offset = low;
+        m_traceRecord.size = high - low;
+    }
 }
 
-size_t
-S3Request::handleBinaryLoad( const void *chunkData, size_t count, 
-    size_t elementSize, void *ctx ) // nofail
+void
+S3Request::recordTrace()  // nofail
 {
-    S3Request *state = static_cast< S3Request * >( ctx );
-    return state->handleBinaryLoad_( chunkData, count, elementSize ); // nofail
+    dbgAssert( m_traceRecorder );
+
+    m_traceRecord.latency = m_traceRecorder->now() - m_traceRecord.timestamp;
+    m_traceRecord.failed = hasError() || m_responseDetails.status != S3_RESPONSE_STATUS_SUCCESS;
+
+    if( m_traceRecord.op == S3_TRACE_OP_PUT )
+    {
+        m_traceRecord.size = m_uploadedLength;
+    }
+    else if( !m_traceRecord.size && m_responseDetails.loadedContentLength != static_cast< size_t >( -1 ) )
+    {
+        // Not a range request.
+
+        m_traceRecord.size = m_responseDetails.loadedContentLength;
+    }
+
+    m_traceRecorder->record( m_traceRecord );
 }
 
-size_t
-S3Request::handleBinaryUpload( void *chunkBuf, size_t count, 
-    size_t elementSize, void *ctx ) // nofail
+void
+S3Request::startStallCheck( long firstByteTimeout, bool lowSpeedCheck, long timeout, 
+    bool *stalled /* out */ )
 {
-    S3Request *state = static_cast< S3Request * >( ctx );
-    return state->handleBinaryUpload_( chunkBuf, count, elementSize ); // nofail
+    dbgAssert( m_curl );
+    dbgAssert( stalled );
+
+    m_firstByteTimeout = firstByteTimeout;
+    m_lowSpeedCheck = lowSpeedCheck;
+    m_timeout = timeout;
+    m_stalled = stalled;
+    *m_stalled = false;
+
+    if( firstByteTimeout > 0 )
+    {
+        // Curl calls the progress callback of a sync request at least every
+        // second, the loop of an async one calls it as often as
+        // progressInterval() asks.
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+        curl_easy_setopt_checked( m_curl, CURLOPT_XFERINFOFUNCTION, handleProgress );
+        curl_easy_setopt_checked( m_curl, CURLOPT_XFERINFODATA, this );
+#else
+        curl_easy_setopt_checked( m_curl, CURLOPT_PROGRESSFUNCTION, handleProgress );
+        curl_easy_setopt_checked( m_curl, CURLOPT_PROGRESSDATA, this );
+#endif
+        curl_easy_setopt_checked( m_curl, CURLOPT_NOPROGRESS, 0L );
+    }
 }
 
-size_t
-S3Request::handleHeader_( const void *headerData, 
-    size_t count, size_t memberSize ) // nofail
+UInt32
+S3Request::progressInterval() const  // nofail
 {
-    try
+    if( m_firstByteTimeout <= 0 )
     {
-        const char *p = static_cast< const char * >( headerData );
-        size_t size = count * memberSize;
-        size_t originalSize = size;
+        return 0;
+    }
 
-        // Trim spaces and line-breaks from the start.
+    return static_cast< UInt32 >( std::min( std::max( m_firstByteTimeout / 4, 1L ), 1000L ) );
+}
 
-        while( size && ( *p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' ) ) { ++p; --size; }
+#if LIBCURL_VERSION_NUM >= 0x072000
+int
+S3Request::handleProgress( void *ctx, curl_off_t dlTotal, curl_off_t dlNow, 
+    curl_off_t ulTotal, curl_off_t ulNow )  // nofail
+#else
+int
+S3Request::handleProgress( void *ctx, double dlTotal, double dlNow, 
+    double ulTotal, double ulNow )  // nofail
+#endif
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleProgress_( ulTotal > 0 ) ? 0 : 1;  // nofail
+}
 
-        if( !size )
-        {
-            return originalSize;
-        } 
+bool
+S3Request::handleProgress_( bool hasBody )  // nofail
+{
+    // Returns false to abort the transfer.
 
-        const char *p1 = &p[ size - 1 ];
-        while( size && ( *p1 == ' ' || *p1 == '\n' || *p1 == '\r' || *p1 == '\t' ) ) { --p1; --size; }
+    if( !m_responseDetails.httpStatus.empty() )
+    {
+        return true;
+    }
 
-        if( !size )
-        {
-            return originalSize;
-        } 
+    // The server answers only after it has read the whole body ('Expect' is
+    // disabled), which may be long after curl has sent it into socket
+    // buffers, so only bodyless requests have a first-byte deadline.
 
-        // Parse the current header.
+    if( hasBody )
+    {
+        return true;
+    }
 
-        size_t prefixLen = 0;
+    if( getInfoUsecs( m_curl, CURLINFO_TOTAL_TIME ) >= m_firstByteTimeout * 1000ULL )
+    {
+        m_firstByteExpired = true;
+        return false;
+    }
 
-        if( startsWith( p, size, STRING_WITH_LEN( "HTTP" ), &prefixLen ) )
-        {
-            // Got HTTP response header.
-            // Find and skip spaces.
+    return true;
+}
 
-            p += prefixLen;
-            size -= prefixLen;
-            while( size && *p != ' ' ) { ++p; --size; }
-            while( size && *p == ' ' ) { ++p; --size; }
+void
+S3Request::checkStalled( CURLcode curlCode )
+{
+    S3RequestStats &stats = m_responseDetails.stats;
 
-            m_responseDetails.httpStatus.assign( p, size );
+    if( curlCode == CURLE_ABORTED_BY_CALLBACK && m_firstByteExpired )
+    {
+        // Replace curl's "Callback aborted".
 
-            if( startsWith( p, size, STRING_WITH_LEN( "200 OK" ) ) || 
-                startsWith( p, size, STRING_WITH_LEN( "206 Partial Content" ) ) || 
-                startsWith( p, size, STRING_WITH_LEN( "204 No Content" ) ) ) 
-            {
-                m_responseDetails.status = S3_RESPONSE_STATUS_SUCCESS;
-            }
-            else if( startsWith( p, size, STRING_WITH_LEN( "404 Not" ) ) )
-            {
-                // AWS/Walrus services may return 404 if the resource is not found with xml
-                // body containing more details about the error. So we may retrieve more details
-                // about this case and this error may be promoted to
-                // S3_RESPONSE_STATUS_FAILURE_WITH_DETAILS later.
+        stats.stalled = true;
+        m_error.reset( new S3Exception( errFirstByteTimeout, m_firstByteTimeout ) );
+    }
+    else if( curlCode == CURLE_OPERATION_TIMEDOUT && m_lowSpeedCheck )
+    {
+        // Curl reports the low-speed limit as a timeout too, tell it from
+        // the connect and the overall timeouts (if there is one).
 
-                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_RESOURSE_NOT_FOUND;
-            } 
-            else if( startsWith( p, size, STRING_WITH_LEN( "301 Moved" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "400 Bad" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "403 Forbidden" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "409 Conflict" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "500 Internal" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "503 Service" ) ) ||
-                startsWith( p, size, STRING_WITH_LEN( "503 Slow" ) ) )
-            {
-                // Try to read detailed error info from the payload.
-                // This error may be promoted to
-                // S3_RESPONSE_STATUS_FAILURE_WITH_DETAILS later.
+        stats.stalled = stats.preTransferTime && 
+            ( m_timeout <= 0 || stats.totalTime < m_timeout * 1000ULL );
+    }
 
-                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_OR_AWS_FAILURE;
-            } 
-            else
-            {
-                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_FAILURE;
-            }
+    if( m_stalled )
+    {
+        *m_stalled = stats.stalled;
+    }
+}
 
-            // Set up the corresponding body loader.
+void
+S3Request::startRetries( const S3RetryPolicy *policy, unsigned int *retries /* out */ )
+{
+    dbgAssert( policy );
+    dbgAssert( retries );
 
-            setPayloadHandler();
-        }
-        else if( startsWith( p, size, STRING_WITH_LEN( "ETag: \""), &prefixLen ) )
-        {
-            // Amazon returns "ETag" header with quotes.
+    m_retryPolicy = policy;
+    m_retries = retries;
+    *m_retries = 0;
+}
 
-            size -= prefixLen;
-            size -= ( size > 0 ); // trim the last '"'
-            m_responseDetails.etag.assign( p + prefixLen, size ); 
+void
+S3Request::startEndpoint( CURL *curl, EndpointState *endpoints, UInt64 endpointId,
+    const char *connectTo )
+{
+    dbgAssert( curl );
+    dbgAssert( endpoints );
+    dbgAssert( endpointId );
+    dbgAssert( connectTo );
+
+#if LIBCURL_VERSION_NUM >= 0x073100
+    curl_slist *const list = curl_slist_append( NULL, connectTo );
+
+    if( !list )
+        throw std::bad_alloc();
+
+    m_connectTo.reset( list );
+    curl_easy_setopt_checked( curl, CURLOPT_CONNECT_TO, list );
+
+    m_endpoints = endpoints;
+    m_endpointId = endpointId;
+#endif
+}
+
+long
+S3Request::handleRetry( void *ctx, int curlCode )  // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleRetry_( static_cast< CURLcode >( curlCode ) );  // nofail
+}
+
+long
+S3Request::handleRetry_( CURLcode curlCode )  // nofail
+{
+    // Returns the delay before the next attempt in milliseconds, or -1 to
+    // complete the request.
+
+    dbgAssert( m_retryPolicy );
+
+    if( m_attempts + 1 >= m_retryPolicy->maxAttempts || hasError() )
+    {
+        return -1;
+    }
+
+    long httpCode = 0;
+    curl_easy_getinfo( m_curl, CURLINFO_RESPONSE_CODE, &httpCode );
+
+    bool idempotent = strcmp( httpVerb(), "POST" ) != 0;
+    bool transient = false;
+
+    switch( curlCode )
+    {
+        case CURLE_OK:
+            // Throttled requests are rejected before they are processed.
+
+            transient = httpCode == 503 || ( httpCode == 500 && idempotent );
+            break;
+
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+            // The request hasn't been sent.
+
+            transient = true;
+            break;
+
+        case CURLE_PARTIAL_FILE:
+        case CURLE_GOT_NOTHING:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_OPERATION_TIMEDOUT:
+            transient = idempotent;
+            break;
+
+        case CURLE_ABORTED_BY_CALLBACK:
+            transient = idempotent && m_firstByteExpired;
+            break;
+
+        default:
+            break;
+    }
+
+    if( !transient || !onRewind() )
+    {
+        return -1;
+    }
+
+    resetForRetry();  // nofail
+    ++m_attempts;
+
+    if( m_retries )
+    {
+        *m_retries = m_attempts;
+    }
+
+    // Exponential backoff with "equal jitter": half of the delay is random.
+
+    UInt64 delay = std::min( static_cast< UInt64 >( m_retryPolicy->baseDelay ) << std::min( m_attempts - 1, 20u ),
+        static_cast< UInt64 >( m_retryPolicy->maxDelay ) );
+    UInt64 random = ( timeNowNs() ^ ( UInt64 )this ) * 0x9E3779B97F4A7C15ULL;
+
+    return static_cast< long >( delay - delay / 2 + ( random >> 32 ) % ( delay / 2 + 1 ) );
+}
+
+void
+S3Request::resetForRetry()  // nofail
+{
+    // Drop the response of the failed attempt, keep the request.
+
+    xmlFreeParserCtxt( m_ctx );  // it handles nulls.
+    m_ctx = NULL;
+    m_stackTop = 0;
+
+    m_responseDetails.status = S3_RESPONSE_STATUS_UNEXPECTED;
+    m_responseDetails.httpStatus.clear();
+    m_responseDetails.httpDate.clear();
+    m_responseDetails.httpContentLength = -1;
+    m_responseDetails.httpContentType.clear();
+    m_responseDetails.amazonId.clear();
+    m_responseDetails.requestId.clear();
+    m_responseDetails.etag.clear();
+    m_responseDetails.errorCode.clear();
+    m_responseDetails.errorMessage.clear();
+    m_responseDetails.hostId.clear();
+    m_responseDetails.isTruncated = false;
+    m_responseDetails.uploadId.clear();
+    m_responseDetails.loadedContentLength = 0;
+
+    m_uploadedLength = 0;
+    m_delivered = false;
+    m_firstByte = false;
+    m_firstByteExpired = false;
+
+    // The payload handler is set by the status line of the next response.
+
+    curl_easy_setopt_checked( m_curl, CURLOPT_WRITEFUNCTION, writeNoop );
+}
+
+void
+S3Request::startSlowTrace( TraceCallback *callback, void *cookie, long latencyThreshold )
+{
+    dbgAssert( callback );
+    dbgAssert( m_curl );
+
+    m_slowTraceCallback = callback;
+    m_slowTraceCookie = cookie;
+    m_slowTraceThreshold = latencyThreshold > 0 ? latencyThreshold * 1000ULL : 0;
+
+    curl_easy_setopt_checked( m_curl, CURLOPT_DEBUGFUNCTION, handleSlowTrace );
+    curl_easy_setopt_checked( m_curl, CURLOPT_DEBUGDATA, this );
+    curl_easy_setopt_checked( m_curl, CURLOPT_VERBOSE, 1L );
+}
+
+int
+S3Request::handleSlowTrace( CURL *curl, curl_infotype type, char *data, size_t size, 
+    void *ctx )  // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    state->handleSlowTrace_( type, data, size );  // nofail
+    return 0;
+}
+
+void
+S3Request::handleSlowTrace_( curl_infotype type, const char *data, size_t size )  // nofail
+{
+    // Keep the trace cheap: only headers and curl messages are buffered, the
+    // buffer is claimed in chunks and never grows beyond the claim.
+
+    if( type != CURLINFO_TEXT && type != CURLINFO_HEADER_IN && type != CURLINFO_HEADER_OUT )
+    {
+        return;
+    }
+
+    size_t recordSize = 1 + sizeof( UInt32 ) + size;
+    size_t needed = m_slowTrace.size() + recordSize;
+
+    if( needed > m_slowTraceClaimed )
+    {
+        size_t claim = ( needed - m_slowTraceClaimed + s_slowTraceChunkSize - 1 ) / 
+            s_slowTraceChunkSize * s_slowTraceChunkSize;
+
+        if( m_slowTraceClaimed + claim > s_maxSlowTraceSize ||
+            ( m_slowTraceBudget && !m_slowTraceBudget->claim( claim ) ) )
+        {
+            m_slowTraceDropped += size;
+            return;
+        }
+
+        m_slowTraceClaimed += claim;
+
+        try
+        {
+            m_slowTrace.reserve( m_slowTraceClaimed );
+        }
+        catch( ... )
+        {
+            m_slowTraceDropped += size;
+            return;
+        }
+    }
+
+    UInt32 size32 = static_cast< UInt32 >( size );
+
+    m_slowTrace.append( 1, static_cast< char >( type ) );
+    m_slowTrace.append( reinterpret_cast< const char * >( &size32 ), sizeof( size32 ) );
+    m_slowTrace.append( data, size );
+}
+
+void
+S3Request::emitSlowTrace()  // nofail
+{
+    dbgAssert( m_slowTraceCallback );
+
+    // A missing object is an expected outcome of get (see completeGet(..)),
+    // not a failure.
+
+    const char *errorCode = m_responseDetails.errorCode.c_str();
+    bool missing = m_responseDetails.status == S3_RESPONSE_STATUS_HTTP_RESOURSE_NOT_FOUND ||
+        ( m_responseDetails.status == S3_RESPONSE_STATUS_FAILURE_WITH_DETAILS &&
+        ( !strcmp( errorCode, "NoSuchKey" ) || !strcmp( errorCode, "NoSuchEntity" ) ) );
+    bool failed = hasError() || ( m_responseDetails.status != S3_RESPONSE_STATUS_SUCCESS && !missing );
+    UInt64 latency = m_responseDetails.stats.totalTime;
+
+    if( !failed && latency < m_slowTraceThreshold )
+    {
+        return;
+    }
+
+    char text[ 128 ];
+    int len = snprintf( text, sizeof( text ), "%s request took %llu.%03llu ms\n",
+        failed ? "Failed" : "Slow", latency / 1000, latency % 1000 );
+    m_slowTraceCallback( m_curl, S3_TRACE_INFO_TEXT, reinterpret_cast< unsigned char * >( text ), 
+        len, m_slowTraceCookie );
+
+    for( size_t i = 0; i < m_slowTrace.size(); )
+    {
+        TraceInfo type = static_cast< TraceInfo >( m_slowTrace[ i ] );
+        UInt32 size = 0;
+        memcpy( &size, &m_slowTrace[ i + 1 ], sizeof( size ) );
+        i += 1 + sizeof( size );
+
+        m_slowTraceCallback( m_curl, type, reinterpret_cast< unsigned char * >( &m_slowTrace[ i ] ), 
+            size, m_slowTraceCookie );
+        i += size;
+    }
+
+    if( m_slowTraceDropped )
+    {
+        len = snprintf( text, sizeof( text ), "%llu bytes of the trace dropped\n", 
+            static_cast< UInt64 >( m_slowTraceDropped ) );
+        m_slowTraceCallback( m_curl, S3_TRACE_INFO_TEXT, reinterpret_cast< unsigned char * >( text ), 
+            len, m_slowTraceCookie );
+    }
+}
+
+void
+S3Request::releaseSlowTrace()  // nofail
+{
+    if( m_slowTraceBudget && m_slowTraceClaimed )
+    {
+        m_slowTraceBudget->release( m_slowTraceClaimed );
+    }
+
+    m_slowTraceClaimed = 0;
+    m_slowTraceDropped = 0;
+    std::string().swap( m_slowTrace );
+}
+
+size_t
+S3Request::handleHeader( const void *headerData, size_t count, 
+    size_t elementSize, void *ctx ) // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleHeader_( headerData, count, elementSize ); // nofail
+}
+
+size_t
+S3Request::handleXmlPayload( const void *chunkData, size_t count,
+    size_t elementSize, void *ctx ) // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleXmlPayload_( chunkData, count, elementSize ); // nofail
+}
+
+size_t
+S3Request::handleBinaryLoad( const void *chunkData, size_t count, 
+    size_t elementSize, void *ctx ) // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleBinaryLoad_( chunkData, count, elementSize ); // nofail
+}
+
+size_t
+S3Request::handleBinaryUpload( void *chunkBuf, size_t count, 
+    size_t elementSize, void *ctx ) // nofail
+{
+    S3Request *state = static_cast< S3Request * >( ctx );
+    return state->handleBinaryUpload_( chunkBuf, count, elementSize ); // nofail
+}
+
+size_t
+S3Request::handleHeader_( const void *headerData, 
+    size_t count, size_t memberSize ) // nofail
+{
+    try
+    {
+        const char *p = static_cast< const char * >( headerData );
+        size_t size = count * memberSize;
+        size_t originalSize = size;
+
+        // Trim spaces and line-breaks from the start.
+
+        while( size && ( *p == ' ' || *p == '\n' || *p == '\r' || *p == '\t' ) ) { ++p; --size; }
+
+        if( !size )
+        {
+            return originalSize;
+        } 
+
+        const char *p1 = &p[ size - 1 ];
+        while( size && ( *p1 == ' ' || *p1 == '\n' || *p1 == '\r' || *p1 == '\t' ) ) { --p1; --size; }
+
+        if( !size )
+        {
+            return originalSize;
+        } 
+
+        // Parse the current header.
+
+        size_t prefixLen = 0;
+
+        if( startsWith( p, size, STRING_WITH_LEN( "HTTP" ), &prefixLen ) )
+        {
+            // Got HTTP response header.
+
+            if( m_responseDetails.httpStatus.empty() )
+            {
+                evTrace( EVT_FIRST_BYTE, m_curl );  // nofail
+                m_firstByte = true;
+            }
+
+            // Find and skip spaces.
+
+            p += prefixLen;
+            size -= prefixLen;
+            while( size && *p != ' ' ) { ++p; --size; }
+            while( size && *p == ' ' ) { ++p; --size; }
+
+            m_responseDetails.httpStatus.assign( p, size );
+
+            if( startsWith( p, size, STRING_WITH_LEN( "200 OK" ) ) || 
+                startsWith( p, size, STRING_WITH_LEN( "206 Partial Content" ) ) || 
+                startsWith( p, size, STRING_WITH_LEN( "204 No Content" ) ) ) 
+            {
+                m_responseDetails.status = S3_RESPONSE_STATUS_SUCCESS;
+            }
+            else if( startsWith( p, size, STRING_WITH_LEN( "404 Not" ) ) )
+            {
+                // AWS/Walrus services may return 404 if the resource is not found with xml
+                // body containing more details about the error. So we may retrieve more details
+                // about this case and this error may be promoted to
+                // S3_RESPONSE_STATUS_FAILURE_WITH_DETAILS later.
+
+                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_RESOURSE_NOT_FOUND;
+            } 
+            else if( startsWith( p, size, STRING_WITH_LEN( "301 Moved" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "400 Bad" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "403 Forbidden" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "409 Conflict" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "500 Internal" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "503 Service" ) ) ||
+                startsWith( p, size, STRING_WITH_LEN( "503 Slow" ) ) )
+            {
+                // Try to read detailed error info from the payload.
+                // This error may be promoted to
+                // S3_RESPONSE_STATUS_FAILURE_WITH_DETAILS later.
+
+                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_OR_AWS_FAILURE;
+            } 
+            else
+            {
+                m_responseDetails.status = S3_RESPONSE_STATUS_HTTP_FAILURE;
+            }
+
+            // Set up the corresponding body loader.
+
+            setPayloadHandler();
+        }
+        else if( startsWith( p, size, STRING_WITH_LEN( "ETag: \""), &prefixLen ) )
+        {
+            // Amazon returns "ETag" header with quotes.
+
+            size -= prefixLen;
+            size -= ( size > 0 ); // trim the last '"'
+            m_responseDetails.etag.assign( p + prefixLen, size ); 
         }
         else if( startsWith( p, size, STRING_WITH_LEN( "ETag: "), &prefixLen ) )
         {
@@ -1390,6 +2123,7 @@ S3Request::handleXmlPayload_( const void *chunkData, size_t count, size_t member
 
         // Parse the current chunk.
         size_t size = count * memberSize;
+        m_delivered = m_delivered || m_responseDetails.status == S3_RESPONSE_STATUS_SUCCESS;
         xmlParseChunk( m_ctx, static_cast< const char * >( chunkData ), size, 0 );
 
         return size;
@@ -1412,6 +2146,13 @@ S3Request::handleBinaryLoad_( const void *chunkData, size_t count,
     size_t loaded = 0;
     size_t chunkSize = count * elementSize;
 
+    // Curl passes the chunk again when the loop resumes the transfer.
+
+    if( m_rateLimited && !passDownload( m_curl, chunkSize ) )
+    {
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
     try
     {
         loaded = onLoadBinary( chunkData, chunkSize, 
@@ -1419,6 +2160,7 @@ S3Request::handleBinaryLoad_( const void *chunkData, size_t count,
 
         dbgAssert( loaded <= chunkSize );
         m_responseDetails.loadedContentLength += loaded;
+        m_delivered = m_delivered || loaded;
     }
     catch( ... )
     {
@@ -1442,15 +2184,28 @@ S3Request::handleBinaryUpload_( void *chunkBuf, size_t count,
     size_t uploaded = 0;
     size_t chunkSize = count * elementSize;
 
+    // Curl asks for the chunk again when the loop resumes the transfer.
+
+    if( m_rateLimited && !passUpload( m_curl ) )
+    {
+        return CURL_READFUNC_PAUSE;
+    }
+
     try
     {
         uploaded = onUploadBinary( chunkBuf, chunkSize );
+        m_uploadedLength += uploaded;
     }
     catch( ... )
     {
         saveError();
     }
 
+    if( m_rateLimited )
+    {
+        chargeUpload( m_curl, uploaded );  // nofail
+    }
+
     return uploaded;
 }
 
@@ -1582,6 +2337,7 @@ private:
     virtual size_t  onLoadBinary( const void *chunkData, size_t chunkSize, size_t totalSizeHint );
     virtual void    onPrepare( CURL *curl );
     virtual const char *onHttpVerb() { return "GET"; }
+    virtual bool    onRewind() { return !m_delivered || m_loader->onRewind(); }
 
     S3GetResponseBufferLoader m_builtinLoader;
     S3GetResponseLoader *m_loader;
@@ -1630,6 +2386,7 @@ private:
     virtual size_t  onUploadBinary( void *chunkBuf, size_t chunkSize );
     virtual void    onPrepare( CURL *curl );
     virtual const char *onHttpVerb() { return "PUT"; }
+    virtual bool    onRewind() { return !m_delivered && ( !m_uploadedLength || m_uploader->onRewind() ); }
 
     S3PutRequestBufferUploader m_builtinUploader;
     S3PutRequestUploader *m_uploader;
@@ -2003,6 +2760,7 @@ private:
     virtual size_t  onUploadBinary( void *chunkBuf, size_t chunkSize );
     virtual void    onPrepare( CURL *curl );
     virtual const char *onHttpVerb() { return "POST"; }
+    virtual bool    onRewind() { return !m_delivered && m_builtinUploader.onRewind(); }
 
     S3PutRequestBufferUploader m_builtinUploader;
 };
@@ -2228,25 +2986,229 @@ throwSummary( const char *op, const char *key )
 }
 
 //////////////////////////////////////////////////////////////////////////////
-// S3Connection.
+// Hedging state.
 
-S3Connection::S3Connection( const S3Config &config )
-    : m_accKey( config.accKey )
-    , m_secKey( config.secKey )
-    , m_baseUrl()
-    , m_proxy( config.proxy ? config.proxy : "" )
+namespace internal
+{
+
+// Shared state of S3HedgePolicy. The delay is recomputed every
+// c_delayUpdate samples, the histogram is restarted every c_window samples
+// so that the delay follows changes of the latency.
+
+class HedgeState
+{
+public:
+    enum { c_delayUpdate = 64, c_window = 4096 };
+
+                    HedgeState( double percentile, double maxHedgePercent );
+
+    UInt64          delay();  // nofail, in usecs, 0 if not sampled yet
+    bool            claimHedge();  // nofail, false if over the budget
+    void            record( UInt64 firstByteTime, bool hedgeWon );  // nofail
+    void            getStats( S3HedgeStats *stats );  // nofail
+
+private:
+    ExLockSync      m_lock;
+    LatencyHistogram m_firstByteTimes;  // in usecs
+    double          m_percentile;
+    double          m_maxHedgePercent;
+    UInt64          m_delay;
+    S3HedgeStats    m_stats;
+};
+
+HedgeState::HedgeState( double percentile, double maxHedgePercent )
+    : m_lock( "S3HedgePolicy" )
+    , m_percentile( percentile )
+    , m_maxHedgePercent( maxHedgePercent )
+    , m_delay( 0 )
+{
+}
+
+UInt64
+HedgeState::delay()  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    return m_delay;
+}
+
+bool
+HedgeState::claimHedge()  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    if( ( m_stats.hedges + 1 ) * 100.0 > m_stats.gets * m_maxHedgePercent )
+    {
+        return false;
+    }
+
+    m_stats.hedges++;
+    return true;
+}
+
+void
+HedgeState::record( UInt64 firstByteTime, bool hedgeWon )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    m_stats.gets++;
+    m_stats.hedgesWon += hedgeWon;
+
+    if( !firstByteTime )
+    {
+        // Failed before the first byte.
+
+        return;
+    }
+
+    m_firstByteTimes.record( firstByteTime );
+
+    if( m_firstByteTimes.count() % c_delayUpdate == 0 )
+    {
+        m_delay = m_firstByteTimes.percentile( m_percentile );
+
+        if( m_firstByteTimes.count() >= c_window )
+        {
+            m_firstByteTimes.reset();
+        }
+    }
+}
+
+void
+HedgeState::getStats( S3HedgeStats *stats )  // nofail
+{
+    dbgAssert( stats );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    *stats = m_stats;
+    stats->delay = m_delay;
+}
+
+// The get pended by S3Connection with hedging enabled, kept to issue its
+// duplicate.
+
+class HedgeGet
+{
+public:
+                    HedgeGet() : pending( false ), asyncMan( NULL ), buffer( NULL ), size( 0 ), offset( 0 ),
+                        hedgeStart( 0 ) {}
+
+    bool            pending;
+    AsyncMan *      asyncMan;
+    std::string     bucketName;
+    std::string     key;
+    void *          buffer;
+    size_t          size;
+    size_t          offset;
+    Stopwatch       clock;
+    UInt64          hedgeStart;  // in usecs on 'clock'
+    std::vector< char > hedgeBuffer;
+};
+
+// The addresses of an S3EndpointSet, with their health and latency.
+
+class EndpointState
+{
+public:
+                    EndpointState( const char *host, unsigned int refreshInterval );
+    explicit        EndpointState( const std::vector< std::string > &addresses );  // fixed, for tests
+                    ~EndpointState();
+
+    void            resolve();
+
+    // <b>now</b> is in msecs, see timeElapsed().
+
+    UInt64          assign( UInt64 endpointId, UInt64 now, std::string *connectTo /* out */ );
+    void            release( UInt64 endpointId );  // nofail
+    void            record( UInt64 endpointId, bool failed, UInt64 firstByteTime, UInt64 now );  // nofail
+    void            getStats( std::vector< S3EndpointStats > *stats );
+
+private:
+    struct Endpoint
+    {
+                    Endpoint() : id( 0 ), connections( 0 ), requests( 0 ), failures( 0 ), latency( 0 ),
+                        samples( 0 ), failuresInRow( 0 ), avoidUntil( 0 ), dropped( false ) {}
+
+        UInt64      id;
+        std::string address;
+        size_t      connections;
+        UInt64      requests;
+        UInt64      failures;
+        double      latency;        // in usecs
+        UInt64      samples;
+        unsigned int failuresInRow;
+        UInt64      avoidUntil;     // in msecs, see timeElapsed()
+        bool        dropped;        // not returned by DNS anymore
+    };
+
+                    EndpointState( const EndpointState & );  // forbidden
+    EndpointState & operator=( const EndpointState & );  // forbidden
+
+    static TaskResult TASKAPI resolveTask( void *arg );
+    void            update( const std::vector< std::string > &addresses );
+    static bool     isBetter( const Endpoint &endpoint, const Endpoint &other,
+                        const Endpoint *current );  // nofail
+    Endpoint *      find( UInt64 endpointId );  // nofail
+    void            expire( UInt64 now );  // nofail
+    void            avoid( Endpoint *endpoint, UInt64 now );  // nofail
+    void            checkSlow( Endpoint *endpoint, UInt64 now );  // nofail
+
+    std::string     m_host;
+    unsigned int    m_refreshInterval;  // in msecs
+    ExLockSync      m_lock;
+    std::vector< Endpoint > m_endpoints;
+    UInt64          m_nextId;
+    EventSync       m_stop;
+    TaskCtrl        m_resolveTaskCtrl;
+};
+
+}  // namespace internal
+
+//////////////////////////////////////////////////////////////////////////////
+// S3Connection.
+
+S3Connection::S3Connection( const S3Config &config )
+    : m_accKey( config.accKey )
+    , m_secKey( config.secKey )
+    , m_baseUrl()
+    , m_proxy( config.proxy ? config.proxy : "" )
     , m_isWalrus( config.isWalrus )
     , m_isHttps( config.isHttps )
     , m_sslCertFile( config.sslCertFile ? config.sslCertFile : "" )
     , m_traceCallback( NULL )
+    , m_traceRecorder( NULL )
+    , m_slowTraceCallback( NULL )
+    , m_slowTraceThreshold( 0 )
     , m_asyncRequest( NULL )
+    , m_hedgePolicy( NULL )
+    , m_hedgeConnection( NULL )
+    , m_hedgeAsyncMan( NULL )
+    , m_hedgeGet( NULL )
+    , m_endpoints( NULL )
+    , m_endpointId( 0 )
     , m_timeout( s_defaultTimeout )      
     , m_connectTimeout( s_defaultConnectTimeout )
+    , m_firstByteTimeout( 0 )
+    , m_deadline( 0 )
+    , m_priority( ASYNC_PRIORITY_NORMAL )
+    , m_lowSpeedLimit( 0 )
+    , m_lowSpeedTime( 0 )
+    , m_lastRequestStalled( false )
+    , m_lastRequestRetries( 0 )
 {
     CASSERT( dimensionOf( m_errorBuffer ) >= CURL_ERROR_SIZE );
 
     memset( m_errorBuffer, 0, sizeof( m_errorBuffer ) );
 
+    // No retries by default.
+
+    m_retryPolicy.maxAttempts = 1;
+
     // Construct a base url for all subsequent requests.
 
     m_baseUrl = config.isHttps ? "https://" : "http://";
@@ -2296,6 +3258,12 @@ S3Connection::S3Connection( const S3Config &config )
 S3Connection::~S3Connection()
 {
     cancelAsync();  // nofail
+    delete m_hedgeGet;
+
+    if( m_endpoints )
+    {
+        m_endpoints->state()->release( m_endpointId );  // nofail
+    }
 }
 
 void
@@ -2307,6 +3275,17 @@ S3Connection::cancelAsync()  // nofail
     m_curl.cancelOp();  // nofail
 }
 
+void
+S3Connection::getLastRequestStats( S3RequestStats *stats /* out */ )  // nofail
+{
+    dbgAssert( stats );
+    dbgAssert( !m_asyncRequest || m_curl.isOpCompleted() );
+
+    getRequestStats( m_curl, stats );
+    stats->stalled = m_lastRequestStalled;
+    stats->retries = m_lastRequestRetries;
+}
+
 bool
 S3Connection::isAsyncPending()
 {
@@ -2384,12 +3363,6 @@ onSocketOpen( void *, curlsocktype, curl_sockaddr *addr )
     return sockfd;
 }
 
-static size_t   
-writeNoop( const void *chunkData, size_t count, size_t elementSize, void *ctx ) // nofail
-{ 
-    return count * elementSize; 
-}
-
 void
 S3Connection::prepare( S3Request *request, const char *bucketName, const char *key,
         const char *contentType, bool makePublic, bool useSrvEncrypt, size_t low, size_t high)
@@ -2422,6 +3395,12 @@ S3Connection::prepare( S3Request *request, const char *bucketName, const char *k
     curl_easy_setopt_checked( m_curl, CURLOPT_TIMEOUT_MS, m_timeout );
     curl_easy_setopt_checked( m_curl, CURLOPT_CONNECTTIMEOUT_MS, m_connectTimeout );
 
+    if( m_lowSpeedLimit > 0 && m_lowSpeedTime > 0 )
+    {
+        curl_easy_setopt_checked( m_curl, CURLOPT_LOW_SPEED_LIMIT, m_lowSpeedLimit );
+        curl_easy_setopt_checked( m_curl, CURLOPT_LOW_SPEED_TIME, m_lowSpeedTime );
+    }
+
     // Disable signal usage by libcurl. 
     // Libcurl uses signals to interrupt slow dns resolver by calling alarm(),
     // unfortunately that logic is not reliable and causes "longjmp causes uninitialized stack frame",
@@ -2491,6 +3470,48 @@ S3Connection::prepare( S3Request *request, const char *bucketName, const char *k
     // Prepare the response handler.
 
     request->prepare( m_curl, m_errorBuffer, sizeof( m_errorBuffer ) );
+
+    if( m_endpoints && m_proxy.empty() )
+    {
+        std::string connectTo;
+        m_endpointId = m_endpoints->state()->assign( m_endpointId, timeElapsed(), &connectTo );
+
+        if( m_endpointId )
+        {
+            request->startEndpoint( m_curl, m_endpoints->state(), m_endpointId, connectTo.c_str() );
+        }
+    }
+
+    if( m_traceRecorder )
+    {
+        request->startTrace( m_traceRecorder, bucketName, key, low, high );
+    }
+
+    if( m_firstByteTimeout > 0 || m_lowSpeedLimit > 0 )
+    {
+        request->startStallCheck( m_firstByteTimeout, m_lowSpeedLimit > 0 && m_lowSpeedTime > 0, 
+            m_timeout, &m_lastRequestStalled );
+    }
+    else
+    {
+        m_lastRequestStalled = false;
+    }
+
+    if( m_retryPolicy.maxAttempts > 1 )
+    {
+        request->startRetries( &m_retryPolicy, &m_lastRequestRetries );
+    }
+    else
+    {
+        m_lastRequestRetries = 0;
+    }
+
+    // Full tracing takes precedence.
+
+    if( m_slowTraceCallback && !m_traceCallback )
+    {
+        request->startSlowTrace( m_slowTraceCallback, this, m_slowTraceThreshold );
+    }
 }
 
 void
@@ -2601,6 +3622,7 @@ completePut( S3ResponseDetails &responseDetails, S3PutResponse *response )
     if( response )
     {
         response->etag.swap( responseDetails.etag );
+        response->stats = responseDetails.stats;
     }
 }
 
@@ -2710,7 +3732,10 @@ S3Connection::pendPut( AsyncMan *asyncMan, const char *bucketName,
 
         // Start async.
 
-        m_curl.pendOp( asyncMan );
+        request->setSlowTraceBudget( asyncMan->slowTraceBudget() );
+        request->setRateLimited( asyncMan->isRateLimited() );
+        m_curl.pendOp( asyncMan, request->retryCallback(), request.get(), pendDeadline(),
+            m_priority, request->progressInterval() );
         m_asyncRequest = request.release(); // nofail
     }
     catch( ... )
@@ -2776,6 +3801,7 @@ completeGet( S3ResponseDetails &responseDetails, S3GetResponse *response )
         response->loadedContentLength = responseDetails.loadedContentLength;
         response->isTruncated = responseDetails.isTruncated;
         response->etag.swap( responseDetails.etag );
+        response->stats = responseDetails.stats;
     }
 }
 
@@ -2820,6 +3846,15 @@ S3Connection::get( const char *bucketName, const char *key, void *buffer, size_t
     dbgAssert( key );
     dbgAssert( implies( size, buffer ) );
 
+    if( m_hedgePolicy && m_hedgeAsyncMan )
+    {
+        // Run as an async get, so that completeGet(..) can hedge it.
+
+        pendGet( m_hedgeAsyncMan, bucketName, key, buffer, size );
+        completeGet( response );
+        return;
+    }
+
     S3GetResponseBufferLoader loader( buffer, size );
     get( bucketName, key, &loader, response );
 }
@@ -2852,7 +3887,16 @@ S3Connection::pendGet( AsyncMan *asyncMan, const char *bucketName, const char *k
 
         // Start async.
 
-        m_curl.pendOp( asyncMan );
+        request->setSlowTraceBudget( asyncMan->slowTraceBudget() );
+        request->setRateLimited( asyncMan->isRateLimited() );
+
+        if( m_hedgePolicy )
+        {
+            startHedgedGet( asyncMan, bucketName, key, buffer, size, offset );
+        }
+
+        m_curl.pendOp( asyncMan, request->retryCallback(), request.get(), pendDeadline(),
+            m_priority, request->progressInterval() );
         m_asyncRequest = request.release(); // nofail
     }
     catch( ... )
@@ -2871,6 +3915,14 @@ S3Connection::completeGet( S3GetResponse *response )
 
     LOG_TRACE( "enter completeGet: conn=0x%llx", ( UInt64 )this );
 
+    if( m_hedgeGet && m_hedgeGet->pending )
+    {
+        completeHedgedGet( response );
+
+        LOG_TRACE( "leave completeGet: conn=0x%llx", ( UInt64 )this );
+        return;
+    }
+
     // Make sure that async operation is completed no matter what happens below.
 
     std::auto_ptr< S3Request > request( m_asyncRequest );
@@ -3029,6 +4081,11 @@ completeDel( S3ResponseDetails &responseDetails, S3DelResponse *response )
     }
 
     handleErrors( responseDetails );
+
+    if( response )
+    {
+        response->stats = responseDetails.stats;
+    }
 }
 
 void
@@ -3090,7 +4147,10 @@ S3Connection::pendDel( AsyncMan *asyncMan, const char *bucketName, const char *k
 
         // Start async.
 
-        m_curl.pendOp( asyncMan );
+        request->setSlowTraceBudget( asyncMan->slowTraceBudget() );
+        request->setRateLimited( asyncMan->isRateLimited() );
+        m_curl.pendOp( asyncMan, request->retryCallback(), request.get(), pendDeadline(),
+            m_priority, request->progressInterval() );
         m_asyncRequest = request.release(); // nofail
     }
     catch( ... )
@@ -3530,6 +4590,1388 @@ S3Connection::setConnectTimeout( long connectTime )
     m_connectTimeout = connectTime;
 }
 
+void
+S3Connection::setLowSpeedLimit( long bytesPerSec, long seconds )
+{
+    m_lowSpeedLimit = bytesPerSec;
+    m_lowSpeedTime = seconds;
+}
+
+void
+S3Connection::setFirstByteTimeout( long firstByteTimeout )
+{
+    m_firstByteTimeout = firstByteTimeout;
+}
+
+void
+S3Connection::setDeadline( long deadline )
+{
+    m_deadline = deadline;
+}
+
+void
+S3Connection::setPriority( AsyncPriority priority )
+{
+    dbgAssert( priority >= 0 && priority < ASYNC_PRIORITY_END );
+    m_priority = priority;
+}
+
+UInt64
+S3Connection::pendDeadline() const  // nofail
+{
+    return m_deadline > 0 ? timeElapsedUs() + m_deadline * 1000ULL : 0;
+}
+
+void
+S3Connection::setRetryPolicy( const S3RetryPolicy *policy )
+{
+    m_retryPolicy = policy ? *policy : S3RetryPolicy();
+
+    if( !policy )
+    {
+        m_retryPolicy.maxAttempts = 1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Hedging.
+
+S3HedgePolicy::S3HedgePolicy( double percentile, double maxHedgePercent )
+    : m_state( new HedgeState( percentile, maxHedgePercent ) )
+{
+}
+
+S3HedgePolicy::~S3HedgePolicy()
+{
+    delete m_state;
+}
+
+void
+S3HedgePolicy::getStats( S3HedgeStats *stats /* out */ ) const  // nofail
+{
+    m_state->getStats( stats );  // nofail
+}
+
+void
+S3Connection::setHedging( S3HedgePolicy *policy, S3Connection *hedgeConnection, AsyncMan *asyncMan )
+{
+    dbgAssert( implies( policy, hedgeConnection && hedgeConnection != this ) );
+    dbgAssert( !m_asyncRequest );
+
+    m_hedgePolicy = policy;
+    m_hedgeConnection = hedgeConnection;
+    m_hedgeAsyncMan = asyncMan;
+}
+
+void
+S3Connection::startHedgedGet( AsyncMan *asyncMan, const char *bucketName, const char *key,
+    void *buffer, size_t size, size_t offset )
+{
+    dbgAssert( m_hedgePolicy );
+
+    if( !m_hedgeGet )
+    {
+        m_hedgeGet = new HedgeGet;
+    }
+
+    m_hedgeGet->pending = false;
+    m_hedgeGet->asyncMan = asyncMan;
+    m_hedgeGet->bucketName.assign( bucketName );
+    m_hedgeGet->key.assign( key );
+    m_hedgeGet->buffer = buffer;
+    m_hedgeGet->size = size;
+    m_hedgeGet->offset = offset;
+    m_hedgeGet->clock.start();
+    m_hedgeGet->pending = true;
+}
+
+void
+S3Connection::completeHedgedGet( S3GetResponse *response )
+{
+    dbgAssert( m_asyncRequest );
+    dbgAssert( m_hedgeGet && m_hedgeGet->pending );
+    dbgAssert( m_hedgeConnection && !m_hedgeConnection->isAsyncPending() );
+
+    HedgeGet &get = *m_hedgeGet;
+    HedgeState *state = m_hedgePolicy->state();
+    get.pending = false;
+
+    // Wait for the first byte till the hedge delay expires.
+
+    UInt64 delay = state->delay();
+    bool hedged = false;
+
+    if( delay )
+    {
+        UInt64 elapsed = get.clock.elapsedUs();
+
+        if( elapsed < delay )
+        {
+            m_curl.completedEvent()->wait( static_cast< UInt32 >( ( delay - elapsed + 999 ) / 1000 ) );
+        }
+
+        if( !m_curl.isOpCompleted() && !m_asyncRequest->hasFirstByte() && state->claimHedge() )
+        {
+            try
+            {
+                get.hedgeBuffer.resize( get.size );
+                get.hedgeStart = get.clock.elapsedUs();
+                m_hedgeConnection->pendGet( get.asyncMan, get.bucketName.c_str(), get.key.c_str(),
+                    get.size ? &get.hedgeBuffer[ 0 ] : NULL, get.size, get.offset );
+                hedged = true;
+            }
+            catch( ... )
+            {
+                // Carry on with the original request.
+            }
+        }
+    }
+
+    S3GetResponse localResponse;
+    S3GetResponse *out = response ? response : &localResponse;
+
+    if( !hedged )
+    {
+        completeGet( out );
+        state->record( out->stats.startTransferTime, false );
+        return;
+    }
+
+    // Take whichever succeeds first (the original one if both completed)
+    // and cancel the other. If the first one to complete failed, wait for
+    // the other, the error of the last one is reported if both failed.
+
+    S3Connection *cons[] = { this, m_hedgeConnection };
+    bool hedgeWon = waitAny( cons, dimensionOf( cons ) ) == 1;
+
+    try
+    {
+        completeHedgedGet( hedgeWon, out );
+    }
+    catch( ... )
+    {
+        hedgeWon = !hedgeWon;
+        completeHedgedGet( hedgeWon, out );
+    }
+
+    S3Connection *loser = hedgeWon ? this : m_hedgeConnection;
+
+    if( loser->isAsyncPending() )
+    {
+        loser->cancelAsync();  // nofail
+    }
+
+    // Record the time to the first byte as seen by the caller, i.e. since
+    // the original request started.
+
+    state->record( out->stats.startTransferTime + ( hedgeWon ? get.hedgeStart : 0 ), hedgeWon );
+}
+
+void
+S3Connection::completeHedgedGet( bool hedge, S3GetResponse *response )
+{
+    // Completes the original get or its hedge, the latter is loaded to
+    // the hedge buffer and copied to the caller's one.
+
+    dbgAssert( response );
+
+    if( !hedge )
+    {
+        completeGet( response );
+        return;
+    }
+
+    HedgeGet &get = *m_hedgeGet;
+    m_hedgeConnection->completeGet( response );
+
+    if( response->loadedContentLength != static_cast< size_t >( -1 ) )
+    {
+        size_t loaded = std::min( response->loadedContentLength, get.size );
+
+        if( loaded )
+        {
+            memcpy( get.buffer, &get.hedgeBuffer[ 0 ], loaded );
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Connection pool.
+
+// The key the warm-up and keep-alive gets ask for, a missing object is
+// reported as success and costs a small response.
+
+static const char s_warmUpKey[] = ".webstor-warm-up";
+
+namespace internal
+{
+
+class ConnectionPool
+{
+public:
+                    ConnectionPool( const S3Config &config, size_t size, const char *bucketName,
+                        AsyncMan *asyncMan, unsigned int refreshInterval, S3EndpointSet *endpoints );
+                    ~ConnectionPool();
+
+    size_t          warmUp();  // nofail
+    S3Connection *  acquire();  // nofail
+    void            release( S3Connection *connection );  // nofail
+    void            getStats( S3ConnectionPoolStats *stats );  // nofail
+
+private:
+    struct Entry
+    {
+                    Entry() : connection( NULL ), lastUse( 0 ), acquired( false ), refreshing( false ),
+                        warm( false ), ok( false ) {}
+
+        S3Connection *connection;
+        UInt64      lastUse;    // in msecs, see timeElapsed()
+        bool        acquired;
+        bool        refreshing;
+        bool        warm;
+        bool        ok;         // the result of the last refresh
+        char        buffer[ 1 ];
+    };
+
+                    ConnectionPool( const ConnectionPool & );  // forbidden
+    ConnectionPool &operator=( const ConnectionPool & );  // forbidden
+
+    static TaskResult TASKAPI refreshTask( void *arg );
+    size_t          refresh( UInt64 maxIdle );  // nofail
+    void            refreshSync();  // nofail
+    void            refreshAsync();  // nofail
+    void            destroy();  // nofail
+
+    std::vector< Entry > m_entries;
+    std::string     m_bucketName;
+    AsyncMan *      m_asyncMan;
+    unsigned int    m_refreshInterval;  // in msecs
+    ExLockSync      m_lock;             // guards the entries and stats
+    ExLockSync      m_refreshLock;      // serializes refreshes
+    S3ConnectionPoolStats m_stats;
+    EventSync       m_stop;
+    TaskCtrl        m_refreshTaskCtrl;
+};
+
+ConnectionPool::ConnectionPool( const S3Config &config, size_t size, const char *bucketName,
+    AsyncMan *asyncMan, unsigned int refreshInterval, S3EndpointSet *endpoints )
+    : m_entries( size )
+    , m_bucketName( bucketName )
+    , m_asyncMan( asyncMan )
+    , m_refreshInterval( refreshInterval )
+    , m_lock( "S3ConnectionPool" )
+    , m_refreshLock( "S3ConnectionPool refresh" )
+{
+    dbgAssert( bucketName );
+
+    try
+    {
+        for( size_t i = 0; i < m_entries.size(); ++i )
+        {
+            m_entries[ i ].connection = new S3Connection( config );
+
+            if( endpoints )
+            {
+                m_entries[ i ].connection->setEndpoints( endpoints );
+            }
+        }
+
+        if( m_refreshInterval )
+        {
+            taskStartAsync( &refreshTask, this, &m_refreshTaskCtrl );
+        }
+    }
+    catch( ... )
+    {
+        destroy();  // nofail
+        throw;
+    }
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    m_stop.set();  // nofail
+
+    if( !m_refreshTaskCtrl.empty() )
+    {
+        m_refreshTaskCtrl.wait();  // nofail
+    }
+
+    destroy();  // nofail
+}
+
+void
+ConnectionPool::destroy()  // nofail
+{
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        dbgAssert( !m_entries[ i ].acquired );
+        delete m_entries[ i ].connection;
+        m_entries[ i ].connection = NULL;
+    }
+}
+
+TaskResult TASKAPI
+ConnectionPool::refreshTask( void *arg )
+{
+    dbgAssert( arg );
+    ConnectionPool *const pool = static_cast< ConnectionPool * >( arg );
+
+    // Check twice per interval, so a connection is refreshed before it
+    // stays idle for the whole interval.
+
+    const UInt32 period = std::max( pool->m_refreshInterval / 2, 1u );
+
+    while( !pool->m_stop.wait( period ) )
+    {
+        pool->refresh( period );  // nofail
+    }
+
+    return 0;
+}
+
+size_t
+ConnectionPool::warmUp()  // nofail
+{
+    // Only the connections that aren't warm.
+
+    return refresh( ~static_cast< UInt64 >( 0 ) );  // nofail
+}
+
+size_t
+ConnectionPool::refresh( UInt64 maxIdle )  // nofail
+{
+    m_refreshLock.claimLock();  // nofail
+    ScopedExLock refreshLock( &m_refreshLock );
+
+    // Claim the idle connections that are cold or unused for maxIdle msecs.
+
+    size_t count = 0;
+
+    {
+        m_lock.claimLock();  // nofail
+        ScopedExLock lock( &m_lock );
+
+        UInt64 now = timeElapsed();
+
+        for( size_t i = 0; i < m_entries.size(); ++i )
+        {
+            Entry &entry = m_entries[ i ];
+
+            if( !entry.acquired && ( !entry.warm || now - entry.lastUse >= maxIdle ) )
+            {
+                entry.refreshing = true;
+                entry.ok = false;
+                count++;
+            }
+        }
+    }
+
+    if( count )
+    {
+        if( m_asyncMan )
+        {
+            refreshAsync();  // nofail
+        }
+        else
+        {
+            refreshSync();  // nofail
+        }
+    }
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    UInt64 now = timeElapsed();
+    size_t warm = 0;
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( entry.refreshing )
+        {
+            entry.refreshing = false;
+            entry.warm = entry.ok;
+            entry.lastUse = now;
+
+            m_stats.refreshes++;
+            m_stats.failures += !entry.ok;
+        }
+
+        warm += entry.warm;
+    }
+
+    return warm;
+}
+
+// The refreshing entries are owned by the refresh till it clears the flag,
+// no lock is needed to use their connections.
+
+void
+ConnectionPool::refreshSync()  // nofail
+{
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( !entry.refreshing )
+        {
+            continue;
+        }
+
+        try
+        {
+            entry.connection->get( m_bucketName.c_str(), s_warmUpKey, entry.buffer, sizeof( entry.buffer ) );
+            entry.ok = true;
+        }
+        catch( ... )
+        {
+        }
+    }
+}
+
+void
+ConnectionPool::refreshAsync()  // nofail
+{
+    dbgAssert( m_asyncMan );
+
+    // Pend all gets before completing any, so each takes its own connection.
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( !entry.refreshing )
+        {
+            continue;
+        }
+
+        try
+        {
+            entry.connection->pendGet( m_asyncMan, m_bucketName.c_str(), s_warmUpKey,
+                entry.buffer, sizeof( entry.buffer ) );
+        }
+        catch( ... )
+        {
+        }
+    }
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( !entry.refreshing || !entry.connection->isAsyncPending() )
+        {
+            continue;
+        }
+
+        try
+        {
+            entry.connection->completeGet();
+            entry.ok = true;
+        }
+        catch( ... )
+        {
+        }
+    }
+}
+
+S3Connection *
+ConnectionPool::acquire()  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    Entry *found = NULL;
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( entry.acquired || entry.refreshing )
+        {
+            continue;
+        }
+
+        if( entry.warm )
+        {
+            found = &entry;
+            break;
+        }
+
+        if( !found )
+        {
+            found = &entry;
+        }
+    }
+
+    if( !found )
+    {
+        return NULL;
+    }
+
+    found->acquired = true;
+    return found->connection;
+}
+
+void
+ConnectionPool::release( S3Connection *connection )  // nofail
+{
+    dbgAssert( connection );
+    dbgAssert( !connection->isAsyncPending() );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        Entry &entry = m_entries[ i ];
+
+        if( entry.connection == connection )
+        {
+            dbgAssert( entry.acquired );
+
+            // The connection has just been used, take it for warm till the
+            // next refresh tells otherwise.
+
+            entry.acquired = false;
+            entry.warm = true;
+            entry.lastUse = timeElapsed();
+            return;
+        }
+    }
+
+    dbgAssert( !"the connection doesn't belong to the pool" );
+}
+
+void
+ConnectionPool::getStats( S3ConnectionPoolStats *stats )  // nofail
+{
+    dbgAssert( stats );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    *stats = m_stats;
+    stats->size = m_entries.size();
+
+    for( size_t i = 0; i < m_entries.size(); ++i )
+    {
+        stats->idle += !m_entries[ i ].acquired;
+        stats->warm += m_entries[ i ].warm;
+    }
+}
+
+}  // namespace internal
+
+S3ConnectionPool::S3ConnectionPool( const S3Config &config, size_t size, const char *bucketName,
+    AsyncMan *asyncMan, unsigned int refreshInterval, S3EndpointSet *endpoints )
+    : m_pool( new ConnectionPool( config, size, bucketName, asyncMan, refreshInterval, endpoints ) )
+{
+}
+
+S3ConnectionPool::~S3ConnectionPool()
+{
+    delete m_pool;
+}
+
+size_t
+S3ConnectionPool::warmUp()  // nofail
+{
+    return m_pool->warmUp();  // nofail
+}
+
+S3Connection *
+S3ConnectionPool::acquire()  // nofail
+{
+    return m_pool->acquire();  // nofail
+}
+
+void
+S3ConnectionPool::release( S3Connection *connection )  // nofail
+{
+    m_pool->release( connection );  // nofail
+}
+
+void
+S3ConnectionPool::getStats( S3ConnectionPoolStats *stats /* out */ ) const  // nofail
+{
+    m_pool->getStats( stats );  // nofail
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Endpoint addresses.
+
+namespace internal
+{
+
+EndpointState::EndpointState( const char *host, unsigned int refreshInterval )
+    : m_host( host )
+    , m_refreshInterval( refreshInterval )
+    , m_lock( "S3EndpointSet" )
+    , m_nextId( 1 )
+{
+    dbgAssert( host );
+
+    resolve();
+
+    if( m_refreshInterval )
+    {
+        taskStartAsync( &resolveTask, this, &m_resolveTaskCtrl );
+    }
+}
+
+EndpointState::EndpointState( const std::vector< std::string > &addresses )
+    : m_host()
+    , m_refreshInterval( 0 )
+    , m_lock( "S3EndpointSet" )
+    , m_nextId( 1 )
+{
+    std::vector< std::string > sorted( addresses );
+    std::sort( sorted.begin(), sorted.end() );
+    sorted.erase( std::unique( sorted.begin(), sorted.end() ), sorted.end() );
+
+    update( sorted );
+}
+
+EndpointState::~EndpointState()
+{
+    m_stop.set();  // nofail
+
+    if( !m_resolveTaskCtrl.empty() )
+    {
+        m_resolveTaskCtrl.wait();  // nofail
+    }
+}
+
+TaskResult TASKAPI
+EndpointState::resolveTask( void *arg )
+{
+    dbgAssert( arg );
+    EndpointState *const state = static_cast< EndpointState * >( arg );
+
+    while( !state->m_stop.wait( state->m_refreshInterval ) )
+    {
+        try
+        {
+            state->resolve();
+        }
+        catch( ... )
+        {
+            // Keep the addresses we have.
+        }
+    }
+
+    return 0;
+}
+
+void
+EndpointState::resolve()
+{
+    std::vector< std::string > addresses;
+    resolveHost( m_host.c_str(), &addresses );
+
+    update( addresses );
+}
+
+void
+EndpointState::update( const std::vector< std::string > &addresses )
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    // Addresses are sorted, so are the endpoints: they're only ever added
+    // in order and removed.
+
+    std::vector< Endpoint > endpoints;
+    endpoints.reserve( m_endpoints.size() + addresses.size() );
+
+    size_t i = 0;
+    size_t j = 0;
+
+    while( i < m_endpoints.size() || j < addresses.size() )
+    {
+        int cmp = i == m_endpoints.size() ? 1 : j == addresses.size() ? -1 :
+            m_endpoints[ i ].address.compare( addresses[ j ] );
+
+        if( cmp < 0 )
+        {
+            // Gone from DNS, kept till its connections move away.
+
+            if( m_endpoints[ i ].connections )
+            {
+                endpoints.push_back( m_endpoints[ i ] );
+                endpoints.back().dropped = true;
+            }
+
+            i++;
+        }
+        else if( cmp > 0 )
+        {
+            endpoints.push_back( Endpoint() );
+            endpoints.back().id = m_nextId++;
+            endpoints.back().address = addresses[ j++ ];
+        }
+        else
+        {
+            endpoints.push_back( m_endpoints[ i++ ] );
+            endpoints.back().dropped = false;
+            j++;
+        }
+    }
+
+    m_endpoints.swap( endpoints );
+}
+
+EndpointState::Endpoint *
+EndpointState::find( UInt64 endpointId )  // nofail
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+
+    for( size_t i = 0; i < m_endpoints.size(); ++i )
+    {
+        if( m_endpoints[ i ].id == endpointId )
+        {
+            return &m_endpoints[ i ];
+        }
+    }
+
+    return NULL;
+}
+
+void
+EndpointState::expire( UInt64 now )  // nofail
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+
+    // Give avoided addresses another chance with a clean record.
+
+    for( size_t i = 0; i < m_endpoints.size(); ++i )
+    {
+        Endpoint &endpoint = m_endpoints[ i ];
+
+        if( endpoint.avoidUntil && now >= endpoint.avoidUntil )
+        {
+            endpoint.avoidUntil = 0;
+            endpoint.failuresInRow = 0;
+            endpoint.latency = 0;
+            endpoint.samples = 0;
+        }
+    }
+}
+
+// Usable addresses come first, then the ones with fewer connections (not
+// counting the connection being assigned), then the faster ones.
+
+bool
+EndpointState::isBetter( const Endpoint &endpoint, const Endpoint &other,
+    const Endpoint *current )  // nofail
+{
+    if( !endpoint.avoidUntil != !other.avoidUntil )
+    {
+        return !endpoint.avoidUntil;
+    }
+
+    size_t connections = endpoint.connections - ( &endpoint == current );
+    size_t otherConnections = other.connections - ( &other == current );
+
+    if( connections != otherConnections )
+    {
+        return connections < otherConnections;
+    }
+
+    return endpoint.latency < other.latency;
+}
+
+void
+EndpointState::avoid( Endpoint *endpoint, UInt64 now )  // nofail
+{
+    dbgAssert( endpoint );
+    endpoint->avoidUntil = std::max< UInt64 >( now + S3EndpointSet::c_avoidTime, 1 );
+}
+
+UInt64
+EndpointState::assign( UInt64 endpointId, UInt64 now, std::string *connectTo /* out */ )
+{
+    dbgAssert( connectTo );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    expire( now );  // nofail
+
+    Endpoint *current = find( endpointId );  // nofail
+
+    if( !current || current->dropped || current->avoidUntil )
+    {
+        Endpoint *best = NULL;
+
+        for( size_t i = 0; i < m_endpoints.size(); ++i )
+        {
+            Endpoint &endpoint = m_endpoints[ i ];
+
+            if( !endpoint.dropped && ( !best || isBetter( endpoint, *best, current ) ) )
+            {
+                best = &endpoint;
+            }
+        }
+
+        if( !best )
+        {
+            // Nothing resolved, connect the usual way.
+
+            return 0;
+        }
+
+        if( best != current )
+        {
+            if( current )
+            {
+                current->connections--;
+            }
+
+            best->connections++;
+            current = best;
+        }
+    }
+
+    // "::address:" connects any host and port of the url to the address.
+
+    bool isIpv6 = current->address.find( ':' ) != std::string::npos;
+
+    connectTo->reserve( current->address.size() + 6 );
+    connectTo->assign( STRING_WITH_LEN( "::" ) );
+
+    if( isIpv6 )
+    {
+        connectTo->append( 1, '[' ).append( current->address ).append( 1, ']' );
+    }
+    else
+    {
+        connectTo->append( current->address );
+    }
+
+    connectTo->append( 1, ':' );
+
+    return current->id;
+}
+
+void
+EndpointState::release( UInt64 endpointId )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    Endpoint *endpoint = find( endpointId );  // nofail
+
+    if( endpoint )
+    {
+        dbgAssert( endpoint->connections );
+        endpoint->connections--;
+    }
+}
+
+void
+EndpointState::record( UInt64 endpointId, bool failed, UInt64 firstByteTime, UInt64 now )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    Endpoint *endpoint = find( endpointId );  // nofail
+
+    if( !endpoint )
+    {
+        return;
+    }
+
+    endpoint->requests++;
+
+    if( failed )
+    {
+        endpoint->failures++;
+
+        if( ++endpoint->failuresInRow >= S3EndpointSet::c_maxFailures )
+        {
+            avoid( endpoint, now );  // nofail
+        }
+
+        return;
+    }
+
+    endpoint->failuresInRow = 0;
+
+    // Exponential moving average over ~8 requests.
+
+    endpoint->latency = endpoint->samples ? endpoint->latency + ( firstByteTime - endpoint->latency ) / 8 :
+        firstByteTime;
+    endpoint->samples++;
+
+    checkSlow( endpoint, now );  // nofail
+}
+
+void
+EndpointState::checkSlow( Endpoint *endpoint, UInt64 now )  // nofail
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+    dbgAssert( endpoint );
+
+    if( endpoint->avoidUntil || endpoint->samples < S3EndpointSet::c_minSamples )
+    {
+        return;
+    }
+
+    // Compare with the fastest of the other usable addresses.
+
+    double fastest = 0;
+
+    for( size_t i = 0; i < m_endpoints.size(); ++i )
+    {
+        const Endpoint &other = m_endpoints[ i ];
+
+        if( &other != endpoint && !other.dropped && !other.avoidUntil && other.samples >= S3EndpointSet::c_minSamples &&
+            ( !fastest || other.latency < fastest ) )
+        {
+            fastest = other.latency;
+        }
+    }
+
+    if( fastest && endpoint->latency > fastest * S3EndpointSet::c_slowFactor )
+    {
+        avoid( endpoint, now );  // nofail
+    }
+}
+
+void
+EndpointState::getStats( std::vector< S3EndpointStats > *stats )
+{
+    dbgAssert( stats );
+
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    stats->resize( m_endpoints.size() );
+
+    for( size_t i = 0; i < m_endpoints.size(); ++i )
+    {
+        const Endpoint &endpoint = m_endpoints[ i ];
+        S3EndpointStats &out = ( *stats )[ i ];
+
+        out.address = endpoint.address;
+        out.connections = endpoint.connections;
+        out.requests = endpoint.requests;
+        out.failures = endpoint.failures;
+        out.latency = static_cast< UInt64 >( endpoint.latency );
+        out.avoided = endpoint.dropped || endpoint.avoidUntil;
+    }
+}
+
+}  // namespace internal
+
+void
+S3Request::recordEndpoint()  // nofail
+{
+    dbgAssert( m_endpoints );
+
+    bool failed = hasError() || ( !m_responseDetails.httpStatus.empty() && m_responseDetails.httpStatus[ 0 ] == '5' );
+    m_endpoints->record( m_endpointId, failed, m_responseDetails.stats.startTransferTime, timeElapsed() );  // nofail
+}
+
+S3EndpointSet::S3EndpointSet( const S3Config &config, unsigned int refreshInterval )
+    : m_state( new EndpointState( config.host && *config.host ? config.host : s_defaultHost,
+        refreshInterval ) )
+{
+}
+
+S3EndpointSet::~S3EndpointSet()
+{
+    delete m_state;
+}
+
+void
+S3EndpointSet::getStats( std::vector< S3EndpointStats > *stats /* out */ ) const
+{
+    m_state->getStats( stats );
+}
+
+void
+S3Connection::setEndpoints( S3EndpointSet *endpoints )
+{
+    dbgAssert( !m_asyncRequest );
+
+    if( m_endpoints )
+    {
+        m_endpoints->state()->release( m_endpointId );  // nofail
+    }
+
+    m_endpoints = endpoints;
+    m_endpointId = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Request traces.
+
+// Trace file layout: a header of s_traceMagic, version and record size
+// (32 bit each) followed by records:
+//
+//  offset  size
+//      0     8  timestamp
+//      8     8  latency
+//     16     8  keyHash
+//     24     8  offset
+//     32     8  size
+//     40     4  bucketHash
+//     44     1  op
+//     45     1  flags, bit 0: failed
+//     46     2  reserved
+//
+// All numbers are little-endian. Readers skip trailing bytes of records
+// larger than they know, so fields can be appended in later versions.
+
+static const char s_traceMagic[ 8 ] = { 'S', '3', 'T', 'R', 'A', 'C', 'E', '\0' };
+static const UInt32 s_traceVersion = 1;
+static const size_t s_traceHeaderSize = 16;
+static const size_t s_traceRecordSize = 48;
+
+namespace internal
+{
+
+class TraceFile
+{
+public:
+                    TraceFile() : file( NULL ), recordSize( s_traceRecordSize ), lock( "S3TraceRecorder" ), clock( true ) {}
+                    ~TraceFile() { if( file ) fclose( file ); }
+
+    FILE           *file;
+    size_t          recordSize;
+    ExLockSync      lock;
+    Stopwatch       clock;
+};
+
+}  // namespace internal
+
+static void
+putLE( unsigned char *p, UInt64 value, size_t size )  // nofail
+{
+    for( size_t i = 0; i < size; ++i, value >>= 8 )
+    {
+        p[ i ] = static_cast< unsigned char >( value );
+    }
+}
+
+static UInt64
+getLE( const unsigned char *p, size_t size )  // nofail
+{
+    UInt64 value = 0;
+
+    for( size_t i = size; i > 0; --i )
+    {
+        value = ( value << 8 ) | p[ i - 1 ];
+    }
+
+    return value;
+}
+
+S3TraceRecorder::S3TraceRecorder( const char *fileName )
+    : m_file( NULL )
+{
+    dbgAssert( fileName );
+
+    std::auto_ptr< TraceFile > file( new TraceFile() );
+    file->file = fopen( fileName, "wb" );
+
+    if( !file->file )
+    {
+        throw S3Exception( errTraceOpen, fileName );
+    }
+
+    unsigned char header[ s_traceHeaderSize ] = {};
+    memcpy( header, s_traceMagic, sizeof( s_traceMagic ) );
+    putLE( header + 8, s_traceVersion, 4 );
+    putLE( header + 12, s_traceRecordSize, 4 );
+
+    if( fwrite( header, sizeof( header ), 1, file->file ) != 1 )
+    {
+        throw S3Exception( errTraceOpen, fileName );
+    }
+
+    m_file = file.release();
+}
+
+S3TraceRecorder::~S3TraceRecorder()
+{
+    delete m_file;
+}
+
+unsigned long long
+S3TraceRecorder::now() const  // nofail
+{
+    return m_file->clock.elapsedUs();
+}
+
+void
+S3TraceRecorder::record( const S3TraceRecord &record )  // nofail
+{
+    CASSERT( S3_TRACE_OP_END <= 256 );
+
+    unsigned char buf[ s_traceRecordSize ] = {};
+
+    putLE( buf, record.timestamp, 8 );
+    putLE( buf + 8, record.latency, 8 );
+    putLE( buf + 16, record.keyHash, 8 );
+    putLE( buf + 24, record.offset, 8 );
+    putLE( buf + 32, record.size, 8 );
+    putLE( buf + 40, record.bucketHash, 4 );
+    buf[ 44 ] = static_cast< unsigned char >( record.op );
+    buf[ 45 ] = record.failed ? 1 : 0;
+
+    m_file->lock.claimLock();
+    ScopedExLock lock( &m_file->lock );
+
+    fwrite( buf, sizeof( buf ), 1, m_file->file );
+}
+
+unsigned long long
+S3TraceRecorder::hash( const char *name )  // nofail
+{
+    UInt64 h = 14695981039346656037ULL;
+
+    for( const char *p = name; p && *p; ++p )
+    {
+        h ^= static_cast< unsigned char >( *p );
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+S3TraceReader::S3TraceReader( const char *fileName )
+    : m_file( NULL )
+{
+    dbgAssert( fileName );
+
+    std::auto_ptr< TraceFile > file( new TraceFile() );
+    file->file = fopen( fileName, "rb" );
+
+    if( !file->file )
+    {
+        throw S3Exception( errTraceOpen, fileName );
+    }
+
+    unsigned char header[ s_traceHeaderSize ] = {};
+
+    if( fread( header, sizeof( header ), 1, file->file ) != 1 ||
+        memcmp( header, s_traceMagic, sizeof( s_traceMagic ) ) ||
+        getLE( header + 8, 4 ) < 1 ||
+        getLE( header + 12, 4 ) < s_traceRecordSize )
+    {
+        throw S3Exception( errTraceFormat, fileName );
+    }
+
+    file->recordSize = static_cast< size_t >( getLE( header + 12, 4 ) );
+    m_file = file.release();
+}
+
+S3TraceReader::~S3TraceReader()
+{
+    delete m_file;
+}
+
+bool
+S3TraceReader::read( S3TraceRecord *record /* out */ )
+{
+    dbgAssert( record );
+
+    unsigned char buf[ s_traceRecordSize ];
+
+    if( fread( buf, sizeof( buf ), 1, m_file->file ) != 1 )
+    {
+        return false;
+    }
+
+    if( m_file->recordSize > sizeof( buf ) &&
+        fseek( m_file->file, static_cast< long >( m_file->recordSize - sizeof( buf ) ), SEEK_CUR ) )
+    {
+        return false;
+    }
+
+    record->timestamp = getLE( buf, 8 );
+    record->latency = getLE( buf + 8, 8 );
+    record->keyHash = getLE( buf + 16, 8 );
+    record->offset = getLE( buf + 24, 8 );
+    record->size = getLE( buf + 32, 8 );
+    record->bucketHash = static_cast< unsigned int >( getLE( buf + 40, 4 ) );
+    record->op = buf[ 44 ] < S3_TRACE_OP_END ? static_cast< S3TraceOp >( buf[ 44 ] ) : S3_TRACE_OP_OTHER;
+    record->failed = ( buf[ 45 ] & 1 ) != 0;
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Hot paths without network I/O (for microbenchmarks).
+
+namespace internal
+{
+
+S3HotPaths::S3HotPaths( const S3Config &config )
+    : m_conn( config )
+{
+}
+
+void
+S3HotPaths::calcSignature( const char *action, const char *bucketName, const char *key,
+    const char *date, std::string *signature /* out */ )
+{
+    ::webstor::calcSignature( m_conn.m_accKey, m_conn.m_secKey, NULL /* contentMd5 */, 
+        NULL /* contentType */, date, false /* makePublic */, false /* srvEncrypt */, 
+        action, bucketName, key, m_conn.m_isWalrus, signature );
+}
+
+size_t
+S3HotPaths::setRequestHeaders( const char *action, const char *bucketName, const char *key,
+    size_t low, size_t high )
+{
+    ScopedCurlList headers;
+
+    ::webstor::setRequestHeaders( m_conn.m_accKey, m_conn.m_secKey, NULL /* contentMd5 */, 
+        NULL /* contentType */, false /* makePublic */, false /* srvEncrypt */, 
+        action, bucketName, key, m_conn.m_isWalrus, &headers, low, high );
+
+    size_t count = 0;
+
+    for( curl_slist *p = headers; p; p = p->next )
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+void
+S3HotPaths::composeUrl( const char *bucketName, const char *key, std::string *url /* out */ )
+{
+    std::string escapedKey;
+    ::webstor::composeUrl( m_conn.m_baseUrl, bucketName, key, NULL /* keySuffix */, 
+        url, &escapedKey );
+}
+
+void
+S3HotPaths::feedHeaders( S3Request *request, const char * const *headers, size_t headerCount )
+{
+    for( size_t i = 0; i < headerCount; ++i )
+    {
+        size_t size = strlen( headers[ i ] );
+
+        if( S3Request::handleHeader( headers[ i ], size, 1, request ) != size )
+        {
+            break;
+        }
+    }
+}
+
+void
+S3HotPaths::parseGetResponse( const char * const *headers, size_t headerCount,
+    const void *body, size_t bodySize, void *buffer, size_t bufferSize,
+    S3GetResponse *response /* out */ )
+{
+    dbgAssert( headers );
+
+    S3GetRequest request( "", buffer, bufferSize );
+    request.prepare( m_conn.m_curl, m_conn.m_errorBuffer, sizeof( m_conn.m_errorBuffer ) );
+
+    CURLcode curlCode = CURLE_OK;
+    feedHeaders( &request, headers, headerCount );
+
+    if( request.hasError() ||
+        ( bodySize && S3Request::handleBinaryLoad( body, bodySize, 1, &request ) != bodySize ) )
+    {
+        curlCode = CURLE_WRITE_ERROR;
+    }
+
+    S3ResponseDetails &responseDetails = request.complete( curlCode );
+    ::webstor::completeGet( responseDetails, response );
+}
+
+void
+S3HotPaths::parseListObjectsResponse( const char * const *headers, size_t headerCount,
+    const char *body, size_t bodySize, size_t chunkSize,
+    S3ObjectEnum *objectEnum, S3ListObjectsResponse *response /* out */ )
+{
+    dbgAssert( headers );
+    dbgAssert( chunkSize );
+
+    S3ListObjectsRequest request( "", objectEnum, m_conn.m_isWalrus );
+    request.prepare( m_conn.m_curl, m_conn.m_errorBuffer, sizeof( m_conn.m_errorBuffer ) );
+
+    CURLcode curlCode = CURLE_OK;
+    feedHeaders( &request, headers, headerCount );
+
+    for( size_t offset = 0; offset < bodySize && !request.hasError(); offset += chunkSize )
+    {
+        size_t size = std::min( chunkSize, bodySize - offset );
+
+        if( S3Request::handleXmlPayload( body + offset, size, 1, &request ) != size )
+        {
+            break;
+        }
+    }
+
+    if( request.hasError() )
+    {
+        curlCode = CURLE_WRITE_ERROR;
+    }
+
+    S3ResponseDetails &responseDetails = request.complete( curlCode );
+    handleErrors( responseDetails );
+
+    if( response )
+    {
+        response->nextMarker = request.nextMarker();
+        response->isTruncated = responseDetails.isTruncated;
+    }
+}
+
+#ifdef DEBUG
+//////////////////////////////////////////////////////////////////////////////
+// Endpoint steering on fixed addresses (for unit tests).
+
+S3EndpointProbe::S3EndpointProbe( const std::vector< std::string > &addresses )
+    : m_state( new EndpointState( addresses ) )
+{
+}
+
+S3EndpointProbe::~S3EndpointProbe()
+{
+    delete m_state;
+}
+
+unsigned long long
+S3EndpointProbe::assign( unsigned long long endpointId, unsigned long long now, std::string *connectTo /* out */ )
+{
+    return m_state->assign( endpointId, now, connectTo );
+}
+
+void
+S3EndpointProbe::release( unsigned long long endpointId )  // nofail
+{
+    m_state->release( endpointId );  // nofail
+}
+
+void
+S3EndpointProbe::record( unsigned long long endpointId, bool failed, unsigned long long firstByteTime,
+    unsigned long long now )  // nofail
+{
+    m_state->record( endpointId, failed, firstByteTime, now );  // nofail
+}
+
+void
+S3EndpointProbe::getStats( std::vector< S3EndpointStats > *stats /* out */ )
+{
+    m_state->getStats( stats );
+}
+#endif
+
+}  // namespace internal
+
 //////////////////////////////////////////////////////////////////////////////
 // S3Exception.
 
@@ -131,6 +131,71 @@ S3Bucket::clear()
     creationDate.clear();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+///@brief Transfer timing of a completed request, as reported by curl.
+///@details Times are in microseconds since the start of the request and
+/// are cumulative, so a slow request can be attributed to name lookup
+/// (nameLookupTime), TCP connect (connectTime - nameLookupTime), TLS
+/// handshake (appConnectTime - connectTime, 0 for http), server time to the
+/// first byte (startTransferTime - preTransferTime) or the transfer itself
+/// (totalTime - startTransferTime). A reused connection has zero connect
+/// time.
+
+struct S3RequestStats
+{
+                    S3RequestStats();
+
+    unsigned long long nameLookupTime;
+    unsigned long long connectTime;
+    unsigned long long appConnectTime;
+    unsigned long long preTransferTime;
+    unsigned long long startTransferTime;
+    unsigned long long totalTime;
+
+    /// Bytes of the request and response bodies.
+
+    unsigned long long bytesUploaded;
+    unsigned long long bytesDownloaded;
+
+    /// Average upload and download speed, in bytes per second.
+
+    double          uploadSpeed;
+    double          downloadSpeed;
+
+    /// Indicates if the request was sent over an existing connection.
+
+    bool            connectionReused;
+
+    /// Indicates if the request was aborted because its transfer stalled
+    /// (see S3Connection::setLowSpeedLimit(..) and setFirstByteTimeout(..)),
+    /// so that it can be re-issued, e.g. on another connection.
+
+    bool            stalled;
+
+    /// Number of times the request has been retried (see
+    /// S3Connection::setRetryPolicy(..)), the timing is of the last attempt.
+
+    unsigned int    retries;
+};
+
+inline
+S3RequestStats::S3RequestStats()
+    : nameLookupTime( 0 )
+    , connectTime( 0 )
+    , appConnectTime( 0 )
+    , preTransferTime( 0 )
+    , startTransferTime( 0 )
+    , totalTime( 0 )
+    , bytesUploaded( 0 )
+    , bytesDownloaded( 0 )
+    , uploadSpeed( 0 )
+    , downloadSpeed( 0 )
+    , connectionReused( false )
+    , stalled( false )
+    , retries( 0 )
+{
+}
+
 //////////////////////////////////////////////////////////////////////////////
 ///@brief Response from 'put' and 'putPart' requests.
 
@@ -145,6 +210,10 @@ struct S3PutResponse
     /// etag assigned to the object by Amazon S3.
 
     std::string     etag;
+
+    /// Transfer timing.
+
+    S3RequestStats  stats;
 };
 
 ///@brief An abstract class to upload 'put' and 'putPart' payload.
@@ -158,6 +227,13 @@ struct S3PutRequestUploader
     /// stopped.
 
     virtual size_t  onUpload( void *chunkBuf, size_t chunkSize ) = 0; 
+
+    ///@brief   A callback to restart the payload from the beginning.
+    ///@details Called before a failed request is retried (see
+    /// S3Connection::setRetryPolicy(..)), the request is not retried if the
+    /// method returns false (the default).
+
+    virtual bool    onRewind() { return false; }
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -178,6 +254,10 @@ struct S3GetResponse
     /// Object's etag.
 
     std::string     etag;
+
+    /// Transfer timing.
+
+    S3RequestStats  stats;
 };
 
 ///@brief An abstract class to download 'get' payload.
@@ -190,6 +270,13 @@ struct S3GetResponseLoader
     /// stopped.
 
     virtual size_t  onLoad( const void *chunkData, size_t chunkSize, size_t totalSizeHint ) = 0; 
+
+    ///@brief   A callback to discard the loaded payload.
+    ///@details Called before a failed request that has loaded a part of the
+    /// payload is retried (see S3Connection::setRetryPolicy(..)), the request
+    /// is not retried if the method returns false (the default).
+
+    virtual bool    onRewind() { return false; }
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -197,6 +284,9 @@ struct S3GetResponseLoader
 
 struct S3DelResponse
 {
+    /// Transfer timing.
+
+    S3RequestStats  stats;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -366,6 +456,287 @@ typedef int ( TraceCallback ) ( void *handle, TraceInfo type, unsigned char *dat
     void *cookie );
 
 
+//////////////////////////////////////////////////////////////////////////////
+///@brief Request kinds in a request trace.
+
+enum S3TraceOp
+{
+    S3_TRACE_OP_GET = 0,
+    S3_TRACE_OP_PUT,
+    S3_TRACE_OP_DEL,
+    S3_TRACE_OP_LIST,
+    S3_TRACE_OP_OTHER,
+    S3_TRACE_OP_END
+};
+
+///@brief A single request in a trace written by S3TraceRecorder.
+///@details Bucket names and keys are stored as hashes (see S3TraceRecorder::hash(..)),
+/// so traces of production workloads don't expose object names.
+
+struct S3TraceRecord
+{
+    /// Request start, in microseconds since the recorder was created.
+
+    unsigned long long timestamp;
+
+    /// Time from the request start till the caller completed it, in microseconds.
+
+    unsigned long long latency;
+
+    /// Hash of the key (or of the prefix for 'listObjects').
+
+    unsigned long long keyHash;
+
+    /// Requested range for a range 'get', otherwise offset is 0 and
+    /// size is the number of bytes loaded or uploaded.
+
+    unsigned long long offset;
+    unsigned long long size;
+
+    /// Low 32 bits of the bucket name hash.
+
+    unsigned int    bucketHash;
+
+    S3TraceOp       op;
+
+    /// Indicates if the request failed (including 'get' of a missing object).
+
+    bool            failed;
+};
+
+namespace internal
+{
+class ConnectionPool;
+class EndpointState;
+class HedgeGet;
+class HedgeState;
+class S3HotPaths;
+class TraceFile;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Records a compact binary trace of requests made by S3Connections.
+///@details Attach the recorder to connections with S3Connection::setTraceRecorder(..).
+/// The file starts with a 16 byte header: "S3TRACE\0", version and record size
+/// (32 bit each), followed by fixed size little-endian records.
+/// Throws if the file cannot be created.
+///@remark Thread-safety: the object is thread safe, one recorder can be shared
+/// by connections used from different threads.
+
+class S3TraceRecorder
+{
+public:
+    explicit        S3TraceRecorder( const char *fileName );
+                    ~S3TraceRecorder();
+
+   /// Returns time since the recorder was created, in microseconds.
+
+   unsigned long long now() const;  // nofail
+
+   /// Appends a record to the trace. Write errors are ignored.
+
+   void             record( const S3TraceRecord &record );  // nofail
+
+   /// Returns a 64 bit hash (FNV-1a) of a name.
+
+   static unsigned long long hash( const char *name );  // nofail
+
+private:
+                    S3TraceRecorder( const S3TraceRecorder & );  // forbidden
+   S3TraceRecorder & operator=( const S3TraceRecorder & );  // forbidden
+
+   internal::TraceFile *m_file;
+};
+
+///@brief Reads a trace written by S3TraceRecorder.
+///@details Throws if the file cannot be opened or is not a trace.
+
+class S3TraceReader
+{
+public:
+    explicit        S3TraceReader( const char *fileName );
+                    ~S3TraceReader();
+
+   /// Reads the next record, returns false at the end of the trace.
+
+   bool             read( S3TraceRecord *record /* out */ );
+
+private:
+                    S3TraceReader( const S3TraceReader & );  // forbidden
+   S3TraceReader &  operator=( const S3TraceReader & );  // forbidden
+
+   internal::TraceFile *m_file;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Retry policy of requests, see S3Connection::setRetryPolicy(..).
+///@details Transient failures are retried: 503 Slow Down or Service
+/// Unavailable, 500 Internal Error, failures to resolve or connect, network
+/// errors and timeouts. Failures after the request may have reached the
+/// server (500, network errors and timeouts) are retried only for idempotent
+/// requests, i.e. all but POST (initiating and completing multipart uploads).
+/// The n-th retry waits min( baseDelay * 2^(n-1), maxDelay ) milliseconds,
+/// half of it random, so that requests failed together don't retry together.
+
+struct S3RetryPolicy
+{
+                    S3RetryPolicy();
+
+    /// Attempts including the first one, 1 disables retries.
+
+    unsigned int    maxAttempts;
+
+    /// Delay before the first retry and the cap of the delay, in milliseconds.
+
+    unsigned int    baseDelay;
+    unsigned int    maxDelay;
+};
+
+inline
+S3RetryPolicy::S3RetryPolicy()
+    : maxAttempts( 4 )
+    , baseDelay( 100 )
+    , maxDelay( 5000 )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Counters of an S3HedgePolicy.
+
+struct S3HedgeStats
+{
+                    S3HedgeStats();
+
+    /// Gets completed under the policy.
+
+    unsigned long long gets;
+
+    /// Duplicate requests issued and duplicates that completed first.
+
+    unsigned long long hedges;
+    unsigned long long hedgesWon;
+
+    /// Current hedge delay in microseconds, 0 till enough gets are sampled.
+
+    unsigned long long delay;
+};
+
+inline
+S3HedgeStats::S3HedgeStats()
+    : gets( 0 )
+    , hedges( 0 )
+    , hedgesWon( 0 )
+    , delay( 0 )
+{
+}
+
+///@brief Hedging policy of gets, see S3Connection::setHedging(..).
+///@details The policy samples the time to the first byte of completed gets,
+/// the hedge delay is its <b>percentile</b>. A get that doesn't receive the
+/// first byte within the delay is duplicated on another connection, unless
+/// duplicates would exceed <b>maxHedgePercent</b> percent of gets.
+///@remark Thread-safety: the object is thread safe, one policy can be shared
+/// by connections used from different threads.
+
+class S3HedgePolicy
+{
+public:
+    explicit        S3HedgePolicy( double percentile = 95, double maxHedgePercent = 5 );
+                    ~S3HedgePolicy();
+
+   void             getStats( S3HedgeStats *stats /* out */ ) const;  // nofail
+
+public:
+   internal::HedgeState *state() const { return m_state; }
+
+private:
+                    S3HedgePolicy( const S3HedgePolicy & );  // forbidden
+   S3HedgePolicy &  operator=( const S3HedgePolicy & );  // forbidden
+
+   internal::HedgeState *m_state;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief State of an address of an S3EndpointSet.
+
+struct S3EndpointStats
+{
+                    S3EndpointStats();
+
+    /// Numeric IP address.
+
+    std::string     address;
+
+    /// Connections assigned to the address.
+
+    size_t          connections;
+
+    /// Requests completed over the address and the failed ones (transport
+    /// errors and 5xx responses).
+
+    unsigned long long requests;
+    unsigned long long failures;
+
+    /// Moving average of the time to the first byte, in microseconds.
+
+    unsigned long long latency;
+
+    /// Indicates if connections are steered away from the address.
+
+    bool            avoided;
+};
+
+inline
+S3EndpointStats::S3EndpointStats()
+    : connections( 0 )
+    , requests( 0 )
+    , failures( 0 )
+    , latency( 0 )
+    , avoided( false )
+{
+}
+
+///@brief All addresses of the storage endpoint, to spread connections across
+/// them, see S3Connection::setEndpoints(..).
+///@details DNS returns several addresses of the endpoint, but curl connects
+/// to the one it caches, so all connections of a process may pile onto a
+/// few front-ends. The set resolves the host of <b>config</b> when it's
+/// created (throws if it cannot) and then every <b>refreshInterval</b>
+/// milliseconds in the background, keeping the last addresses if the
+/// resolution fails. A connection is assigned the address with the fewest
+/// connections and keeps it, so its connection is reused, till the address
+/// disappears from DNS or is avoided: after c_maxFailures requests in a row
+/// fail over it or when its first byte latency gets c_slowFactor times
+/// that of the fastest address. Avoided addresses are given another chance
+/// after c_avoidTime milliseconds.
+///@remark Thread-safety: the object is thread safe, one set can be shared
+/// by connections used from different threads.
+
+class S3EndpointSet
+{
+public:
+    enum { c_defaultRefreshInterval = 60000 };  // msecs
+    enum { c_maxFailures = 3 };
+    enum { c_slowFactor = 3 };
+    enum { c_minSamples = 16 };  // latency samples before an address is compared
+    enum { c_avoidTime = 30000 };  // msecs
+
+    explicit        S3EndpointSet( const S3Config &config,
+                        unsigned int refreshInterval = c_defaultRefreshInterval );
+                    ~S3EndpointSet();
+
+   void             getStats( std::vector< S3EndpointStats > *stats /* out */ ) const;
+
+public:
+   internal::EndpointState *state() const { return m_state; }
+
+private:
+                    S3EndpointSet( const S3EndpointSet & );  // forbidden
+   S3EndpointSet &  operator=( const S3EndpointSet & );  // forbidden
+
+   internal::EndpointState *m_state;
+};
+
 class S3Request;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -687,6 +1058,13 @@ public:
 
    void             cancelAsync(); // nofail
 
+   ///@brief Returns transfer timing of the last completed request.
+   ///@details Unlike the stats in the responses, this covers failed requests
+   /// too (e.g. to tell a connect timeout from a slow first byte). The stats
+   /// are available till the next request is started on the connection.
+
+   void             getLastRequestStats( S3RequestStats *stats /* out */ ); // nofail
+
    /// Maximum number of S3Connections waitAny(..) supports.
 
    enum { c_maxWaitAny = 128 };
@@ -708,11 +1086,108 @@ public:
 
    void             setConnectTimeout( long connectTime ); 
 
+   ///@brief Sets the minimum transfer speed of a request.
+   ///@details A request that transfers less than <b>bytesPerSec</b> bytes
+   /// per second for <b>seconds</b> seconds, once it has been sent, is
+   /// aborted as stalled (see S3RequestStats::stalled). 0 disables the check
+   /// (the default).
+
+   void             setLowSpeedLimit( long bytesPerSec, long seconds );
+
+   ///@brief Sets the first-byte deadline, in milliseconds.
+   ///@details A request that doesn't receive the response status line within
+   /// the deadline from its start (including connect) is aborted as stalled
+   /// (see S3RequestStats::stalled). Requests with a body (puts) aren't
+   /// checked: the server answers only after it has read the whole body,
+   /// which may still sit in socket buffers long after curl has sent it;
+   /// the low-speed limit covers them. The deadline is checked every
+   /// quarter of it (at most every second) for async requests and every
+   /// second for sync ones. 0 disables the check (the default).
+
+   void             setFirstByteTimeout( long firstByteTimeout );
+
+   ///@brief Sets the deadline of async requests, in milliseconds from
+   /// pendXXX(..).
+   ///@details Requests waiting for the concurrency limit of their AsyncMan
+   /// (see AsyncMan::setConcurrencyPolicy(..)) are sent earliest deadline
+   /// first, ahead of requests without a deadline. A request that hasn't
+   /// been sent by its deadline fails in completeXXX(..) without being sent
+   /// (see AsyncLoopStats::expired), and a failed one isn't retried past it.
+   /// Requests that have been sent are not interrupted, see setTimeout(..).
+   /// 0 means no deadline (the default).
+
+   void             setDeadline( long deadline );
+
+   ///@brief Sets the priority class of async requests (ASYNC_PRIORITY_NORMAL
+   /// by default).
+   ///@details Requests waiting for the concurrency limit of their AsyncMan
+   /// are admitted higher classes first. Per-class caps and reservations
+   /// take effect if the AsyncMan has a priority policy, see
+   /// AsyncMan::setPriorityPolicy(..).
+
+   void             setPriority( AsyncPriority priority );
+
+   ///@brief Sets the retry policy of requests, NULL disables retries (the
+   /// default).
+   ///@details Transient failures (see S3RetryPolicy) are retried without
+   /// returning to the caller: async requests are retried by the background
+   /// thread of their AsyncMan after the delay, so the caller sees only the
+   /// final outcome in completeXXX(..); sync requests sleep in the calling
+   /// thread. Buffers are uploaded again from the start; custom uploaders
+   /// and loaders must support onRewind() to be retried once they have
+   /// transferred a part of the payload. The policy is copied.
+
+   void             setRetryPolicy( const S3RetryPolicy *policy );
+
    /// Enables HTTP tracing.
 
    void             enableTracing( TraceCallback *traceCallback ) { m_traceCallback = traceCallback; }
 
+   ///@brief Enables tracing of slow and failed requests, NULL to disable.
+   ///@details Header and text events of each request are buffered (up to 16KB,
+   /// data events are skipped) and passed to <b>traceCallback</b> when the
+   /// request completes only if it failed or its transfer took at least
+   /// <b>latencyThreshold</b> milliseconds. Async requests share the memory
+   /// budget of their AsyncMan (see AsyncMan::setSlowTraceBudget(..)), the
+   /// rest of a trace that doesn't fit is dropped. The callback is called by
+   /// the thread completing the request. enableTracing(..) takes precedence.
+
+   void             enableSlowRequestTracing( TraceCallback *traceCallback, long latencyThreshold )
+                        { m_slowTraceCallback = traceCallback; m_slowTraceThreshold = latencyThreshold; }
+
+   ///@brief Records all subsequent requests to the given recorder, NULL to stop.
+   ///@details The connection doesn't own the recorder, it must outlive the
+   /// connection or be detached first.
+
+   void             setTraceRecorder( S3TraceRecorder *recorder ) { m_traceRecorder = recorder; }
+
+   ///@brief Enables hedging of gets into a buffer, NULL <b>policy</b> to disable.
+   ///@details While completeGet(..) waits for a get pended with pendGet(..),
+   /// it duplicates the get on <b>hedgeConnection</b> if the policy says so
+   /// (see S3HedgePolicy), takes whichever request succeeds first and
+   /// cancels the other. The duplicate downloads into its own buffer, the
+   /// content is copied if it wins. Sync gets into a buffer are hedged too
+   /// if <b>asyncMan</b> is given: they are run as async gets on it.
+   /// Hedges are issued only when the caller waits in completeGet(..), not
+   /// in waitAny(..). The <b>hedgeConnection</b> must not be used for
+   /// anything else, the connection doesn't own it nor the policy.
+
+   void             setHedging( S3HedgePolicy *policy, S3Connection *hedgeConnection,
+                        AsyncMan *asyncMan = NULL );
+
+   ///@brief Spreads the connection across the addresses of the endpoint, NULL
+   /// to disable.
+   ///@details Each request connects to the address the set assigns to the
+   /// connection (see S3EndpointSet) and reports its outcome and latency to
+   /// it. The set must be created with the same config and outlive the
+   /// connection or be detached first. Ignored if the connection uses a
+   /// proxy.
+
+   void             setEndpoints( S3EndpointSet *endpoints );
+
 private:
+    friend class internal::S3HotPaths;
+
                     S3Connection( const S3Connection & );  // forbidden
      S3Connection & operator=( const S3Connection & );  // forbidden
 
@@ -724,6 +1199,8 @@ private:
                         const char *keySuffix = NULL, const char *contentType = NULL, 
                         bool makePublic = false, bool useSrvEncrypt = false, size_t low = 0, size_t high = 0);
 
+    unsigned long long pendDeadline() const;  // nofail
+
     void            put( S3Request *request, const char *bucketName, const char *key, 
                         const char *uploadId, int partNumber, 
                         bool makePublic, bool useSrvEncrypt, const char *contentType,
@@ -732,6 +1209,11 @@ private:
     void            del( const char *bucketName, const char *key, const char *keySuffix, 
                         S3DelResponse *response );
 
+    void            startHedgedGet( AsyncMan *asyncMan, const char *bucketName, const char *key,
+                        void *buffer, size_t size, size_t offset );
+    void            completeHedgedGet( S3GetResponse *response );
+    void            completeHedgedGet( bool hedge, S3GetResponse *response );
+
     std::string     m_accKey;
     std::string     m_secKey;
     std::string     m_baseUrl;
@@ -743,6 +1225,9 @@ private:
 
     char            m_errorBuffer[ 256 ];
     TraceCallback * m_traceCallback;
+    S3TraceRecorder *m_traceRecorder;
+    TraceCallback * m_slowTraceCallback;
+    long            m_slowTraceThreshold;   // in milliseconds
 
     internal::AsyncCurl m_curl;
 
@@ -750,12 +1235,208 @@ private:
 
     S3Request *     m_asyncRequest;
 
+    // Hedging.
+
+    S3HedgePolicy * m_hedgePolicy;
+    S3Connection *  m_hedgeConnection;
+    AsyncMan *      m_hedgeAsyncMan;
+    internal::HedgeGet *m_hedgeGet;     // the pended get, NULL before the first one
+
+    // Endpoint addresses.
+
+    S3EndpointSet * m_endpoints;
+    unsigned long long m_endpointId;    // the assigned address, 0 if none
+
     // Timeouts.
 
     long            m_timeout;          // in milliseconds
     long            m_connectTimeout;   // in milliseconds
+    long            m_firstByteTimeout; // in milliseconds
+    long            m_deadline;         // in milliseconds
+    AsyncPriority   m_priority;
+
+    // Low-speed limit.
+
+    long            m_lowSpeedLimit;    // in bytes per second
+    long            m_lowSpeedTime;     // in seconds
+    bool            m_lastRequestStalled;
+
+    // Retries.
+
+    S3RetryPolicy   m_retryPolicy;
+    unsigned int    m_lastRequestRetries;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief Counters of an S3ConnectionPool.
+
+struct S3ConnectionPoolStats
+{
+                    S3ConnectionPoolStats();
+
+    /// Connections in the pool, the ones not acquired and the ones believed
+    /// to hold an established connection to the server.
+
+    size_t          size;
+    size_t          idle;
+    size_t          warm;
+
+    /// Warm-up and keep-alive requests issued by the pool and the failed ones.
+
+    unsigned long long refreshes;
+    unsigned long long failures;
+};
+
+inline
+S3ConnectionPoolStats::S3ConnectionPoolStats()
+    : size( 0 )
+    , idle( 0 )
+    , warm( 0 )
+    , refreshes( 0 )
+    , failures( 0 )
+{
+}
+
+///@brief A pool of S3Connections kept connected to the server.
+///@details The first request on a fresh connection pays DNS, TCP and TLS
+/// setup. The pool establishes its <b>size</b> connections ahead of the
+/// workload with warmUp() and, if <b>refreshInterval</b> (in milliseconds)
+/// isn't 0, a background task keeps them warm: a connection left idle for
+/// half the interval is refreshed, so none stays idle for the whole
+/// interval. Keep it below the server's keep-alive timeout (S3 drops idle
+/// connections after about 20 seconds). Warm-up and refreshes get a missing
+/// key from <b>bucketName</b>, a cheap request that leaves the connection
+/// in curl's cache.
+/// If <b>asyncMan</b> is given, the connections are meant for async requests
+/// on it: warm-up and refreshes are pended on it in parallel and the
+/// established connections are kept by its connection cache, shared by
+/// all its requests. Otherwise they are run as sync requests one by one
+/// and each S3Connection keeps its own connection.
+/// The connections are spread across <b>endpoints</b> if given, see
+/// S3Connection::setEndpoints(..).
+/// Throws if the background task cannot be started.
+///@remark Thread-safety: the methods are thread safe, an acquired connection
+/// is used by one thread at a time as usual.
+
+class S3ConnectionPool
+{
+public:
+    enum { c_defaultRefreshInterval = 15000 };  // msecs
+
+                    S3ConnectionPool( const S3Config &config, size_t size, const char *bucketName,
+                        AsyncMan *asyncMan = NULL,
+                        unsigned int refreshInterval = c_defaultRefreshInterval,
+                        S3EndpointSet *endpoints = NULL );
+
+   ///@brief Stops the background task, all connections must be released.
+
+                    ~S3ConnectionPool();
+
+   ///@brief Establishes the idle connections that aren't warm yet.
+   ///@details Blocks till the warm-up requests complete, failures are
+   /// counted in the stats. Returns the number of warm connections.
+
+   size_t           warmUp();  // nofail
+
+   ///@brief Takes a connection out of the pool, warm ones first.
+   ///@details Returns NULL if all connections are acquired or being
+   /// refreshed. The connection must be given back with release(..).
+
+   S3Connection *   acquire();  // nofail
+
+   ///@brief Gives back a connection taken with acquire(), it must have no
+   /// pending async request.
+
+   void             release( S3Connection *connection );  // nofail
+
+   void             getStats( S3ConnectionPoolStats *stats /* out */ ) const;  // nofail
+
+private:
+                    S3ConnectionPool( const S3ConnectionPool & );  // forbidden
+   S3ConnectionPool &operator=( const S3ConnectionPool & );  // forbidden
+
+   internal::ConnectionPool *m_pool;
+};
+
+namespace internal
+{
+
+//////////////////////////////////////////////////////////////////////////////
+///@brief INTERNAL: S3HotPaths -- CPU-bound parts of S3Connection requests.
+///@details Runs request signing, header and URL composition and response
+/// parsing on canned data without any network I/O, so that per-request
+/// overhead of the client can be measured in isolation (see s3micro).
+/// Each <b>headers</b> array contains complete header lines, starting with
+/// the status line, as curl would pass them to the header callback.
+
+class S3HotPaths
+{
+public:
+                    S3HotPaths( const S3Config &config );
+
+    void            calcSignature( const char *action, const char *bucketName, const char *key,
+                        const char *date, std::string *signature /* out */ );
+
+    // Builds the request header list, returns the number of headers.
+
+    size_t          setRequestHeaders( const char *action, const char *bucketName, const char *key,
+                        size_t low = 0, size_t high = 0 );
+
+    void            composeUrl( const char *bucketName, const char *key, std::string *url /* out */ );
+
+    void            parseGetResponse( const char * const *headers, size_t headerCount,
+                        const void *body, size_t bodySize, void *buffer, size_t bufferSize,
+                        S3GetResponse *response /* out */ );
+
+    // Feeds the xml <b>body</b> in <b>chunkSize</b> pieces.
+
+    void            parseListObjectsResponse( const char * const *headers, size_t headerCount,
+                        const char *body, size_t bodySize, size_t chunkSize,
+                        S3ObjectEnum *objectEnum, S3ListObjectsResponse *response /* out */ );
+
+private:
+                    S3HotPaths( const S3HotPaths & );  // forbidden
+    S3HotPaths &    operator=( const S3HotPaths & );  // forbidden
+
+    static void     feedHeaders( S3Request *request, const char * const *headers, size_t headerCount );
+
+    S3Connection    m_conn;
 };
 
+#ifdef DEBUG
+//////////////////////////////////////////////////////////////////////////////
+///@brief INTERNAL: S3EndpointProbe -- address steering of S3EndpointSet.
+///@details Runs the steering on a fixed list of <b>addresses</b> instead of
+/// resolving a host, with the time passed in, so that assignment and
+/// avoidance can be unit tested (see s3dbg). <b>now</b> is in milliseconds
+/// on any clock that doesn't go back.
+
+class S3EndpointProbe
+{
+public:
+    explicit        S3EndpointProbe( const std::vector< std::string > &addresses );
+                    ~S3EndpointProbe();
+
+    // Returns the id of the assigned address, <b>connectTo</b> is the
+    // CURLOPT_CONNECT_TO entry.
+
+    unsigned long long assign( unsigned long long endpointId, unsigned long long now,
+                        std::string *connectTo /* out */ );
+    void            release( unsigned long long endpointId );  // nofail
+    void            record( unsigned long long endpointId, bool failed, unsigned long long firstByteTime,
+                        unsigned long long now );  // nofail
+    void            getStats( std::vector< S3EndpointStats > *stats /* out */ );
+
+private:
+                    S3EndpointProbe( const S3EndpointProbe & );  // forbidden
+    S3EndpointProbe & operator=( const S3EndpointProbe & );  // forbidden
+
+    EndpointState * m_state;
+};
+#endif
+
+}  // namespace internal
+
 }  // namespace webstor
 
 #endif // !INCLUDED_S3CONN_H
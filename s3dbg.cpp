@@ -91,6 +91,192 @@ dbgAssertS3MultipartUploads( const S3MultipartUpload *actual,
     }
 }
 
+void
+dbgTestLatencyHistogram()
+{
+    LatencyHistogram histogram;
+
+    dbgAssert( histogram.count() == 0 );
+    dbgAssert( histogram.percentile( 50 ) == 0 );
+
+    // Small values are exact.
+
+    for( UInt64 i = 1; i <= 100; ++i )
+    {
+        histogram.record( i );
+    }
+
+    dbgAssert( histogram.count() == 100 );
+    dbgAssert( histogram.min() == 1 );
+    dbgAssert( histogram.max() == 100 );
+    dbgAssert( histogram.percentile( 50 ) == 50 );
+    dbgAssert( histogram.percentile( 99 ) == 99 );
+    dbgAssert( histogram.percentile( 100 ) == 100 );
+    dbgAssert( histogram.mean() == 50.5 );
+
+    // Large values are within 1%.
+
+    LatencyHistogram large;
+
+    for( UInt64 i = 1; i <= 1000; ++i )
+    {
+        large.record( i * 1000 );
+    }
+
+    UInt64 p90 = large.percentile( 90 );
+    dbgAssert( p90 >= 900000 && p90 <= 909000 );
+    dbgAssert( large.percentile( 100 ) == 1000000 );
+
+    // Out of range values are clamped but max is preserved.
+
+    large.record( LatencyHistogram::c_maxValue * 2 );
+    dbgAssert( large.max() == LatencyHistogram::c_maxValue * 2 );
+    dbgAssert( large.percentile( 100 ) == large.max() );
+
+    // Merge.
+
+    histogram.merge( large );
+    dbgAssert( histogram.count() == 1101 );
+    dbgAssert( histogram.min() == 1 );
+    dbgAssert( histogram.max() == large.max() );
+    dbgAssert( histogram.percentile( 5 ) == 55 );
+
+    // Raw state round trip.
+
+    LatencyHistogram copy;
+    copy.assign( histogram.counters(), histogram.min(), histogram.max(), histogram.sum() );
+    dbgAssert( copy.count() == histogram.count() );
+    dbgAssert( copy.mean() == histogram.mean() );
+    dbgAssert( copy.percentile( 5 ) == 55 );
+    dbgAssert( copy.percentile( 100 ) == histogram.max() );
+
+    histogram.reset();
+    dbgAssert( histogram.count() == 0 && histogram.max() == 0 );
+}
+
+void
+dbgTestEndpointState()
+{
+    std::vector< std::string > addresses;
+    addresses.push_back( "::1" );
+    addresses.push_back( "10.0.0.2" );
+    addresses.push_back( "10.0.0.1" );
+    addresses.push_back( "10.0.0.2" );
+
+    S3EndpointProbe probe( addresses );
+    std::vector< S3EndpointStats > stats;
+    std::string connectTo;
+    UInt64 now = 1000;
+
+    // Addresses are sorted and deduplicated, connections spread over them.
+
+    probe.getStats( &stats );
+    dbgAssert( stats.size() == 3 );
+    dbgAssert( stats[ 0 ].address == "10.0.0.1" && stats[ 1 ].address == "10.0.0.2" && stats[ 2 ].address == "::1" );
+
+    UInt64 id1 = probe.assign( 0, now, &connectTo );
+    dbgAssert( id1 && connectTo == "::10.0.0.1:" );
+    UInt64 id2 = probe.assign( 0, now, &connectTo );
+    dbgAssert( id2 && id2 != id1 && connectTo == "::10.0.0.2:" );
+    UInt64 id3 = probe.assign( 0, now, &connectTo );
+    dbgAssert( id3 && id3 != id1 && id3 != id2 && connectTo == "::[::1]:" );
+
+    // A connection keeps its address.
+
+    dbgAssert( probe.assign( id1, now, &connectTo ) == id1 && connectTo == "::10.0.0.1:" );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].connections == 1 && stats[ 1 ].connections == 1 && stats[ 2 ].connections == 1 );
+
+    // Failures are only counted in a row.
+
+    for( int i = 1; i < S3EndpointSet::c_maxFailures; ++i )
+    {
+        probe.record( id1, true, 0, now );
+    }
+
+    probe.record( id1, false, 1000, now );
+    probe.record( id1, true, 0, now );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].requests == S3EndpointSet::c_maxFailures + 1 );
+    dbgAssert( stats[ 0 ].failures == S3EndpointSet::c_maxFailures );
+    dbgAssert( !stats[ 0 ].avoided );
+
+    // c_maxFailures in a row avoid the address, its connection moves to
+    // the first of the least loaded ones.
+
+    for( int i = 1; i < S3EndpointSet::c_maxFailures; ++i )
+    {
+        probe.record( id1, true, 0, now );
+    }
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].avoided );
+
+    dbgAssert( probe.assign( id1, now, &connectTo ) == id2 && connectTo == "::10.0.0.2:" );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].connections == 0 && stats[ 1 ].connections == 2 && stats[ 2 ].connections == 1 );
+
+    // An address c_slowFactor times slower than the fastest one is avoided,
+    // but only once both have enough samples.
+
+    for( int i = 0; i < S3EndpointSet::c_minSamples; ++i )
+    {
+        probe.record( id3, false, 1000 * S3EndpointSet::c_slowFactor + 1000, now );
+    }
+
+    probe.getStats( &stats );
+    dbgAssert( !stats[ 2 ].avoided );
+
+    for( int i = 0; i < S3EndpointSet::c_minSamples; ++i )
+    {
+        probe.record( id2, false, 1000, now );
+    }
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 1 ].latency == 1000 && !stats[ 1 ].avoided );
+    dbgAssert( !stats[ 2 ].avoided );
+
+    probe.record( id3, false, 1000 * S3EndpointSet::c_slowFactor + 1000, now );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 2 ].avoided );
+
+    // Usable addresses win over less loaded avoided ones.
+
+    dbgAssert( probe.assign( id3, now, &connectTo ) == id2 );
+    dbgAssert( probe.assign( 0, now + S3EndpointSet::c_avoidTime - 1, &connectTo ) == id2 );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].connections == 0 && stats[ 1 ].connections == 4 && stats[ 2 ].connections == 0 );
+
+    // After c_avoidTime avoided addresses get another chance with a clean
+    // record.
+
+    now += S3EndpointSet::c_avoidTime;
+
+    dbgAssert( probe.assign( 0, now, &connectTo ) == id1 );
+    dbgAssert( probe.assign( 0, now, &connectTo ) == id3 );
+
+    probe.getStats( &stats );
+    dbgAssert( !stats[ 0 ].avoided && !stats[ 2 ].avoided );
+    dbgAssert( stats[ 2 ].latency == 0 );
+    dbgAssert( stats[ 0 ].connections == 1 && stats[ 1 ].connections == 4 && stats[ 2 ].connections == 1 );
+
+    // A single failure doesn't avoid it again, connections stay.
+
+    probe.record( id1, true, 0, now );
+    dbgAssert( probe.assign( id1, now, &connectTo ) == id1 );
+
+    probe.release( id1 );
+    probe.release( id3 );
+
+    probe.getStats( &stats );
+    dbgAssert( stats[ 0 ].connections == 0 && stats[ 2 ].connections == 0 );
+}
+
 void
 dbgTestS3Connection()
 {
@@ -595,6 +781,8 @@ main( int argc, char **argv )
 
     try
     {
+        DBG_RUN_UNIT_TEST( dbgTestLatencyHistogram );
+        DBG_RUN_UNIT_TEST( dbgTestEndpointState );
         DBG_RUN_UNIT_TEST( dbgTestS3Connection );
     }
     catch( const std::exception &e )
@@ -0,0 +1,402 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Converts binary event traces (see evtrace.h) to Chrome trace JSON:
+//
+//   s3bench get ... -evt run.evt
+//   s3evtrace run.evt > run.json
+//
+// Open the result in chrome://tracing or ui.perfetto.dev.  Each request is
+// an async slice from pend to completion on the track of the AsyncLoop that
+// ran it, split into 'queued' (pend to add), 'waiting' (add to the first
+// byte) and 'transfer' (first byte to completion), so overlapping requests
+// of a loop are shown side by side.  Each retry of a request is a slice of
+// its own, starting when the loop adds it back.  Loop wakeups and dropped events are
+// instant events on the thread tracks.  Each recording in the file (tracing
+// restarted or several processes appending to the same file) becomes its
+// own process.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "evtrace.h"
+#include "sysutils.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace webstor::internal;
+
+static void
+usage()
+{
+    std::cout <<
+        "s3evtrace trace [trace ...]                                                    \n"
+        "                                                                               \n"
+        "Converts binary event traces recorded with startEventTrace(..) (e.g. s3bench   \n"
+        "-evt) to Chrome trace JSON on stdout.                                          \n";
+}
+
+// Events of one recording.
+
+typedef std::vector< EvTraceEvent > Recording;
+
+static bool
+isEarlier( const EvTraceEvent &a, const EvTraceEvent &b )
+{
+    return a.timestamp < b.timestamp;
+}
+
+static bool
+load( const char *path, std::vector< Recording > *recordings )
+{
+    dbgAssert( path );
+    dbgAssert( recordings );
+
+    FILE *file = fopen( path, "rb" );
+
+    if( !file )
+    {
+        std::cerr << "Cannot open " << path << "." << std::endl;
+        return false;
+    }
+
+    // A file may contain several recordings, each starts with a header.
+
+    bool ok = true;
+    EvTraceEvent event;
+    CASSERT( sizeof( EvTraceHeader ) < sizeof( event ) );
+
+    while( fread( &event, sizeof( EvTraceHeader ), 1, file ) == 1 )
+    {
+        const EvTraceHeader &header = reinterpret_cast< const EvTraceHeader & >( event );
+
+        if( !memcmp( header.magic, "WSEVTR02", sizeof( header.magic ) ) )
+        {
+            if( header.eventSize != sizeof( EvTraceEvent ) )
+            {
+                std::cerr << path << " is recorded on an incompatible platform." << std::endl;
+                ok = false;
+                break;
+            }
+
+            recordings->push_back( Recording() );
+            continue;
+        }
+
+        char *rest = reinterpret_cast< char * >( &event ) + sizeof( EvTraceHeader );
+
+        if( recordings->empty() ||
+            fread( rest, sizeof( event ) - sizeof( EvTraceHeader ), 1, file ) != 1 )
+        {
+            std::cerr << path << " is not an event trace or is truncated." << std::endl;
+            ok = false;
+            break;
+        }
+
+        recordings->back().push_back( event );
+    }
+
+    fclose( file );
+    return ok;
+}
+
+// Chrome trace timestamps are in microseconds, events are recorded in
+// nanoseconds: print them as fixed point to keep the sub-microsecond part.
+
+#define TS_FMT "%llu.%03llu"
+#define TS_ARGS( ns ) ( ns ) / 1000, ( ns ) % 1000
+
+// Request being converted.
+
+struct Span
+{
+                    Span() : pend( 0 ), add( 0 ), firstByte( 0 ), loopThread( -1 ) {}
+
+    UInt64          pend;
+    UInt64          add;
+    UInt64          firstByte;
+    int             loopThread;
+};
+
+class Converter
+{
+public:
+                    Converter() : m_pid( 0 ), m_spanId( 0 ), m_first( true ) {}
+
+    void            begin();
+    void            convert( Recording *recording );
+    void            end();
+
+private:
+    void            emitSpan( const Span &span, UInt64 end, const char *result, UInt64 handle );
+    void            emitAsync( const char *name, const char *phase, int thread, UInt64 ts,
+                        const char *loop );
+    void            emitInstant( const char *name, int thread, UInt64 ts, const char *argName,
+                        UInt64 arg );
+    void            emitThreadName( int thread, const char *name );
+    void            separate();
+
+    int             m_pid;
+    UInt64          m_spanId;
+    bool            m_first;
+    std::map< int, int > m_loops;   // thread => AsyncLoop number
+};
+
+void
+Converter::begin()
+{
+    printf( "{\"traceEvents\":[\n" );
+}
+
+void
+Converter::end()
+{
+    printf( "\n],\"displayTimeUnit\":\"ms\"}\n" );
+}
+
+void
+Converter::separate()
+{
+    if( !m_first )
+    {
+        printf( ",\n" );
+    }
+
+    m_first = false;
+}
+
+void
+Converter::emitThreadName( int thread, const char *name )
+{
+    separate();
+    printf( "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+        m_pid, thread, name );
+}
+
+void
+Converter::emitAsync( const char *name, const char *phase, int thread, UInt64 ts, const char *loop )
+{
+    separate();
+    printf( "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":" TS_FMT "}",
+        name, loop, phase, m_spanId, m_pid, thread, TS_ARGS( ts ) );
+}
+
+void
+Converter::emitInstant( const char *name, int thread, UInt64 ts, const char *argName, UInt64 arg )
+{
+    separate();
+    printf( "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":" TS_FMT ","
+        "\"args\":{\"%s\":%llu}}",
+        name, m_pid, thread, TS_ARGS( ts ), argName, arg );
+}
+
+void
+Converter::emitSpan( const Span &span, UInt64 end, const char *result, UInt64 handle )
+{
+    // Use the loop name as the category, so that requests of the same loop
+    // share a track.
+
+    char loop[ 32 ] = "request";
+
+    if( span.loopThread >= 0 )
+    {
+        snprintf( loop, sizeof( loop ), "AsyncLoop %d", m_loops[ span.loopThread ] );
+    }
+
+    UInt64 start = span.pend ? span.pend : span.add;
+    int thread = span.loopThread >= 0 ? span.loopThread : 0;
+
+    ++m_spanId;
+
+    separate();
+    printf( "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"b\",\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":" TS_FMT ","
+        "\"args\":{\"handle\":\"0x%llx\",\"result\":\"%s\"}}",
+        loop, loop, m_spanId, m_pid, thread, TS_ARGS( start ), handle, result );
+
+    if( span.pend && span.add )
+    {
+        emitAsync( "queued", "b", thread, span.pend, loop );
+        emitAsync( "queued", "e", thread, span.add, loop );
+    }
+
+    if( span.add )
+    {
+        UInt64 firstByte = span.firstByte ? span.firstByte : end;
+        emitAsync( "waiting", "b", thread, span.add, loop );
+        emitAsync( "waiting", "e", thread, firstByte, loop );
+
+        if( span.firstByte )
+        {
+            emitAsync( "transfer", "b", thread, span.firstByte, loop );
+            emitAsync( "transfer", "e", thread, end, loop );
+        }
+    }
+
+    emitAsync( loop, "e", thread, end, loop );
+}
+
+void
+Converter::convert( Recording *recording )
+{
+    dbgAssert( recording );
+
+    ++m_pid;
+    m_loops.clear();
+
+    // Rings are flushed one by one, restore the global order.
+
+    std::stable_sort( recording->begin(), recording->end(), isEarlier );
+
+    std::map< UInt64, Span > spans;  // handle => request
+    std::map< int, bool > threads;
+
+    for( size_t i = 0; i < recording->size(); ++i )
+    {
+        const EvTraceEvent &event = ( *recording )[ i ];
+        int thread = event.thread;
+
+        if( !threads.count( thread ) )
+        {
+            threads[ thread ] = true;
+
+            if( event.type != EVT_LOOP_START && event.type != EVT_WAKE )
+            {
+                char name[ 32 ];
+                snprintf( name, sizeof( name ), "thread %d", thread );
+                emitThreadName( thread, name );
+            }
+        }
+
+        if( ( event.type == EVT_LOOP_START || event.type == EVT_WAKE ) && !m_loops.count( thread ) )
+        {
+            int loop = static_cast< int >( m_loops.size() + 1 );
+            m_loops[ thread ] = loop;
+
+            char name[ 32 ];
+            snprintf( name, sizeof( name ), "AsyncLoop %d", loop );
+            emitThreadName( thread, name );
+        }
+
+        switch( event.type )
+        {
+            case EVT_PEND:
+                spans[ event.id ] = Span();
+                spans[ event.id ].pend = event.timestamp;
+                break;
+
+            case EVT_ADD:
+            {
+                Span &span = spans[ event.id ];
+                span.add = event.timestamp;
+                span.loopThread = thread;
+
+                if( !m_loops.count( thread ) )
+                {
+                    int loop = static_cast< int >( m_loops.size() + 1 );
+                    m_loops[ thread ] = loop;
+                }
+                break;
+            }
+
+            case EVT_FIRST_BYTE:
+            {
+                // Sync requests are not pended, ignore them.
+
+                std::map< UInt64, Span >::iterator it = spans.find( event.id );
+
+                if( it != spans.end() && !it->second.firstByte )
+                {
+                    it->second.firstByte = event.timestamp;
+                }
+                break;
+            }
+
+            case EVT_COMPLETE:
+            case EVT_CANCEL:
+            case EVT_RETRY:
+            {
+                std::map< UInt64, Span >::iterator it = spans.find( event.id );
+
+                if( it != spans.end() )
+                {
+                    char result[ 32 ];
+
+                    if( event.type == EVT_CANCEL )
+                    {
+                        strcpy( result, "canceled" );
+                    }
+                    else if( event.type == EVT_RETRY )
+                    {
+                        snprintf( result, sizeof( result ), "retry in %llu ms", event.arg );
+                    }
+                    else
+                    {
+                        snprintf( result, sizeof( result ), "curl %llu", event.arg );
+                    }
+
+                    emitSpan( it->second, event.timestamp, result, event.id );
+                    spans.erase( it );
+                }
+                break;
+            }
+
+            case EVT_WAKE:
+                emitInstant( "wake", thread, event.timestamp, "actions", event.arg );
+                break;
+
+            case EVT_DROPPED:
+                emitInstant( "dropped", thread, event.timestamp, "events", event.arg );
+                break;
+        }
+    }
+}
+
+int
+main( int argc, char **argv )
+{
+    if( argc < 2 || !strcmp( argv[ 1 ], "-help" ) || !strcmp( argv[ 1 ], "--help" ) ||
+        !strcmp( argv[ 1 ], "-?" ) )
+    {
+        usage();
+        return argc < 2;
+    }
+
+    std::vector< Recording > recordings;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        if( !load( argv[ i ], &recordings ) )
+        {
+            return 1;
+        }
+    }
+
+    Converter converter;
+    converter.begin();
+
+    for( size_t i = 0; i < recordings.size(); ++i )
+    {
+        converter.convert( &recordings[ i ] );
+    }
+
+    converter.end();
+    return 0;
+}
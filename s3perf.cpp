@@ -22,8 +22,10 @@
 
 
 #include "s3conn.h"
+#include "s3stub.h"
 #include "sysutils.h"
 
+#include <curl/curl.h>
 #include <string.h>
 #include <algorithm>
 #include <fstream> 
@@ -57,8 +59,6 @@ static AsyncMan s_asyncMans[ 4 ];
 static const char s_key[] = "tmp/perf/test.dat";
 static const size_t  s_keyCount = 64;
 
-static double s_samples[ s_iterationCount ] = {};
-
 static UInt64 s_cooldown = 10 * SEC;
 
 
@@ -82,107 +82,63 @@ dbgRunUnitTest( void ( &fnTest )(), const char *name )
     }
 }
 
+// Fails the running test if 'condition' doesn't hold, also in release builds.
+
 static void
-diffs( double *samples, size_t *count )
+check( bool condition, const char *what )
 {
-    dbgAssert( samples );
-    dbgAssert( count && *count );
+    dbgAssert( what );
 
-    for( size_t i = 1; i < *count; ++i )
+    if( !condition )
     {
-        samples[ i - 1 ] = samples[ i ] - samples[ i - 1 ];
+        throw what;
     }
-
-    samples[ *count - 1 ] = 0;
-    --( *count );
 }
 
+static const char s_latencyColumns[] = "response(average in usecs)\tp50(usecs)\tp90(usecs)"
+    "\tp99(usecs)\tp99.9(usecs)\tmax(usecs)";
+
+static const double s_percentiles[] = { 50, 90, 99, 99.9 };
+
 static void
-dumpSamples( const char* test, double *samples, size_t count )
+dumpHistogram( const char* test, const LatencyHistogram &histogram )
 {
     dbgAssert( test );
-    dbgAssert( samples );
-    dbgAssert( count > 0 );
 
     if( s_dumpFile && s_dumpFile[ 0 ] )
     {
         std::fstream dump( s_dumpFile, std::fstream::out | std::fstream::app );
 
-        for( size_t i = 0; i < count; ++i )
-        {
-            dump << test << '\t' << i << '\t' << samples[ i ] << std::endl;
-        }
-    }
-}
-
-static double 
-average( const double *samples, size_t count )
-{
-    dbgAssert( samples );
-    dbgAssert( count > 0 );
-
-    double a = 0;
-
-    for( size_t i = 0; i < count; ++i )
-    {
-        a += samples[ i ];
-    }
-
-    return a / count;
-}
-
-static double 
-median( double *samples, size_t count )
-{
-    dbgAssert( samples );
-    dbgAssert( count > 0 );
-
-    std::sort( samples, samples + count );
-
-    size_t m = count / 2;
-    return ( count & 1 ) ?  samples[ m ] : ( samples[ m - 1 ] + samples[ m ] ) / 2;
-}
-
-
-static void 
-appendSample( double *samples, size_t size, size_t *current, double value )
-{
-    if( *current >= size )
-    {
-        // Shift elements.
-
-        for( size_t i = 1; i < size; ++i )
+        for( size_t i = 0; i < dimensionOf( s_percentiles ); ++i )
         {
-            samples[ i - 1 ] = samples[ i ];
+            dump << test << '\t' << s_percentiles[ i ] << '\t' 
+                << histogram.percentile( s_percentiles[ i ] ) << std::endl;
         }
 
-        samples[ size - 1 ] = value;
-    }
-    else
-    {
-        samples[ ( *current )++ ] = value;
+        dump << test << '\t' << 100 << '\t' << histogram.max() << std::endl;
     }
 }
 
 static void 
-print( const char *test, double *samples, size_t count, bool calcDiff = true )
+print( const char *test, const LatencyHistogram &histogram )
 {
     dbgAssert( test );
-    dbgAssert( samples );
 
-    if( count <= 1 )
+    if( !histogram.count() )
     {
          std::cout << test << "\t<empty>" << std::endl;
          return;
     }
 
-    if( calcDiff )
+    dumpHistogram( test, histogram );
+    std::cout << test << '\t' << histogram.mean();
+
+    for( size_t i = 0; i < dimensionOf( s_percentiles ); ++i )
     {
-        diffs( samples, &count );
+        std::cout << '\t' << histogram.percentile( s_percentiles[ i ] );
     }
 
-    dumpSamples( test, samples, count );
-    std::cout << test << "\t" << average( samples, count ) << '\t' << median( samples, count ) << std::endl;
+    std::cout << '\t' << histogram.max() << std::endl;
 }
 
 static void
@@ -544,7 +500,7 @@ perfTestS3Connection()
     // Test Single operation.
 
     std::cout << std::endl << "test response with a single connection." << std::endl;
-    std::cout << "name\tresponse(average in msecs)\tresponse(median in msecs)" << std::endl;
+    std::cout << "name\t" << s_latencyColumns << std::endl;
 
     static const Test tests[] = 
     { 
@@ -556,19 +512,22 @@ perfTestS3Connection()
         { "async_put_del", testAsyncPutDel }
     };
 
+    LatencyHistogram histogram;
+
     for( int t = 0; t < dimensionOf( tests ); ++t )
     {
-        stopwatch.start();
+        histogram.reset();
 
-        for( size_t i = 0; i < dimensionOf( s_samples ); ++i )
+        for( size_t i = 0; i < s_iterationCount; ++i )
         {
             // Use 1 connection.
 
+            stopwatch.start();
             dbgVerify( tests[ t ].test( 0, 0, i % s_keyCount, s_objectSize ) );
-            s_samples[ i ] = stopwatch.elapsed();
+            histogram.record( stopwatch.elapsedUs() );
         }
 
-        print( tests[ t ].name, s_samples, dimensionOf( s_samples ) );
+        print( tests[ t ].name, histogram );
 
         taskSleep( s_cooldown );
     }
@@ -576,18 +535,20 @@ perfTestS3Connection()
     // Test One AsyncMan vs. multiple AsyncMans.
 
     std::cout << std::endl << "test one AsyncMan vs. multiple AsyncMans." << std::endl;
-    std::cout << "name\tresponse(average in msecs)\tresponse(median in msecs)" << std::endl;
+    std::cout << "name\t" << s_latencyColumns << std::endl;
 
     static const char *tests2[] = { "async_put_one_async_man", "async_put_multiple_async_mans" };
 
-    stopwatch.start();
-
     for( int t = 0; t < dimensionOf( tests2 ); ++t )
     {
-        for( size_t i = 0; i < dimensionOf( s_samples ); ++i )
+        histogram.reset();
+
+        for( size_t i = 0; i < s_iterationCount; ++i )
         {
             size_t cons = std::min( dimensionOf( s_asyncMans ), dimensionOf( s_cons ) );
 
+            stopwatch.start();
+
             for( size_t c = 0; c < cons; ++c )
             {
                 testPendPut( c, ( t == 0 ? 0 : c ), i, s_objectSize );
@@ -597,10 +558,10 @@ perfTestS3Connection()
                 testCompletePut( c, ( t == 0 ? 0 : c ), i, s_objectSize );
             }
 
-            s_samples[ i ] = stopwatch.elapsed();
+            histogram.record( stopwatch.elapsedUs() );
         }
 
-        print( tests2[ t ], s_samples, dimensionOf( s_samples ) );
+        print( tests2[ t ], histogram );
 
         taskSleep( s_cooldown );
     }
@@ -609,7 +570,7 @@ perfTestS3Connection()
 
     std::cout << std::endl << "test response and throughput with multiple connections." << std::endl;
     std::cout << "name\tobjectSize(bytes)\tconnections\ttotal(bytes)\tbytes per sec\ttps(ops per sec)"
-        "\telapsed(msecs)\terrors\tkeyCount\tresponse(average in msecs)\tresponse(median in msecs)" << std::endl;
+        "\telapsed(msecs)\terrors\tkeyCount\t" << s_latencyColumns << std::endl;
 
     const size_t objectSizes[] = { 1 * MB, 4 * MB, 16 * MB, 64 * MB };
 
@@ -619,6 +580,10 @@ perfTestS3Connection()
         { "async_get", testPendGet, testCompleteGet } // reads the objects created by put.
     };
 
+    // Latencies of each test merged across all runs.
+
+    LatencyHistogram totals[ dimensionOf( tests3 ) ];
+
     const UInt64 testDuration = 1 * MINUTE;
 
     // Allocate a temp array to wait for completion.
@@ -636,7 +601,6 @@ perfTestS3Connection()
     for( int o = 0; o < dimensionOf( objectSizes ); ++o )
     {
         size_t objectSize = objectSizes[ o ];
-        size_t isample = 0;
 
         // Iterate through all connection counts.
 
@@ -651,12 +615,13 @@ perfTestS3Connection()
                 TestFunc testPend = tests3[ t ].test;
                 TestFunc testComplete = tests3[ t ].testComplete;
 
-                // Prepare samples.
+                // Prepare latency histograms, one per connection; they are
+                // merged when the run is finished.
 
-                memset( s_samples, 0, sizeof( s_samples ) );
-                size_t isample = 0;
+                std::vector< LatencyHistogram > conHistograms( c );
+                Stopwatch clock( true );
 
-                UInt64 conSamples[ dimensionOf( s_cons ) ] = {};
+                UInt64 conStarts[ dimensionOf( s_cons ) ] = {};
                 int conKeys[ dimensionOf( s_cons ) ] = {};
 
                 // Start async for all connections.
@@ -665,6 +630,7 @@ perfTestS3Connection()
 
                 for( int k = 0; k < c; ++k, ++key )
                 {
+                   conStarts[ k ] = clock.elapsedUs();
                    testPend( k, 0, key, objectSize );
                    conKeys[ k ] = key;
                 }
@@ -677,7 +643,7 @@ perfTestS3Connection()
 
                 // Run the current test for the 'testDuration'.
 
-                for(  ;( elapsed = stopwatch.elapsed() ) < testDuration; ++key )
+                for(  ;( elapsed = stopwatch.elapsedUs() ) < testDuration * 1000ULL; ++key )
                 {
                     if( putKeyCount != 0  && key >= putKeyCount )
                     {
@@ -700,10 +666,7 @@ perfTestS3Connection()
                     if( testComplete( k, 0, conKeys[ k ], objectSize ) )
                     {
                         total += objectSize;
-
-                        elapsed = stopwatch.elapsed();
-                        appendSample( s_samples, dimensionOf( s_samples ), &isample, elapsed - conSamples[ k ] );
-                        conSamples[ k ] = elapsed;
+                        conHistograms[ k ].record( clock.elapsedUs() - conStarts[ k ] );
                     }
                     else
                     {
@@ -712,6 +675,7 @@ perfTestS3Connection()
 
                     // Start a new.
 
+                    conStarts[ k ] = clock.elapsedUs();
                     testPend( k, 0, key, objectSize );
                     conKeys[ k ] = key;
                 }
@@ -734,9 +698,18 @@ perfTestS3Connection()
                 dbgAssert( total <= objectSize * key ); // it can be less because we don't count objects 
                                                         // after testDuration elapsed.
 
-                UInt64 bps = elapsed > 0 ? total * 1000ULL / elapsed : 0;  // bytes per second
+                UInt64 bps = elapsed > 0 ? total * 1000000ULL / elapsed : 0;  // bytes per second
                 UInt64 tps = bps / objectSize;
 
+                histogram.reset();
+
+                for( int k = 0; k < c; ++k )
+                {
+                    histogram.merge( conHistograms[ k ] );
+                }
+
+                totals[ t ].merge( histogram );
+
                 std::stringstream testName;
                 testName << tests3[ t ].name << '\t' 
                     << objectSize  << '\t' 
@@ -744,15 +717,1227 @@ perfTestS3Connection()
                     << total << '\t' 
                     << bps << '\t' 
                     << tps << '\t' 
-                    << elapsed << '\t'
+                    << elapsed / 1000.0 << '\t'
                     << errors << '\t'
                     << putKeyCount;
-                print( testName.str().c_str(), s_samples, isample, false /* calcDiffs */ );
+                print( testName.str().c_str(), histogram );
 
                 taskSleep( s_cooldown );
             }
         }
     }
+
+    // Summary across all object sizes and connection counts.
+
+    std::cout << std::endl << "response across all runs." << std::endl;
+    std::cout << "name\t" << s_latencyColumns << std::endl;
+
+    for( int t = 0; t < dimensionOf( tests3 ); ++t )
+    {
+        print( tests3[ t ].name, totals[ t ] );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Fault injection against the local S3 stand-in.
+
+static const size_t s_faultConnectionCount = 8;
+static const size_t s_faultObjectSize = 64 * KB;
+static const size_t s_faultKeyCount = 16;
+static const size_t s_faultOpCount = 400;
+static const long s_faultTimeout = 1 * SEC;
+
+static const char *const s_faultScenarios[] = 
+{ 
+    "baseline", "jitter", "tail", "throttled", "slow_down", "reset", "stall" 
+};
+
+static void
+getFaults( size_t scenario, S3StubFaults *faults )
+{
+    dbgAssert( faults );
+
+    *faults = S3StubFaults();
+
+    switch( scenario )
+    {
+        case 1:  // exponential jitter
+            faults->delayMs = 2;
+            faults->jitterMs = 10;
+            break;
+        case 2:  // heavy tail: 2% of requests are 100x slower
+            faults->delayMs = 2;
+            faults->slowPercent = 2;
+            faults->slowMs = 200;
+            break;
+        case 3:  // 1MB/s per connection
+            faults->bandwidth = 1 * MB;
+            break;
+        case 4:  // throttling
+            faults->slowDownPercent = 10;
+            break;
+        case 5:  // connection resets in the middle of the body
+            faults->resetPercent = 5;
+            break;
+        case 6:  // stalled first byte, longer than the client timeout
+            faults->stallPercent = 5;
+            faults->stallMs = 3 * s_faultTimeout;
+            break;
+    }
+}
+
+static bool
+completeFaultGet( S3Connection *con, Stopwatch *clock, UInt64 start, 
+    LatencyHistogram *histogram, UInt64 *retries )  // nofail
+{
+    dbgAssert( con );
+    dbgAssert( clock );
+    dbgAssert( histogram );
+    dbgAssert( retries );
+
+    try
+    {
+        S3GetResponse response;
+        con->completeGet( &response );
+        *retries += response.stats.retries;
+
+        if( response.loadedContentLength == s_faultObjectSize )
+        {
+            histogram->record( clock->elapsedUs() - start );
+            return true;
+        }
+    }
+    catch( ... )
+    {
+    }
+
+    return false;
+}
+
+// Keeps all connections busy with async gets till s_faultOpCount are done,
+// returns the number of failed gets (timeouts, 503 and reset connections
+// surface from completeGet).
+
+static size_t
+runFaultGets( S3Connection **cons, size_t count, AsyncMan *asyncMan, const char *bucketName,
+    LatencyHistogram *histogram, UInt64 *retries )  // nofail
+{
+    dbgAssert( cons );
+    dbgAssert( count && count <= s_faultConnectionCount );
+    dbgAssert( asyncMan );
+    dbgAssert( histogram );
+    dbgAssert( retries );
+
+    Stopwatch clock( true );
+    UInt64 conStarts[ s_faultConnectionCount ] = {};
+    size_t started = 0;
+    size_t errors = 0;
+
+    for( size_t k = 0; k < count; ++k, ++started )
+    {
+        conStarts[ k ] = clock.elapsedUs();
+        cons[ k ]->pendGet( asyncMan, bucketName, getKey( started % s_faultKeyCount ).c_str(), 
+            s_readBufs[ k ], s_objectSizeMax );
+    }
+
+    // Start a new get on each completed connection until all are started.
+
+    for( ; started < s_faultOpCount; ++started )
+    {
+        int k = S3Connection::waitAny( cons, count, started % count );
+        dbgAssert( k >= 0 && k < count );
+
+        if( !completeFaultGet( cons[ k ], &clock, conStarts[ k ], histogram, retries ) )
+        {
+            errors++;
+        }
+
+        conStarts[ k ] = clock.elapsedUs();
+        cons[ k ]->pendGet( asyncMan, bucketName, getKey( started % s_faultKeyCount ).c_str(), 
+            s_readBufs[ k ], s_objectSizeMax );
+    }
+
+    // Complete all.
+
+    for( size_t k = 0; k < count; ++k )
+    {
+        if( !completeFaultGet( cons[ k ], &clock, conStarts[ k ], histogram, retries ) )
+        {
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+// Config of a connection to the stand-in, 'port' keeps the port string.
+
+static S3Config
+getStubConfig( const S3Stub &stub, std::string *port )
+{
+    dbgAssert( port );
+
+    std::stringstream tmp;
+    tmp << stub.port();
+    *port = tmp.str();
+
+    S3Config config = {};
+    config.accKey = "perf";
+    config.secKey = "perf";
+    config.host = "127.0.0.1";
+    config.port = port->c_str();
+    config.isWalrus = true;
+    return config;
+}
+
+void
+perfTestFaultInjection()
+{
+    // Start the stand-in on a free port and populate test data.
+
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    const std::string data( s_faultObjectSize, 'x' );
+
+    for( size_t i = 0; i < s_faultKeyCount; ++i )
+    {
+        stub.putObject( bucketName, getKey( i ), data );
+    }
+
+    AsyncMan asyncMan;
+    std::auto_ptr< S3Connection > faultCons[ s_faultConnectionCount ];
+    S3Connection *cons[ s_faultConnectionCount ] = {};
+
+    for( size_t i = 0; i < dimensionOf( faultCons ); ++i )
+    {
+        faultCons[ i ].reset( new S3Connection( config ) );
+        faultCons[ i ]->setTimeout( s_faultTimeout );
+        cons[ i ] = faultCons[ i ].get();
+    }
+
+    std::cout << std::endl << "test async gets with injected faults." << std::endl;
+    std::cout << "name\tconnections\tops\terrors\tslow\tslowDowns\tresets\tstalls\t"
+        << s_latencyColumns << std::endl;
+
+    for( size_t s = 0; s < dimensionOf( s_faultScenarios ); ++s )
+    {
+        S3StubFaults faults;
+        getFaults( s, &faults );
+        stub.setFaults( faults );
+        stub.resetStats();
+
+        LatencyHistogram histogram;
+        UInt64 retries = 0;
+        size_t errors = runFaultGets( cons, dimensionOf( cons ), &asyncMan, bucketName, 
+            &histogram, &retries );
+
+        S3StubStats stats = stub.stats();
+
+        std::stringstream testName;
+        testName << s_faultScenarios[ s ] << '\t'
+            << dimensionOf( cons ) << '\t'
+            << s_faultOpCount << '\t'
+            << errors << '\t'
+            << stats.slowRequests << '\t'
+            << stats.slowDowns << '\t'
+            << stats.resets << '\t'
+            << stats.stalls;
+        print( testName.str().c_str(), histogram );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Retries: the failing fault scenarios again, with a retry policy. Every
+// injected fault fails one attempt, which must be retried, so all gets
+// succeed and their retries add up to the injected faults.
+
+static const unsigned int s_retryMaxAttempts = 8;
+
+void
+perfTestRetries()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    const std::string data( s_faultObjectSize, 'x' );
+
+    for( size_t i = 0; i < s_faultKeyCount; ++i )
+    {
+        stub.putObject( bucketName, getKey( i ), data );
+    }
+
+    S3RetryPolicy policy;
+    policy.maxAttempts = s_retryMaxAttempts;
+    policy.baseDelay = 10;
+    policy.maxDelay = 100;
+
+    AsyncMan asyncMan;
+    std::auto_ptr< S3Connection > faultCons[ s_faultConnectionCount ];
+    S3Connection *cons[ s_faultConnectionCount ] = {};
+
+    for( size_t i = 0; i < dimensionOf( faultCons ); ++i )
+    {
+        faultCons[ i ].reset( new S3Connection( config ) );
+        faultCons[ i ]->setTimeout( s_faultTimeout );
+        faultCons[ i ]->setRetryPolicy( &policy );
+        cons[ i ] = faultCons[ i ].get();
+    }
+
+    std::cout << std::endl << "test async gets with injected faults and retries." << std::endl;
+    std::cout << "name\tconnections\tops\terrors\tfaults\tretries\t"
+        << s_latencyColumns << std::endl;
+
+    for( size_t s = 0; s < dimensionOf( s_faultScenarios ); ++s )
+    {
+        S3StubFaults faults;
+        getFaults( s, &faults );
+
+        if( !faults.slowDownPercent && !faults.resetPercent && !faults.stallPercent )
+        {
+            continue;
+        }
+
+        stub.setFaults( faults );
+        stub.resetStats();
+
+        LatencyHistogram histogram;
+        UInt64 retries = 0;
+        size_t errors = runFaultGets( cons, dimensionOf( cons ), &asyncMan, bucketName, 
+            &histogram, &retries );
+
+        S3StubStats stats = stub.stats();
+        UInt64 injected = stats.slowDowns + stats.resets + stats.stalls;
+
+        std::stringstream testName;
+        testName << s_faultScenarios[ s ] << '\t'
+            << dimensionOf( cons ) << '\t'
+            << s_faultOpCount << '\t'
+            << errors << '\t'
+            << injected << '\t'
+            << retries;
+        print( testName.str().c_str(), histogram );
+
+        check( errors == 0, "a get failed in spite of retries" );
+        check( injected > 0, "no faults injected" );
+        check( retries == injected, "retries don't match the injected faults" );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// First-byte deadline and low-speed limit without an overall timeout: a put
+// uploading for longer than the deadline over a throttled connection must
+// succeed, puts aren't subject to the deadline; a get whose response stalls
+// and a get slower than the low-speed limit must be aborted as stalled.
+
+static const long s_deadlineFirstByteTimeout = 500;
+static const size_t s_deadlinePutSize = 2 * MB;
+static const long s_deadlineLowSpeed = 64 * KB;  // bytes per second
+static const long s_deadlineLowSpeedTime = 1;  // in seconds
+
+void
+perfTestFirstByteDeadline()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    S3Connection con( config );
+    con.setTimeout( 0 );
+    con.setFirstByteTimeout( s_deadlineFirstByteTimeout );
+    con.setLowSpeedLimit( s_deadlineLowSpeed, s_deadlineLowSpeedTime );
+
+    std::cout << std::endl << "test first-byte deadline of " << s_deadlineFirstByteTimeout 
+        << " msecs and low-speed limit of " << s_deadlineLowSpeed << " bytes/s." << std::endl;
+    std::cout << "name	size	msecs	stalled" << std::endl;
+
+    // Throttled put: the upload alone takes about 2 seconds.
+
+    S3StubFaults faults;
+    faults.bandwidth = 1 * MB;
+    stub.setFaults( faults );
+
+    const std::string data( s_deadlinePutSize, 'x' );
+    S3RequestStats stats;
+    Stopwatch clock( true );
+    bool failed = false;
+
+    try
+    {
+        con.put( "perf", "deadline", data.data(), data.size() );
+    }
+    catch( ... )
+    {
+        printError( &con );
+        failed = true;
+    }
+
+    con.getLastRequestStats( &stats );
+    std::cout << "throttled_put	" << data.size() << '	' << clock.elapsed() << '	' 
+        << stats.stalled << std::endl;
+
+    check( !failed && !stats.stalled, "throttled put aborted by the first-byte deadline" );
+    check( clock.elapsed() > static_cast< UInt64 >( s_deadlineFirstByteTimeout ), 
+        "put is not throttled" );
+
+    // Stalled get: the response is held for longer than the deadline.
+
+    faults = S3StubFaults();
+    faults.stallPercent = 100;
+    faults.stallMs = 4 * s_deadlineFirstByteTimeout;
+    stub.setFaults( faults );
+
+    clock.start();
+    failed = false;
+
+    try
+    {
+        con.get( "perf", "deadline", s_readBufs[ 0 ], s_objectSizeMax );
+    }
+    catch( ... )
+    {
+        failed = true;
+    }
+
+    con.getLastRequestStats( &stats );
+    std::cout << "stalled_get	" << 0 << '	' << clock.elapsed() << '	' 
+        << stats.stalled << std::endl;
+
+    check( failed && stats.stalled, "stalled get isn't aborted by the first-byte deadline" );
+
+    // Slow get: the response body comes at a quarter of the low-speed limit.
+
+    faults = S3StubFaults();
+    faults.bandwidth = s_deadlineLowSpeed / 4;
+    stub.setFaults( faults );
+
+    clock.start();
+    failed = false;
+
+    try
+    {
+        con.get( "perf", "deadline", s_readBufs[ 0 ], s_objectSizeMax );
+    }
+    catch( ... )
+    {
+        failed = true;
+    }
+
+    con.getLastRequestStats( &stats );
+    std::cout << "slow_get\t" << 0 << '\t' << clock.elapsed() << '\t' 
+        << stats.stalled << std::endl;
+
+    check( failed && stats.stalled, "slow get isn't aborted by the low-speed limit" );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Hedging: sync gets hedged on a second connection. Once the delay is
+// sampled, slow and stalled first bytes must be hedged within the budget,
+// and a get won by its hedge must return the content of the key asked for.
+
+static const size_t s_hedgeWarmUpCount = 128;
+static const size_t s_hedgeOpCount = 400;
+static const double s_hedgePercentile = 90;
+static const double s_hedgeMaxPercent = 5;
+
+void
+perfTestHedging()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+
+    for( size_t i = 0; i < s_faultKeyCount; ++i )
+    {
+        stub.putObject( bucketName, getKey( i ), std::string( s_faultObjectSize, 'a' + i ) );
+    }
+
+    S3HedgePolicy policy( s_hedgePercentile, s_hedgeMaxPercent );
+    AsyncMan asyncMan;
+    S3Connection hedgeCon( config );
+    S3Connection con( config );
+    con.setHedging( &policy, &hedgeCon, &asyncMan );
+
+    std::cout << std::endl << "test hedged gets at p" << s_hedgePercentile << ", at most " 
+        << s_hedgeMaxPercent << "% hedges." << std::endl;
+    std::cout << "name\tops\terrors\tgets\thedges\thedgesWon\tdelay(usecs)\t" 
+        << s_latencyColumns << std::endl;
+
+    for( int pass = 0; pass < 2; ++pass )
+    {
+        // Sample the delay without faults first, then more requests are
+        // slow or stall than the budget allows to hedge, but few enough to
+        // keep the delay.
+
+        S3StubFaults faults;
+
+        if( pass )
+        {
+            faults.slowPercent = 6;
+            faults.slowMs = 200;
+            faults.stallPercent = 2;
+            faults.stallMs = 2 * SEC;
+        }
+
+        stub.setFaults( faults );
+
+        S3HedgeStats before;
+        policy.getStats( &before );
+
+        LatencyHistogram histogram;
+        size_t count = pass ? s_hedgeOpCount : s_hedgeWarmUpCount;
+        size_t errors = 0;
+        size_t checkedWins = 0;
+
+        for( size_t i = 0; i < count; ++i )
+        {
+            size_t key = i % s_faultKeyCount;
+            unsigned char *buffer = s_readBufs[ 0 ];
+            memset( buffer, 0, s_faultObjectSize );
+
+            S3HedgeStats last;
+            policy.getStats( &last );
+            Stopwatch clock( true );
+
+            try
+            {
+                S3GetResponse response;
+                con.get( bucketName, getKey( key ).c_str(), buffer, s_objectSizeMax, &response );
+                histogram.record( clock.elapsedUs() );
+
+                if( response.loadedContentLength != s_faultObjectSize ||
+                    buffer[ 0 ] != 'a' + key || buffer[ s_faultObjectSize - 1 ] != 'a' + key )
+                {
+                    errors++;
+                    continue;
+                }
+            }
+            catch( ... )
+            {
+                errors++;
+                continue;
+            }
+
+            S3HedgeStats current;
+            policy.getStats( &current );
+            checkedWins += current.hedgesWon - last.hedgesWon;
+        }
+
+        S3HedgeStats stats;
+        policy.getStats( &stats );
+
+        std::stringstream testName;
+        testName << ( pass ? "faults" : "warm_up" ) << '\t'
+            << count << '\t'
+            << errors << '\t'
+            << stats.gets - before.gets << '\t'
+            << stats.hedges - before.hedges << '\t'
+            << stats.hedgesWon - before.hedgesWon << '\t'
+            << stats.delay;
+        print( testName.str().c_str(), histogram );
+
+        check( errors == 0, "a hedged get failed or returned wrong content" );
+        check( stats.delay > 0, "hedge delay isn't sampled" );
+        check( stats.hedges * 100 <= stats.gets * s_hedgeMaxPercent, "hedges exceed the budget" );
+
+        if( pass )
+        {
+            check( stats.hedges > before.hedges, "slow gets aren't hedged" );
+            check( checkedWins > 0, "no hedge won" );
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Rate limit: gets and puts share an AsyncMan (and its loop) with a download
+// rate limit. The gets must be held to the limit, while the puts, whose
+// bodies go the other way, must keep flowing past paused gets.
+
+static const size_t s_rateGetConnections = 4;
+static const size_t s_ratePutConnections = 2;
+static const UInt64 s_rateDownload = 2 * MB;  // bytes per second
+static const UInt64 s_rateDuration = 3 * SEC;
+
+static void
+pendRateOp( S3Connection *con, AsyncMan *asyncMan, const char *bucketName, size_t k, 
+    size_t started )
+{
+    dbgAssert( con );
+
+    if( k < s_rateGetConnections )
+    {
+        con->pendGet( asyncMan, bucketName, getKey( started % s_faultKeyCount ).c_str(), 
+            s_readBufs[ k ], s_objectSizeMax );
+    }
+    else
+    {
+        con->pendPut( asyncMan, bucketName, getKey( s_faultKeyCount + k ).c_str(), 
+            s_writeData, s_faultObjectSize );
+    }
+}
+
+// Results of the gets (index 1) and of the puts (index 0).
+
+struct RateResults
+{
+    LatencyHistogram histograms[ 2 ];
+    size_t          ops[ 2 ];
+    size_t          errors[ 2 ];
+    UInt64          bytes[ 2 ];
+};
+
+static void
+completeRateOp( S3Connection *con, size_t k, Stopwatch *clock, UInt64 start, 
+    RateResults *results )  // nofail
+{
+    dbgAssert( con );
+    dbgAssert( clock );
+    dbgAssert( results );
+
+    bool isGet = k < s_rateGetConnections;
+    bool ok = false;
+
+    try
+    {
+        if( isGet )
+        {
+            S3GetResponse response;
+            con->completeGet( &response );
+            ok = response.loadedContentLength == s_faultObjectSize;
+        }
+        else
+        {
+            con->completePut();
+            ok = true;
+        }
+    }
+    catch( ... )
+    {
+    }
+
+    results->ops[ isGet ]++;
+
+    if( !ok )
+    {
+        results->errors[ isGet ]++;
+        return;
+    }
+
+    results->bytes[ isGet ] += s_faultObjectSize;
+    results->histograms[ isGet ].record( clock->elapsedUs() - start );
+}
+
+void
+perfTestRateLimit()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    const std::string data( s_faultObjectSize, 'x' );
+
+    for( size_t i = 0; i < s_faultKeyCount; ++i )
+    {
+        stub.putObject( bucketName, getKey( i ), data );
+    }
+
+    AsyncRatePolicy policy;
+    policy.downloadRate = s_rateDownload;
+
+    AsyncMan asyncMan;
+    asyncMan.setRatePolicy( &policy );
+
+    const size_t count = s_rateGetConnections + s_ratePutConnections;
+    std::auto_ptr< S3Connection > rateCons[ count ];
+    S3Connection *cons[ count ] = {};
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        rateCons[ i ].reset( new S3Connection( config ) );
+        cons[ i ] = rateCons[ i ].get();
+    }
+
+    std::cout << std::endl << "test download rate limit of " << s_rateDownload 
+        << " bytes/s." << std::endl;
+    std::cout << "name\tconnections\tops\terrors\tbytes/s\t" << s_latencyColumns << std::endl;
+
+    // Keep all connections busy for s_rateDuration, the first ones with gets,
+    // the rest with puts.
+
+    RateResults results = {};
+    UInt64 conStarts[ count ] = {};
+    Stopwatch clock( true );
+    size_t started = 0;
+
+    for( size_t k = 0; k < count; ++k, ++started )
+    {
+        conStarts[ k ] = clock.elapsedUs();
+        pendRateOp( cons[ k ], &asyncMan, bucketName, k, started );
+    }
+
+    int last = -1;
+
+    for( ; ; ++started )
+    {
+        int k = S3Connection::waitAny( cons, count, started % count );
+        dbgAssert( k >= 0 && k < static_cast< int >( count ) );
+
+        completeRateOp( cons[ k ], k, &clock, conStarts[ k ], &results );
+
+        if( clock.elapsed() >= s_rateDuration )
+        {
+            last = k;
+            break;
+        }
+
+        conStarts[ k ] = clock.elapsedUs();
+        pendRateOp( cons[ k ], &asyncMan, bucketName, k, started );
+    }
+
+    // Complete the rest.
+
+    for( size_t k = 0; k < count; ++k )
+    {
+        if( static_cast< int >( k ) != last )
+        {
+            completeRateOp( cons[ k ], k, &clock, conStarts[ k ], &results );
+        }
+    }
+
+    UInt64 elapsed = clock.elapsed();
+    const char *const names[] = { "put", "get" };
+    const size_t connections[] = { s_ratePutConnections, s_rateGetConnections };
+    UInt64 rates[ 2 ] = {};
+
+    for( int i = 1; i >= 0; --i )
+    {
+        rates[ i ] = results.bytes[ i ] * SEC / elapsed;
+
+        std::stringstream testName;
+        testName << names[ i ] << '\t'
+            << connections[ i ] << '\t'
+            << results.ops[ i ] << '\t'
+            << results.errors[ i ] << '\t'
+            << rates[ i ];
+        print( testName.str().c_str(), results.histograms[ i ] );
+    }
+
+    // The gets may overshoot by the burst and the gets that were in flight
+    // when the time was up.
+
+    check( !results.errors[ 0 ] && !results.errors[ 1 ], "a rate limited request failed" );
+    check( rates[ 1 ] >= s_rateDownload * 3 / 4, "gets are below the download rate limit" );
+    check( rates[ 1 ] <= s_rateDownload * 5 / 4, "gets are over the download rate limit" );
+    check( rates[ 0 ] >= 4 * s_rateDownload, "puts are held back by the paused gets" );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Priority classes: bulk gets saturate a small fixed concurrency limit, then
+// interactive gets are pended behind them. Bulk must stay within its cap,
+// interactive gets must get the reserved slot at once and be admitted ahead
+// of the waiting bulk gets.
+
+static const size_t s_priorityLimit = 4;
+static const size_t s_priorityBulkCap = 3;
+static const size_t s_priorityBulkCount = 8;
+static const size_t s_priorityInteractiveCount = 2;
+static const UInt32 s_priorityDelay = 200;  // of each response, in msecs
+
+void
+perfTestPriorities()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    stub.putObject( bucketName, getKey( 0 ), std::string( s_faultObjectSize, 'x' ) );
+
+    S3StubFaults faults;
+    faults.delayMs = s_priorityDelay;
+    stub.setFaults( faults );
+
+    // A fixed limit: no latency signal and no room to grow.
+
+    AsyncConcurrencyPolicy policy;
+    policy.minLimit = s_priorityLimit;
+    policy.maxLimit = s_priorityLimit;
+    policy.initialLimit = s_priorityLimit;
+    policy.latencyTolerance = 0;
+
+    AsyncPriorityPolicy priorityPolicy;
+    priorityPolicy.maxInFlight[ ASYNC_PRIORITY_BULK ] = s_priorityBulkCap;
+    priorityPolicy.reserved[ ASYNC_PRIORITY_INTERACTIVE ] = 1;
+
+    AsyncMan asyncMan;
+    asyncMan.setConcurrencyPolicy( &policy );
+    asyncMan.setPriorityPolicy( &priorityPolicy );
+
+    const size_t count = s_priorityBulkCount + s_priorityInteractiveCount;
+    std::auto_ptr< S3Connection > priorityCons[ count ];
+    S3Connection *cons[ count ] = {};
+    size_t indexes[ count ] = {};
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        priorityCons[ i ].reset( new S3Connection( config ) );
+        priorityCons[ i ]->setPriority( i < s_priorityBulkCount ? ASYNC_PRIORITY_BULK : 
+            ASYNC_PRIORITY_INTERACTIVE );
+        cons[ i ] = priorityCons[ i ].get();
+        indexes[ i ] = i;
+    }
+
+    std::cout << std::endl << "test priority classes with a limit of " << s_priorityLimit 
+        << " requests, bulk capped at " << s_priorityBulkCap << '.' << std::endl;
+    std::cout << "name\tops\terrors\tmaxInFlight\tlastCompleted\t" << s_latencyColumns << std::endl;
+
+    // Saturate the limit with bulk gets, let the loop admit them, then pend
+    // the interactive ones.
+
+    Stopwatch clock( true );
+
+    for( size_t i = 0; i < count; ++i )
+    {
+        if( i == s_priorityBulkCount )
+        {
+            taskSleep( s_priorityDelay / 4 );
+        }
+
+        cons[ i ]->pendGet( &asyncMan, bucketName, getKey( 0 ).c_str(), s_readBufs[ i ], 
+            s_objectSizeMax );
+    }
+
+    // Complete in order, sampling the requests in flight meanwhile. Completed
+    // connections are moved past the active ones.
+
+    LatencyHistogram histograms[ ASYNC_PRIORITY_END ];
+    size_t maxInFlight[ ASYNC_PRIORITY_END ] = {};
+    size_t errors[ ASYNC_PRIORITY_END ] = {};
+    size_t completed[ ASYNC_PRIORITY_END ] = {};
+    size_t lastCompleted[ ASYNC_PRIORITY_END ] = {};  // 1-based order of the last one
+
+    for( size_t active = count; active; )
+    {
+        AsyncConcurrencyStats stats;
+        asyncMan.getConcurrencyStats( &stats );
+
+        for( int c = 0; c < ASYNC_PRIORITY_END; ++c )
+        {
+            maxInFlight[ c ] = std::max( maxInFlight[ c ], stats.inFlightByPriority[ c ] );
+        }
+
+        int k = S3Connection::waitAny( cons, active, 0, 10 );
+
+        if( k < 0 )
+        {
+            continue;
+        }
+
+        size_t i = indexes[ k ];
+        int c = i < s_priorityBulkCount ? ASYNC_PRIORITY_BULK : ASYNC_PRIORITY_INTERACTIVE;
+
+        try
+        {
+            S3GetResponse response;
+            cons[ k ]->completeGet( &response );
+
+            if( response.loadedContentLength != s_faultObjectSize )
+            {
+                errors[ c ]++;
+            }
+        }
+        catch( ... )
+        {
+            errors[ c ]++;
+        }
+
+        histograms[ c ].record( clock.elapsedUs() );
+        completed[ c ]++;
+        lastCompleted[ c ] = count - active + 1;
+
+        active--;
+        std::swap( cons[ k ], cons[ active ] );
+        std::swap( indexes[ k ], indexes[ active ] );
+    }
+
+    const int classes[] = { ASYNC_PRIORITY_INTERACTIVE, ASYNC_PRIORITY_BULK };
+    const char *const names[] = { "interactive", "bulk" };
+
+    for( size_t i = 0; i < dimensionOf( classes ); ++i )
+    {
+        std::stringstream testName;
+        testName << names[ i ] << '\t'
+            << completed[ classes[ i ] ] << '\t'
+            << errors[ classes[ i ] ] << '\t'
+            << maxInFlight[ classes[ i ] ] << '\t'
+            << lastCompleted[ classes[ i ] ];
+        print( testName.str().c_str(), histograms[ classes[ i ] ] );
+    }
+
+    // The interactive gets finish in the second round at the latest, while
+    // the bulk ones take three (gets of a round complete in any order).
+
+    check( !errors[ ASYNC_PRIORITY_INTERACTIVE ] && !errors[ ASYNC_PRIORITY_BULK ], 
+        "a prioritized get failed" );
+    check( maxInFlight[ ASYNC_PRIORITY_BULK ] == s_priorityBulkCap, "bulk gets exceed their cap" );
+    check( maxInFlight[ ASYNC_PRIORITY_INTERACTIVE ] >= 1, 
+        "interactive gets don't get the reserved slot" );
+    check( histograms[ ASYNC_PRIORITY_INTERACTIVE ].max() + s_priorityDelay * 1000ULL / 2 < 
+        histograms[ ASYNC_PRIORITY_BULK ].max(), "interactive gets aren't admitted ahead of bulk ones" );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Deadlines: gets wait behind a slow one for a limit of 1 request in flight.
+// A get whose deadline passes while it waits must fail with a timeout
+// without being sent, and of the others, the earlier deadline must be sent
+// first although it was pended last.
+
+static const UInt32 s_deadlineDelay = 300;  // of each response, in msecs
+
+void
+perfTestDeadlines()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    stub.putObject( bucketName, getKey( 0 ), std::string( s_faultObjectSize, 'x' ) );
+
+    S3StubFaults faults;
+    faults.delayMs = s_deadlineDelay;
+    stub.setFaults( faults );
+
+    AsyncConcurrencyPolicy policy;
+    policy.minLimit = 1;
+    policy.maxLimit = 1;
+    policy.initialLimit = 1;
+    policy.latencyTolerance = 0;
+
+    AsyncMan asyncMan;
+    asyncMan.setConcurrencyPolicy( &policy );
+
+    // The blocking get, the one that expires, and two with a late and an
+    // earlier deadline, pended in this order.
+
+    const char *const names[] = { "blocking", "expired", "late", "early" };
+    const long deadlines[] = { 0, s_deadlineDelay / 3, 4 * s_deadlineDelay, 3 * s_deadlineDelay };
+    std::auto_ptr< S3Connection > deadlineCons[ dimensionOf( names ) ];
+    S3Connection *cons[ dimensionOf( names ) ] = {};
+    size_t indexes[ dimensionOf( names ) ] = {};
+
+    for( size_t i = 0; i < dimensionOf( cons ); ++i )
+    {
+        deadlineCons[ i ].reset( new S3Connection( config ) );
+        deadlineCons[ i ]->setDeadline( deadlines[ i ] );
+        cons[ i ] = deadlineCons[ i ].get();
+        indexes[ i ] = i;
+    }
+
+    std::cout << std::endl << "test deadlines of gets waiting for a limit of 1 request." 
+        << std::endl;
+    std::cout << "name\tdeadline(msecs)\tmsecs\torder\tresult" << std::endl;
+
+    stub.resetStats();
+    Stopwatch clock( true );
+
+    for( size_t i = 0; i < dimensionOf( cons ); ++i )
+    {
+        cons[ i ]->pendGet( &asyncMan, bucketName, getKey( 0 ).c_str(), s_readBufs[ i ], 
+            s_objectSizeMax );
+
+        if( i == 0 )
+        {
+            // Let the loop send the blocking get, or it would be queued
+            // behind the gets with deadlines.
+
+            taskSleep( s_deadlineDelay / 10 );
+        }
+    }
+
+    // Complete in order, completed connections are moved past the active ones.
+
+    size_t orders[ dimensionOf( names ) ] = {};
+    std::string results[ dimensionOf( names ) ];
+
+    for( size_t active = dimensionOf( cons ); active; )
+    {
+        int k = S3Connection::waitAny( cons, active );
+        dbgAssert( k >= 0 && k < static_cast< int >( active ) );
+
+        size_t i = indexes[ k ];
+        orders[ i ] = dimensionOf( cons ) - active + 1;
+
+        try
+        {
+            S3GetResponse response;
+            cons[ k ]->completeGet( &response );
+            results[ i ] = response.loadedContentLength == s_faultObjectSize ? "ok" : "short";
+        }
+        catch( const std::exception &e )
+        {
+            results[ i ] = e.what();
+        }
+
+        std::cout << names[ i ] << '\t' << deadlines[ i ] << '\t' << clock.elapsed() << '\t' 
+            << orders[ i ] << '\t' << results[ i ] << std::endl;
+
+        active--;
+        std::swap( cons[ k ], cons[ active ] );
+        std::swap( indexes[ k ], indexes[ active ] );
+    }
+
+    std::vector< AsyncLoopStats > loops;
+    asyncMan.getStats( &loops );
+    UInt64 expired = 0;
+
+    for( size_t i = 0; i < loops.size(); ++i )
+    {
+        expired += loops[ i ].expired;
+    }
+
+    check( results[ 0 ] == "ok" && results[ 2 ] == "ok" && results[ 3 ] == "ok", 
+        "a get within its deadline failed" );
+    check( strstr( results[ 1 ].c_str(), curl_easy_strerror( CURLE_OPERATION_TIMEDOUT ) ) != NULL, 
+        "expired get doesn't fail with a timeout" );
+    check( expired == 1, "expired get isn't counted" );
+    check( stub.stats().requests == dimensionOf( cons ) - 1, "expired get is sent" );
+    check( orders[ 1 ] == 1, "expired get isn't completed first" );
+    check( orders[ 3 ] < orders[ 2 ], "earlier deadline isn't sent first" );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Connection pool: sync and async pools are warmed up against the stand-in.
+// All connections must be warm, the first get on an acquired connection
+// must reuse a connection, and idle connections must be refreshed.
+
+static const size_t s_poolSize = 4;
+static const unsigned int s_poolRefreshInterval = 400;  // in msecs
+
+void
+perfTestConnectionPool()
+{
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const char bucketName[] = "perf";
+    stub.putObject( bucketName, getKey( 0 ), std::string( s_faultObjectSize, 'x' ) );
+
+    std::cout << std::endl << "test connection pool of " << s_poolSize << " connections." 
+        << std::endl;
+    std::cout << "name\twarm\trefreshes\tfailures\treused\trefreshed" << std::endl;
+
+    AsyncMan asyncMan;
+
+    for( int async = 0; async < 2; ++async )
+    {
+        S3ConnectionPool pool( config, s_poolSize, bucketName, async ? &asyncMan : NULL,
+            s_poolRefreshInterval );
+
+        size_t warm = pool.warmUp();
+
+        S3ConnectionPoolStats stats;
+        pool.getStats( &stats );
+
+        // The first get on an acquired connection.
+
+        S3Connection *con = pool.acquire();
+        check( con != NULL, "no connection in the pool" );
+
+        S3RequestStats requestStats;
+
+        try
+        {
+            if( async )
+            {
+                con->pendGet( &asyncMan, bucketName, getKey( 0 ).c_str(), s_readBufs[ 0 ], 
+                    s_objectSizeMax );
+                con->completeGet();
+            }
+            else
+            {
+                con->get( bucketName, getKey( 0 ).c_str(), s_readBufs[ 0 ], s_objectSizeMax );
+            }
+
+            con->getLastRequestStats( &requestStats );
+        }
+        catch( ... )
+        {
+            printError( con );
+        }
+
+        pool.release( con );
+
+        // Leave the connections idle for longer than the refresh interval.
+
+        taskSleep( 2 * s_poolRefreshInterval );
+
+        S3ConnectionPoolStats idleStats;
+        pool.getStats( &idleStats );
+
+        std::cout << ( async ? "async" : "sync" ) << '\t' 
+            << stats.warm << '\t'
+            << stats.refreshes << '\t'
+            << stats.failures << '\t'
+            << requestStats.connectionReused << '\t'
+            << idleStats.refreshes - stats.refreshes << std::endl;
+
+        check( warm == s_poolSize && stats.warm == s_poolSize, "pool isn't warm" );
+        check( stats.refreshes == s_poolSize && !stats.failures, "warm-up requests failed" );
+        check( requestStats.connectionReused, "first get after warm-up doesn't reuse a connection" );
+        check( idleStats.refreshes > stats.refreshes && !idleStats.failures, 
+            "idle connections aren't refreshed" );
+        check( idleStats.warm == s_poolSize, "refreshed pool isn't warm" );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Lock contention: several tasks pend small gets through a shared AsyncMan,
+// so that request submission dominates. Lock stats are available if the
+// library is built with LOCK_STATS (see Makefile).
+
+static const size_t s_contentionTaskCount = 8;
+static const size_t s_contentionConnectionCount = 4;  // per task
+static const size_t s_contentionRoundCount = 200;     // per task
+static const size_t s_contentionObjectSize = 4 * KB;
+
+struct ContentionTask
+{
+    const S3Config *config;
+    AsyncMan *      asyncMan;
+    size_t          index;
+    size_t          errors;
+    TaskCtrl        taskCtrl;
+};
+
+static TaskResult TASKAPI
+contentionTask( void *arg )
+{
+    dbgAssert( arg );
+    ContentionTask *task = static_cast< ContentionTask * >( arg );
+
+    try
+    {
+        std::auto_ptr< S3Connection > cons[ s_contentionConnectionCount ];
+
+        for( size_t k = 0; k < dimensionOf( cons ); ++k )
+        {
+            cons[ k ].reset( new S3Connection( *task->config ) );
+        }
+
+        for( size_t r = 0; r < s_contentionRoundCount; ++r )
+        {
+            for( size_t k = 0; k < dimensionOf( cons ); ++k )
+            {
+                cons[ k ]->pendGet( task->asyncMan, "perf", getKey( k ).c_str(),
+                    s_readBufs[ task->index * s_contentionConnectionCount + k ], s_contentionObjectSize );
+            }
+
+            for( size_t k = 0; k < dimensionOf( cons ); ++k )
+            {
+                S3GetResponse response;
+                cons[ k ]->completeGet( &response );
+
+                if( response.loadedContentLength != s_contentionObjectSize )
+                {
+                    task->errors++;
+                }
+            }
+        }
+    }
+    catch( ... )
+    {
+        printError();
+        task->errors++;
+    }
+
+    return 0;
+}
+
+void
+perfTestLockContention()
+{
+    CASSERT( s_contentionTaskCount * s_contentionConnectionCount <= s_connectionCount );
+
+    S3Stub stub;
+    std::string port;
+    S3Config config = getStubConfig( stub, &port );
+
+    const std::string data( s_contentionObjectSize, 'x' );
+
+    for( size_t k = 0; k < s_contentionConnectionCount; ++k )
+    {
+        stub.putObject( "perf", getKey( k ), data );
+    }
+
+    AsyncMan asyncMan;
+    ContentionTask tasks[ s_contentionTaskCount ];
+
+    resetLockStats();
+    Stopwatch clock( true );
+
+    for( size_t i = 0; i < dimensionOf( tasks ); ++i )
+    {
+        tasks[ i ].config = &config;
+        tasks[ i ].asyncMan = &asyncMan;
+        tasks[ i ].index = i;
+        tasks[ i ].errors = 0;
+        taskStartAsync( &contentionTask, &tasks[ i ], &tasks[ i ].taskCtrl );
+    }
+
+    size_t errors = 0;
+
+    for( size_t i = 0; i < dimensionOf( tasks ); ++i )
+    {
+        tasks[ i ].taskCtrl.wait();
+        errors += tasks[ i ].errors;
+    }
+
+    UInt64 elapsed = clock.elapsedUs();
+    size_t ops = s_contentionTaskCount * s_contentionConnectionCount * s_contentionRoundCount;
+
+    std::cout << std::endl << "test lock contention of async gets from " << s_contentionTaskCount 
+        << " tasks." << std::endl;
+    std::cout << "ops	errors	ops/s" << std::endl;
+    std::cout << ops << '\t' << errors << '\t' << ( elapsed ? ops * 1000000.0 / elapsed : 0 ) << std::endl;
+
+    std::vector< LockStats > lockStats;
+    getLockStats( &lockStats );
+
+    if( lockStats.empty() )
+    {
+        std::cout << "no lock stats, build with -DLOCK_STATS to get them." << std::endl;
+        return;
+    }
+
+    std::cout << "lock\tacquisitions\tcontended\tcontended(%)\twait(average in usecs)"
+        "\thold(average in usecs)\tmax hold(usecs)" << std::endl;
+
+    for( size_t i = 0; i < lockStats.size(); ++i )
+    {
+        const LockStats &lock = lockStats[ i ];
+
+        if( !lock.acquisitions )
+        {
+            continue;
+        }
+
+        std::cout << lock.name << '\t'
+            << lock.acquisitions << '\t'
+            << lock.contended << '\t'
+            << 100.0 * lock.contended / lock.acquisitions << '\t'
+            << ( lock.contended ? lock.waitTime / 1000.0 / lock.contended : 0 ) << '\t'
+            << lock.holdTime / 1000.0 / lock.acquisitions << '\t'
+            << lock.maxHoldTime / 1000.0 << std::endl;
+    }
 }
 
 int
@@ -762,6 +1947,15 @@ main( int argc, char **argv )
 
     try
     {
+        DBG_RUN_UNIT_TEST( perfTestFaultInjection );
+        DBG_RUN_UNIT_TEST( perfTestFirstByteDeadline );
+        DBG_RUN_UNIT_TEST( perfTestRetries );
+        DBG_RUN_UNIT_TEST( perfTestHedging );
+        DBG_RUN_UNIT_TEST( perfTestRateLimit );
+        DBG_RUN_UNIT_TEST( perfTestPriorities );
+        DBG_RUN_UNIT_TEST( perfTestDeadlines );
+        DBG_RUN_UNIT_TEST( perfTestConnectionPool );
+        DBG_RUN_UNIT_TEST( perfTestLockContention );
         DBG_RUN_UNIT_TEST( perfTestS3Connection );
     }
     catch( const std::exception &e )
@@ -0,0 +1,1114 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Local S3 stand-in for tests and benchmarks.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "s3stub.h"
+
+#ifdef _WIN32
+#error S3Stub is not supported on Windows.
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace webstor
+{
+
+namespace internal
+{
+
+static const size_t s_maxRequestHeadSize = 64 * 1024;
+static const size_t s_ioChunkSize = 64 * 1024;
+static const UInt32 s_sleepSlice = 10;  // msecs, how fast sleeps notice shutdown
+static const int s_acceptTimeout = 100;  // msecs, how fast the listener notices shutdown
+
+static const char s_walrusPrefix[] = "/services/Walrus";
+static const char s_xmlHeader[] = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+
+//////////////////////////////////////////////////////////////////////////////
+// Requests and connections.
+
+struct S3Stub::Request
+{
+    std::string     method;
+    std::string     bucket;
+    std::string     key;
+    std::map< std::string, std::string > query;
+    std::map< std::string, std::string > headers;  // names in lower case
+
+    const std::string &
+    header( const char *name ) const
+    {
+        return find( headers, name );
+    }
+
+    const std::string &
+    param( const char *name ) const
+    {
+        return find( query, name );
+    }
+
+private:
+    static const std::string &
+    find( const std::map< std::string, std::string > &values, const char *name )
+    {
+        static const std::string s_empty;
+        std::map< std::string, std::string >::const_iterator it = values.find( name );
+        return it != values.end() ? it->second : s_empty;
+    }
+};
+
+struct S3Stub::Connection
+{
+    Connection( S3Stub *_stub, SocketHandle _socket )
+        : stub( _stub )
+        , socket( _socket )
+        , bandwidth( 0 )
+    {}
+
+    S3Stub         *stub;
+    SocketHandle    socket;
+    std::string     buf;        // received, but not consumed yet
+    UInt64          bandwidth;  // of the current request
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Helpers.
+
+static int
+hexValue( char c )
+{
+    if( c >= '0' && c <= '9' ) return c - '0';
+    if( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+    if( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+    return -1;
+}
+
+static std::string
+unescape( const char *p, size_t size )
+{
+    std::string result;
+    result.reserve( size );
+
+    for( size_t i = 0; i < size; ++i )
+    {
+        int hi = 0;
+        int lo = 0;
+
+        if( p[ i ] == '%' && i + 2 < size &&
+            ( hi = hexValue( p[ i + 1 ] ) ) >= 0 && ( lo = hexValue( p[ i + 2 ] ) ) >= 0 )
+        {
+            result.append( 1, static_cast< char >( hi * 16 + lo ) );
+            i += 2;
+        }
+        else
+        {
+            result.append( 1, p[ i ] );
+        }
+    }
+
+    return result;
+}
+
+static std::string
+escapeXml( const std::string &value )
+{
+    std::string result;
+    result.reserve( value.size() );
+
+    for( size_t i = 0; i < value.size(); ++i )
+    {
+        switch( value[ i ] )
+        {
+            case '&': result.append( "&amp;" ); break;
+            case '<': result.append( "&lt;" ); break;
+            case '>': result.append( "&gt;" ); break;
+            case '"': result.append( "&quot;" ); break;
+            default: result.append( 1, value[ i ] ); break;
+        }
+    }
+
+    return result;
+}
+
+static std::string
+etag( const std::string &key, size_t size )
+{
+    // Stable for the same key and size, good enough for a stand-in.
+
+    UInt64 h = 14695981039346656037ULL ^ size;
+
+    for( size_t i = 0; i < key.size(); ++i )
+    {
+        h ^= static_cast< unsigned char >( key[ i ] );
+        h *= 1099511628211ULL;
+    }
+
+    char buf[ 40 ];
+    snprintf( buf, sizeof( buf ), "\"%016llx\"", h );
+    return buf;
+}
+
+static std::string
+errorBody( const char *code, const char *message )
+{
+    std::string body( s_xmlHeader );
+    body.append( "<Error><Code>" );
+    body.append( code );
+    body.append( "</Code><Message>" );
+    body.append( message );
+    body.append( "</Message></Error>" );
+    return body;
+}
+
+static std::string
+responseHead( int status, const char *reason, size_t contentLength, const std::string &headers )
+{
+    dbgAssert( reason );
+
+    char buf[ 128 ];
+    snprintf( buf, sizeof( buf ), "HTTP/1.1 %d %s\r\nContent-Length: %llu\r\n", status, reason,
+        static_cast< unsigned long long >( contentLength ) );
+
+    std::string head( buf );
+    head.append( headers );
+    head.append( "\r\n" );
+    return head;
+}
+
+static bool
+startsWith( const std::string &value, const std::string &prefix )
+{
+    return !value.compare( 0, prefix.size(), prefix );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Socket I/O.
+
+static bool
+sendAll( SocketHandle socket, const char *data, size_t size )  // nofail
+{
+    while( size )
+    {
+        ssize_t sent = ::send( socket, data, size, MSG_NOSIGNAL );
+
+        if( sent < 0 && errno == EINTR )
+        {
+            continue;
+        }
+
+        if( sent <= 0 )
+        {
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+static ssize_t
+recvSome( SocketHandle socket, char *buf, size_t size )  // nofail
+{
+    while( true )
+    {
+        ssize_t received = ::recv( socket, buf, size, 0 );
+
+        if( received < 0 && errno == EINTR )
+        {
+            continue;
+        }
+
+        return received;
+    }
+}
+
+static size_t
+chunkSize( UInt64 bandwidth )
+{
+    // Throttled transfers go in ~10ms worth of bytes, so the rate is smooth.
+
+    if( !bandwidth )
+    {
+        return s_ioChunkSize;
+    }
+
+    return static_cast< size_t >( std::min( std::max( bandwidth / 100, static_cast< UInt64 >( 1024 ) ),
+        static_cast< UInt64 >( s_ioChunkSize ) ) );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// S3StubFaults.
+
+S3StubFaults::S3StubFaults()
+    : delayMs( 0 )
+    , jitterMs( 0 )
+    , slowPercent( 0 )
+    , slowMs( 0 )
+    , bandwidth( 0 )
+    , slowDownPercent( 0 )
+    , resetPercent( 0 )
+    , stallPercent( 0 )
+    , stallMs( 0 )
+    , maxActive( 0 )
+    , seed( 1 )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// S3Stub.
+
+S3Stub::S3Stub( unsigned short port, const char *address )
+    : m_socket( INVALID_SOCKET_HANDLE )
+    , m_port( 0 )
+    , m_stopping( false )
+    , m_stats()
+    , m_sequence( 0 )
+    , m_active( 0 )
+{
+    dbgAssert( address );
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+
+    if( inet_pton( AF_INET, address, &addr.sin_addr ) != 1 )
+    {
+        throw std::runtime_error( "S3Stub: invalid address." );
+    }
+
+    m_socket = ::socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+
+    if( m_socket == INVALID_SOCKET_HANDLE )
+    {
+        throw std::runtime_error( "S3Stub: cannot create a socket." );
+    }
+
+    int on = 1;
+    setsockopt( m_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+
+    socklen_t len = sizeof( addr );
+
+    if( bind( m_socket, reinterpret_cast< sockaddr * >( &addr ), sizeof( addr ) ) ||
+        ::listen( m_socket, SOMAXCONN ) ||
+        getsockname( m_socket, reinterpret_cast< sockaddr * >( &addr ), &len ) )
+    {
+        close( m_socket );
+        throw std::runtime_error( "S3Stub: cannot listen on the given port." );
+    }
+
+    m_port = ntohs( addr.sin_port );
+
+    try
+    {
+        taskStartAsync( &listenTask, this, &m_listenTask );
+    }
+    catch( ... )
+    {
+        close( m_socket );
+        throw;
+    }
+}
+
+S3Stub::~S3Stub()
+{
+    m_stopping = true;
+    m_listenTask.wait();
+    close( m_socket );
+
+    // Wake up connection tasks blocked in I/O and wait till they are gone.
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        for( size_t i = 0; i < m_connections.size(); ++i )
+        {
+            shutdown( m_connections[ i ], SHUT_RDWR );
+        }
+    }
+
+    while( true )
+    {
+        {
+            m_lock.claimLock();
+            ScopedExLock lock( &m_lock );
+
+            if( m_connections.empty() )
+            {
+                break;
+            }
+        }
+
+        taskSleep( 1 );
+    }
+}
+
+void
+S3Stub::setFaults( const S3StubFaults &faults )  // nofail
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    m_faults = faults;
+    m_sequence = 0;
+}
+
+S3StubFaults
+S3Stub::faults()  // nofail
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    return m_faults;
+}
+
+S3StubStats
+S3Stub::stats()  // nofail
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    return m_stats;
+}
+
+void
+S3Stub::resetStats()  // nofail
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    memset( &m_stats, 0, sizeof( m_stats ) );
+}
+
+void
+S3Stub::putObject( const std::string &bucket, const std::string &key, const std::string &data )
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    m_objects[ bucket + '/' + key ] = data;
+}
+
+void
+S3Stub::clear()  // nofail
+{
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    m_objects.clear();
+}
+
+double
+S3Stub::random()  // nofail
+{
+    // The caller must hold m_lock.
+    // splitmix64 of the sequence number, so the n-th number after
+    // setFaults(..) depends only on the seed.
+
+    UInt64 z = m_faults.seed + ++m_sequence * 0x9E3779B97F4A7C15ULL;
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+
+    return ( z >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+bool
+S3Stub::sleep( UInt32 msTimeout )  // nofail
+{
+    while( msTimeout && !m_stopping )
+    {
+        UInt32 slice = std::min( msTimeout, s_sleepSlice );
+        taskSleep( slice );
+        msTimeout -= slice;
+    }
+
+    return !m_stopping;
+}
+
+TaskResult TASKAPI
+S3Stub::listenTask( void *arg )
+{
+    dbgAssert( arg );
+    static_cast< S3Stub * >( arg )->listen();
+    return 0;
+}
+
+TaskResult TASKAPI
+S3Stub::connectionTask( void *arg )
+{
+    dbgAssert( arg );
+
+    std::auto_ptr< Connection > connection( static_cast< Connection * >( arg ) );
+    connection->stub->serve( connection.get() );
+    return 0;
+}
+
+void
+S3Stub::listen()  // nofail
+{
+    while( !m_stopping )
+    {
+        pollfd fds = { m_socket, POLLIN, 0 };
+
+        if( poll( &fds, 1, s_acceptTimeout ) <= 0 )
+        {
+            continue;
+        }
+
+        SocketHandle socket = accept4( m_socket, NULL, NULL, SOCK_CLOEXEC );
+
+        if( socket == INVALID_SOCKET_HANDLE )
+        {
+            continue;
+        }
+
+        int on = 1;
+        setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+
+        try
+        {
+            std::auto_ptr< Connection > connection( new Connection( this, socket ) );
+
+            {
+                m_lock.claimLock();
+                ScopedExLock lock( &m_lock );
+
+                m_connections.push_back( socket );
+                m_stats.connections++;
+            }
+
+            TaskCtrl task;  // detached when it goes out of scope
+            taskStartAsync( &connectionTask, connection.get(), &task );
+            connection.release();
+        }
+        catch( ... )
+        {
+            m_lock.claimLock();
+            ScopedExLock lock( &m_lock );
+
+            m_connections.erase( std::remove( m_connections.begin(), m_connections.end(), socket ),
+                m_connections.end() );
+            close( socket );
+        }
+    }
+}
+
+void
+S3Stub::serve( Connection *connection )  // nofail
+{
+    dbgAssert( connection );
+
+    try
+    {
+        while( !m_stopping )
+        {
+            // Read the request head.
+
+            size_t end = std::string::npos;
+
+            while( ( end = connection->buf.find( "\r\n\r\n" ) ) == std::string::npos )
+            {
+                char buf[ 4096 ];
+                ssize_t received = recvSome( connection->socket, buf, sizeof( buf ) );
+
+                if( received <= 0 || connection->buf.size() > s_maxRequestHeadSize )
+                {
+                    goto LClose;
+                }
+
+                connection->buf.append( buf, received );
+            }
+
+            Request request;
+            bool parsed = parseRequest( connection->buf.substr( 0, end ), &request );
+            connection->buf.erase( 0, end + 4 );
+
+            if( !parsed )
+            {
+                respond( connection, 400, "Bad Request", std::string(),
+                    errorBody( "InvalidRequest", "Malformed request." ) );
+                break;
+            }
+
+            bool keepAlive = handle( connection, request );
+
+            {
+                m_lock.claimLock();
+                ScopedExLock lock( &m_lock );
+
+                dbgAssert( m_active );
+                m_active--;
+            }
+
+            if( !keepAlive )
+            {
+                break;
+            }
+        }
+    }
+    catch( ... )
+    {
+        // Drop the connection, the client sees it as a network error.
+    }
+
+LClose:
+
+    m_lock.claimLock();
+    ScopedExLock lock( &m_lock );
+
+    m_connections.erase( std::remove( m_connections.begin(), m_connections.end(), connection->socket ),
+        m_connections.end() );
+    close( connection->socket );
+}
+
+bool
+S3Stub::parseRequest( const std::string &head, Request *request )
+{
+    dbgAssert( request );
+
+    // METHOD SP /[services/Walrus/]bucket[/key][?query] SP HTTP/1.x CRLF
+    // followed by headers.
+
+    size_t lineEnd = head.find( "\r\n" );
+    std::string line = head.substr( 0, lineEnd );
+    size_t methodEnd = line.find( ' ' );
+    size_t targetEnd = methodEnd == std::string::npos ? methodEnd : line.find( ' ', methodEnd + 1 );
+
+    if( targetEnd == std::string::npos || line[ methodEnd + 1 ] != '/' )
+    {
+        return false;
+    }
+
+    request->method = line.substr( 0, methodEnd );
+
+    std::string target = line.substr( methodEnd + 1, targetEnd - methodEnd - 1 );
+    size_t queryStart = target.find( '?' );
+    std::string path = target.substr( 0, queryStart );
+
+    if( startsWith( path, s_walrusPrefix ) )
+    {
+        path.erase( 0, sizeof( s_walrusPrefix ) - 1 );
+    }
+
+    size_t bucketStart = path.find_first_not_of( '/' );
+
+    if( bucketStart != std::string::npos )
+    {
+        size_t bucketEnd = path.find( '/', bucketStart );
+        request->bucket = unescape( path.c_str() + bucketStart,
+            ( bucketEnd == std::string::npos ? path.size() : bucketEnd ) - bucketStart );
+
+        if( bucketEnd != std::string::npos )
+        {
+            request->key = unescape( path.c_str() + bucketEnd + 1, path.size() - bucketEnd - 1 );
+        }
+    }
+
+    while( queryStart != std::string::npos )
+    {
+        size_t start = queryStart + 1;
+        queryStart = target.find( '&', start );
+
+        std::string param = target.substr( start,
+            queryStart == std::string::npos ? std::string::npos : queryStart - start );
+        size_t eq = std::min( param.find( '=' ), param.size() );
+
+        if( !param.empty() )
+        {
+            request->query[ unescape( param.c_str(), eq ) ] =
+                eq < param.size() ? unescape( param.c_str() + eq + 1, param.size() - eq - 1 ) : std::string();
+        }
+    }
+
+    while( lineEnd != std::string::npos )
+    {
+        size_t start = lineEnd + 2;
+        lineEnd = head.find( "\r\n", start );
+
+        line = head.substr( start, lineEnd == std::string::npos ? std::string::npos : lineEnd - start );
+        size_t colon = line.find( ':' );
+
+        if( colon == std::string::npos )
+        {
+            continue;
+        }
+
+        std::string name = line.substr( 0, colon );
+        std::transform( name.begin(), name.end(), name.begin(), ::tolower );
+
+        size_t valueStart = line.find_first_not_of( ' ', colon + 1 );
+        request->headers[ name ] = valueStart == std::string::npos ? std::string() : line.substr( valueStart );
+    }
+
+    return true;
+}
+
+bool
+S3Stub::handle( Connection *connection, const Request &request )
+{
+    dbgAssert( connection );
+
+    // Draw faults for the request.  Each request consumes the same count of
+    // random numbers, so the n-th request gets the same faults regardless of
+    // the method or which faults are enabled.
+
+    S3StubFaults faults;
+    bool stall = false;
+    bool slow = false;
+    bool slowDown = false;
+    bool overloaded = false;
+    bool reset = false;
+    double jitter = 0;
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        double r[ 5 ];
+
+        for( size_t i = 0; i < dimensionOf( r ); ++i )
+        {
+            r[ i ] = random();
+        }
+
+        faults = m_faults;
+        stall = r[ 0 ] * 100 < faults.stallPercent;
+        slow = r[ 1 ] * 100 < faults.slowPercent;
+        jitter = -log( 1 - r[ 2 ] ) * faults.jitterMs;
+        overloaded = faults.maxActive && m_active >= faults.maxActive;
+        slowDown = overloaded || r[ 3 ] * 100 < faults.slowDownPercent;
+        reset = !slowDown && request.method == "GET" && !request.key.empty() && r[ 4 ] * 100 < faults.resetPercent;
+
+        m_stats.requests++;
+        m_stats.stalls += stall;
+        m_stats.slowRequests += slow;
+        m_stats.slowDowns += slowDown;
+        m_active++;
+    }
+
+    connection->bandwidth = faults.bandwidth;
+
+    // Read the request body, chunked uploads are not supported.
+
+    std::string body;
+
+    if( !request.header( "transfer-encoding" ).empty() )
+    {
+        respond( connection, 411, "Length Required", std::string(),
+            errorBody( "MissingContentLength", "You must provide the Content-Length HTTP header." ) );
+        return false;
+    }
+
+    size_t contentLength = static_cast< size_t >( strtoull( request.header( "content-length" ).c_str(), NULL, 10 ) );
+
+    if( contentLength && !recvBody( connection, contentLength, &body ) )
+    {
+        return false;
+    }
+
+    // Hold the response.
+
+    UInt32 delay = faults.delayMs + static_cast< UInt32 >( jitter ) + ( slow ? faults.slowMs : 0 );
+
+    if( !overloaded && ( ( stall && !sleep( faults.stallMs ) ) || ( delay && !sleep( delay ) ) ) )
+    {
+        return false;
+    }
+
+    bool keepAlive = strcasecmp( request.header( "connection" ).c_str(), "close" ) != 0;
+
+    if( slowDown )
+    {
+        return respond( connection, 503, "Slow Down", std::string(),
+            errorBody( "SlowDown", "Please reduce your request rate." ) ) && keepAlive;
+    }
+
+    bool result = false;
+
+    if( request.method == "PUT" )
+    {
+        std::string headers;
+
+        if( !request.key.empty() )
+        {
+            headers = "ETag: " + etag( request.key, body.size() ) + "\r\n";
+
+            m_lock.claimLock();
+            ScopedExLock lock( &m_lock );
+
+            m_objects[ request.bucket + '/' + request.key ].swap( body );
+        }
+
+        result = respond( connection, 200, "OK", headers, std::string() );
+    }
+    else if( ( request.method == "GET" || request.method == "HEAD" ) && !request.key.empty() )
+    {
+        result = handleGet( connection, request, reset );
+    }
+    else if( request.method == "GET" && !request.bucket.empty() )
+    {
+        result = handleList( connection, request );
+    }
+    else if( request.method == "DELETE" )
+    {
+        if( !request.key.empty() )
+        {
+            m_lock.claimLock();
+            ScopedExLock lock( &m_lock );
+
+            m_objects.erase( request.bucket + '/' + request.key );
+        }
+
+        result = respond( connection, 204, "No Content", std::string(), std::string() );
+    }
+    else
+    {
+        result = respond( connection, 501, "Not Implemented", std::string(),
+            errorBody( "NotImplemented", "The stand-in doesn't implement this request." ),
+            request.method == "HEAD" );
+    }
+
+    return result && keepAlive;
+}
+
+bool
+S3Stub::handleGet( Connection *connection, const Request &request, bool reset )
+{
+    dbgAssert( connection );
+
+    // Copy the object, so a concurrent put doesn't change it under the response.
+
+    bool found = false;
+    std::string data;
+    bool headOnly = request.method == "HEAD";
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        std::map< std::string, std::string >::const_iterator it =
+            m_objects.find( request.bucket + '/' + request.key );
+
+        if( it != m_objects.end() )
+        {
+            found = true;
+            data = it->second;
+        }
+    }
+
+    if( !found )
+    {
+        return respond( connection, 404, "Not Found", std::string(),
+            errorBody( "NoSuchKey", "The specified key does not exist." ), headOnly );
+    }
+
+    // Range: bytes=first-[last]
+
+    size_t first = 0;
+    size_t last = data.size() - 1;
+    int status = 200;
+    std::string headers = "ETag: " + etag( request.key, data.size() ) + "\r\n";
+    const std::string &range = request.header( "range" );
+
+    if( !range.empty() )
+    {
+        unsigned long long rangeFirst = 0;
+        unsigned long long rangeLast = 0;
+        int count = sscanf( range.c_str(), "bytes=%llu-%llu", &rangeFirst, &rangeLast );
+
+        if( count < 1 || rangeFirst >= data.size() || ( count == 2 && rangeLast < rangeFirst ) )
+        {
+            return respond( connection, 416, "Requested Range Not Satisfiable", std::string(),
+                errorBody( "InvalidRange", "The requested range is not satisfiable." ), headOnly );
+        }
+
+        first = static_cast< size_t >( rangeFirst );
+
+        if( count == 2 )
+        {
+            last = static_cast< size_t >( std::min( rangeLast, static_cast< unsigned long long >( last ) ) );
+        }
+
+        char buf[ 128 ];
+        snprintf( buf, sizeof( buf ), "Content-Range: bytes %llu-%llu/%llu\r\n",
+            static_cast< unsigned long long >( first ), static_cast< unsigned long long >( last ),
+            static_cast< unsigned long long >( data.size() ) );
+
+        headers.append( buf );
+        status = 206;
+    }
+
+    size_t size = data.empty() ? 0 : last - first + 1;
+    std::string head = responseHead( status, status == 200 ? "OK" : "Partial Content", size, headers );
+
+    if( !sendAll( connection->socket, head.data(), head.size() ) )
+    {
+        return false;
+    }
+
+    if( headOnly )
+    {
+        return true;
+    }
+
+    if( reset )
+    {
+        // Send half of the body and reset the connection (SO_LINGER with
+        // zero timeout makes close(..) send RST).
+
+        {
+            m_lock.claimLock();
+            ScopedExLock lock( &m_lock );
+
+            m_stats.resets++;
+        }
+
+        sendBody( connection, data.data() + first, size / 2 );
+
+        linger lingerOff = { 1, 0 };
+        setsockopt( connection->socket, SOL_SOCKET, SO_LINGER, &lingerOff, sizeof( lingerOff ) );
+        return false;
+    }
+
+    return sendBody( connection, data.data() + first, size );
+}
+
+bool
+S3Stub::handleList( Connection *connection, const Request &request )
+{
+    dbgAssert( connection );
+
+    const std::string &prefix = request.param( "prefix" );
+    const std::string &marker = request.param( "marker" );
+    const std::string &delimiter = request.param( "delimiter" );
+    const std::string &maxKeysParam = request.param( "max-keys" );
+    size_t maxKeys = maxKeysParam.empty() ? 1000 : static_cast< size_t >( strtoul( maxKeysParam.c_str(), NULL, 10 ) );
+
+    std::string contents;
+    std::string commonPrefixes;
+    std::string lastPrefix;
+    std::string nextMarker;
+    bool isTruncated = false;
+    size_t count = 0;
+
+    {
+        m_lock.claimLock();
+        ScopedExLock lock( &m_lock );
+
+        std::string bucketPrefix = request.bucket + '/';
+        std::map< std::string, std::string >::const_iterator it =
+            m_objects.lower_bound( bucketPrefix + std::max( prefix, marker ) );
+
+        for( ; it != m_objects.end() && startsWith( it->first, bucketPrefix + prefix ); ++it )
+        {
+            std::string key = it->first.substr( bucketPrefix.size() );
+
+            if( key <= marker )
+            {
+                continue;
+            }
+
+            // Keys with the delimiter after the prefix roll up into a common prefix.
+
+            size_t pos = delimiter.empty() ? std::string::npos : key.find( delimiter, prefix.size() );
+            std::string commonPrefix = pos == std::string::npos ? std::string() :
+                key.substr( 0, pos + delimiter.size() );
+
+            if( !commonPrefix.empty() && ( commonPrefix == lastPrefix || commonPrefix == marker ) )
+            {
+                continue;
+            }
+
+            if( count == maxKeys )
+            {
+                isTruncated = true;
+                break;
+            }
+
+            ++count;
+
+            if( !commonPrefix.empty() )
+            {
+                commonPrefixes.append( "<CommonPrefixes><Prefix>" + escapeXml( commonPrefix ) +
+                    "</Prefix></CommonPrefixes>" );
+                lastPrefix = commonPrefix;
+                nextMarker = commonPrefix;
+                continue;
+            }
+
+            char size[ 32 ];
+            snprintf( size, sizeof( size ), "%llu", static_cast< unsigned long long >( it->second.size() ) );
+
+            contents.append( "<Contents><Key>" + escapeXml( key ) +
+                "</Key><LastModified>2012-01-01T00:00:00.000Z</LastModified><ETag>" +
+                escapeXml( etag( key, it->second.size() ) ) + "</ETag><Size>" + size +
+                "</Size><StorageClass>STANDARD</StorageClass></Contents>" );
+            nextMarker = key;
+        }
+    }
+
+    char maxKeysValue[ 32 ];
+    snprintf( maxKeysValue, sizeof( maxKeysValue ), "%llu", static_cast< unsigned long long >( maxKeys ) );
+
+    std::string body( s_xmlHeader );
+    body.append( "<ListBucketResult xmlns=\"http://s3.amazonaws.com/doc/2006-03-01/\"><Name>" +
+        escapeXml( request.bucket ) + "</Name><Prefix>" + escapeXml( prefix ) + "</Prefix><Marker>" +
+        escapeXml( marker ) + "</Marker><MaxKeys>" + maxKeysValue + "</MaxKeys>" );
+
+    if( !delimiter.empty() )
+    {
+        body.append( "<Delimiter>" + escapeXml( delimiter ) + "</Delimiter>" );
+    }
+
+    body.append( isTruncated ? "<IsTruncated>true</IsTruncated>" : "<IsTruncated>false</IsTruncated>" );
+
+    if( isTruncated )
+    {
+        body.append( "<NextMarker>" + escapeXml( nextMarker ) + "</NextMarker>" );
+    }
+
+    body.append( contents );
+    body.append( commonPrefixes );
+    body.append( "</ListBucketResult>" );
+
+    return respond( connection, 200, "OK", "Content-Type: application/xml\r\n", body );
+}
+
+bool
+S3Stub::respond( Connection *connection, int status, const char *reason, const std::string &headers,
+    const std::string &body, bool headOnly )
+{
+    dbgAssert( connection );
+
+    std::string response = responseHead( status, reason, body.size(),
+        status >= 400 && !body.empty() ? headers + "Content-Type: application/xml\r\n" : headers );
+
+    if( !headOnly )
+    {
+        response.append( body );
+    }
+
+    return sendAll( connection->socket, response.data(), response.size() );
+}
+
+bool
+S3Stub::recvBody( Connection *connection, size_t size, std::string *body )
+{
+    dbgAssert( connection );
+    dbgAssert( body );
+
+    body->reserve( size );
+
+    // Take what came with the head first.
+
+    size_t buffered = std::min( size, connection->buf.size() );
+    body->assign( connection->buf, 0, buffered );
+    connection->buf.erase( 0, buffered );
+
+    Stopwatch clock( true );
+    std::vector< char > buf( chunkSize( connection->bandwidth ) );
+
+    while( body->size() < size )
+    {
+        ssize_t received = recvSome( connection->socket, &buf[ 0 ], std::min( buf.size(), size - body->size() ) );
+
+        if( received <= 0 )
+        {
+            return false;
+        }
+
+        body->append( &buf[ 0 ], received );
+
+        if( !pace( connection, &clock, body->size() - buffered ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+S3Stub::sendBody( Connection *connection, const char *data, size_t size )
+{
+    dbgAssert( connection );
+    dbgAssert( implies( size, data ) );
+
+    Stopwatch clock( true );
+    size_t chunk = chunkSize( connection->bandwidth );
+
+    for( size_t sent = 0; sent < size; )
+    {
+        size_t count = std::min( chunk, size - sent );
+
+        if( !sendAll( connection->socket, data + sent, count ) )
+        {
+            return false;
+        }
+
+        sent += count;
+
+        if( !pace( connection, &clock, sent ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+S3Stub::pace( Connection *connection, Stopwatch *clock, size_t transferred )
+{
+    // Sleeps till 'transferred' bytes are due at the connection's bandwidth.
+
+    dbgAssert( connection );
+    dbgAssert( clock );
+
+    if( !connection->bandwidth )
+    {
+        return !m_stopping;
+    }
+
+    UInt64 dueUs = transferred * 1000000ULL / connection->bandwidth;
+    UInt64 elapsedUs = clock->elapsedUs();
+
+    return sleep( dueUs > elapsedUs ? static_cast< UInt32 >( ( dueUs - elapsedUs ) / 1000 ) : 0 );
+}
+
+}  // namespace internal
+
+}  // namespace webstor
@@ -0,0 +1,177 @@
+#ifndef INCLUDED_S3STUB_H
+#define INCLUDED_S3STUB_H
+
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Local S3 stand-in for tests and benchmarks.
+//
+// S3Stub is a small in-memory S3 server (Walrus-style path addressing, so
+// clients use S3Config::isWalrus with host 127.0.0.1 and the stub's port).
+// It supports put, get (including ranges), head, delete and list objects,
+// and can inject faults to reproduce slow and failing backends: added
+// latency with a heavy tail, throttled bandwidth, 503 Slow Down responses,
+// connection resets in the middle of a response body and stalled first
+// bytes.  Faults are drawn from a seeded random sequence, so a run with the
+// same seed and request order gets the same faults.
+//
+// The stub serves each connection on its own task with blocking sockets, it
+// is meant for loopback tests, not for load beyond a few hundred connections.
+// POSIX only.
+//////////////////////////////////////////////////////////////////////////////
+
+#include "sysutils.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace webstor
+{
+
+namespace internal
+{
+
+//////////////////////////////////////////////////////////////////////////////
+// Fault injection settings, all faults are off by default.
+
+struct S3StubFaults
+{
+                    S3StubFaults();
+
+    // Added latency before the first byte of each response: 'delayMs' plus
+    // an exponentially distributed delay with mean 'jitterMs'; 'slowPercent'
+    // of requests get 'slowMs' more (a heavy tail).
+
+    UInt32          delayMs;
+    UInt32          jitterMs;
+    double          slowPercent;
+    UInt32          slowMs;
+
+    // Per-connection bandwidth of request and response bodies, in bytes per
+    // second, 0 is unlimited.
+
+    UInt64          bandwidth;
+
+    // Percentage of requests answered with 503 Slow Down.
+
+    double          slowDownPercent;
+
+    // Percentage of gets whose connection is reset after half of the body
+    // is sent.
+
+    double          resetPercent;
+
+    // Percentage of requests whose response is held for 'stallMs' before
+    // the first byte (set it above the client timeout to hit timeouts).
+
+    double          stallPercent;
+    UInt32          stallMs;
+
+    // Requests over 'maxActive' served at the same time are answered with
+    // 503 Slow Down right away, like an overloaded partition; 0 is unlimited.
+
+    UInt32          maxActive;
+
+    UInt64          seed;
+};
+
+// Counters of served requests and injected faults.
+
+struct S3StubStats
+{
+    UInt64          connections;
+    UInt64          requests;
+    UInt64          slowRequests;
+    UInt64          slowDowns;
+    UInt64          resets;
+    UInt64          stalls;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// S3Stub -- in-memory S3 server.
+
+class S3Stub
+{
+public:
+    // Listens on 127.0.0.1:'port' (0 picks a free port), throws on failure.
+
+    explicit        S3Stub( unsigned short port = 0, const char *address = "127.0.0.1" );
+                    ~S3Stub();
+
+    unsigned short  port() const { return m_port; }
+
+    void            setFaults( const S3StubFaults &faults );  // nofail
+    S3StubFaults    faults();  // nofail
+
+    S3StubStats     stats();  // nofail
+    void            resetStats();  // nofail
+
+    // Stored objects, e.g. to seed or clear the store between runs.
+
+    void            putObject( const std::string &bucket, const std::string &key,
+                        const std::string &data );
+    void            clear();  // nofail
+
+private:
+                    S3Stub( const S3Stub & );  // forbidden
+    S3Stub &        operator=( const S3Stub & );  // forbidden
+
+    struct Request;
+    struct Connection;
+
+    static TaskResult TASKAPI listenTask( void *arg );
+    static TaskResult TASKAPI connectionTask( void *arg );
+
+    void            listen();  // nofail
+    void            serve( Connection *connection );  // nofail
+
+    // Request handlers return false if the connection must be closed.
+
+    static bool     parseRequest( const std::string &head, Request *request );
+    bool            handle( Connection *connection, const Request &request );
+    bool            handleGet( Connection *connection, const Request &request, bool reset );
+    bool            handleList( Connection *connection, const Request &request );
+
+    bool            respond( Connection *connection, int status, const char *reason,
+                        const std::string &headers, const std::string &body, bool headOnly = false );
+    bool            recvBody( Connection *connection, size_t size, std::string *body );
+    bool            sendBody( Connection *connection, const char *data, size_t size );
+    bool            pace( Connection *connection, Stopwatch *clock, size_t transferred );
+
+    double          random();  // nofail, [0, 1)
+    bool            sleep( UInt32 msTimeout );  // nofail, false if stopping
+
+    SocketHandle    m_socket;
+    unsigned short  m_port;
+    TaskCtrl        m_listenTask;
+    volatile bool   m_stopping;
+
+    ExLockSync      m_lock;
+    S3StubFaults    m_faults;
+    S3StubStats     m_stats;
+    UInt64          m_sequence;     // of random numbers drawn
+    UInt32          m_active;       // requests being handled
+    std::map< std::string, std::string > m_objects;  // "bucket/key" => data
+    std::vector< SocketHandle > m_connections;
+};
+
+}  // namespace internal
+
+}  // namespace webstor
+
+#endif // !INCLUDED_S3STUB_H
@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2011-2012, OblakSoft LLC.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//////////////////////////////////////////////////////////////////////////////
+// Standalone local S3 stand-in (see s3stub.h), e.g. for s3bench runs:
+//
+//   s3stubd -P 18080 -j 5 -sp 1 -sm 500 &
+//   s3bench get -H 127.0.0.1 -P 18080 -U -n bk -s 1 -c 16 -kh 1000
+//////////////////////////////////////////////////////////////////////////////
+
+#include "s3stub.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+
+using namespace webstor::internal;
+
+static void
+usage()
+{
+    std::cout <<
+        "s3stubd [options]                                                              \n"
+        "                                                                               \n"
+        "options:                                                                       \n"
+        "    -P port (default 18080, 0 picks a free one),                               \n"
+        "    -A address to listen on (default 127.0.0.1),                               \n"
+        "    -d added latency of each response, in msecs,                               \n"
+        "    -j mean of exponentially distributed extra latency, in msecs,              \n"
+        "    -sp percentage of slow requests (the tail),                                \n"
+        "    -sm extra latency of slow requests, in msecs,                              \n"
+        "    -bw per-connection bandwidth in bytes/s (with k/m/g suffix), 0 unlimited,  \n"
+        "    -503 percentage of requests answered with 503 Slow Down,                   \n"
+        "    -rst percentage of gets reset in the middle of the body,                   \n"
+        "    -stp percentage of requests with a stalled first byte,                     \n"
+        "    -stm stall duration, in msecs (default 60000),                             \n"
+        "    -max requests served at once, the rest get 503 Slow Down (default 0, no    \n"
+        "       limit),                                                                 \n"
+        "    -seed seed of the fault sequence (default 1).                              \n"
+        "                                                                               \n"
+        "The stand-in uses Walrus-style addressing: run clients with -H 127.0.0.1 -P    \n"
+        "port -U. Objects are kept in memory. Stop it with Ctrl-C or SIGTERM, it prints \n"
+        "counters of requests and injected faults on exit.                              \n";
+}
+
+static UInt64
+parseBandwidth( const char *value )
+{
+    char *end = NULL;
+    double bandwidth = strtod( value, &end );
+
+    switch( end ? *end : 0 )
+    {
+        case 'k': case 'K': bandwidth *= 1024; break;
+        case 'm': case 'M': bandwidth *= 1024 * 1024; break;
+        case 'g': case 'G': bandwidth *= 1024 * 1024 * 1024; break;
+    }
+
+    return static_cast< UInt64 >( bandwidth );
+}
+
+int
+main( int argc, char **argv )
+{
+    unsigned short port = 18080;
+    const char *address = "127.0.0.1";
+    S3StubFaults faults;
+    faults.stallMs = 60 * 1000;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        const char *flag = argv[ i ];
+        const char *value = i + 1 < argc ? argv[ i + 1 ] : NULL;
+
+        if( !strcmp( flag, "-help" ) || !strcmp( flag, "--help" ) || !strcmp( flag, "-?" ) )
+        {
+            usage();
+            return 0;
+        }
+
+        if( !value )
+        {
+            std::cerr << "Value is missing for " << flag << "." << std::endl;
+            return 1;
+        }
+
+        ++i;
+
+        if( !strcmp( flag, "-P" ) ) port = static_cast< unsigned short >( atoi( value ) );
+        else if( !strcmp( flag, "-A" ) ) address = value;
+        else if( !strcmp( flag, "-d" ) ) faults.delayMs = atoi( value );
+        else if( !strcmp( flag, "-j" ) ) faults.jitterMs = atoi( value );
+        else if( !strcmp( flag, "-sp" ) ) faults.slowPercent = atof( value );
+        else if( !strcmp( flag, "-sm" ) ) faults.slowMs = atoi( value );
+        else if( !strcmp( flag, "-bw" ) ) faults.bandwidth = parseBandwidth( value );
+        else if( !strcmp( flag, "-503" ) ) faults.slowDownPercent = atof( value );
+        else if( !strcmp( flag, "-rst" ) ) faults.resetPercent = atof( value );
+        else if( !strcmp( flag, "-stp" ) ) faults.stallPercent = atof( value );
+        else if( !strcmp( flag, "-stm" ) ) faults.stallMs = atoi( value );
+        else if( !strcmp( flag, "-max" ) ) faults.maxActive = atoi( value );
+        else if( !strcmp( flag, "-seed" ) ) faults.seed = strtoull( value, NULL, 10 );
+        else
+        {
+            std::cerr << "Invalid option '" << flag << "'." << std::endl;
+            return 1;
+        }
+    }
+
+    // Block termination signals in all tasks, the main one waits for them.
+
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    pthread_sigmask( SIG_BLOCK, &signals, NULL );
+
+    try
+    {
+        S3Stub stub( port, address );
+        stub.setFaults( faults );
+
+        std::cout << "listening on " << address << ':' << stub.port() << std::endl;
+
+        int signal = 0;
+        sigwait( &signals, &signal );
+
+        S3StubStats stats = stub.stats();
+        std::cout << "connections=" << stats.connections
+            << " requests=" << stats.requests
+            << " slow=" << stats.slowRequests
+            << " slowDowns=" << stats.slowDowns
+            << " resets=" << stats.resets
+            << " stalls=" << stats.stalls << std::endl;
+    }
+    catch( const std::exception &e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -29,6 +29,7 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <mstcpip.h>
+#include <intrin.h>
 #else  // !_WIN32
 #include <errno.h> 
 #include <sys/eventfd.h> 
@@ -36,8 +37,10 @@
 #include <poll.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/socket.h>
 #endif  // !_WIN32
 
 #include <stdarg.h>
@@ -46,6 +49,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -134,15 +138,13 @@ Stopwatch::Stopwatch( bool _start )
     }
 }
 
-#if defined( _WIN32 ) && defined( PERF )
+#ifdef _WIN32
 struct StopwatchFrequency
 {
                     StopwatchFrequency();
     UInt64          value;
 };
 
-static StopwatchFrequency s_stopwatchFrequency;
-
 StopwatchFrequency::StopwatchFrequency()
 {
     LARGE_INTEGER tmp;
@@ -150,57 +152,97 @@ StopwatchFrequency::StopwatchFrequency()
     value = tmp.QuadPart;
 }
 
-void 
-Stopwatch::start()  // nofail
+UInt64
+timeNowNs()  // nofail
 {
+    // A local static, so that the time read from static constructors of
+    // other modules is on the same clock.
+
+    static const StopwatchFrequency s_stopwatchFrequency;
+
+    // QPC is invariant and monotonic on all supported versions, split the
+    // conversion to avoid overflow of ticks * 1e9.
+
     LARGE_INTEGER tmp;
     QueryPerformanceCounter( &tmp );
-    m_startTime = tmp.QuadPart;
-}
 
-UInt64 
-Stopwatch::elapsed()  // nofail
+    UInt64 ticks = tmp.QuadPart;
+    UInt64 frequency = s_stopwatchFrequency.value;
+
+    if( frequency == 0 )
+    {
+        return GetTickCount64() * 1000000;
+    }
+
+    return ticks / frequency * 1000000000ULL + ticks % frequency * 1000000000ULL / frequency;
+}
+#else  // !_WIN32
+static clockid_t
+getStopwatchClock()  // nofail
 {
-    LARGE_INTEGER tmp;
-    QueryPerformanceCounter( &tmp );
+    // Prefer the raw hardware clock: it is not slewed by NTP, so short
+    // intervals are not stretched or shrunk while the clock is adjusted.
+
+#ifdef CLOCK_MONOTONIC_RAW
+    timespec ts;
+
+    if( !clock_gettime( CLOCK_MONOTONIC_RAW, &ts ) )
+    {
+        return CLOCK_MONOTONIC_RAW;
+    }
+#endif  // CLOCK_MONOTONIC_RAW
 
-    return s_stopwatchFrequency.value != 0 ? 
-        1000ULL * ( tmp.QuadPart - m_startTime ) / s_stopwatchFrequency.value :
-        0;
+    return CLOCK_MONOTONIC;
 }
-#else  // !( defined( _WIN32 ) && defined( PERF ) )
 
-#ifndef _WIN32
-static UInt64 
-GetTickCount64()
+UInt64
+timeNowNs()  // nofail
 {
+    // Resolved on first use: static constructors of other modules may
+    // read the time before this one's run.
+
+    static const clockid_t s_stopwatchClock = getStopwatchClock();
+
     timespec ts;
 
-    if( clock_gettime( CLOCK_MONOTONIC, &ts ) )
+    if( clock_gettime( s_stopwatchClock, &ts ) )
     {
         return 0;
     }
 
-    UInt64 result = ts.tv_sec;
-    result *= 1000;  // ms, overflow is ok
-    result += ts.tv_nsec / 1000000;  // ms
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    return result;
+static UInt64 
+GetTickCount64()
+{
+    return timeNowNs() / 1000000;  // ms
 }
 #endif  // !_WIN32
 
 void 
 Stopwatch::start()  // nofail
 {
-    m_startTime = GetTickCount64();
+    m_startTime = timeNowNs();
 }
 
 UInt64 
 Stopwatch::elapsed()  // nofail
 {
-    return GetTickCount64() - m_startTime;  // overflow is ok
+    return elapsedNs() / 1000000;
+}
+
+UInt64 
+Stopwatch::elapsedUs()  // nofail
+{
+    return elapsedNs() / 1000;
+}
+
+UInt64 
+Stopwatch::elapsedNs()  // nofail
+{
+    return timeNowNs() - m_startTime;
 }
-#endif  // !( defined( _WIN32 ) && defined( PERF ) )
 
 static Stopwatch s_stopwatch( true );
 
@@ -210,6 +252,173 @@ timeElapsed()  // nofail, in milliseconds.
     return s_stopwatch.elapsed();
 }
 
+UInt64
+timeElapsedUs()  // nofail, in microseconds.
+{
+    return s_stopwatch.elapsedUs();
+}
+
+UInt64
+timeElapsedNs()  // nofail, in nanoseconds.
+{
+    return s_stopwatch.elapsedNs();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram -- log-linear (HDR-style) histogram.
+
+const UInt64 LatencyHistogram::c_maxValue;
+
+LatencyHistogram::LatencyHistogram()
+    : m_counters( c_counterCount )
+    , m_count( 0 )
+    , m_min( 0 )
+    , m_max( 0 )
+    , m_sum( 0 )
+{
+}
+
+static inline unsigned
+highestBit( UInt64 value )  // nofail
+{
+    dbgAssert( value );
+
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanReverse64( &index, value );
+    return index;
+#else
+    return 63 - __builtin_clzll( value );
+#endif
+}
+
+size_t
+LatencyHistogram::counterIndex( UInt64 value )  // nofail
+{
+    dbgAssert( value <= c_maxValue );
+
+    // The first 2 * c_subBucketCount values map 1:1, after that each power of 2
+    // range [ 2^n, 2^(n+1) ) is split into c_subBucketCount equal sub-buckets.
+
+    if( value < 2 * c_subBucketCount )
+    {
+        return static_cast< size_t >( value );
+    }
+
+    unsigned shift = highestBit( value ) - c_subBucketBits;
+    return ( shift + 1 ) * c_subBucketCount + 
+        static_cast< size_t >( ( value >> shift ) - c_subBucketCount );
+}
+
+UInt64
+LatencyHistogram::highestEquivalentValue( size_t index )  // nofail
+{
+    dbgAssert( index < c_counterCount );
+
+    if( index < 2 * c_subBucketCount )
+    {
+        return index;
+    }
+
+    unsigned shift = static_cast< unsigned >( index / c_subBucketCount - 1 );
+    UInt64 low = static_cast< UInt64 >( index % c_subBucketCount + c_subBucketCount ) << shift;
+
+    return low + ( 1ULL << shift ) - 1;
+}
+
+void
+LatencyHistogram::record( UInt64 value )  // nofail
+{
+    m_min = m_count ? std::min( m_min, value ) : value;
+    m_max = std::max( m_max, value );
+    m_sum += value;
+    ++m_count;
+
+    ++m_counters[ counterIndex( value < c_maxValue ? value : static_cast< UInt64 >( c_maxValue ) ) ];
+}
+
+void
+LatencyHistogram::merge( const LatencyHistogram &other )  // nofail
+{
+    if( !other.m_count )
+    {
+        return;
+    }
+
+    for( size_t i = 0; i < c_counterCount; ++i )
+    {
+        m_counters[ i ] += other.m_counters[ i ];
+    }
+
+    m_min = m_count ? std::min( m_min, other.m_min ) : other.m_min;
+    m_max = std::max( m_max, other.m_max );
+    m_sum += other.m_sum;
+    m_count += other.m_count;
+}
+
+void
+LatencyHistogram::reset()  // nofail
+{
+    std::fill( m_counters.begin(), m_counters.end(), 0 );
+    m_count = 0;
+    m_min = 0;
+    m_max = 0;
+    m_sum = 0;
+}
+
+void
+LatencyHistogram::assign( const UInt64 *counters, UInt64 min, UInt64 max, UInt64 sum )  // nofail
+{
+    dbgAssert( counters );
+
+    m_count = 0;
+
+    for( size_t i = 0; i < c_counterCount; ++i )
+    {
+        m_counters[ i ] = counters[ i ];
+        m_count += counters[ i ];
+    }
+
+    m_min = m_count ? min : 0;
+    m_max = m_count ? max : 0;
+    m_sum = m_count ? sum : 0;
+}
+
+UInt64
+LatencyHistogram::percentile( double p ) const  // nofail
+{
+    if( !m_count )
+    {
+        return 0;
+    }
+
+    if( p >= 100 )
+    {
+        return m_max;
+    }
+
+    // Find the first counter where the cumulative count reaches the rank
+    // of the requested percentile.
+
+    UInt64 rank = static_cast< UInt64 >( p / 100 * m_count + 0.5 );
+    rank = std::max( rank, 1ULL );
+    UInt64 total = 0;
+
+    for( size_t i = 0; i < c_counterCount; ++i )
+    {
+        total += m_counters[ i ];
+
+        if( total >= rank )
+        {
+            // Don't report more than the actual range of recorded values.
+
+            return std::max( m_min, std::min( highestEquivalentValue( i ), m_max ) );
+        }
+    }
+
+    return m_max;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Adjustable timeout.
 
@@ -435,7 +644,7 @@ waitAny( pollfd *fds, size_t count, UInt32 msTimeout )  // nofail
 
         for( size_t i = 0; i < count; ++i )
         {
-            if( fds[ i ].revents | POLLIN )
+            if( fds[ i ].revents & POLLIN )
             {
                 return i;
             }
@@ -477,6 +686,203 @@ EventSync::waitAny( EventSync **events, size_t count, UInt32 msTimeout )
 
 #endif  // !_WIN32
 
+//////////////////////////////////////////////////////////////////////////////
+// Lock contention stats.
+
+LockStats::LockStats()
+    : acquisitions( 0 )
+    , contended( 0 )
+    , waitTime( 0 )
+    , holdTime( 0 )
+    , maxHoldTime( 0 )
+{
+}
+
+#ifdef LOCK_STATS
+
+// Records are shared by locks with the same name and never freed. The list
+// is lock-free, so that locks can be constructed during static
+// initialization in any order.
+
+struct LockStatsRecord
+{
+    const char *    name;
+    volatile UInt64 acquisitions;
+    volatile UInt64 contended;
+    volatile UInt64 waitTime;
+    volatile UInt64 holdTime;
+    volatile UInt64 maxHoldTime;
+    LockStatsRecord *next;
+};
+
+static LockStatsRecord *volatile s_lockStats = NULL;
+
+#ifdef _WIN32
+static inline void
+atomicAdd( volatile UInt64 *value, UInt64 delta )  // nofail
+{
+    InterlockedExchangeAdd64( reinterpret_cast< volatile LONGLONG * >( value ), delta );
+}
+
+static inline bool
+atomicCas( volatile UInt64 *value, UInt64 expected, UInt64 desired )  // nofail
+{
+    return InterlockedCompareExchange64( reinterpret_cast< volatile LONGLONG * >( value ),
+        desired, expected ) == ( LONGLONG )expected;
+}
+
+static inline bool
+atomicCas( LockStatsRecord *volatile *value, LockStatsRecord *expected, LockStatsRecord *desired )  // nofail
+{
+    return InterlockedCompareExchangePointer( reinterpret_cast< void *volatile * >( value ),
+        desired, expected ) == expected;
+}
+#else  // !_WIN32
+static inline void
+atomicAdd( volatile UInt64 *value, UInt64 delta )  // nofail
+{
+    __sync_fetch_and_add( value, delta );
+}
+
+template< class T >
+static inline bool
+atomicCas( T volatile *value, T expected, T desired )  // nofail
+{
+    return __sync_bool_compare_and_swap( value, expected, desired );
+}
+#endif  // !_WIN32
+
+static LockStatsRecord *
+getLockStatsRecord( const char *name )  // nofail, NULL if out of memory
+{
+    dbgAssert( name );
+
+    LockStatsRecord *head = s_lockStats;
+    cpuMemLoadFence();
+
+    for( ;; )
+    {
+        for( LockStatsRecord *record = head; record; record = record->next )
+        {
+            if( !strcmp( record->name, name ) )
+            {
+                return record;
+            }
+        }
+
+        LockStatsRecord *record = new( std::nothrow ) LockStatsRecord;
+
+        if( !record )
+        {
+            return NULL;
+        }
+
+        memset( record, 0, sizeof( *record ) );
+        record->name = name;
+        record->next = head;
+
+        if( atomicCas( &s_lockStats, head, record ) )  // full barrier
+        {
+            return record;
+        }
+
+        // Another task has added a record, check if it's for the same name.
+
+        delete record;
+        head = s_lockStats;
+        cpuMemLoadFence();
+    }
+}
+
+void
+getLockStats( std::vector< LockStats > *stats /* out */ )
+{
+    dbgAssert( stats );
+
+    stats->clear();
+
+    LockStatsRecord *head = s_lockStats;
+    cpuMemLoadFence();
+
+    for( LockStatsRecord *record = head; record; record = record->next )
+    {
+        stats->push_back( LockStats() );
+
+        LockStats &item = stats->back();
+        item.name = record->name;
+        item.acquisitions = record->acquisitions;
+        item.contended = record->contended;
+        item.waitTime = record->waitTime;
+        item.holdTime = record->holdTime;
+        item.maxHoldTime = record->maxHoldTime;
+    }
+}
+
+void
+resetLockStats()  // nofail
+{
+    // Not atomic with respect to the locks being used, good enough to
+    // separate test runs.
+
+    for( LockStatsRecord *record = s_lockStats; record; record = record->next )
+    {
+        record->acquisitions = 0;
+        record->contended = 0;
+        record->waitTime = 0;
+        record->holdTime = 0;
+        record->maxHoldTime = 0;
+    }
+}
+
+void
+ExLockSync::onClaimed( UInt64 waitStart )  // nofail
+{
+    dbgAssert( m_stats );
+
+    m_claimTime = timeNowNs();
+
+    if( waitStart )
+    {
+        atomicAdd( &m_stats->contended, 1 );
+        atomicAdd( &m_stats->waitTime, m_claimTime - waitStart );
+    }
+
+    atomicAdd( &m_stats->acquisitions, 1 );
+}
+
+void
+ExLockSync::onReleasing()  // nofail
+{
+    dbgAssert( m_stats );
+
+    UInt64 holdTime = timeNowNs() - m_claimTime;
+    atomicAdd( &m_stats->holdTime, holdTime );
+
+    for( UInt64 max = m_stats->maxHoldTime; holdTime > max; max = m_stats->maxHoldTime )
+    {
+        if( atomicCas( &m_stats->maxHoldTime, max, holdTime ) )
+        {
+            break;
+        }
+    }
+}
+
+#else  // !LOCK_STATS
+
+void
+getLockStats( std::vector< LockStats > *stats /* out */ )
+{
+    dbgAssert( stats );
+    stats->clear();
+}
+
+void
+resetLockStats()  // nofail
+{
+}
+
+#endif  // !LOCK_STATS
+
 //////////////////////////////////////////////////////////////////////////////
 // ExLockSync -- exclusive lock.
 
@@ -487,12 +893,17 @@ pcs( void *p )
     return static_cast< LPCRITICAL_SECTION >( p );
 }
 
-ExLockSync::ExLockSync()
+ExLockSync::ExLockSync( const char *name )
 {
 #ifdef DEBUG
     m_lockOwner = 0;
 #endif
 
+#ifdef LOCK_STATS
+    m_stats = name ? getLockStatsRecord( name ) : NULL;
+    m_claimTime = 0;
+#endif
+
     CASSERT( sizeof( m_data ) == sizeof( CRITICAL_SECTION ) );
     CASSERT( __alignof( Data ) == __alignof( CRITICAL_SECTION ) );
     InitializeCriticalSection( pcs( &m_data ) );
@@ -507,7 +918,22 @@ ExLockSync::~ExLockSync()
 void
 ExLockSync::claimLock()  // nofail
 {
-    EnterCriticalSection( pcs( &m_data ) );
+#ifdef LOCK_STATS
+    if( m_stats && TryEnterCriticalSection( pcs( &m_data ) ) )
+    {
+        onClaimed( 0 );
+    }
+    else if( m_stats )
+    {
+        UInt64 waitStart = timeNowNs();
+        EnterCriticalSection( pcs( &m_data ) );
+        onClaimed( waitStart );
+    }
+    else
+#endif
+    {
+        EnterCriticalSection( pcs( &m_data ) );
+    }
 
 #ifdef DEBUG
     dbgAssert( !m_lockOwner );
@@ -523,6 +949,13 @@ ExLockSync::releaseLock()  // nofail
     m_lockOwner = 0; 
 #endif
 
+#ifdef LOCK_STATS
+    if( m_stats )
+    {
+        onReleasing();
+    }
+#endif
+
     LeaveCriticalSection( pcs( &m_data ) );
 }
 
@@ -536,12 +969,17 @@ pmtx( void *p )
     return static_cast< pthread_mutex_t * >( p );
 }
 
-ExLockSync::ExLockSync()
+ExLockSync::ExLockSync( const char *name )
 {
 #ifdef DEBUG
     m_lockOwner = 0;
 #endif
 
+#ifdef LOCK_STATS
+    m_stats = name ? getLockStatsRecord( name ) : NULL;
+    m_claimTime = 0;
+#endif
+
     CASSERT( sizeof( m_data ) == sizeof( pthread_mutex_t ) );
     CASSERT( __alignof__( Data ) == __alignof__( pthread_mutex_t ) );
 
@@ -560,7 +998,22 @@ ExLockSync::~ExLockSync()
 void
 ExLockSync::claimLock()  // nofail
 {
-    dbgVerify( !pthread_mutex_lock( pmtx( &m_data ) ) );
+#ifdef LOCK_STATS
+    if( m_stats && !pthread_mutex_trylock( pmtx( &m_data ) ) )
+    {
+        onClaimed( 0 );
+    }
+    else if( m_stats )
+    {
+        UInt64 waitStart = timeNowNs();
+        dbgVerify( !pthread_mutex_lock( pmtx( &m_data ) ) );
+        onClaimed( waitStart );
+    }
+    else
+#endif
+    {
+        dbgVerify( !pthread_mutex_lock( pmtx( &m_data ) ) );
+    }
 
 #ifdef DEBUG
     dbgAssert( !m_lockOwner );
@@ -576,6 +1029,13 @@ ExLockSync::releaseLock()  // nofail
     m_lockOwner = 0; 
 #endif
 
+#ifdef LOCK_STATS
+    if( m_stats )
+    {
+        onReleasing();
+    }
+#endif
+
     dbgVerify( !pthread_mutex_unlock( pmtx( &m_data ) ) );
 }
 #endif  // !_WIN32
@@ -717,6 +1177,9 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
     dbgAssert( socketActions );
     socketActions->clear();
 
+    m_stats.waits++;
+    Stopwatch blocked( true );
+
     if( m_pool->size() == 0 )
     {
         // We don't have any sockets to check activity, so wait for 
@@ -735,6 +1198,17 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
 #endif
 
         m_interrupt.reset();
+        m_stats.blockedTime += blocked.elapsedUs();
+
+        if( res == WAIT_OBJECT_0 )
+        {
+            m_stats.interrupts++;
+        }
+        else
+        {
+            m_stats.timeouts++;
+        }
+
         return res == WAIT_OBJECT_0;  // true if interrupt.
     }
   
@@ -778,12 +1252,15 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
         if( m_interrupt.wait( 0 ) )
         {
             m_interrupt.reset();
+            m_stats.blockedTime += blocked.elapsedUs();
+            m_stats.interrupts++;
             return true;  // true if interrupt.
         }
 
 #ifdef PERF
         Stopwatch stopwatch( true );
 #endif
+        m_stats.polls++;
         int res = WSAPoll( &( ( *m_pool )[ 0 ] ), m_pool->size(), spinTimeout );
 #ifdef PERF
         LOG_TRACE( "SocketPoolSync:WSAPoll, timeout left=%d, spin=%d, actual=%llu, size=%llu, result=%d", 
@@ -822,6 +1299,14 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
         break;
     }
 
+    m_stats.blockedTime += blocked.elapsedUs();
+    m_stats.events += socketActions->size();
+
+    if( socketActions->empty() )
+    {
+        m_stats.timeouts++;
+    }
+
     return !socketActions->empty(); // true if activity has been detected.
 }
 
@@ -993,11 +1478,15 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
     UInt32 initTimeout = m_pool->sockets.size() > 0 ? msTimeout : msInterruptOnlyTimeout;
     Timeout timeout( initTimeout ); 
 
+    m_stats.waits++;
+    Stopwatch blocked( true );
+
     while( true ) 
     {
 #ifdef PERF
         Stopwatch stopwatch( true );
 #endif
+        m_stats.polls++;
         res = epoll_wait( m_pool->epoll, events, dimensionOf( events ), timeout.left() );
 
 #ifdef PERF
@@ -1032,6 +1521,8 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
         break;
     } 
 
+    m_stats.blockedTime += blocked.elapsedUs();
+
     // Get the events.
 
     size_t eventCount = res > 0 ? res : 0;
@@ -1051,6 +1542,17 @@ SocketPool::wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions
         }
     }
 
+    m_stats.events += socketActions->size();
+
+    if( !eventCount )
+    {
+        m_stats.timeouts++;
+    }
+    else if( socketActions->empty() )
+    {
+        m_stats.interrupts++;
+    }
+
     return eventCount != 0;  // true if socket activity or interrupt.
 }
 #endif  // !_WIN32
@@ -1060,6 +1562,16 @@ SocketPool::~SocketPool()
     delete m_pool;
 }
 
+SocketPoolStats::SocketPoolStats()
+    : waits( 0 )
+    , polls( 0 )
+    , events( 0 )
+    , interrupts( 0 )
+    , timeouts( 0 )
+    , blockedTime( 0 )
+{
+}
+
 void 
 SocketPool::signal()  // nofail
 { 
@@ -1131,6 +1643,180 @@ setSocketBuffers( SocketHandle socket, UInt32 size )
     dbgAssert( !res );  
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Name resolution.
+
+struct AddrInfoDeleter
+{
+    static void     free( addrinfo *info ) { dbgAssert( info ); freeaddrinfo( info ); }
+};
+
+typedef auto_scope< addrinfo *, AddrInfoDeleter > ScopedAddrInfo;
+
+void
+resolveHost( const char *host, std::vector< std::string > *addresses /* out */ )
+{
+    dbgAssert( host );
+    dbgAssert( addresses );
+
+    addrinfo hints;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo *info = NULL;
+    int res = getaddrinfo( host, NULL, &hints, &info );
+
+    if( res )
+    {
+        std::string op( "getaddrinfo " );
+        op.append( host );
+        throwSystemError( op.c_str(), gai_strerror( res ) );
+    }
+
+    ScopedAddrInfo scopedInfo( info );
+
+    addresses->clear();
+
+    for( addrinfo *p = info; p; p = p->ai_next )
+    {
+        char buf[ NI_MAXHOST ];
+
+        if( !getnameinfo( p->ai_addr, static_cast< socklen_t >( p->ai_addrlen ), buf, sizeof( buf ),
+                NULL, 0, NI_NUMERICHOST ) )
+        {
+            addresses->push_back( buf );
+        }
+    }
+
+    std::sort( addresses->begin(), addresses->end() );
+    addresses->erase( std::unique( addresses->begin(), addresses->end() ), addresses->end() );
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MemoryBudget -- a limit on memory shared by several consumers.
+
+MemoryBudget::MemoryBudget( size_t limit )
+    : m_lock( "MemoryBudget" )
+    , m_limit( limit )
+    , m_used( 0 )
+{
+}
+
+void
+MemoryBudget::setLimit( size_t limit )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    m_limit = limit;
+}
+
+bool
+MemoryBudget::claim( size_t size )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    if( m_used > m_limit || size > m_limit - m_used )
+    {
+        return false;
+    }
+
+    m_used += size;
+    return true;
+}
+
+void
+MemoryBudget::release( size_t size )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    dbgAssert( size <= m_used );
+    m_used -= size;
+}
+
+size_t
+MemoryBudget::used()  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    return m_used;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// TokenBucket -- a rate limit with bursts shared by several consumers.
+
+TokenBucket::TokenBucket()
+    : m_lock( "TokenBucket" )
+    , m_rate( 0 )
+    , m_burst( 0 )
+    , m_tokens( 0 )
+    , m_lastRefill( 0 )
+{
+}
+
+void
+TokenBucket::setRate( double rate, double burst )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    m_rate = std::max( rate, 0.0 );
+    m_burst = std::max( burst, 1.0 );
+    m_tokens = m_burst;
+    m_lastRefill = timeElapsedUs();
+}
+
+void
+TokenBucket::refill()  // nofail
+{
+    dbgAssert( m_lock.dbgHoldLock() );
+
+    UInt64 now = timeElapsedUs();
+
+    if( now > m_lastRefill )
+    {
+        m_tokens = std::min( m_tokens + m_rate * ( now - m_lastRefill ) / 1000000, m_burst );
+        m_lastRefill = now;
+    }
+}
+
+UInt32
+TokenBucket::take( double amount )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    if( m_rate <= 0 )
+    {
+        return 0;
+    }
+
+    refill();  // nofail
+
+    if( m_tokens > 0 )
+    {
+        m_tokens -= amount;
+        return 0;
+    }
+
+    // Wait till the bucket is out of debt, at least a millisecond.
+
+    return static_cast< UInt32 >( -m_tokens * 1000 / m_rate ) + 1;
+}
+
+void
+TokenBucket::charge( double amount )  // nofail
+{
+    m_lock.claimLock();  // nofail
+    ScopedExLock lock( &m_lock );
+
+    m_tokens = std::min( m_tokens - amount, m_burst );
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // TaskCtrl -- asynchronous task control and Task utilities.
 
@@ -1175,7 +1861,7 @@ void
 TaskCtrlDeleter::free( TaskHandle handle )
 {
     dbgAssert( handle );
-    dbgVerify( pthread_detach( handle ) );
+    dbgVerify( !pthread_detach( handle ) );
 }
 
 void
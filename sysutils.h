@@ -236,6 +236,32 @@ private:
 //////////////////////////////////////////////////////////////////////////////
 // ExLockSync -- exclusive lock.
 
+// Lock contention stats, compiled in with LOCK_STATS (see Makefile). Locks
+// are accounted by name: all locks with the same name (e.g. the locks of all
+// AsyncLoops) share a record, unnamed locks are not accounted.
+
+struct LockStatsRecord;
+
+struct LockStats
+{
+                    LockStats();
+
+    std::string     name;
+    UInt64          acquisitions;
+    UInt64          contended;      // acquisitions that had to wait
+    UInt64          waitTime;       // total, in nanoseconds
+    UInt64          holdTime;       // total, in nanoseconds
+    UInt64          maxHoldTime;    // in nanoseconds
+};
+
+// Returns stats of all named locks, nothing if built without LOCK_STATS.
+
+void
+getLockStats( std::vector< LockStats > *stats /* out */ );
+
+void
+resetLockStats();  // nofail
+
 class ExLockSync 
 {
 #ifdef _WIN32
@@ -283,7 +309,10 @@ class ExLockSync
 
 #endif  // !_WIN32
 public:
-                    ExLockSync();
+    // The name identifies the lock in the lock stats, it must be a string
+    // literal (or otherwise outlive the process).
+
+    explicit        ExLockSync( const char *name = NULL );
                     ~ExLockSync();
 
     void            claimLock();  // nofail
@@ -297,11 +326,21 @@ private:
                     ExLockSync( const ExLockSync & );  // forbidden
     ExLockSync &    operator=( const ExLockSync & );  // forbidden
 
+#ifdef LOCK_STATS
+    void            onClaimed( UInt64 waitStart );  // nofail
+    void            onReleasing();  // nofail
+#endif
+
     Data            m_data;
 
 #ifdef DEBUG
     UInt64          m_lockOwner; 
 #endif
+
+#ifdef LOCK_STATS
+    LockStatsRecord *m_stats;
+    UInt64          m_claimTime;
+#endif
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -314,6 +353,62 @@ struct ExLockDeleter
 
 typedef auto_scope< ExLockSync *, ExLockDeleter > ScopedExLock;
 
+//////////////////////////////////////////////////////////////////////////////
+// MemoryBudget -- a limit on memory shared by several consumers.
+// Consumers claim memory before they allocate it and release it when they
+// free it; a claim that would exceed the limit fails.
+
+class MemoryBudget
+{
+public:
+    explicit        MemoryBudget( size_t limit );
+
+    void            setLimit( size_t limit );  // nofail
+    bool            claim( size_t size );  // nofail
+    void            release( size_t size );  // nofail
+    size_t          used();  // nofail
+
+private:
+                    MemoryBudget( const MemoryBudget & );  // forbidden
+    MemoryBudget &  operator=( const MemoryBudget & );  // forbidden
+
+    ExLockSync      m_lock;
+    size_t          m_limit;
+    size_t          m_used;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// TokenBucket -- a rate limit with bursts shared by several consumers.
+// Tokens accrue at 'rate' per second up to 'burst'. A take succeeds while
+// there are tokens left, even if it takes more than there are (the bucket
+// goes into debt, so that chunks bigger than the burst pass); otherwise it
+// returns the time till the debt is paid. Consumers that learn the amount
+// only after they've passed may take 0 and charge the amount afterwards.
+
+class TokenBucket
+{
+public:
+                    TokenBucket();
+
+    void            setRate( double rate, double burst );  // nofail, 0 rate is unlimited
+    bool            isLimited() const { return m_rate > 0; }  // nofail
+
+    UInt32          take( double amount );  // nofail, 0 or msecs to wait
+    void            charge( double amount );  // nofail, negative gives back
+
+private:
+                    TokenBucket( const TokenBucket & );  // forbidden
+    TokenBucket &   operator=( const TokenBucket & );  // forbidden
+
+    void            refill();  // nofail
+
+    ExLockSync      m_lock;
+    volatile double m_rate;         // tokens per second
+    double          m_burst;
+    double          m_tokens;
+    UInt64          m_lastRefill;   // timeElapsedUs()
+};
+
 //////////////////////////////////////////////////////////////////////////////
 // SocketPool -- a collection of sockets with interruptible wait.
 
@@ -338,6 +433,21 @@ typedef std::vector< std::pair< SocketHandle, SocketActionMask > > SocketActions
 
 struct SocketPoolState;
 
+// Counters of SocketPool::wait(..) calls. They are updated by the waiting task
+// only, so other tasks can read them without locking.
+
+struct SocketPoolStats
+{
+                    SocketPoolStats();
+
+    volatile UInt64 waits;          // wait(..) calls
+    volatile UInt64 polls;          // epoll_wait / WSAPoll calls, including retries
+    volatile UInt64 events;         // socket events returned
+    volatile UInt64 interrupts;     // waits woken by signal() without socket events
+    volatile UInt64 timeouts;       // waits without any activity
+    volatile UInt64 blockedTime;    // time spent in wait(..), in microseconds
+};
+
 class SocketPool 
 {
 public:
@@ -352,12 +462,15 @@ public:
     void            signal();  // nofail
     bool            wait( UInt32 msTimeout, UInt32 msInterruptOnlyTimeout, SocketActions *socketActions );
 
+    const SocketPoolStats & stats() const { return m_stats; }  // nofail
+
 private:
                     SocketPool( const SocketPool & );  // forbidden
     SocketPool &    operator=( const SocketPool & );  // forbidden
 
     SocketPoolState *   m_pool;
     EventSync           m_interrupt;
+    SocketPoolStats     m_stats;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -388,6 +501,15 @@ setTcpKeepAlive( SocketHandle socket, const TcpKeepAliveParams *params );
 void
 setSocketBuffers( SocketHandle socket, UInt32 size );
 
+//////////////////////////////////////////////////////////////////////////////
+// Name resolution.
+
+// Resolves 'host' to the numeric addresses of all its IPv4 and IPv6 records,
+// sorted and without duplicates. Throws if the name cannot be resolved.
+
+void
+resolveHost( const char *host, std::vector< std::string > *addresses /* out */ );
+
 //////////////////////////////////////////////////////////////////////////////
 // TaskCtrl -- asynchronous task control.
 
@@ -433,6 +555,12 @@ taskSleep( UInt32 msTimeout );  // nofail
 
 //////////////////////////////////////////////////////////////////////////////
 // Stopwatch to measure time intervals.
+// Uses a monotonic high-resolution clock (CLOCK_MONOTONIC_RAW on Linux,
+// QueryPerformanceCounter on Windows), so short intervals can be measured
+// in microseconds or nanoseconds.
+
+UInt64
+timeNowNs();  // nofail, monotonic clock in nanoseconds, arbitrary origin.
 
 class Stopwatch
 {
@@ -440,7 +568,9 @@ public:
                     Stopwatch( bool _start = false );
 
     void            start();  // nofail
-    UInt64          elapsed();  // nofail
+    UInt64          elapsed();  // nofail, in milliseconds.
+    UInt64          elapsedUs();  // nofail, in microseconds.
+    UInt64          elapsedNs();  // nofail, in nanoseconds.
 
 private:
     UInt64          m_startTime;
@@ -449,6 +579,69 @@ private:
 UInt64
 timeElapsed();  // nofail, in milliseconds.
 
+UInt64
+timeElapsedUs();  // nofail, in microseconds.
+
+UInt64
+timeElapsedNs();  // nofail, in nanoseconds.
+
+//////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram -- log-linear (HDR-style) histogram.
+
+// Values below 2 * c_subBucketCount are counted exactly, larger values fall
+// into one of c_subBucketCount buckets per power of 2, so the relative error
+// is below 1/c_subBucketCount (< 1%) for the whole range.  Values above 
+// c_maxValue are counted as c_maxValue (but still reported by max()).
+// Recording is a couple of arithmetic operations and doesn't allocate, so
+// it's fine for hot paths.
+// The object is not thread-safe: use one histogram per thread and merge(..)
+// them (or histograms from different runs) when reporting.
+
+class LatencyHistogram
+{
+public:
+    enum { c_subBucketBits = 7 };
+    enum { c_subBucketCount = 1 << c_subBucketBits };
+    enum { c_maxValueBits = 40 };  // e.g. 12 days in microseconds
+
+    static const UInt64 c_maxValue = ( 1ULL << c_maxValueBits ) - 1;
+
+    enum { c_counterCount = ( c_maxValueBits - c_subBucketBits + 1 ) * c_subBucketCount };
+
+                    LatencyHistogram();
+
+    void            record( UInt64 value );  // nofail
+    void            merge( const LatencyHistogram &other );  // nofail
+    void            reset();  // nofail
+
+    UInt64          count() const { return m_count; }
+    UInt64          min() const { return m_count ? m_min : 0; }
+    UInt64          max() const { return m_max; }
+    double          mean() const { return m_count ? static_cast< double >( m_sum ) / m_count : 0; }
+
+    // Returns the value below or at which the given percentage (0..100) of
+    // the recorded values fall.
+
+    UInt64          percentile( double p ) const;  // nofail
+
+    // Raw state, e.g. to merge histograms of different processes.
+    // counters() returns c_counterCount items.
+
+    UInt64          sum() const { return m_sum; }
+    const UInt64 *  counters() const { return &m_counters[ 0 ]; }
+    void            assign( const UInt64 *counters, UInt64 min, UInt64 max, UInt64 sum );  // nofail
+
+private:
+    static size_t   counterIndex( UInt64 value );  // nofail
+    static UInt64   highestEquivalentValue( size_t index );  // nofail
+
+    std::vector< UInt64 > m_counters;
+    UInt64          m_count;
+    UInt64          m_min;
+    UInt64          m_max;
+    UInt64          m_sum;
+};
+
 }  // namespace internal
 
 }  // namespace webstor